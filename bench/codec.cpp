@@ -0,0 +1,322 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Microbenchmarks of the per-packet encoding and decoding costs. No socket is used.
+// Each benchmark is repeated with doubling iterations until it runs at least 200ms.
+// usage: bench_codec [filter]
+//   Only the benchmarks whose names contain filter are run.
+
+#if !defined(MQTT_USE_STR_CHECK)
+#define MQTT_USE_STR_CHECK
+#endif // !defined(MQTT_USE_STR_CHECK)
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+#include <mqtt/connect_return_code.hpp>
+#include <mqtt/reason_code.hpp>
+#include <mqtt/variable_length.hpp>
+#include <mqtt/utf8encoded_strings.hpp>
+#include <mqtt/property_parse.hpp>
+#include <mqtt/property_view.hpp>
+#include <mqtt/message.hpp>
+#include <mqtt/v5_message.hpp>
+#include <mqtt/shared_publish.hpp>
+
+namespace as = boost::asio;
+
+namespace {
+
+// Prevent the compiler from removing the computation of the value.
+template <typename T>
+void do_not_optimize(T const& v) {
+#if defined(__GNUC__)
+    asm volatile("" : : "g"(&v) : "memory");
+#else  // defined(__GNUC__)
+    static volatile char const* sink;
+    sink = reinterpret_cast<char const*>(&v);
+#endif // defined(__GNUC__)
+}
+
+class runner {
+public:
+    explicit runner(std::string filter) : filter_(std::move(filter)) {}
+
+    template <typename F>
+    void run(std::string const& name, F&& f) {
+        if (name.find(filter_) == std::string::npos) return;
+        using clock = std::chrono::steady_clock;
+        std::size_t iterations = 1;
+        while (true) {
+            auto begin = clock::now();
+            for (std::size_t i = 0; i != iterations; ++i) f();
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - begin).count();
+            if (ns >= 200 * 1000 * 1000) {
+                std::cout
+                    << "name: " << name
+                    << " ns_per_op: " << static_cast<double>(ns) / static_cast<double>(iterations)
+                    << " iterations: " << iterations
+                    << std::endl;
+                return;
+            }
+            iterations *= 2;
+        }
+    }
+
+private:
+    std::string filter_;
+};
+
+// const_buffer_sequence() and continuous_buffer() of the message.
+template <typename Message>
+void encode(runner& r, std::string const& name, Message const& m) {
+    r.run(
+        name + "/const_buffer_sequence",
+        [&] {
+            auto cbs = m.const_buffer_sequence();
+            do_not_optimize(cbs);
+        }
+    );
+    r.run(
+        name + "/continuous_buffer",
+        [&] {
+            auto buf = m.continuous_buffer();
+            do_not_optimize(buf);
+        }
+    );
+}
+
+void variable_length_benchmarks(runner& r) {
+    for (std::size_t size : { std::size_t(100), std::size_t(10000), std::size_t(1000000), std::size_t(100000000) }) {
+        auto bytes = mqtt::variable_bytes(size);
+        auto suffix = "/" + std::to_string(bytes.size()) + "bytes";
+        r.run(
+            "variable_bytes" + suffix,
+            [&] {
+                auto b = mqtt::variable_bytes(size);
+                do_not_optimize(b);
+            }
+        );
+        r.run(
+            "variable_push" + suffix,
+            [&] {
+                std::string b;
+                mqtt::variable_push(b, size);
+                do_not_optimize(b);
+            }
+        );
+        r.run(
+            "variable_length" + suffix,
+            [&] {
+                auto l = mqtt::variable_length(bytes.begin(), bytes.end());
+                do_not_optimize(l);
+            }
+        );
+    }
+}
+
+void utf8_benchmarks(runner& r) {
+    std::string ascii16(16, 'a');
+    std::string topic64 = "building1/floor12/room1234/sensor/temperature/celsius/average/1m";
+    std::string ascii1024(1024, 'a');
+    std::string multi1024;
+    // 2, 3 and 4 bytes characters
+    while (multi1024.size() < 1024) multi1024 += u8"aéあ\U0001f600";
+    for (auto const& e : {
+            std::make_pair("ascii16", &ascii16),
+            std::make_pair("topic64", &topic64),
+            std::make_pair("ascii1024", &ascii1024),
+            std::make_pair("multibyte1024", &multi1024) }) {
+        mqtt::string_view sv(*e.second);
+        r.run(
+            std::string("utf8string::validate_contents/") + e.first,
+            [&] {
+                auto v = mqtt::utf8string::validate_contents(sv);
+                do_not_optimize(v);
+            }
+        );
+        r.run(
+            std::string("utf8string::detail::validate_scalar/") + e.first,
+            [&] {
+                auto v = mqtt::utf8string::detail::validate_scalar(sv.data(), sv.data() + sv.size());
+                do_not_optimize(v);
+            }
+        );
+    }
+}
+
+std::vector<mqtt::v5::property_variant> publish_props() {
+    return {
+        mqtt::v5::property::payload_format_indicator(mqtt::v5::property::payload_format_indicator::string),
+        mqtt::v5::property::message_expiry_interval(3600),
+        mqtt::v5::property::content_type("application/json"),
+        mqtt::v5::property::response_topic("response/topic"),
+        mqtt::v5::property::correlation_data("correlation"),
+        mqtt::v5::property::user_property("key1", "val1"),
+        mqtt::v5::property::user_property("key2", "val2"),
+    };
+}
+
+void property_benchmarks(runner& r) {
+    std::string topic = "topic";
+    std::string payload = "payload";
+    // Packet id is 0 because of QoS0, so the properties follow the topic name.
+    auto buf = mqtt::v5::publish_message(
+        as::buffer(topic), mqtt::qos::at_most_once, false, false, 0, publish_props(), as::buffer(payload)
+    ).continuous_buffer();
+    auto remaining_length_bytes = std::get<1>(mqtt::variable_length(buf.begin() + 1, buf.end()));
+    auto props_begin = buf.cbegin() + static_cast<std::ptrdiff_t>(1 + remaining_length_bytes + 2 + topic.size());
+    r.run(
+        "v5::property::parse_with_length/publish7",
+        [&] {
+            auto it = props_begin;
+            auto props = mqtt::v5::property::parse_with_length(it, buf.cend());
+            do_not_optimize(props);
+        }
+    );
+    mqtt::buffer view_buf(mqtt::string_view(&*props_begin, static_cast<std::size_t>(buf.cend() - props_begin)));
+    r.run(
+        "v5::property::parse_view_with_length/publish7",
+        [&] {
+            std::size_t consumed = 0;
+            auto props = mqtt::v5::property::parse_view_with_length(view_buf, consumed);
+            do_not_optimize(props);
+        }
+    );
+    r.run(
+        "v5::property_view::find/publish7",
+        [&] {
+            std::size_t consumed = 0;
+            auto props = mqtt::v5::property::parse_view_with_length(view_buf, consumed);
+            auto ct = props->find<mqtt::v5::property::content_type>();
+            do_not_optimize(ct);
+        }
+    );
+}
+
+void publish_benchmarks(runner& r) {
+    std::string topic = "sensor/room1/temperature";
+    std::string payload16(16, 'p');
+    std::string payload1024(1024, 'p');
+    for (auto const& e : {
+            std::make_pair("16", &payload16),
+            std::make_pair("1024", &payload1024) }) {
+        auto const& payload = *e.second;
+        std::string suffix = std::string("/payload") + e.first;
+        r.run(
+            "v3_1_1::basic_publish_message/construct" + suffix,
+            [&] {
+                mqtt::publish_message m(
+                    as::buffer(topic), mqtt::qos::at_least_once, false, false, 1, as::buffer(payload)
+                );
+                do_not_optimize(m);
+            }
+        );
+        r.run(
+            "v5::basic_publish_message/construct" + suffix,
+            [&] {
+                mqtt::v5::publish_message m(
+                    as::buffer(topic), mqtt::qos::at_least_once, false, false, 1, {}, as::buffer(payload)
+                );
+                do_not_optimize(m);
+            }
+        );
+        auto props = publish_props();
+        r.run(
+            "v5::basic_publish_message/construct_props7" + suffix,
+            [&] {
+                mqtt::v5::publish_message m(
+                    as::buffer(topic), mqtt::qos::at_least_once, false, false, 1, props, as::buffer(payload)
+                );
+                do_not_optimize(m);
+            }
+        );
+        mqtt::shared_publish body(as::buffer(topic), as::buffer(payload), mqtt::any(), props);
+        r.run(
+            "v5::basic_publish_message/construct_shared" + suffix,
+            [&] {
+                mqtt::v5::publish_message m(body, mqtt::qos::at_least_once, false, false, 1);
+                do_not_optimize(m);
+            }
+        );
+
+        auto v3_buf = mqtt::publish_message(
+            as::buffer(topic), mqtt::qos::at_least_once, false, false, 1, as::buffer(payload)
+        ).continuous_buffer();
+        r.run(
+            "v3_1_1::basic_publish_message/parse" + suffix,
+            [&] {
+                mqtt::publish_message m(v3_buf.begin(), v3_buf.end());
+                do_not_optimize(m);
+            }
+        );
+        auto v5_buf = mqtt::v5::publish_message(
+            as::buffer(topic), mqtt::qos::at_least_once, false, false, 1, props, as::buffer(payload)
+        ).continuous_buffer();
+        r.run(
+            "v5::basic_publish_message/parse_props7" + suffix,
+            [&] {
+                mqtt::v5::publish_message m(v5_buf.begin(), v5_buf.end());
+                do_not_optimize(m);
+            }
+        );
+    }
+}
+
+void v3_1_1_message_benchmarks(runner& r) {
+    std::string topic = "sensor/room1/temperature";
+    std::string payload(64, 'p');
+    encode(r, "v3_1_1::connect_message", mqtt::v3_1_1::connect_message(60, "client_id", true, mqtt::nullopt, std::string("user"), std::string("password")));
+    encode(r, "v3_1_1::connack_message", mqtt::v3_1_1::connack_message(false, mqtt::connect_return_code::accepted));
+    encode(r, "v3_1_1::publish_message", mqtt::v3_1_1::publish_message(as::buffer(topic), mqtt::qos::at_least_once, false, false, 1, as::buffer(payload)));
+    encode(r, "v3_1_1::puback_message", mqtt::v3_1_1::puback_message(1));
+    encode(r, "v3_1_1::pubrec_message", mqtt::v3_1_1::pubrec_message(1));
+    encode(r, "v3_1_1::pubrel_message", mqtt::v3_1_1::pubrel_message(1));
+    encode(r, "v3_1_1::pubcomp_message", mqtt::v3_1_1::pubcomp_message(1));
+    encode(r, "v3_1_1::subscribe_message", mqtt::v3_1_1::subscribe_message({ std::make_tuple(as::buffer(topic), mqtt::qos::at_least_once) }, 1));
+    encode(r, "v3_1_1::suback_message", mqtt::v3_1_1::suback_message({ mqtt::qos::at_least_once }, 1));
+    encode(r, "v3_1_1::unsubscribe_message", mqtt::v3_1_1::basic_unsubscribe_message<2>({ as::buffer(topic) }, 1));
+    encode(r, "v3_1_1::unsuback_message", mqtt::v3_1_1::unsuback_message(1));
+    encode(r, "v3_1_1::pingreq_message", mqtt::v3_1_1::pingreq_message());
+    encode(r, "v3_1_1::pingresp_message", mqtt::v3_1_1::pingresp_message());
+    encode(r, "v3_1_1::disconnect_message", mqtt::v3_1_1::disconnect_message());
+}
+
+void v5_message_benchmarks(runner& r) {
+    std::string topic = "sensor/room1/temperature";
+    std::string payload(64, 'p');
+    std::vector<mqtt::v5::property_variant> reason { mqtt::v5::property::reason_string("reason") };
+    encode(r, "v5::connect_message", mqtt::v5::connect_message(60, "client_id", true, mqtt::nullopt, std::string("user"), std::string("password"), { mqtt::v5::property::session_expiry_interval(3600) }));
+    encode(r, "v5::connack_message", mqtt::v5::connack_message(false, mqtt::v5::reason_code::success, { mqtt::v5::property::topic_alias_maximum(16) }));
+    encode(r, "v5::publish_message", mqtt::v5::publish_message(as::buffer(topic), mqtt::qos::at_least_once, false, false, 1, publish_props(), as::buffer(payload)));
+    encode(r, "v5::puback_message", mqtt::v5::puback_message(1, mqtt::v5::reason_code::success, reason));
+    encode(r, "v5::pubrec_message", mqtt::v5::pubrec_message(1, mqtt::v5::reason_code::success, reason));
+    encode(r, "v5::pubrel_message", mqtt::v5::pubrel_message(1, mqtt::v5::reason_code::success, reason));
+    encode(r, "v5::pubcomp_message", mqtt::v5::pubcomp_message(1, mqtt::v5::reason_code::success, reason));
+    encode(r, "v5::subscribe_message", mqtt::v5::subscribe_message({ std::make_tuple(as::buffer(topic), mqtt::qos::at_least_once) }, 1, { mqtt::v5::property::subscription_identifier(1) }));
+    encode(r, "v5::suback_message", mqtt::v5::suback_message({ mqtt::v5::reason_code::granted_qos_1 }, 1, reason));
+    encode(r, "v5::unsubscribe_message", mqtt::v5::unsubscribe_message({ as::buffer(topic) }, 1, {}));
+    encode(r, "v5::unsuback_message", mqtt::v5::unsuback_message({ mqtt::v5::reason_code::success }, 1, reason));
+    encode(r, "v5::pingreq_message", mqtt::v5::pingreq_message());
+    encode(r, "v5::pingresp_message", mqtt::v5::pingresp_message());
+    encode(r, "v5::disconnect_message", mqtt::v5::disconnect_message(mqtt::v5::reason_code::normal_disconnection, reason));
+    encode(r, "v5::auth_message", mqtt::v5::auth_message(mqtt::v5::reason_code::continue_authentication, { mqtt::v5::property::authentication_method("method") }));
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    runner r(argc > 1 ? argv[1] : "");
+    variable_length_benchmarks(r);
+    utf8_benchmarks(r);
+    property_benchmarks(r);
+    publish_benchmarks(r);
+    v3_1_1_message_benchmarks(r);
+    v5_message_benchmarks(r);
+}
@@ -0,0 +1,93 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Measures ordered_inflight_store and flat_inflight_store against the number of in-flight messages.
+// Each operation stores a message with the next packet id and erases the oldest one,
+// that is the steady state of a publisher that waits for PUBACK.
+// usage: bench_inflight_store [max_inflight]
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cstdint>
+
+#include <mqtt/control_packet_type.hpp>
+#include <mqtt/inflight_store.hpp>
+
+namespace {
+
+struct entry {
+    std::uint16_t packet_id() const { return id; }
+    std::uint8_t expected_control_packet_type() const { return mqtt::control_packet_type::puback; }
+    std::uint16_t id;
+    std::uint64_t payload;
+};
+
+std::uint16_t next_id(std::uint16_t id) {
+    return ++id == 0 ? 1 : id;
+}
+
+template <typename Store>
+void run(char const* name, std::size_t inflight) {
+    using clock = std::chrono::steady_clock;
+
+    Store s;
+    std::uint16_t oldest = 1;
+    std::uint16_t next = 1;
+    for (std::size_t i = 0; i != inflight; ++i) {
+        s.insert(entry { next, i });
+        next = next_id(next);
+    }
+
+    std::size_t ops = 0;
+    auto begin = clock::now();
+    auto end = begin;
+    // Run at least 200ms
+    do {
+        for (std::size_t i = 0; i != 1024; ++i) {
+            s.erase(oldest, mqtt::control_packet_type::puback);
+            oldest = next_id(oldest);
+            s.insert(entry { next, ops + i });
+            next = next_id(next);
+        }
+        ops += 1024;
+        end = clock::now();
+    } while (end - begin < std::chrono::milliseconds(200));
+
+    std::size_t visited = 0;
+    auto for_each_begin = clock::now();
+    s.for_each([&](entry const&) { ++visited; });
+    auto for_each_end = clock::now();
+
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+    auto for_each_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(for_each_end - for_each_begin).count();
+    std::cout
+        << "store: " << name
+        << " inflight: " << visited
+        << " insert_erase_ns_per_op: " << static_cast<double>(ns) / static_cast<double>(ops)
+        << " ops_per_sec: " << static_cast<double>(ops) * 1e9 / static_cast<double>(ns)
+        << " for_each_ns: " << for_each_ns
+        << std::endl;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    std::size_t max_inflight = 60000;
+    if (argc > 1) max_inflight = std::strtoull(argv[1], nullptr, 10);
+    // Packet ids are 16 bits. 0 is not used.
+    if (max_inflight > 65534) max_inflight = 65534;
+    std::size_t inflight = 10;
+    for (; inflight <= max_inflight; inflight *= 10) {
+        run<mqtt::ordered_inflight_store<entry>>("ordered", inflight);
+        run<mqtt::flat_inflight_store<entry>>("flat", inflight);
+    }
+    if (inflight / 10 != max_inflight) {
+        run<mqtt::ordered_inflight_store<entry>>("ordered", max_inflight);
+        run<mqtt::flat_inflight_store<entry>>("flat", max_inflight);
+    }
+}
@@ -0,0 +1,648 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// End-to-end benchmarks of clients and a server over the loopback interface.
+// The server forwards every PUBLISH to all subscribers, so the results don't depend on
+// the topic matching of a broker. Clients and the server run on one io_service and one thread,
+// that makes the results reproducible on the same machine.
+//
+// Scenarios
+//   qos0, qos1, qos2  1 publisher -> 1 subscriber throughput
+//   latency           1 publisher -> 1 subscriber, the next message is published after
+//                     the previous one is delivered
+//   fanout            1 publisher -> N subscribers
+//   fanin             N publishers -> 1 subscriber
+//   connect           N clients connect and disconnect at the same time
+// Each scenario is run for each transport (tcp, ws, tls, tls_ws) that is built, with
+// as::io_service::strand and null_strand.
+//
+// usage: bench_loopback [key=value]...
+//   messages=20000    messages per publisher
+//   payload=64        payload bytes. At least 8, the send time is stored in it.
+//   window=256        max in-flight messages per publisher
+//   fanout=8          subscribers of fanout and publishers of fanin
+//   connections=200   clients of connect
+//   port=11883        port of the server
+//   scenario=all      comma separated scenarios
+//   transport=all     comma separated transports
+//   strand=all        strand, null_strand or all
+//   output=-          JSON output file. - is stdout.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <memory>
+#include <algorithm>
+
+#include <mqtt_client_cpp.hpp>
+#include <mqtt_server_cpp.hpp>
+#include <mqtt/latency.hpp>
+
+namespace as = boost::asio;
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+char const* const host = "localhost";
+char const* const topic = "bench";
+
+struct options {
+    std::size_t messages = 20000;
+    std::size_t payload = 64;
+    std::size_t window = 256;
+    std::size_t fanout = 8;
+    std::size_t connections = 200;
+    std::uint16_t port = 11883;
+    std::string scenario = "all";
+    std::string transport = "all";
+    std::string strand = "all";
+    std::string output = "-";
+    std::string base; // directory of the certificate files
+};
+
+bool selected(std::string const& list, std::string const& name) {
+    if (list == "all") return true;
+    std::stringstream ss(list);
+    std::string e;
+    while (std::getline(ss, e, ',')) {
+        if (e == name) return true;
+    }
+    return false;
+}
+
+// JSON object that keeps the insertion order.
+class json_object {
+public:
+    json_object& add(std::string const& key, std::string const& value) {
+        return add_raw(key, "\"" + value + "\"");
+    }
+    json_object& add(std::string const& key, char const* value) {
+        return add(key, std::string(value));
+    }
+    template <typename T>
+    json_object& add(std::string const& key, T value) {
+        std::ostringstream os;
+        os << std::boolalpha << value;
+        return add_raw(key, os.str());
+    }
+    json_object& add(std::string const& key, json_object const& value) {
+        return add_raw(key, value.str());
+    }
+    json_object& add_raw(std::string const& key, std::string const& value) {
+        members_.emplace_back(key, value);
+        return *this;
+    }
+    std::string str(std::string const& indent = "") const {
+        std::string ret = "{";
+        for (std::size_t i = 0; i != members_.size(); ++i) {
+            ret += i == 0 ? "" : ",";
+            ret += "\n" + indent + "  \"" + members_[i].first + "\": " + members_[i].second;
+        }
+        return ret + "\n" + indent + "}";
+    }
+private:
+    std::vector<std::pair<std::string, std::string>> members_;
+};
+
+double seconds(clock_type::duration d) {
+    return std::chrono::duration_cast<std::chrono::duration<double>>(d).count();
+}
+
+json_object latency_json(mqtt::latency_histogram const& h) {
+    auto s = h.take_snapshot();
+    auto us = [](std::uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+    json_object o;
+    o.add("p50", us(s.value_at_percentile(50)))
+     .add("p90", us(s.value_at_percentile(90)))
+     .add("p99", us(s.value_at_percentile(99)))
+     .add("p999", us(s.value_at_percentile(99.9)))
+     .add("max", us(s.max()))
+     .add("mean", s.mean() / 1000.0);
+    return o;
+}
+
+// The server side. Every PUBLISH is forwarded to all subscribers.
+template <typename Server>
+class router {
+public:
+    using endpoint_t = typename Server::endpoint_t;
+
+    explicit router(std::unique_ptr<Server> s) : server_(std::move(s)) {
+        server_->set_error_handler(
+            [](boost::system::error_code const&) {
+            }
+        );
+        server_->set_accept_handler(
+            [this](endpoint_t& ep) {
+                accept(ep);
+            }
+        );
+        server_->listen();
+    }
+
+    void close() {
+        server_->close();
+        subscribers_.clear();
+    }
+
+private:
+    void accept(endpoint_t& ep) {
+        auto sp = ep.shared_from_this();
+        // The responses must not be written synchronously while async writes are in progress.
+        ep.set_auto_pub_response(true, true);
+        ep.start_session(
+            [sp] // keeping ep's lifetime as sp until session finished
+            (boost::system::error_code const&) {
+            }
+        );
+        ep.set_close_handler(
+            [this, &ep] {
+                remove(ep);
+            });
+        ep.set_error_handler(
+            [this, &ep]
+            (boost::system::error_code const&) {
+                remove(ep);
+            });
+        ep.set_connect_handler(
+            [&ep]
+            (std::string const&,
+             mqtt::optional<std::string> const&,
+             mqtt::optional<std::string> const&,
+             mqtt::optional<mqtt::will>,
+             bool,
+             std::uint16_t) {
+                ep.connack(false, mqtt::connect_return_code::accepted);
+                return true;
+            });
+        ep.set_disconnect_handler(
+            [this, &ep] {
+                remove(ep);
+            });
+        ep.set_subscribe_handler(
+            [this, &ep]
+            (typename endpoint_t::packet_id_t packet_id,
+             std::vector<std::tuple<std::string, std::uint8_t>> entries) {
+                std::vector<std::uint8_t> res;
+                for (auto const& e : entries) {
+                    res.push_back(std::get<1>(e));
+                    subscribers_.emplace_back(ep.shared_from_this(), std::get<1>(e));
+                }
+                ep.suback(packet_id, std::move(res));
+                return true;
+            });
+        ep.set_publish_handler(
+            [this]
+            (std::uint8_t header,
+             mqtt::optional<typename endpoint_t::packet_id_t>,
+             std::string topic_name,
+             std::string contents) {
+                auto t = std::make_shared<std::string>(std::move(topic_name));
+                auto c = std::make_shared<std::string>(std::move(contents));
+                auto body = mqtt::make_shared_publish(as::buffer(*t), as::buffer(*c), std::make_pair(t, c));
+                auto qos = mqtt::publish::get_qos(header);
+                for (auto const& s : subscribers_) {
+                    s.first->async_publish(body, std::min(qos, s.second), false);
+                }
+                return true;
+            });
+    }
+
+    void remove(endpoint_t& ep) {
+        subscribers_.erase(
+            std::remove_if(
+                subscribers_.begin(),
+                subscribers_.end(),
+                [&](auto const& s) { return s.first.get() == &ep; }
+            ),
+            subscribers_.end()
+        );
+    }
+
+    std::unique_ptr<Server> server_;
+    std::vector<std::pair<std::shared_ptr<endpoint_t>, std::uint8_t>> subscribers_;
+};
+
+// Transports. Each has the server type, make_server() and make_client().
+
+using strand = as::io_service::strand;
+using null_strand = mqtt::null_strand;
+
+struct tcp {
+    static constexpr char const* name = "tcp";
+    template <typename Strand>
+    using server = mqtt::server<Strand>;
+
+    template <typename Strand>
+    static std::unique_ptr<server<Strand>> make_server(as::io_service& ios, options const& opts) {
+        return std::make_unique<server<Strand>>(as::ip::tcp::endpoint(as::ip::tcp::v4(), opts.port), ios);
+    }
+    static auto make_client(as::io_service& ios, options const& opts, strand*) {
+        return mqtt::make_client(ios, host, opts.port);
+    }
+    static auto make_client(as::io_service& ios, options const& opts, null_strand*) {
+        return mqtt::make_client_no_strand(ios, host, opts.port);
+    }
+};
+
+#if defined(MQTT_USE_WS)
+
+struct ws {
+    static constexpr char const* name = "ws";
+    template <typename Strand>
+    using server = mqtt::server_ws<Strand>;
+
+    template <typename Strand>
+    static std::unique_ptr<server<Strand>> make_server(as::io_service& ios, options const& opts) {
+        return std::make_unique<server<Strand>>(as::ip::tcp::endpoint(as::ip::tcp::v4(), opts.port), ios);
+    }
+    static auto make_client(as::io_service& ios, options const& opts, strand*) {
+        return mqtt::make_client_ws(ios, host, opts.port);
+    }
+    static auto make_client(as::io_service& ios, options const& opts, null_strand*) {
+        return mqtt::make_client_no_strand_ws(ios, host, opts.port);
+    }
+};
+
+#endif // defined(MQTT_USE_WS)
+
+#if !defined(MQTT_NO_TLS)
+
+as::ssl::context server_context(options const& opts) {
+    as::ssl::context ctx(as::ssl::context::tlsv12);
+    ctx.set_options(
+        as::ssl::context::default_workarounds |
+        as::ssl::context::single_dh_use);
+    ctx.use_certificate_file(opts.base + "server.crt.pem", as::ssl::context::pem);
+    ctx.use_private_key_file(opts.base + "server.key.pem", as::ssl::context::pem);
+    return ctx;
+}
+
+struct tls {
+    static constexpr char const* name = "tls";
+    template <typename Strand>
+    using server = mqtt::server_tls<Strand>;
+
+    template <typename Strand>
+    static std::unique_ptr<server<Strand>> make_server(as::io_service& ios, options const& opts) {
+        return std::make_unique<server<Strand>>(
+            as::ip::tcp::endpoint(as::ip::tcp::v4(), opts.port), server_context(opts), ios);
+    }
+    static auto make_client(as::io_service& ios, options const& opts, strand*) {
+        auto c = mqtt::make_tls_client(ios, host, opts.port);
+        c->set_ca_cert_file(opts.base + "cacert.pem");
+        return c;
+    }
+    static auto make_client(as::io_service& ios, options const& opts, null_strand*) {
+        auto c = mqtt::make_tls_client_no_strand(ios, host, opts.port);
+        c->set_ca_cert_file(opts.base + "cacert.pem");
+        return c;
+    }
+};
+
+#if defined(MQTT_USE_WS)
+
+struct tls_ws {
+    static constexpr char const* name = "tls_ws";
+    template <typename Strand>
+    using server = mqtt::server_tls_ws<Strand>;
+
+    template <typename Strand>
+    static std::unique_ptr<server<Strand>> make_server(as::io_service& ios, options const& opts) {
+        return std::make_unique<server<Strand>>(
+            as::ip::tcp::endpoint(as::ip::tcp::v4(), opts.port), server_context(opts), ios);
+    }
+    static auto make_client(as::io_service& ios, options const& opts, strand*) {
+        auto c = mqtt::make_tls_client_ws(ios, host, opts.port);
+        c->set_ca_cert_file(opts.base + "cacert.pem");
+        return c;
+    }
+    static auto make_client(as::io_service& ios, options const& opts, null_strand*) {
+        auto c = mqtt::make_tls_client_no_strand_ws(ios, host, opts.port);
+        c->set_ca_cert_file(opts.base + "cacert.pem");
+        return c;
+    }
+};
+
+#endif // defined(MQTT_USE_WS)
+
+#endif // !defined(MQTT_NO_TLS)
+
+struct pubsub_scenario {
+    char const* name;
+    std::size_t publishers;
+    std::size_t subscribers;
+    std::uint8_t qos;
+    bool ping_pong; // publish the next message after the previous one is delivered
+};
+
+template <typename Transport, typename Strand>
+json_object run_pubsub(options const& opts, pubsub_scenario const& sc) {
+    as::io_service ios;
+    router<typename Transport::template server<Strand>> r(Transport::template make_server<Strand>(ios, opts));
+
+    using client_t = decltype(Transport::make_client(ios, opts, static_cast<Strand*>(nullptr)));
+    std::vector<client_t> pubs;
+    std::vector<client_t> subs;
+    std::vector<std::size_t> sent(sc.publishers);
+    std::vector<std::size_t> inflight(sc.publishers);
+    std::size_t subscribed = 0;
+    std::size_t connected = 0;
+    std::size_t received = 0;
+    std::size_t closed = 0;
+    std::size_t const expected = sc.publishers * opts.messages * sc.subscribers;
+    std::size_t const window = sc.ping_pong ? 1 : opts.window;
+    mqtt::latency_histogram latency;
+    clock_type::time_point begin;
+    clock_type::time_point end;
+
+    std::function<void(std::size_t)> fill =
+        [&](std::size_t i) {
+            while (inflight[i] < window && sent[i] < opts.messages) {
+                ++inflight[i];
+                ++sent[i];
+                std::string contents(opts.payload, 'x');
+                auto now = clock_type::now().time_since_epoch().count();
+                std::memcpy(&contents[0], &now, sizeof(now));
+                pubs[i]->async_publish(
+                    topic,
+                    std::move(contents),
+                    sc.qos,
+                    false,
+                    [&, i](boost::system::error_code const& ec) {
+                        if (ec || sc.qos != mqtt::qos::at_most_once || sc.ping_pong) return;
+                        --inflight[i];
+                        fill(i);
+                    }
+                );
+            }
+        };
+    auto acked =
+        [&](std::size_t i) {
+            if (sc.ping_pong) return true;
+            --inflight[i];
+            fill(i);
+            return true;
+        };
+    auto finish =
+        [&] {
+            for (auto& c : pubs) c->async_disconnect();
+            for (auto& c : subs) c->async_disconnect();
+        };
+    auto on_close =
+        [&] {
+            if (++closed == pubs.size() + subs.size()) r.close();
+        };
+
+    for (std::size_t i = 0; i != sc.publishers; ++i) {
+        auto c = Transport::make_client(ios, opts, static_cast<Strand*>(nullptr));
+        c->set_client_id("pub" + std::to_string(i));
+        c->set_clean_session(true);
+        c->set_auto_pub_response(true, true);
+        c->set_connack_handler(
+            [&](bool, std::uint8_t) {
+                if (++connected != pubs.size()) return true;
+                begin = clock_type::now();
+                for (std::size_t i = 0; i != pubs.size(); ++i) fill(i);
+                return true;
+            });
+        c->set_puback_handler([&, i](typename client_t::element_type::packet_id_t) { return acked(i); });
+        c->set_pubcomp_handler([&, i](typename client_t::element_type::packet_id_t) { return acked(i); });
+        c->set_close_handler(on_close);
+        c->set_error_handler([&](boost::system::error_code const&) { on_close(); });
+        pubs.push_back(std::move(c));
+    }
+    for (std::size_t i = 0; i != sc.subscribers; ++i) {
+        auto c = Transport::make_client(ios, opts, static_cast<Strand*>(nullptr));
+        c->set_client_id("sub" + std::to_string(i));
+        c->set_clean_session(true);
+        c->set_auto_pub_response(true, true);
+        c->set_connack_handler(
+            [&, i](bool, std::uint8_t) {
+                subs[i]->async_subscribe(topic, sc.qos);
+                return true;
+            });
+        c->set_suback_handler(
+            [&](typename client_t::element_type::packet_id_t, std::vector<mqtt::optional<std::uint8_t>>) {
+                // Publishers connect after all subscribers are ready.
+                if (++subscribed == subs.size()) {
+                    for (auto& p : pubs) p->connect();
+                }
+                return true;
+            });
+        c->set_publish_handler(
+            [&]
+            (std::uint8_t,
+             mqtt::optional<typename client_t::element_type::packet_id_t>,
+             std::string,
+             std::string contents) {
+                clock_type::rep sent_at;
+                std::memcpy(&sent_at, contents.data(), sizeof(sent_at));
+                latency.record(clock_type::now().time_since_epoch() - clock_type::duration(sent_at));
+                if (++received == expected) {
+                    end = clock_type::now();
+                    finish();
+                }
+                else if (sc.ping_pong) {
+                    --inflight[0];
+                    fill(0);
+                }
+                return true;
+            });
+        c->set_close_handler(on_close);
+        c->set_error_handler([&](boost::system::error_code const&) { on_close(); });
+        subs.push_back(std::move(c));
+    }
+    for (auto& c : subs) c->connect();
+    ios.run();
+
+    auto s = seconds(end - begin);
+    json_object o;
+    o.add("scenario", sc.name)
+     .add("transport", Transport::name)
+     .add("strand", std::is_same<Strand, strand>::value ? "strand" : "null_strand")
+     .add("qos", static_cast<int>(sc.qos))
+     .add("publishers", sc.publishers)
+     .add("subscribers", sc.subscribers)
+     .add("payload", opts.payload)
+     .add("window", window)
+     .add("messages", received)
+     .add("complete", received == expected)
+     .add("seconds", s)
+     .add("messages_per_sec", s == 0 ? 0.0 : static_cast<double>(received) / s)
+     .add("mbytes_per_sec", s == 0 ? 0.0 : static_cast<double>(received * opts.payload) / s / 1e6)
+     .add("latency_us", latency_json(latency));
+    return o;
+}
+
+template <typename Transport, typename Strand>
+json_object run_connect(options const& opts) {
+    as::io_service ios;
+    router<typename Transport::template server<Strand>> r(Transport::template make_server<Strand>(ios, opts));
+
+    using client_t = decltype(Transport::make_client(ios, opts, static_cast<Strand*>(nullptr)));
+    std::vector<client_t> clients;
+    std::size_t connected = 0;
+    std::size_t closed = 0;
+    mqtt::latency_histogram latency;
+    auto begin = clock_type::now();
+    clock_type::time_point end;
+
+    auto on_close =
+        [&] {
+            if (++closed != clients.size()) return;
+            end = clock_type::now();
+            r.close();
+        };
+    for (std::size_t i = 0; i != opts.connections; ++i) {
+        auto c = Transport::make_client(ios, opts, static_cast<Strand*>(nullptr));
+        c->set_client_id("cid" + std::to_string(i));
+        c->set_clean_session(true);
+        c->set_connack_handler(
+            [&, i](bool, std::uint8_t) {
+                ++connected;
+                latency.record(clock_type::now() - begin);
+                clients[i]->disconnect();
+                return true;
+            });
+        c->set_close_handler(on_close);
+        c->set_error_handler([&](boost::system::error_code const&) { on_close(); });
+        clients.push_back(std::move(c));
+    }
+    begin = clock_type::now();
+    for (auto& c : clients) c->connect();
+    ios.run();
+
+    auto s = seconds(end - begin);
+    json_object o;
+    o.add("scenario", "connect")
+     .add("transport", Transport::name)
+     .add("strand", std::is_same<Strand, strand>::value ? "strand" : "null_strand")
+     .add("connections", connected)
+     .add("complete", connected == opts.connections)
+     .add("seconds", s)
+     .add("connects_per_sec", s == 0 ? 0.0 : static_cast<double>(connected) / s)
+     .add("connack_us", latency_json(latency));
+    return o;
+}
+
+template <typename Transport, typename Strand>
+void run_transport(options const& opts, std::vector<json_object>& results) {
+    if (!selected(opts.transport, Transport::name)) return;
+    if (!selected(opts.strand, std::is_same<Strand, strand>::value ? "strand" : "null_strand")) return;
+
+    pubsub_scenario const scenarios[] = {
+        { "qos0", 1, 1, mqtt::qos::at_most_once, false },
+        { "qos1", 1, 1, mqtt::qos::at_least_once, false },
+        { "qos2", 1, 1, mqtt::qos::exactly_once, false },
+        { "latency", 1, 1, mqtt::qos::at_most_once, true },
+        { "fanout", 1, opts.fanout, mqtt::qos::at_most_once, false },
+        { "fanin", opts.fanout, 1, mqtt::qos::at_most_once, false },
+    };
+    for (auto const& sc : scenarios) {
+        if (!selected(opts.scenario, sc.name)) continue;
+        results.push_back(run_pubsub<Transport, Strand>(opts, sc));
+        std::cerr << "done: " << sc.name << " " << Transport::name << std::endl;
+    }
+    if (selected(opts.scenario, "connect")) {
+        results.push_back(run_connect<Transport, Strand>(opts));
+        std::cerr << "done: connect " << Transport::name << std::endl;
+    }
+}
+
+template <typename Transport>
+void run_transport(options const& opts, std::vector<json_object>& results) {
+    run_transport<Transport, strand>(opts, results);
+    run_transport<Transport, null_strand>(opts, results);
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    options opts;
+    std::map<std::string, std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto pos = a.find('=');
+        if (pos == std::string::npos) {
+            std::cerr << "invalid argument: " << a << std::endl;
+            return EXIT_FAILURE;
+        }
+        args.emplace(a.substr(0, pos), a.substr(pos + 1));
+    }
+    auto num =
+        [&](char const* key, std::size_t& v) {
+            auto it = args.find(key);
+            if (it != args.end()) v = std::strtoull(it->second.c_str(), nullptr, 10);
+        };
+    auto str =
+        [&](char const* key, std::string& v) {
+            auto it = args.find(key);
+            if (it != args.end()) v = it->second;
+        };
+    std::size_t port = opts.port;
+    num("messages", opts.messages);
+    num("payload", opts.payload);
+    num("window", opts.window);
+    num("fanout", opts.fanout);
+    num("connections", opts.connections);
+    num("port", port);
+    str("scenario", opts.scenario);
+    str("transport", opts.transport);
+    str("strand", opts.strand);
+    str("output", opts.output);
+    opts.port = static_cast<std::uint16_t>(port);
+    opts.payload = std::max(opts.payload, sizeof(clock_type::rep));
+    opts.window = std::max<std::size_t>(opts.window, 1);
+
+    std::string path = argv[0];
+    std::size_t pos = path.find_last_of("/\\");
+    opts.base = pos == std::string::npos ? "" : path.substr(0, pos + 1);
+
+    std::vector<json_object> results;
+    run_transport<tcp>(opts, results);
+#if defined(MQTT_USE_WS)
+    run_transport<ws>(opts, results);
+#endif // defined(MQTT_USE_WS)
+#if !defined(MQTT_NO_TLS)
+    run_transport<tls>(opts, results);
+#if defined(MQTT_USE_WS)
+    run_transport<tls_ws>(opts, results);
+#endif // defined(MQTT_USE_WS)
+#endif // !defined(MQTT_NO_TLS)
+
+    json_object config;
+    config.add("messages", opts.messages)
+          .add("payload", opts.payload)
+          .add("window", opts.window)
+          .add("fanout", opts.fanout)
+          .add("connections", opts.connections);
+    std::string list = "[";
+    for (std::size_t i = 0; i != results.size(); ++i) {
+        list += (i == 0 ? "\n    " : ",\n    ") + results[i].str("    ");
+    }
+    list += "\n  ]";
+    json_object root;
+    root.add("benchmark", "loopback")
+        .add_raw("config", config.str("  "))
+        .add_raw("results", list);
+
+    if (opts.output == "-") {
+        std::cout << root.str() << std::endl;
+    }
+    else {
+        std::ofstream ofs(opts.output);
+        ofs << root.str() << std::endl;
+    }
+}
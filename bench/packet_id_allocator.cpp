@@ -0,0 +1,118 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Measures the packet id acquire latency against the occupancy of 2 bytes packet ids.
+// Each operation releases a random used id and acquires a new one.
+// The former std::set based algorithm of endpoint::acquire_unique_packet_id is measured as a baseline.
+// usage: bench_packet_id_allocator
+
+#include <iostream>
+#include <vector>
+#include <set>
+#include <limits>
+#include <random>
+#include <chrono>
+#include <cstdint>
+
+#include <mqtt/packet_id_allocator.hpp>
+
+namespace {
+
+using packet_id_t = std::uint16_t;
+
+class set_allocator {
+public:
+    packet_id_t acquire() {
+        if (packet_id_.size() == std::numeric_limits<packet_id_t>::max()) throw mqtt::packet_id_exhausted_error();
+        if (packet_id_master_ == std::numeric_limits<packet_id_t>::max()) {
+            packet_id_master_ = 1U;
+        }
+        else {
+            ++packet_id_master_;
+        }
+        auto ret = packet_id_.insert(packet_id_master_);
+        if (ret.second) return packet_id_master_;
+
+        auto last = packet_id_.end();
+        auto e = last;
+        --last;
+
+        if (*last != std::numeric_limits<packet_id_t>::max()) {
+            packet_id_master_ = static_cast<packet_id_t>(*last + 1U);
+            packet_id_.insert(e, packet_id_master_);
+            return packet_id_master_;
+        }
+
+        auto b = packet_id_.begin();
+        auto prev = *b;
+        if (prev != 1U) {
+            packet_id_master_ = 1U;
+            packet_id_.insert(b, packet_id_master_);
+            return packet_id_master_;
+        }
+        ++b;
+        while (*b - 1U == prev && b != e) {
+            prev = *b;
+            ++b;
+        }
+        packet_id_master_ = static_cast<packet_id_t>(prev + 1U);
+        packet_id_.insert(b, packet_id_master_);
+        return packet_id_master_;
+    }
+
+    bool erase(packet_id_t packet_id) {
+        return packet_id_.erase(packet_id);
+    }
+
+private:
+    packet_id_t packet_id_master_{0};
+    std::set<packet_id_t> packet_id_;
+};
+
+template <typename Allocator>
+void run(char const* name, std::size_t used) {
+    using clock = std::chrono::steady_clock;
+    std::mt19937 rng(static_cast<std::mt19937::result_type>(used));
+
+    Allocator a;
+    std::vector<packet_id_t> ids;
+    ids.reserve(used);
+    for (std::size_t i = 0; i != used; ++i) {
+        ids.push_back(a.acquire());
+    }
+
+    std::size_t ops = 0;
+    auto begin = clock::now();
+    auto end = begin;
+    // Run at least 200ms
+    do {
+        for (std::size_t i = 0; i != 256; ++i) {
+            auto& id = ids[rng() % ids.size()];
+            a.erase(id);
+            id = a.acquire();
+        }
+        ops += 256;
+        end = clock::now();
+    } while (end - begin < std::chrono::milliseconds(200));
+
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+    std::cout
+        << "allocator: " << name
+        << " used: " << used
+        << " occupancy: " << static_cast<double>(used) / std::numeric_limits<packet_id_t>::max()
+        << " release_acquire_ns_per_op: " << static_cast<double>(ns) / static_cast<double>(ops)
+        << std::endl;
+}
+
+} // anonymous namespace
+
+int main() {
+    for (auto occupancy : { 0.01, 0.1, 0.5, 0.9, 0.99 }) {
+        auto used = static_cast<std::size_t>(std::numeric_limits<packet_id_t>::max() * occupancy);
+        run<set_allocator>("set", used);
+        run<mqtt::packet_id_allocator<packet_id_t>>("bitmap", used);
+    }
+}
@@ -0,0 +1,94 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Measures subscription_map match throughput against the number of filters.
+// usage: bench_subscription_map [max_filters]
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+
+#include <mqtt/subscription_map.hpp>
+
+namespace {
+
+// Filters look like "site<s>/dev<d>/<metric>". About 10% of them have '+' and 1% have '#'.
+std::string make_filter(std::mt19937& rng, std::size_t filters) {
+    std::size_t devices = std::max<std::size_t>(filters / 4, 1);
+    auto d = std::uniform_int_distribution<std::size_t>(0, devices - 1)(rng);
+    auto m = std::uniform_int_distribution<int>(0, 7)(rng);
+    auto kind = std::uniform_int_distribution<int>(0, 99)(rng);
+    std::string site = "site" + std::to_string(d % 100);
+    std::string dev = "dev" + std::to_string(d);
+    std::string metric = "m" + std::to_string(m);
+    if (kind == 0) return site + "/" + dev + "/#";
+    if (kind < 6) return site + "/+/" + metric;
+    if (kind < 11) return site + "/" + dev + "/+";
+    return site + "/" + dev + "/" + metric;
+}
+
+std::string make_topic(std::mt19937& rng, std::size_t filters) {
+    std::size_t devices = std::max<std::size_t>(filters / 4, 1);
+    auto d = std::uniform_int_distribution<std::size_t>(0, devices - 1)(rng);
+    auto m = std::uniform_int_distribution<int>(0, 7)(rng);
+    return "site" + std::to_string(d % 100) + "/dev" + std::to_string(d) + "/m" + std::to_string(m);
+}
+
+void run(std::size_t filters) {
+    using clock = std::chrono::steady_clock;
+    std::mt19937 rng(filters);
+
+    mqtt::subscription_map<std::size_t, std::uint8_t> m;
+    auto insert_begin = clock::now();
+    for (std::size_t i = 0; i != filters; ++i) {
+        m.insert_or_assign(make_filter(rng, filters), i, 0);
+    }
+    auto insert_end = clock::now();
+
+    constexpr std::size_t num_of_topics = 1024;
+    std::vector<std::string> topics;
+    topics.reserve(num_of_topics);
+    for (std::size_t i = 0; i != num_of_topics; ++i) {
+        topics.push_back(make_topic(rng, filters));
+    }
+
+    std::size_t matched = 0;
+    std::size_t iterations = 0;
+    auto match_begin = clock::now();
+    auto match_end = match_begin;
+    // Run at least 200ms
+    do {
+        for (auto const& t : topics) {
+            m.match(t, [&](std::size_t, std::uint8_t) { ++matched; });
+        }
+        iterations += topics.size();
+        match_end = clock::now();
+    } while (match_end - match_begin < std::chrono::milliseconds(200));
+
+    auto insert_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(insert_end - insert_begin).count();
+    auto match_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(match_end - match_begin).count();
+    std::cout
+        << "filters: " << filters
+        << " subscriptions: " << m.size()
+        << " insert_ns_per_op: " << static_cast<double>(insert_ns) / static_cast<double>(filters)
+        << " match_ns_per_op: " << static_cast<double>(match_ns) / static_cast<double>(iterations)
+        << " matches_per_sec: " << static_cast<double>(iterations) * 1e9 / static_cast<double>(match_ns)
+        << " subscribers_per_match: " << static_cast<double>(matched) / static_cast<double>(iterations)
+        << std::endl;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    std::size_t max_filters = 1000000;
+    if (argc > 1) max_filters = std::strtoull(argv[1], nullptr, 10);
+    for (std::size_t filters = 1000; filters <= max_filters; filters *= 10) {
+        run(filters);
+    }
+}
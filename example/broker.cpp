@@ -1,9 +1,40 @@
+#include <cstdlib>
+
 #include "../test/test_server_no_tls.hpp"
 #include "../test/test_broker.hpp"
+#include "../test/sharded_broker.hpp"
+
+// usage: broker [num_of_threads]
+// If num_of_threads is greater than 1, connections are distributed over
+// num_of_threads shards that run on their own threads.
+int main(int argc, char** argv) {
+    std::size_t num_of_threads = 1;
+    if (argc > 1) num_of_threads = std::strtoul(argv[1], nullptr, 10);
 
-int main() {
     boost::asio::io_service ios;
-    test_broker b(ios);
-    test_server_no_tls s(ios, b);
+    if (num_of_threads <= 1) {
+        test_broker b(ios);
+        test_server_no_tls s(ios, b);
+        ios.run();
+        return 0;
+    }
+
+    sharded_broker sb(num_of_threads);
+    mqtt::server<> s(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), broker_notls_port),
+        ios
+    );
+    s.set_io_service_selector(
+        [&]() -> boost::asio::io_service& {
+            return sb.next_io_service();
+        }
+    );
+    s.set_accept_handler(
+        [&](mqtt::server<>::endpoint_t& ep) {
+            sb.handle_accept(ep);
+        }
+    );
+    s.listen();
+    sb.run();
     ios.run();
 }
@@ -0,0 +1,86 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_BUFFER_HPP)
+#define MQTT_BUFFER_HPP
+
+#include <memory>
+
+#include <boost/asio/buffer.hpp>
+
+#include <mqtt/string_view.hpp>
+
+namespace mqtt {
+
+namespace as = boost::asio;
+
+/**
+ * @brief string_view with the lifetime keeper of the memory that it refers to.
+ *        Copying a buffer doesn't copy the contents. It shares the memory instead.
+ *        The memory is kept alive while at least one buffer refers to it.
+ */
+class buffer : public string_view {
+public:
+    /**
+     * @brief Constructor
+     *        The caller needs to keep the memory that sv refers to alive.
+     * @param sv string_view
+     */
+    explicit buffer(string_view sv = string_view())
+        : string_view(sv) {}
+
+    /**
+     * @brief Constructor
+     * @param sv   string_view that refers to the memory kept by life
+     * @param life lifetime keeper of the memory
+     */
+    buffer(string_view sv, std::shared_ptr<void> life)
+        : string_view(sv), life_(std::move(life)) {}
+
+    /**
+     * @brief Get the part of the buffer. The lifetime keeper is shared.
+     * @param offset offset of the beginning
+     * @param length length of the part
+     * @return buffer that refers to the part
+     */
+    buffer substr(size_type offset, size_type length = npos) const {
+        return buffer(string_view::substr(offset, length), life_);
+    }
+
+    /**
+     * @brief Get lifetime keeper
+     * @return lifetime keeper. It could be nullptr if the buffer doesn't keep the memory.
+     */
+    std::shared_ptr<void> const& life() const {
+        return life_;
+    }
+
+    /**
+     * @brief Check the buffer keeps the memory alive.
+     * @return true if the buffer has the lifetime keeper, otherwise false.
+     */
+    bool has_life() const {
+        return static_cast<bool>(life_);
+    }
+
+private:
+    std::shared_ptr<void> life_;
+};
+
+/**
+ * @brief Create asio::const_buffer that refers to the buffer.
+ *        The buffer (or its lifetime keeper) needs to be kept alive while the const_buffer is used.
+ *        e.g. pass the buffer as the life_keeper parameter of publish functions.
+ * @param buf buffer
+ * @return const_buffer
+ */
+inline as::const_buffer as_const_buffer(buffer const& buf) {
+    return as::buffer(buf.data(), buf.size());
+}
+
+} // namespace mqtt
+
+#endif // MQTT_BUFFER_HPP
@@ -0,0 +1,243 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_BUFFER_POOL_HPP)
+#define MQTT_BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+
+#include <mqtt/buffer.hpp>
+
+namespace mqtt {
+
+/**
+ * @brief Pool of reference counted memory slabs.
+ *        Slabs are grouped into size classes. A slab is returned to the pool when the
+ *        last reference to it is dropped, and it is reused by the next allocation of
+ *        the same size class.
+ *        The pool can be shared by many endpoints (e.g. all endpoints on the same io_service
+ *        or the same server). It is thread safe.
+ *        buffer_pool needs to be managed by std::shared_ptr.
+ */
+class buffer_pool : public std::enable_shared_from_this<buffer_pool> {
+public:
+    /**
+     * @brief Statistics of the pool
+     */
+    struct stats {
+        std::size_t hit = 0;       ///< number of allocations served by a cached slab
+        std::size_t miss = 0;      ///< number of allocations that needed a new slab
+        std::size_t oversize = 0;  ///< number of allocations larger than the biggest size class
+        std::size_t returned = 0;  ///< number of slabs returned to the pool
+        std::size_t discarded = 0; ///< number of slabs freed because the size class was full
+        std::size_t cached = 0;    ///< number of slabs currently cached in the pool
+    };
+
+    /**
+     * @brief Constructor
+     * @param class_sizes         slab sizes of each size class
+     * @param max_cached_per_class maximum number of slabs that are cached per size class
+     */
+    explicit buffer_pool(
+        std::vector<std::size_t> class_sizes = { 64, 256, 1024, 4096, 16 * 1024, 64 * 1024 },
+        std::size_t max_cached_per_class = 1024)
+        : class_sizes_(std::move(class_sizes)),
+          free_lists_(class_sizes_.size()),
+          max_cached_per_class_(max_cached_per_class) {
+        std::sort(class_sizes_.begin(), class_sizes_.end());
+    }
+
+    ~buffer_pool() {
+        for (auto& fl : free_lists_) {
+            for (auto p : fl) delete[] p;
+        }
+    }
+
+    buffer_pool(buffer_pool const&) = delete;
+    buffer_pool(buffer_pool&&) = delete;
+    buffer_pool& operator=(buffer_pool const&) = delete;
+    buffer_pool& operator=(buffer_pool&&) = delete;
+
+    /**
+     * @brief Allocate a slab
+     * @param size required size
+     * @return pair of the slab and its actual size that is equal to or greater than size.
+     */
+    std::pair<std::shared_ptr<char>, std::size_t> allocate(std::size_t size) {
+        auto it = std::lower_bound(class_sizes_.begin(), class_sizes_.end(), size);
+        if (it == class_sizes_.end()) {
+            {
+                std::lock_guard<std::mutex> lck(mtx_);
+                ++stats_.oversize;
+            }
+            return { std::shared_ptr<char>(new char[size], std::default_delete<char[]>()), size };
+        }
+        auto index = static_cast<std::size_t>(std::distance(class_sizes_.begin(), it));
+        char* p = nullptr;
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+            auto& fl = free_lists_[index];
+            if (fl.empty()) {
+                ++stats_.miss;
+            }
+            else {
+                ++stats_.hit;
+                --stats_.cached;
+                p = fl.back();
+                fl.pop_back();
+            }
+        }
+        if (!p) p = new char[*it];
+        return { std::shared_ptr<char>(p, slab_deleter(shared_from_this(), index)), *it };
+    }
+
+    /**
+     * @brief Get statistics
+     * @return snapshot of the statistics
+     */
+    stats get_stats() const {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return stats_;
+    }
+
+private:
+    struct slab_deleter {
+        slab_deleter(std::shared_ptr<buffer_pool> const& pool, std::size_t index)
+            :pool_(pool), index_(index) {}
+        void operator()(char* p) const {
+            if (auto pool = pool_.lock()) {
+                pool->release(p, index_);
+            }
+            else {
+                delete[] p;
+            }
+        }
+        std::weak_ptr<buffer_pool> pool_;
+        std::size_t index_;
+    };
+
+    void release(char* p, std::size_t index) {
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+            auto& fl = free_lists_[index];
+            if (fl.size() < max_cached_per_class_) {
+                ++stats_.returned;
+                ++stats_.cached;
+                fl.push_back(p);
+                return;
+            }
+            ++stats_.discarded;
+        }
+        delete[] p;
+    }
+
+private:
+    std::vector<std::size_t> class_sizes_;
+    std::vector<std::vector<char*>> free_lists_;
+    std::size_t max_cached_per_class_;
+    mutable std::mutex mtx_;
+    stats stats_;
+};
+
+/**
+ * @brief Receive buffer of an endpoint.
+ *        The memory is reference counted, so that a part of it can be passed to the user as
+ *        mqtt::buffer and kept alive after the next message is received.
+ *        If buffer_pool is set, the memory is allocated from the pool.
+ */
+class receive_buffer {
+public:
+    void set_pool(std::shared_ptr<buffer_pool> pool) {
+        pool_ = std::move(pool);
+    }
+
+    std::shared_ptr<buffer_pool> const& pool() const {
+        return pool_;
+    }
+
+    char* data() { return mem_.get(); }
+    char const* data() const { return mem_.get(); }
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    char& operator[](std::size_t i) { return mem_.get()[i]; }
+    char const& operator[](std::size_t i) const { return mem_.get()[i]; }
+
+    char* begin() { return data(); }
+    char* end() { return data() + size_; }
+    char const* begin() const { return data(); }
+    char const* end() const { return data() + size_; }
+    char const* cbegin() const { return data(); }
+    char const* cend() const { return data() + size_; }
+
+    /**
+     * @brief Resize the buffer.
+     *        The memory is reused if it is big enough and no one else refers to it.
+     *        Otherwise new memory is allocated and the current contents are copied.
+     */
+    void resize(std::size_t size) {
+        if (size == 0) {
+            size_ = 0;
+            return;
+        }
+        if (size > capacity_ || mem_.use_count() != 1) {
+            auto mem = allocate(size);
+            if (size_ != 0) std::memcpy(mem.first.get(), mem_.get(), std::min(size, size_));
+            mem_ = std::move(mem.first);
+            capacity_ = mem.second;
+        }
+        size_ = size;
+    }
+
+    template <typename It>
+    void assign(It b, It e) {
+        clear();
+        resize(static_cast<std::size_t>(std::distance(b, e)));
+        std::copy(b, e, mem_.get());
+    }
+
+    /**
+     * @brief Clear the buffer.
+     *        The memory is kept for the next message if no one else refers to it.
+     *        Otherwise, the memory is left to them. If it is taken from the pool,
+     *        it is returned to the pool when the last reference is dropped.
+     */
+    void clear() {
+        size_ = 0;
+        if (mem_ && mem_.use_count() != 1) {
+            mem_.reset();
+            capacity_ = 0;
+        }
+    }
+
+    /**
+     * @brief Get mqtt::buffer that refers to the whole contents and shares the memory.
+     */
+    buffer share() const {
+        return buffer(string_view(mem_.get(), size_), mem_);
+    }
+
+private:
+    std::pair<std::shared_ptr<char>, std::size_t> allocate(std::size_t size) {
+        if (pool_) return pool_->allocate(size);
+        return { std::shared_ptr<char>(new char[size], std::default_delete<char[]>()), size };
+    }
+
+private:
+    std::shared_ptr<buffer_pool> pool_;
+    std::shared_ptr<char> mem_;
+    std::size_t capacity_ = 0;
+    std::size_t size_ = 0;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_BUFFER_POOL_HPP
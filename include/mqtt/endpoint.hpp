@@ -12,11 +12,15 @@
 #include <string>
 #include <vector>
 #include <deque>
+#include <algorithm>
 #include <functional>
 #include <set>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <atomic>
+#include <iterator>
+#include <chrono>
 
 #include <boost/any.hpp>
 #include <boost/lexical_cast.hpp>
@@ -53,9 +57,21 @@
 #include <mqtt/optional.hpp>
 #include <mqtt/property_variant.hpp>
 #include <mqtt/property_parse.hpp>
+#include <mqtt/property_view.hpp>
 #include <mqtt/protocol_version.hpp>
 #include <mqtt/reason_code.hpp>
 #include <mqtt/subscribe.hpp>
+#include <mqtt/buffer.hpp>
+#include <mqtt/buffer_pool.hpp>
+#include <mqtt/shared_publish.hpp>
+#include <mqtt/inflight_store.hpp>
+#include <mqtt/packet_id_allocator.hpp>
+#include <mqtt/topic_alias.hpp>
+#include <mqtt/keep_alive.hpp>
+#include <mqtt/latency.hpp>
+#include <mqtt/traffic_stats.hpp>
+#include <mqtt/visitor_util.hpp>
+#include <mqtt/write_batch_policy.hpp>
 
 #if defined(MQTT_USE_WS)
 #include <mqtt/ws_endpoint.hpp>
@@ -66,9 +82,24 @@ namespace mqtt {
 namespace as = boost::asio;
 namespace mi = boost::multi_index;
 
-template <typename Socket, typename Mutex = std::mutex, template<typename...> class LockGuard = std::lock_guard, std::size_t PacketIdBytes = 2>
-class endpoint : public std::enable_shared_from_this<endpoint<Socket, Mutex, LockGuard, PacketIdBytes>> {
-    using this_type = endpoint<Socket, Mutex, LockGuard, PacketIdBytes>;
+/**
+ * @brief MQTT endpoint
+ * @tparam Socket        socket type. e.g. tcp_endpoint
+ * @tparam Mutex         mutex type of the in-flight message store
+ * @tparam LockGuard     lock guard type of Mutex
+ * @tparam PacketIdBytes packet id size. 2 for MQTT, 4 for the extended packet id.
+ * @tparam InflightStore store of the in-flight messages. ordered_inflight_store or flat_inflight_store.
+ *                       See inflight_store.hpp.
+ */
+template <
+    typename Socket,
+    typename Mutex = std::mutex,
+    template<typename...> class LockGuard = std::lock_guard,
+    std::size_t PacketIdBytes = 2,
+    template<typename...> class InflightStore = ordered_inflight_store
+>
+class endpoint : public std::enable_shared_from_this<endpoint<Socket, Mutex, LockGuard, PacketIdBytes, InflightStore>> {
+    using this_type = endpoint<Socket, Mutex, LockGuard, PacketIdBytes, InflightStore>;
 public:
     using async_handler_t = std::function<void(boost::system::error_code const& ec)>;
     using packet_id_t = typename packet_id_type<PacketIdBytes>::type;
@@ -647,6 +678,56 @@ public:
      */
     using pub_res_sent_handler = std::function<void(packet_id_t packet_id)>;
 
+    /**
+     * @brief Publish view handler
+     *        It is called instead of publish_handler if it is set.
+     *        topic_name and contents refer to the receive buffer directly, so they are not copied.
+     *        If you copy topic_name or contents (the buffer object, not its contents), the receive
+     *        buffer is kept alive until the last copy is destroyed.
+     * @param fixed_header
+     *        fixed_header byte. See publish_handler.
+     * @param packet_id
+     *        packet identifier<BR>
+     *        If received publish's QoS is 0, packet_id is mqtt::nullopt.
+     * @param topic_name
+     *        Topic name
+     * @param contents
+     *        Published contents
+     * @return if the handler returns true, then continue receiving, otherwise quit.
+     */
+    using publish_view_handler = std::function<bool(std::uint8_t fixed_header,
+                                                    mqtt::optional<packet_id_t> packet_id,
+                                                    buffer topic_name,
+                                                    buffer contents)>;
+
+    /**
+     * @brief Publish view handler for MQTT v5
+     *        It is called instead of v5_publish_handler if it is set.
+     *        topic_name and contents refer to the receive buffer directly, so they are not copied.
+     *        If you copy topic_name or contents (the buffer object, not its contents), the receive
+     *        buffer is kept alive until the last copy is destroyed.
+     * @param fixed_header
+     *        fixed_header byte. See v5_publish_handler.
+     * @param packet_id
+     *        packet identifier<BR>
+     *        If received publish's QoS is 0, packet_id is mqtt::nullopt.
+     * @param topic_name
+     *        Topic name
+     * @param contents
+     *        Published contents
+     * @param props
+     *        Properties that are decoded on access. They refer to the receive buffer
+     *        like topic_name and contents.
+     * @return if the handler returns true, then continue receiving, otherwise quit.
+     */
+    using v5_publish_view_handler = std::function<
+        bool(std::uint8_t fixed_header,
+             mqtt::optional<packet_id_t> packet_id,
+             buffer topic_name,
+             buffer contents,
+             v5::property_view props)
+    >;
+
     /**
      * @brief Serialize publish handler
      *        You can serialize the publish message.
@@ -717,6 +798,14 @@ public:
      */
     using pre_send_handler = std::function<void()>;
 
+    /**
+     * @brief Write batch handler
+     *        This handler is called when queued messages are concatenated and passed to async_write.
+     * @param num_of_messages number of messages in the batch
+     * @param bytes           size of the batch
+     */
+    using write_batch_handler = std::function<void(std::size_t num_of_messages, std::size_t bytes)>;
+
     /**
      * @brief is valid length handler
      *        This handler is called when remaining length is received.
@@ -776,6 +865,107 @@ public:
         auto_pub_response_async_ = async;
     }
 
+    /**
+     * @brief Set auto topic alias send mode.
+     * @param b set value
+     *
+     * When set auto topic alias send mode to true, the topic names of MQTT v5 PUBLISH are replaced with
+     * topic aliases automatically. The aliases are assigned to the recently used topic names up to
+     * the Topic Alias Maximum that is sent by the peer. If the peer doesn't send Topic Alias Maximum,
+     * topic alias is not used.<BR>
+     * PUBLISH that has topic alias property given by the user is sent as is.<BR>
+     * See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901113<BR>
+     * 3.3.2.3.4 Topic Alias<BR>
+     * The default value is true.
+     */
+    void set_auto_topic_alias_send(bool b = true) {
+        auto_topic_alias_send_ = b;
+    }
+
+    /**
+     * @brief Set the maximum packet size that this endpoint receives.
+     * @param size maximum packet size in bytes. It includes the fixed header and the remaining length.
+     *
+     * The size is checked before the buffer for the packet is allocated. If the received packet exceeds it,
+     * the endpoint stops reading and calls the error handler with message_size error.
+     * On MQTT v5, DISCONNECT with packet_too_large is sent before that, and the size is added to
+     * CONNECT or CONNACK as Maximum Packet Size property unless the properties already have it.
+     * If the properties have it, the value of the property is used as the maximum packet size.<BR>
+     * See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901050<BR>
+     * 3.1.2.11.4 Maximum Packet Size<BR>
+     * The default value is packet_size_no_limit.
+     */
+    void set_maximum_packet_size_recv(std::size_t size) {
+        maximum_packet_size_recv_ = size;
+    }
+
+    /**
+     * @brief Enforce the Keep Alive of the client on the server side endpoint.
+     * @param service
+     *        keep alive service of the io_service that this endpoint runs on.
+     *        e.g. &as::use_service<keep_alive_service>(ios). nullptr means the Keep Alive is not enforced.
+     *
+     * When CONNECT with non zero Keep Alive is received, the endpoint starts the check.
+     * If no control packet is received within one and a half times the Keep Alive,
+     * the connection is closed and the error handler is called with timed_out error.
+     * On MQTT v5, the Server Keep Alive of CONNACK overrides the Keep Alive of CONNECT.<BR>
+     * See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901045<BR>
+     * 3.1.2.10 Keep Alive<BR>
+     * This function should be called before the first message is read.
+     */
+    void set_keep_alive_service(keep_alive_service* service) {
+        keep_alive_service_ = service;
+    }
+
+#if defined(MQTT_USE_LATENCY_METRICS)
+
+    /**
+     * @brief Set the latency metrics to record the latencies of this endpoint.
+     * @param metrics
+     *        The histograms of latency_kind and control packet type are recorded.
+     *        The same metrics can be set to many endpoints, and it can be read by other threads
+     *        while recording. nullptr stops recording.
+     *
+     * This function should be called before connect or start_session.
+     * Only available if MQTT_USE_LATENCY_METRICS is defined, otherwise no latency is measured.
+     */
+    void set_latency_metrics(std::shared_ptr<latency_metrics> metrics) {
+        latency_.set_metrics(std::move(metrics));
+    }
+
+    /**
+     * @brief Get the latency metrics
+     * @return the latency metrics that is set by set_latency_metrics()
+     */
+    std::shared_ptr<latency_metrics> const& get_latency_metrics() const {
+        return latency_.metrics();
+    }
+
+#endif // defined(MQTT_USE_LATENCY_METRICS)
+
+    /**
+     * @brief Set the counters that the traffic of this endpoint is also added to.
+     * @param counters
+     *        The same counters can be set to many endpoints, e.g. all endpoints accepted by a server.
+     *        The queue and store gauges of this endpoint are moved from the previous counters
+     *        and removed when this endpoint is destroyed. nullptr stops adding.
+     *
+     * This function should be called before connect or start_session.
+     */
+    void set_traffic_counters(std::shared_ptr<traffic_counters> counters) {
+        traffic_.set_shared(std::move(counters));
+    }
+
+    /**
+     * @brief Get the traffic statistics of this endpoint
+     * @return snapshot of the counters.
+     * The counters are updated without locks, so it can be called from any thread and is cheap.
+     * See traffic_stats for the details of each value.
+     */
+    traffic_stats stats() const {
+        return traffic_.take_snapshot();
+    }
+
 
     // MQTT Common handlers
 
@@ -1244,6 +1434,22 @@ public:
         h_pub_res_sent_ = std::move(h);
     }
 
+    /**
+     * @brief Set publish view handler
+     * @param h handler
+     */
+    void set_publish_view_handler(publish_view_handler h = publish_view_handler()) {
+        h_publish_view_ = std::move(h);
+    }
+
+    /**
+     * @brief Set publish view handler for MQTT v5
+     * @param h handler
+     */
+    void set_v5_publish_view_handler(v5_publish_view_handler h = v5_publish_view_handler()) {
+        h_v5_publish_view_ = std::move(h);
+    }
+
     /**
      * @brief Set serialize handlers
      * @param h_publish serialize handler for publish message
@@ -1351,6 +1557,14 @@ public:
         h_pre_send_ = std::move(h);
     }
 
+    /**
+     * @brief Set write batch handler
+     * @param h handler
+     */
+    void set_write_batch_handler(write_batch_handler h = write_batch_handler()) {
+        h_write_batch_ = std::move(h);
+    }
+
     /**
      * @brief Set check length handler
      * @param h handler
@@ -1385,6 +1599,22 @@ public:
         return h_pub_res_sent_;
     }
 
+    /**
+     * @brief Get publish view handler
+     * @return handler
+     */
+    publish_view_handler const& get_publish_view_handler() const {
+        return h_publish_view_;
+    }
+
+    /**
+     * @brief Get publish view handler for MQTT v5
+     * @return handler
+     */
+    v5_publish_view_handler const& get_v5_publish_view_handler() const {
+        return h_v5_publish_view_;
+    }
+
     /**
      * @brief Get serialize publish handler
      * @return handler
@@ -1433,6 +1663,14 @@ public:
         return h_pre_send_;
     }
 
+    /**
+     * @brief Get write batch handler
+     * @return handler
+     */
+    write_batch_handler const& get_write_batch_handler() const {
+        return h_write_batch_;
+    }
+
     /**
      * @brief Get check length handler
      * @return handler
@@ -1520,6 +1758,7 @@ public:
      *        3.3.2.3 PUBLISH Properties
      * @return packet_id
      * packet_id is automatically generated.
+     * If the message exceeds the Maximum Packet Size of the peer, it doesn't publish and returns 0.
      */
     packet_id_t publish_at_least_once(
         std::string topic_name,
@@ -1558,6 +1797,7 @@ public:
      *        3.3.2.3 PUBLISH Properties
      * @return packet_id
      * packet_id is automatically generated.
+     * If the message exceeds the Maximum Packet Size of the peer, it doesn't publish and returns 0.
      */
     packet_id_t publish_at_least_once(
         as::const_buffer topic_name,
@@ -1567,7 +1807,7 @@ public:
         std::vector<v5::property_variant> props = {}
     ) {
         packet_id_t packet_id = acquire_unique_packet_id();
-        acquired_publish_at_least_once(packet_id, topic_name, contents, std::move(life_keeper), retain, std::move(props));
+        if (!acquired_publish_at_least_once(packet_id, topic_name, contents, std::move(life_keeper), retain, std::move(props))) return 0;
         return packet_id;
     }
 
@@ -1587,6 +1827,7 @@ public:
      *        3.3.2.3 PUBLISH Properties
      * @return packet_id
      * packet_id is automatically generated.
+     * If the message exceeds the Maximum Packet Size of the peer, it doesn't publish and returns 0.
      */
     packet_id_t publish_exactly_once(
         std::string topic_name,
@@ -1625,6 +1866,7 @@ public:
      *        3.3.2.3 PUBLISH Properties
      * @return packet_id
      * packet_id is automatically generated.
+     * If the message exceeds the Maximum Packet Size of the peer, it doesn't publish and returns 0.
      */
     packet_id_t publish_exactly_once(
         as::const_buffer topic_name,
@@ -1634,7 +1876,7 @@ public:
         std::vector<v5::property_variant> props = {}
     ) {
         packet_id_t packet_id = acquire_unique_packet_id();
-        acquired_publish_exactly_once(packet_id, topic_name, contents, std::move(life_keeper), retain, std::move(props));
+        if (!acquired_publish_exactly_once(packet_id, topic_name, contents, std::move(life_keeper), retain, std::move(props))) return 0;
         return packet_id;
     }
 
@@ -1656,6 +1898,7 @@ public:
      *        3.3.2.3 PUBLISH Properties
      * @return packet_id. If qos is set to at_most_once, return 0.
      * packet_id is automatically generated.
+     * If the message exceeds the Maximum Packet Size of the peer, it doesn't publish and returns 0.
      *
      * @note If you know ahead of time that qos will be at_most_once, then prefer
      *       publish_at_most_once() over publish() as it is slightly more efficent.
@@ -1682,7 +1925,7 @@ public:
             as::const_buffer contents_buf = as::buffer(sp_contents->data(), sp_contents->size());
 
             packet_id_t packet_id = acquire_unique_packet_id();
-            acquired_publish(packet_id, topic_buf, contents_buf, std::make_pair(std::move(sp_topic), std::move(sp_contents)), qos, retain, std::move(props));
+            if (!acquired_publish(packet_id, topic_buf, contents_buf, std::make_pair(std::move(sp_topic), std::move(sp_contents)), qos, retain, std::move(props))) return 0;
             return packet_id;
         }
     }
@@ -1707,6 +1950,7 @@ public:
      *        3.3.2.3 PUBLISH Properties
      * @return packet_id. If qos is set to at_most_once, return 0.
      * packet_id is automatically generated.
+     * If the message exceeds the Maximum Packet Size of the peer, it doesn't publish and returns 0.
      *
      * @note If you know ahead of time that qos will be at_most_once, then prefer
      *       publish_at_most_once() over publish() as it is slightly more efficent.
@@ -1728,11 +1972,39 @@ public:
         else
         {
             packet_id_t packet_id = acquire_unique_packet_id();
-            acquired_publish(packet_id, topic_name, contents, std::move(life_keeper), qos, retain, std::move(props));
+            if (!acquired_publish(packet_id, topic_name, contents, std::move(life_keeper), qos, retain, std::move(props))) return 0;
             return packet_id;
         }
     }
 
+    /**
+     * @brief Publish the shared message
+     * @param body
+     *        The topic name, the properties and the contents to publish. See make_shared_publish().<BR>
+     *        The same body can be published to many endpoints. It is encoded only once, and
+     *        each endpoint only builds its own fixed header, remaining length and packet id.<BR>
+     *        The body stays alive until the message is no longer needed to be resent.
+     * @param qos
+     *        mqtt::qos
+     * @param retain
+     *        A retain flag. If set it to true, the contents is retained.<BR>
+     *        https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901104<BR>
+     *        3.3.1.3 RETAIN
+     * @return packet_id. If qos is set to at_most_once, return 0.
+     * packet_id is automatically generated.
+     * If the message exceeds the Maximum Packet Size of the peer, it doesn't publish and returns 0.
+     */
+    packet_id_t publish(
+        std::shared_ptr<shared_publish const> body,
+        std::uint8_t qos = qos::at_most_once,
+        bool retain = false
+    ) {
+        BOOST_ASSERT(qos == qos::at_most_once || qos == qos::at_least_once || qos == qos::exactly_once);
+        packet_id_t packet_id = qos == qos::at_most_once ? 0 : acquire_unique_packet_id();
+        if (!send_publish(std::move(body), qos, retain, false, packet_id)) return 0;
+        return packet_id;
+    }
+
     /**
      * @brief Subscribe
      * @param topic_name
@@ -1995,8 +2267,9 @@ public:
      *        Properties<BR>
      *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901109<BR>
      *        3.3.2.3 PUBLISH Properties
-     * @return If packet_id is used in the publishing/subscribing sequence, then returns false and
-     *         contents doesn't publish, otherwise return true and contents publish.
+     * @return If packet_id is used in the publishing/subscribing sequence, or the message exceeds
+     *         the Maximum Packet Size of the peer, then returns false and contents doesn't publish,
+     *         otherwise return true and contents publish.
      */
     bool publish_at_least_once(
         packet_id_t packet_id,
@@ -2032,8 +2305,9 @@ public:
      *        Properties<BR>
      *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901109<BR>
      *        3.3.2.3 PUBLISH Properties
-     * @return If packet_id is used in the publishing/subscribing sequence, then returns false and
-     *         contents doesn't publish, otherwise return true and contents publish.
+     * @return If packet_id is used in the publishing/subscribing sequence, or the message exceeds
+     *         the Maximum Packet Size of the peer, then returns false and contents doesn't publish,
+     *         otherwise return true and contents publish.
      */
     bool publish_at_least_once(
         packet_id_t packet_id,
@@ -2044,8 +2318,7 @@ public:
         std::vector<v5::property_variant> props = {}
     ) {
         if (register_packet_id(packet_id)) {
-            acquired_publish_at_least_once(packet_id, topic_name, contents, std::move(life_keeper), retain, std::move(props));
-            return true;
+            return acquired_publish_at_least_once(packet_id, topic_name, contents, std::move(life_keeper), retain, std::move(props));
         }
         return false;
     }
@@ -2066,8 +2339,9 @@ public:
      *        Properties<BR>
      *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901109<BR>
      *        3.3.2.3 PUBLISH Properties
-     * @return If packet_id is used in the publishing/subscribing sequence, then returns false and
-     *         contents doesn't publish, otherwise return true and contents publish.
+     * @return If packet_id is used in the publishing/subscribing sequence, or the message exceeds
+     *         the Maximum Packet Size of the peer, then returns false and contents doesn't publish,
+     *         otherwise return true and contents publish.
      */
     bool publish_exactly_once(
         packet_id_t packet_id,
@@ -2103,8 +2377,9 @@ public:
      *        Properties<BR>
      *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901109<BR>
      *        3.3.2.3 PUBLISH Properties
-     * @return If packet_id is used in the publishing/subscribing sequence, then returns false and
-     *         contents doesn't publish, otherwise return true and contents publish.
+     * @return If packet_id is used in the publishing/subscribing sequence, or the message exceeds
+     *         the Maximum Packet Size of the peer, then returns false and contents doesn't publish,
+     *         otherwise return true and contents publish.
      */
     bool publish_exactly_once(
         packet_id_t packet_id,
@@ -2115,8 +2390,7 @@ public:
         std::vector<v5::property_variant> props = {}
     ) {
         if (register_packet_id(packet_id)) {
-            acquired_publish_exactly_once(packet_id, topic_name, contents, std::move(life_keeper), retain, std::move(props));
-            return true;
+            return acquired_publish_exactly_once(packet_id, topic_name, contents, std::move(life_keeper), retain, std::move(props));
         }
         return false;
     }
@@ -2139,8 +2413,9 @@ public:
      *        Properties<BR>
      *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901109<BR>
      *        3.3.2.3 PUBLISH Properties
-     * @return If packet_id is used in the publishing/subscribing sequence, then returns false and
-     *         contents don't publish, otherwise return true and contents publish.
+     * @return If packet_id is used in the publishing/subscribing sequence, or the message exceeds
+     *         the Maximum Packet Size of the peer, then returns false and contents don't publish,
+     *         otherwise return true and contents publish.
      */
     bool publish(
         packet_id_t packet_id,
@@ -2179,8 +2454,9 @@ public:
      *        Properties<BR>
      *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901109<BR>
      *        3.3.2.3 PUBLISH Properties
-     * @return If packet_id is used in the publishing/subscribing sequence, then returns false and
-     *         contents don't publish, otherwise return true and contents publish.
+     * @return If packet_id is used in the publishing/subscribing sequence, or the message exceeds
+     *         the Maximum Packet Size of the peer, then returns false and contents don't publish,
+     *         otherwise return true and contents publish.
      */
     bool publish(
         packet_id_t packet_id,
@@ -2193,8 +2469,7 @@ public:
     ) {
         BOOST_ASSERT(qos == qos::at_most_once || qos == qos::at_least_once || qos == qos::exactly_once);
         if (register_packet_id(packet_id)) {
-            acquired_publish(packet_id, topic_name, contents, std::move(life_keeper), qos, retain, std::move(props));
-            return true;
+            return acquired_publish(packet_id, topic_name, contents, std::move(life_keeper), qos, retain, std::move(props));
         }
         return false;
     }
@@ -2217,8 +2492,9 @@ public:
      *        Properties<BR>
      *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901109<BR>
      *        3.3.2.3 PUBLISH Properties
-     * @return If packet_id is used in the publishing/subscribing sequence, then returns false and
-     *         contents don't publish, otherwise return true and contents publish.
+     * @return If packet_id is used in the publishing/subscribing sequence, or the message exceeds
+     *         the Maximum Packet Size of the peer, then returns false and contents don't publish,
+     *         otherwise return true and contents publish.
      */
     bool publish_dup(
         packet_id_t packet_id,
@@ -2257,8 +2533,9 @@ public:
      *        Properties<BR>
      *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901109<BR>
      *        3.3.2.3 PUBLISH Properties
-     * @return If packet_id is used in the publishing/subscribing sequence, then returns false and
-     *         contents don't publish, otherwise return true and contents publish.
+     * @return If packet_id is used in the publishing/subscribing sequence, or the message exceeds
+     *         the Maximum Packet Size of the peer, then returns false and contents don't publish,
+     *         otherwise return true and contents publish.
      */
     bool publish_dup(
         packet_id_t packet_id,
@@ -2271,8 +2548,7 @@ public:
     ) {
         BOOST_ASSERT(qos == qos::at_most_once || qos == qos::at_least_once || qos == qos::exactly_once);
         if (register_packet_id(packet_id)) {
-            acquired_publish_dup(packet_id, topic_name, contents, std::move(life_keeper), qos, retain, std::move(props));
-            return true;
+            return acquired_publish_dup(packet_id, topic_name, contents, std::move(life_keeper), qos, retain, std::move(props));
         }
         return false;
     }
@@ -2532,8 +2808,10 @@ public:
      *        Properties<BR>
      *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901109<BR>
      *        3.3.2.3 PUBLISH Properties
+     * @return If the message exceeds the Maximum Packet Size of the peer, then returns false and
+     *         contents doesn't publish, and the packet_id is released. Otherwise return true.
      */
-    void acquired_publish_at_least_once(
+    bool acquired_publish_at_least_once(
         packet_id_t packet_id,
         std::string topic_name,
         std::string contents,
@@ -2547,7 +2825,7 @@ public:
         auto topic_buf    = as::buffer(*sp_topic_name);
         auto contents_buf = as::buffer(*sp_contents);
 
-        send_publish(
+        return send_publish(
             topic_buf,
             qos::at_least_once,
             retain,
@@ -2578,8 +2856,10 @@ public:
      *        Properties<BR>
      *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901109<BR>
      *        3.3.2.3 PUBLISH Properties
+     * @return If the message exceeds the Maximum Packet Size of the peer, then returns false and
+     *         contents doesn't publish, and the packet_id is released. Otherwise return true.
      */
-    void acquired_publish_at_least_once(
+    bool acquired_publish_at_least_once(
         packet_id_t packet_id,
         as::const_buffer topic_name,
         as::const_buffer contents,
@@ -2588,7 +2868,7 @@ public:
         std::vector<v5::property_variant> props = {}
     ) {
         BOOST_ASSERT(packet_id != 0);
-        send_publish(
+        return send_publish(
             topic_name,
             qos::at_least_once,
             retain,
@@ -2617,8 +2897,10 @@ public:
      *        Properties<BR>
      *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901109<BR>
      *        3.3.2.3 PUBLISH Properties
+     * @return If the message exceeds the Maximum Packet Size of the peer, then returns false and
+     *         contents doesn't publish, and the packet_id is released. Otherwise return true.
      */
-    void acquired_publish_exactly_once(
+    bool acquired_publish_exactly_once(
         packet_id_t packet_id,
         std::string topic_name,
         std::string contents,
@@ -2632,7 +2914,7 @@ public:
         auto topic_buf    = as::buffer(*sp_topic_name);
         auto contents_buf = as::buffer(*sp_contents);
 
-        send_publish(
+        return send_publish(
             topic_buf,
             qos::exactly_once,
             retain,
@@ -2663,8 +2945,10 @@ public:
      *        Properties<BR>
      *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901109<BR>
      *        3.3.2.3 PUBLISH Properties
+     * @return If the message exceeds the Maximum Packet Size of the peer, then returns false and
+     *         contents doesn't publish, and the packet_id is released. Otherwise return true.
      */
-    void acquired_publish_exactly_once(
+    bool acquired_publish_exactly_once(
         packet_id_t packet_id,
         as::const_buffer topic_name,
         as::const_buffer contents,
@@ -2673,7 +2957,7 @@ public:
         std::vector<v5::property_variant> props = {}
     ) {
 
-        send_publish(
+        return send_publish(
             topic_name,
             qos::exactly_once,
             retain,
@@ -2705,8 +2989,10 @@ public:
      *        Properties<BR>
      *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901109<BR>
      *        3.3.2.3 PUBLISH Properties
+     * @return If the message exceeds the Maximum Packet Size of the peer, then returns false and
+     *         contents doesn't publish, and the packet_id is released. Otherwise return true.
      */
-    void acquired_publish(
+    bool acquired_publish(
         packet_id_t packet_id,
         std::string topic_name,
         std::string contents,
@@ -2723,7 +3009,7 @@ public:
         auto topic_buf    = as::buffer(*sp_topic_name);
         auto contents_buf = as::buffer(*sp_contents);
 
-        send_publish(
+        return send_publish(
             topic_buf,
             qos,
             retain,
@@ -2757,8 +3043,10 @@ public:
      *        Properties<BR>
      *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901109<BR>
      *        3.3.2.3 PUBLISH Properties
+     * @return If the message exceeds the Maximum Packet Size of the peer, then returns false and
+     *         contents doesn't publish, and the packet_id is released. Otherwise return true.
      */
-    void acquired_publish(
+    bool acquired_publish(
         packet_id_t packet_id,
         as::const_buffer topic_name,
         as::const_buffer contents,
@@ -2770,7 +3058,7 @@ public:
         BOOST_ASSERT(qos == qos::at_most_once || qos == qos::at_least_once || qos == qos::exactly_once);
         BOOST_ASSERT((qos == qos::at_most_once && packet_id == 0) || (qos != qos::at_most_once && packet_id != 0));
 
-        send_publish(
+        return send_publish(
             topic_name,
             qos,
             retain,
@@ -2802,8 +3090,10 @@ public:
      *        Properties<BR>
      *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901109<BR>
      *        3.3.2.3 PUBLISH Properties
+     * @return If the message exceeds the Maximum Packet Size of the peer, then returns false and
+     *         contents doesn't publish, and the packet_id is released. Otherwise return true.
      */
-    void acquired_publish_dup(
+    bool acquired_publish_dup(
         packet_id_t packet_id,
         std::string topic_name,
         std::string contents,
@@ -2820,7 +3110,7 @@ public:
         auto topic_buf    = as::buffer(*sp_topic_name);
         auto contents_buf = as::buffer(*sp_contents);
 
-        send_publish(
+        return send_publish(
             topic_buf,
             qos,
             retain,
@@ -2854,8 +3144,10 @@ public:
      *        Properties<BR>
      *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901109<BR>
      *        3.3.2.3 PUBLISH Properties
+     * @return If the message exceeds the Maximum Packet Size of the peer, then returns false and
+     *         contents doesn't publish, and the packet_id is released. Otherwise return true.
      */
-    void acquired_publish_dup(
+    bool acquired_publish_dup(
         packet_id_t packet_id,
         as::const_buffer topic_name,
         as::const_buffer contents,
@@ -2867,7 +3159,7 @@ public:
         BOOST_ASSERT(qos == qos::at_most_once || qos == qos::at_least_once || qos == qos::exactly_once);
         BOOST_ASSERT((qos == qos::at_most_once && packet_id == 0) || (qos != qos::at_most_once && packet_id != 0));
 
-        send_publish(
+        return send_publish(
             topic_name,
             qos,
             retain,
@@ -3826,6 +4118,37 @@ public:
         return packet_id;
     }
 
+    /**
+     * @brief Publish the shared message
+     * @param body
+     *        The topic name, the properties and the contents to publish. See make_shared_publish().<BR>
+     *        The same body can be published to many endpoints. It is encoded only once, and
+     *        each endpoint only builds its own fixed header, remaining length and packet id.<BR>
+     *        The body stays alive until the async operation is finished and the message is no longer
+     *        needed to be resent.
+     * @param qos
+     *        mqtt::qos
+     * @param retain
+     *        A retain flag. If set it to true, the contents is retained.<BR>
+     *        https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901104<BR>
+     *        3.3.1.3 RETAIN
+     * @param func
+     *        functor object who's operator() will be called when the async operation completes.
+     * @return packet_id. If qos is set to at_most_once, return 0.
+     * packet_id is automatically generated.
+     */
+    packet_id_t async_publish(
+        std::shared_ptr<shared_publish const> body,
+        std::uint8_t qos,
+        bool retain,
+        async_handler_t func = async_handler_t()
+    ) {
+        BOOST_ASSERT(qos == qos::at_most_once || qos == qos::at_least_once || qos == qos::exactly_once);
+        packet_id_t packet_id = qos == qos::at_most_once ? 0 : acquire_unique_packet_id();
+        async_send_publish(std::move(body), qos, retain, false, packet_id, std::move(func));
+        return packet_id;
+    }
+
     /**
      * @brief Subscribe
      * @param topic_name
@@ -7278,9 +7601,8 @@ public:
      */
     void clear_stored_publish(packet_id_t packet_id) {
         LockGuard<Mutex> lck (store_mtx_);
-        auto& idx = store_.template get<tag_packet_id>();
-        auto r = idx.equal_range(packet_id);
-        idx.erase(std::get<0>(r), std::get<1>(r));
+        store_.erase(packet_id);
+        traffic_.store_size(store_.size());
         packet_id_.erase(packet_id);
     }
 
@@ -7307,12 +7629,13 @@ public:
      */
     void for_each_store(std::function<void(char const*, std::size_t)> const& f) {
         LockGuard<Mutex> lck (store_mtx_);
-        auto& idx = store_.template get<tag_seq>();
-        for (auto const & e : idx) {
-            auto const& m = e.message();
-            auto cb = continuous_buffer(m);
-            f(cb.data(), cb.size());
-        }
+        store_.for_each(
+            [&](store const& e) {
+                auto const& m = e.message();
+                auto cb = continuous_buffer(m);
+                f(cb.data(), cb.size());
+            }
+        );
     }
 
     /**
@@ -7321,10 +7644,11 @@ public:
      */
     void for_each_store(std::function<void(message_variant const&)> const& f) {
         LockGuard<Mutex> lck (store_mtx_);
-        auto& idx = store_.template get<tag_seq>();
-        for (auto const & e : idx) {
-            f(e.message());
-        }
+        store_.for_each(
+            [&](store const& e) {
+                f(e.message());
+            }
+        );
     }
 
     // manual packet_id management for advanced users
@@ -7339,41 +7663,7 @@ public:
      */
     packet_id_t acquire_unique_packet_id() {
         LockGuard<Mutex> lck (store_mtx_);
-        if (packet_id_.size() == std::numeric_limits<packet_id_t>::max()) throw packet_id_exhausted_error();
-        if (packet_id_master_ == std::numeric_limits<packet_id_t>::max()) {
-            packet_id_master_ = 1U;
-        }
-        else {
-            ++packet_id_master_;
-        }
-        auto ret = packet_id_.insert(packet_id_master_);
-        if (ret.second) return packet_id_master_;
-
-        auto last = packet_id_.end();
-        auto e = last;
-        --last;
-
-        if (*last != std::numeric_limits<packet_id_t>::max()) {
-            packet_id_master_ = static_cast<packet_id_t>(*last + 1U);
-            packet_id_.insert(e, packet_id_master_);
-            return packet_id_master_;
-        }
-
-        auto b = packet_id_.begin();
-        auto prev = *b;
-        if (prev != 1U) {
-            packet_id_master_ = 1U;
-            packet_id_.insert(b, packet_id_master_);
-            return packet_id_master_;
-        }
-        ++b;
-        while (*b - 1U == prev && b != e) {
-            prev = *b;
-            ++b;
-        }
-        packet_id_master_ = static_cast<packet_id_t>(prev + 1U);
-        packet_id_.insert(b, packet_id_master_);
-        return packet_id_master_;
+        return packet_id_.acquire();
     }
 
     /**
@@ -7386,7 +7676,7 @@ public:
     bool register_packet_id(packet_id_t packet_id) {
         if (packet_id == 0) return false;
         LockGuard<Mutex> lck (store_mtx_);
-        return packet_id_.insert(packet_id).second;
+        return packet_id_.insert(packet_id);
     }
 
     /**
@@ -7428,6 +7718,36 @@ public:
         }
     }
 
+    /**
+     * @brief Restore serialized publish and pubrel messages without copying them.
+     *        The topic name and the payload of the restored publish message refer to [b, e) directly.
+     *        e.g. [b, e) can be a part of a memory mapped file and life_keeper can hold the mapping.
+     *        This function should be called before connect.
+     * @param packet_id   packet id of the message
+     * @param b           iterator begin of the message
+     * @param e           iterator end of the message
+     * @param life_keeper
+     *        An object that keeps [b, e) valid until the stored message is sent.
+     */
+    template <typename Iterator>
+    typename std::enable_if<std::is_convertible<typename std::iterator_traits<Iterator>::value_type, char>::value>::type
+    restore_serialized_message(packet_id_t /*packet_id*/, Iterator b, Iterator e, mqtt::any life_keeper) {
+        if (b == e) return;
+
+        auto fixed_header = static_cast<std::uint8_t>(*b);
+        switch (get_control_packet_type(fixed_header)) {
+        case control_packet_type::publish: {
+            restore_serialized_message(basic_publish_message<PacketIdBytes>(b, e), std::move(life_keeper));
+        } break;
+        case control_packet_type::pubrel: {
+            restore_serialized_message(basic_pubrel_message<PacketIdBytes>(b, e));
+        } break;
+        default:
+            throw protocol_error();
+            break;
+        }
+    }
+
     /**
      * @brief Restore serialized publish message.
      *        This function should be called before connect.
@@ -7439,31 +7759,20 @@ public:
         auto packet_id = msg.packet_id();
         auto qos = msg.qos();
         LockGuard<Mutex> lck (store_mtx_);
-        if (packet_id_.insert(packet_id).second) {
-            auto ret = store_.emplace(
-                packet_id,
-                qos == qos::at_least_once ? control_packet_type::puback
-                                          : control_packet_type::pubrec,
-                std::move(msg),
-                std::move(life_keeper)
-            );
+        if (packet_id_.insert(packet_id)) {
             // When client want to restore serialized messages,
             // endpoint might keep the message that has the same packet_id.
             // In this case, overwrite store_.
-            if (!ret.second) {
-                store_.modify(
-                    ret.first,
-                    [&] (auto& e) {
-                        e = store(
-                            packet_id,
-                            qos == qos::at_least_once ? control_packet_type::puback
-                                                      : control_packet_type::pubrec,
-                            std::move(msg),
-                            std::move(life_keeper)
-                        );
-                    }
-                );
-            }
+            store_.insert_or_assign(
+                store(
+                    packet_id,
+                    qos == qos::at_least_once ? control_packet_type::puback
+                                              : control_packet_type::pubrec,
+                    std::move(msg),
+                    std::move(life_keeper)
+                )
+            );
+            traffic_.store_size(store_.size());
         }
     }
 
@@ -7475,27 +7784,18 @@ public:
     void restore_serialized_message(basic_pubrel_message<PacketIdBytes> msg) {
         auto packet_id = msg.packet_id();
         LockGuard<Mutex> lck (store_mtx_);
-        if (packet_id_.insert(packet_id).second) {
-            auto ret = store_.emplace(
-                packet_id,
-                control_packet_type::pubcomp,
-                std::move(msg)
-            );
+        if (packet_id_.insert(packet_id)) {
             // When client want to restore serialized messages,
             // endpoint might keep the message that has the same packet_id.
             // In this case, overwrite store_.
-            if (!ret.second) {
-                store_.modify(
-                    ret.first,
-                    [&] (auto& e) {
-                        e = store(
-                            packet_id,
-                            control_packet_type::pubcomp,
-                            std::move(msg)
-                        );
-                    }
-                );
-            }
+            store_.insert_or_assign(
+                store(
+                    packet_id,
+                    control_packet_type::pubcomp,
+                    std::move(msg)
+                )
+            );
+            traffic_.store_size(store_.size());
         }
     }
 
@@ -7508,18 +7808,36 @@ public:
      */
     template <typename Iterator>
     typename std::enable_if<std::is_convertible<typename Iterator::value_type, char>::value>::type
-    restore_v5_serialized_message(packet_id_t /*packet_id*/, Iterator b, Iterator e) {
+    restore_v5_serialized_message(packet_id_t packet_id, Iterator b, Iterator e) {
+        if (b == e) return;
+
+        auto sp = std::make_shared<std::string>(b, e);
+        restore_v5_serialized_message(packet_id, sp->cbegin(), sp->cend(), sp);
+    }
+
+    /**
+     * @brief Restore serialized publish and pubrel messages without copying them.
+     *        The topic name, the properties, and the payload of the restored message refer to [b, e) directly.
+     *        e.g. [b, e) can be a part of a memory mapped file and life_keeper can hold the mapping.
+     *        This function should be called before connect.
+     * @param packet_id   packet id of the message
+     * @param b           iterator begin of the message
+     * @param e           iterator end of the message
+     * @param life_keeper
+     *        An object that keeps [b, e) valid until the stored message is sent.
+     */
+    template <typename Iterator>
+    typename std::enable_if<std::is_convertible<typename std::iterator_traits<Iterator>::value_type, char>::value>::type
+    restore_v5_serialized_message(packet_id_t /*packet_id*/, Iterator b, Iterator e, mqtt::any life_keeper) {
         if (b == e) return;
 
         auto fixed_header = static_cast<std::uint8_t>(*b);
         switch (get_control_packet_type(fixed_header)) {
         case control_packet_type::publish: {
-            auto sp = std::make_shared<std::string>(b, e);
-            restore_v5_serialized_message(v5::basic_publish_message<PacketIdBytes>(sp->begin(), sp->end()), sp);
+            restore_v5_serialized_message(v5::basic_publish_message<PacketIdBytes>(b, e), std::move(life_keeper));
         } break;
         case control_packet_type::pubrel: {
-            auto sp = std::make_shared<std::string>(b, e);
-            restore_v5_serialized_message(v5::basic_pubrel_message<PacketIdBytes>(sp->begin(), sp->end()), sp);
+            restore_v5_serialized_message(v5::basic_pubrel_message<PacketIdBytes>(b, e), std::move(life_keeper));
         } break;
         default:
             throw protocol_error();
@@ -7538,31 +7856,20 @@ public:
         auto packet_id = msg.packet_id();
         auto qos = msg.qos();
         LockGuard<Mutex> lck (store_mtx_);
-        if (packet_id_.insert(packet_id).second) {
-            auto ret = store_.emplace(
-                packet_id,
-                qos == qos::at_least_once ? control_packet_type::puback
-                                          : control_packet_type::pubrec,
-                std::move(msg),
-                std::move(life_keeper)
-            );
+        if (packet_id_.insert(packet_id)) {
             // When client want to restore serialized messages,
             // endpoint might keep the message that has the same packet_id.
             // In this case, overwrite store_.
-            if (!ret.second) {
-                store_.modify(
-                    ret.first,
-                    [&] (auto& e) {
-                        e = store(
-                            packet_id,
-                            qos == qos::at_least_once ? control_packet_type::puback
-                                                      : control_packet_type::pubrec,
-                            std::move(msg),
-                            std::move(life_keeper)
-                        );
-                    }
-                );
-            }
+            store_.insert_or_assign(
+                store(
+                    packet_id,
+                    qos == qos::at_least_once ? control_packet_type::puback
+                                              : control_packet_type::pubrec,
+                    std::move(msg),
+                    std::move(life_keeper)
+                )
+            );
+            traffic_.store_size(store_.size());
         }
     }
 
@@ -7576,28 +7883,19 @@ public:
     void restore_v5_serialized_message(v5::basic_pubrel_message<PacketIdBytes> msg, mqtt::any life_keeper) {
         auto packet_id = msg.packet_id();
         LockGuard<Mutex> lck (store_mtx_);
-        if (packet_id_.insert(packet_id).second) {
-            auto ret = store_.emplace(
-                packet_id,
-                control_packet_type::pubcomp,
-                std::move(msg),
-                std::move(life_keeper)
-            );
+        if (packet_id_.insert(packet_id)) {
             // When client want to restore serialized messages,
             // endpoint might keep the message that has the same packet_id.
             // In this case, overwrite store_.
-            if (!ret.second) {
-                store_.modify(
-                    ret.first,
-                    [&] (auto& e) {
-                        e = store(
-                            packet_id,
-                            control_packet_type::pubcomp,
-                            std::move(msg)
-                        );
-                    }
-                );
-            }
+            store_.insert_or_assign(
+                store(
+                    packet_id,
+                    control_packet_type::pubcomp,
+                    std::move(msg),
+                    std::move(life_keeper)
+                )
+            );
+            traffic_.store_size(store_.size());
         }
     }
 
@@ -7651,13 +7949,14 @@ public:
      *        message is processed, then concatenate queued messages and
      *        send it.
      *        This value limits the maximum number of concatenating messages.
-     *        The default value is 1.
+     *        The default value is 0.
+     *        It is the same as write_batch_policy::set_max_messages().
      *
      * @param count maximum number of queued message sending. 0 means infinity.
      *
      */
     void set_max_queue_send_count(std::size_t count) {
-        max_queue_send_count_ = count;
+        write_batch_policy_.set_max_messages(count);
     }
 
      /**
@@ -7673,17 +7972,94 @@ public:
      *
      */
     void set_max_queue_send_size(std::size_t size) {
-        max_queue_send_size_ = size;
+        write_batch_policy_.set_max_bytes(size);
     }
 
-    protocol_version get_protocol_version() const {
-        return version_;
+    /**
+     * @brief Set write batch policy.
+     *        The policy decides how many queued messages are concatenated and sent by one async_write,
+     *        and how long the endpoint waits for more messages before sending.
+     *        The default policy is write_batch_policy::drain_all().
+     *        Use set_write_batch_handler() to observe the number of messages and bytes of each batch.
+     *
+     * @param policy write batch policy
+     *
+     */
+    void set_write_batch_policy(write_batch_policy policy) {
+        write_batch_policy_ = policy;
     }
 
-protected:
-    void async_read_control_packet_type(async_handler_t func) {
-        async_read(
-            *socket_,
+    /**
+     * @brief Get write batch policy.
+     * @return write batch policy
+     */
+    write_batch_policy const& get_write_batch_policy() const {
+        return write_batch_policy_;
+    }
+
+    /**
+     * @brief Set buffer pool for receiving messages.
+     *        The payload of received messages is allocated from the pool.
+     *        A pool can be shared by many endpoints, e.g. all endpoints on the same io_service.
+     *        The memory that is kept by mqtt::buffer passed to publish view handlers is returned
+     *        to the pool when the last mqtt::buffer is destroyed.
+     *        This function should be called before the first message is read.
+     *
+     * @param pool buffer pool. nullptr means the memory is allocated from the heap.
+     *
+     */
+    void set_buffer_pool(std::shared_ptr<buffer_pool> pool) {
+        payload_.set_pool(std::move(pool));
+    }
+
+    /**
+     * @brief Get buffer pool for receiving messages.
+     * @return buffer pool. nullptr if not set.
+     */
+    std::shared_ptr<buffer_pool> const& get_buffer_pool() const {
+        return payload_.pool();
+    }
+
+    /**
+     * @brief Set bulk read buffer size.
+     *        By default, each mqtt message is received by several reads:
+     *        fixed header, each byte of the remaining length, and payload.
+     *        When the bulk read buffer size is set, the endpoint reads as many bytes as
+     *        available up to the buffer size at once, and then processes all complete
+     *        mqtt messages in the buffer before the next read.
+     *        A message that is larger than the buffer is received directly into the
+     *        payload buffer after its fixed header and remaining length are decoded.
+     *        The default value is 0.
+     *        This function should be called before the first message is read.
+     *
+     * @param size size of the bulk read buffer. 0 means bulk read is disabled.
+     *
+     */
+    void set_bulk_read_buffer_size(std::size_t size) {
+        bulk_read_buffer_size_ = size;
+    }
+
+    /**
+     * @brief Get bulk read buffer size.
+     * @return bulk read buffer size. 0 means bulk read is disabled.
+     */
+    std::size_t get_bulk_read_buffer_size() const {
+        return bulk_read_buffer_size_;
+    }
+
+    protocol_version get_protocol_version() const {
+        return version_;
+    }
+
+protected:
+    void async_read_control_packet_type(async_handler_t func) {
+        if (bulk_read_buffer_size_ != 0) {
+            bulk_read_next_message(std::move(func));
+            return;
+        }
+        traffic_.read_call();
+        async_read(
+            *socket_,
             as::buffer(&buf_, 1),
             [self = this->shared_from_this(), func = std::move(func)](
                 boost::system::error_code const& ec,
@@ -7703,6 +8079,7 @@ protected:
 
     bool handle_close_or_error(boost::system::error_code const& ec) {
         if (!ec) return false;
+        stop_keep_alive();
         if (connected_) {
             connected_ = false;
             mqtt_connected_ = false;
@@ -7732,7 +8109,12 @@ protected:
         }
         disconnect_requested_ = false;
         connect_requested_ = false;
-        handle_error(ec);
+        if (keep_alive_timed_out_) {
+            handle_error(boost::system::errc::make_error_code(boost::system::errc::timed_out));
+        }
+        else {
+            handle_error(ec);
+        }
         return true;
     }
 
@@ -8079,7 +8461,8 @@ private:
         std::shared_ptr<std::string> buf_;
     };
 
-    struct store {
+    // The latency stamp is the time when the message is stored.
+    struct store : latency_stamp {
         store(
             packet_id_t id,
             std::uint8_t type,
@@ -8088,56 +8471,150 @@ private:
             : packet_id_(id)
             , expected_control_packet_type_(type)
             , smv_(std::move(smv))
-            , life_keeper_(std::move(life_keeper)) {}
+            , life_keeper_(std::move(life_keeper))
+            , expiry_(publish_expiry(smv_)) {}
         packet_id_t packet_id() const { return packet_id_; }
         std::uint8_t expected_control_packet_type() const { return expected_control_packet_type_; }
         basic_message_variant<PacketIdBytes> message() const {
             return get_basic_message_variant<PacketIdBytes>(smv_);
         }
+        // The message to resend. The Message Expiry Interval is rewritten to the remaining interval.
+        // See MQTT v5 3.3.2.3.3 Message Expiry Interval.
+        basic_message_variant<PacketIdBytes> message(std::chrono::steady_clock::time_point now) const {
+            if (!expiry_) return message();
+            return mqtt::visit(
+                make_lambda_visitor<basic_message_variant<PacketIdBytes>>(
+                    [&](v5::basic_publish_message<PacketIdBytes> msg) -> basic_message_variant<PacketIdBytes> {
+                        // Round up not to expire before the original deadline.
+                        auto remaining = std::chrono::duration_cast<std::chrono::seconds>(
+                            *expiry_ - now + std::chrono::seconds(1) - std::chrono::steady_clock::duration(1));
+                        msg.update_message_expiry_interval(static_cast<std::uint32_t>(remaining.count()));
+                        return msg;
+                    },
+                    [](auto const& msg) -> basic_message_variant<PacketIdBytes> {
+                        return msg;
+                    }
+                ),
+                smv_
+            );
+        }
+        // The PUBLISH whose Message Expiry Interval has passed is not resent.
+        bool expired(std::chrono::steady_clock::time_point now) const {
+            return expiry_ && *expiry_ <= now;
+        }
     private:
+        static mqtt::optional<std::chrono::steady_clock::time_point>
+        publish_expiry(basic_store_message_variant<PacketIdBytes> const& smv) {
+            return mqtt::visit(
+                make_lambda_visitor<mqtt::optional<std::chrono::steady_clock::time_point>>(
+                    [](v5::basic_publish_message<PacketIdBytes> const& msg)
+                    -> mqtt::optional<std::chrono::steady_clock::time_point> {
+                        if (auto interval = msg.message_expiry_interval()) {
+                            return std::chrono::steady_clock::now() + std::chrono::seconds(*interval);
+                        }
+                        return mqtt::nullopt;
+                    },
+                    [](auto const&) -> mqtt::optional<std::chrono::steady_clock::time_point> {
+                        return mqtt::nullopt;
+                    }
+                ),
+                smv
+            );
+        }
+
         packet_id_t packet_id_;
         std::uint8_t expected_control_packet_type_;
         basic_store_message_variant<PacketIdBytes> smv_;
         mqtt::any life_keeper_;
+        // The time when the stored PUBLISH expires
+        mqtt::optional<std::chrono::steady_clock::time_point> expiry_;
     };
 
-    struct tag_packet_id {};
-    struct tag_packet_id_type {};
-    struct tag_seq {};
-    using mi_store = mi::multi_index_container<
-        store,
-        mi::indexed_by<
-            mi::ordered_unique<
-                mi::tag<tag_packet_id_type>,
-                mi::composite_key<
-                    store,
-                    mi::const_mem_fun<
-                        store, packet_id_t,
-                        &store::packet_id
-                    >,
-                    mi::const_mem_fun<
-                        store, std::uint8_t,
-                        &store::expected_control_packet_type
-                    >
-                >
-            >,
-            mi::ordered_non_unique<
-                mi::tag<tag_packet_id>,
-                mi::const_mem_fun<
-                    store, packet_id_t,
-                    &store::packet_id
-                >
-            >,
-            mi::sequenced<
-                mi::tag<tag_seq>
-            >
-        >
-    >;
+    bool check_remaining_length() const {
+        auto cpt = get_control_packet_type(fixed_header_);
+        switch (version_) {
+        case protocol_version::v3_1_1:
+            switch (cpt) {
+            case control_packet_type::connect:
+            case control_packet_type::publish:
+            case control_packet_type::subscribe:
+            case control_packet_type::suback:
+            case control_packet_type::unsubscribe:
+                if (h_is_valid_length_) {
+                    return h_is_valid_length_(cpt, remaining_length_);
+                }
+                else {
+                    return true;
+                }
+            case control_packet_type::connack:
+                return remaining_length_ == 2;
+            case control_packet_type::puback:
+            case control_packet_type::pubrec:
+            case control_packet_type::pubrel:
+            case control_packet_type::pubcomp:
+            case control_packet_type::unsuback:
+                return remaining_length_ == sizeof(packet_id_t);
+            case control_packet_type::pingreq:
+            case control_packet_type::pingresp:
+            case control_packet_type::disconnect:
+                return remaining_length_ == 0;
+            default:
+                return false;
+            }
+            break;
+        case protocol_version::v5:
+        default:
+            switch (cpt) {
+            case control_packet_type::connect:
+            case control_packet_type::publish:
+            case control_packet_type::subscribe:
+            case control_packet_type::suback:
+            case control_packet_type::unsubscribe:
+            case control_packet_type::connack:
+            case control_packet_type::puback:
+            case control_packet_type::pubrec:
+            case control_packet_type::pubrel:
+            case control_packet_type::pubcomp:
+            case control_packet_type::unsuback:
+            case control_packet_type::disconnect:
+                if (h_is_valid_length_) {
+                    return h_is_valid_length_(cpt, remaining_length_);
+                }
+                else {
+                    return true;
+                }
+            case control_packet_type::pingreq:
+            case control_packet_type::pingresp:
+                return remaining_length_ == 0;
+            default:
+                return false;
+            }
+            break;
+        }
+    }
+
+    // Check the received packet size before the payload is allocated.
+    // If it exceeds the maximum, send DISCONNECT with packet_too_large on MQTT v5. See MQTT v5 3.1.2.11.4.
+    bool check_maximum_packet_size_recv(async_handler_t const& func) {
+        if (1 + remaining_length_size(remaining_length_) + remaining_length_ <= maximum_packet_size_recv_) return true;
+        if (version_ == protocol_version::v5 && connected_) {
+            if (auto_pub_response_async_) {
+                async_send_disconnect(v5::reason_code::packet_too_large, {}, async_handler_t());
+            }
+            else {
+                send_disconnect(v5::reason_code::packet_too_large);
+            }
+        }
+        handle_error(boost::system::errc::make_error_code(boost::system::errc::message_size));
+        if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
+        return false;
+    }
 
     void handle_control_packet_type(async_handler_t func) {
         fixed_header_ = static_cast<std::uint8_t>(buf_);
         remaining_length_ = 0;
         remaining_length_multiplier_ = 1;
+        traffic_.read_call();
         async_read(
             *socket_,
             as::buffer(&buf_, 1),
@@ -8167,6 +8644,7 @@ private:
             return;
         }
         if (buf_ & 0b10000000) {
+            traffic_.read_call();
             async_read(
                 *socket_,
                 as::buffer(&buf_, 1),
@@ -8187,70 +8665,8 @@ private:
             );
         }
         else {
-            auto check =
-                [&]() -> bool {
-                    auto cpt = get_control_packet_type(fixed_header_);
-                    switch (version_) {
-                    case protocol_version::v3_1_1:
-                        switch (cpt) {
-                        case control_packet_type::connect:
-                        case control_packet_type::publish:
-                        case control_packet_type::subscribe:
-                        case control_packet_type::suback:
-                        case control_packet_type::unsubscribe:
-                            if (h_is_valid_length_) {
-                                return h_is_valid_length_(cpt, remaining_length_);
-                            }
-                            else {
-                                return true;
-                            }
-                        case control_packet_type::connack:
-                            return remaining_length_ == 2;
-                        case control_packet_type::puback:
-                        case control_packet_type::pubrec:
-                        case control_packet_type::pubrel:
-                        case control_packet_type::pubcomp:
-                        case control_packet_type::unsuback:
-                            return remaining_length_ == sizeof(packet_id_t);
-                        case control_packet_type::pingreq:
-                        case control_packet_type::pingresp:
-                        case control_packet_type::disconnect:
-                            return remaining_length_ == 0;
-                        default:
-                            return false;
-                        }
-                        break;
-                    case protocol_version::v5:
-                    default:
-                        switch (cpt) {
-                        case control_packet_type::connect:
-                        case control_packet_type::publish:
-                        case control_packet_type::subscribe:
-                        case control_packet_type::suback:
-                        case control_packet_type::unsubscribe:
-                        case control_packet_type::connack:
-                        case control_packet_type::puback:
-                        case control_packet_type::pubrec:
-                        case control_packet_type::pubrel:
-                        case control_packet_type::pubcomp:
-                        case control_packet_type::unsuback:
-                        case control_packet_type::disconnect:
-                            if (h_is_valid_length_) {
-                                return h_is_valid_length_(cpt, remaining_length_);
-                            }
-                            else {
-                                return true;
-                            }
-                        case control_packet_type::pingreq:
-                        case control_packet_type::pingresp:
-                            return remaining_length_ == 0;
-                        default:
-                            return false;
-                        }
-                        break;
-                    }
-                };
-            if (!check()) {
+            if (!check_maximum_packet_size_recv(func)) return;
+            if (!check_remaining_length()) {
                 handle_error(boost::system::errc::make_error_code(boost::system::errc::message_size));
                 if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
                 return;
@@ -8271,9 +8687,10 @@ private:
                 handle_payload(func);
                 return;
             }
+            traffic_.read_call();
             async_read(
                 *socket_,
-                as::buffer(payload_),
+                as::buffer(payload_.data(), payload_.size()),
                 [self = this->shared_from_this(), func = std::move(func)](
                     boost::system::error_code const& ec,
                     std::size_t bytes_transferred){
@@ -8298,8 +8715,150 @@ private:
         }
     }
 
+    void bulk_read_next_message(async_handler_t func) {
+        if (bulk_read_processing_) {
+            // Called from handle_payload() via mqtt_message_processed_handler.
+            // The loop below processes the next message after handle_payload() returns,
+            // so that many buffered messages don't deepen the call stack.
+            bulk_read_next_ = std::move(func);
+            return;
+        }
+        auto self = this->shared_from_this();
+        mqtt::optional<async_handler_t> next(std::move(func));
+        while (next) {
+            async_handler_t f = std::move(next.value());
+            next = mqtt::nullopt;
+
+            char const* b = bulk_read_buf_.data() + bulk_read_begin_;
+            std::size_t available = bulk_read_end_ - bulk_read_begin_;
+            if (available == 0) {
+                bulk_read_some(std::move(f));
+                return;
+            }
+
+            // decode fixed header and remaining length from the buffered bytes
+            std::size_t header_size = 1;
+            std::size_t remaining_length = 0;
+            std::size_t multiplier = 1;
+            while (true) {
+                if (header_size == available) {
+                    bulk_read_some(std::move(f));
+                    return;
+                }
+                auto byte = static_cast<std::uint8_t>(b[header_size++]);
+                remaining_length += (byte & 0b01111111) * multiplier;
+                multiplier *= 128;
+                if (!(byte & 0b10000000)) break;
+                if (multiplier == 128 * 128 * 128 * 128) {
+                    handle_error(boost::system::errc::make_error_code(boost::system::errc::message_size));
+                    if (f) f(boost::system::errc::make_error_code(boost::system::errc::message_size));
+                    return;
+                }
+            }
+
+            fixed_header_ = static_cast<std::uint8_t>(b[0]);
+            remaining_length_ = remaining_length;
+            if (!check_maximum_packet_size_recv(f)) return;
+            if (!check_remaining_length()) {
+                handle_error(boost::system::errc::make_error_code(boost::system::errc::message_size));
+                if (f) f(boost::system::errc::make_error_code(boost::system::errc::message_size));
+                return;
+            }
+
+            if (available - header_size >= remaining_length_) {
+                payload_.assign(b + header_size, b + header_size + remaining_length_);
+                bulk_read_begin_ += header_size + remaining_length_;
+                next = bulk_read_handle_payload(std::move(f));
+                continue;
+            }
+
+            if (header_size + remaining_length_ <= bulk_read_buf_.size()) {
+                // The rest of the message fits in the buffer.
+                bulk_read_some(std::move(f));
+                return;
+            }
+
+            // The message is larger than the buffer. Read the rest of it directly into payload_.
+            std::size_t copied = available - header_size;
+            payload_.resize(remaining_length_);
+            std::copy(b + header_size, b + available, payload_.begin());
+            bulk_read_begin_ = bulk_read_end_ = 0;
+            traffic_.read_call();
+            async_read(
+                *socket_,
+                as::buffer(payload_.data() + copied, remaining_length_ - copied),
+                [self, func = std::move(f), expected = remaining_length_ - copied](
+                    boost::system::error_code const& ec,
+                    std::size_t bytes_transferred) mutable {
+                    if (self->handle_close_or_error(ec)) {
+                        self->payload_.clear();
+                        if (func) func(ec);
+                        return;
+                    }
+                    if (bytes_transferred != expected) {
+                        self->payload_.clear();
+                        self->handle_error(boost::system::errc::make_error_code(boost::system::errc::message_size));
+                        if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
+                        return;
+                    }
+                    if (auto next = self->bulk_read_handle_payload(std::move(func))) {
+                        self->bulk_read_next_message(std::move(next.value()));
+                    }
+                }
+            );
+            return;
+        }
+    }
+
+    mqtt::optional<async_handler_t> bulk_read_handle_payload(async_handler_t func) {
+        bulk_read_processing_ = true;
+        handle_payload(std::move(func));
+        bulk_read_processing_ = false;
+        payload_.clear();
+        mqtt::optional<async_handler_t> next;
+        std::swap(next, bulk_read_next_);
+        return next;
+    }
+
+    void bulk_read_some(async_handler_t func) {
+        std::size_t available = bulk_read_end_ - bulk_read_begin_;
+        if (bulk_read_buf_.size() < bulk_read_buffer_size_) {
+            bulk_read_buf_.resize(bulk_read_buffer_size_);
+        }
+        // 5 bytes are enough to decode any fixed header and remaining length.
+        if (bulk_read_buf_.size() < 5) {
+            bulk_read_buf_.resize(5);
+        }
+        if (bulk_read_begin_ != 0) {
+            std::copy(
+                bulk_read_buf_.begin() + static_cast<std::ptrdiff_t>(bulk_read_begin_),
+                bulk_read_buf_.begin() + static_cast<std::ptrdiff_t>(bulk_read_end_),
+                bulk_read_buf_.begin());
+            bulk_read_begin_ = 0;
+            bulk_read_end_ = available;
+        }
+        traffic_.read_call();
+        async_read_some(
+            *socket_,
+            as::buffer(bulk_read_buf_.data() + bulk_read_end_, bulk_read_buf_.size() - bulk_read_end_),
+            [self = this->shared_from_this(), func = std::move(func)](
+                boost::system::error_code const& ec,
+                std::size_t bytes_transferred) mutable {
+                if (self->handle_close_or_error(ec)) {
+                    if (func) func(ec);
+                    return;
+                }
+                self->bulk_read_end_ += bytes_transferred;
+                self->bulk_read_next_message(std::move(func));
+            }
+        );
+    }
+
     void handle_payload(async_handler_t func) {
+        latency_.receive_begin();
+        if (keep_alive_) keep_alive_->touch();
         auto control_packet_type = get_control_packet_type(fixed_header_);
+        traffic_.received(control_packet_type, 1 + remaining_length_size(remaining_length_) + remaining_length_);
         bool ret = false;
         switch (control_packet_type) {
         case control_packet_type::connect:
@@ -8373,6 +8932,7 @@ private:
         default:
             break;
         }
+        latency_.receive_end(control_packet_type);
         if (ret) {
             h_mqtt_message_processed_(std::move(func));
         }
@@ -8381,6 +8941,219 @@ private:
         }
     }
 
+    // Record the time from the message is stored to it is acknowledged. store_mtx_ needs to be locked.
+    void record_ack_latency(packet_id_t packet_id, std::uint8_t type) {
+        if (!latency_.enabled()) return;
+        if (auto e = store_.find(packet_id, type)) {
+            latency_.record(latency_kind::ack, type, *e);
+        }
+    }
+
+    // Return the value of the last Property in props.
+    template <typename Property>
+    static auto find_property(std::vector<v5::property_variant> const& props)
+        -> mqtt::optional<decltype(std::declval<Property const&>().val())> {
+        mqtt::optional<decltype(std::declval<Property const&>().val())> ret;
+        for (auto const& p : props) {
+            mqtt::visit(
+                make_lambda_visitor<void>(
+                    [&](Property const& t) {
+                        ret = t.val();
+                    },
+                    [](auto const&) {}
+                ),
+                p
+            );
+        }
+        return ret;
+    }
+
+    // Start the flow control of sending PUBLISH by the Receive Maximum of the peer.
+    // The messages resent on CONNACK consume the quota after this.
+    // If the Receive Maximum is 0, send DISCONNECT with protocol_error and return false.
+    bool start_publish_send_quota(std::vector<v5::property_variant> const& props, async_handler_t const& func) {
+        // If the property is absent, the value is 65,535. A value of 0 is a Protocol Error.
+        // See MQTT v5 3.1.2.11.3 and 3.2.2.3.3.
+        auto max = find_property<v5::property::receive_maximum>(props).value_or(0xffff);
+        if (version_ == protocol_version::v5 && max == 0) {
+            disconnect_by_protocol_error(v5::reason_code::protocol_error, func);
+            return false;
+        }
+        LockGuard<Mutex> lck (store_mtx_);
+        if (version_ == protocol_version::v5) publish_send_max_ = max;
+        publish_send_count_ = 0;
+        // The queued messages are in store_. They are resent as stored messages.
+        publish_send_queue_.clear();
+        return true;
+    }
+
+    // Called when PUBACK, PUBCOMP or PUBREC with an error reason code is received. The released quota is used by the queued message if exists.
+    void release_publish_send_quota() {
+        while (true) {
+            std::function<bool()> next;
+            {
+                LockGuard<Mutex> lck (store_mtx_);
+                if (publish_send_queue_.empty()) {
+                    if (publish_send_count_ != 0) --publish_send_count_;
+                    return;
+                }
+                next = std::move(publish_send_queue_.front());
+                publish_send_queue_.pop_front();
+            }
+            // The queued message that is not sent passes the quota to the next one.
+            if (next()) return;
+        }
+    }
+
+    // Resend the stored PUBLISH that waited for the quota after CONNACK. The Message Expiry Interval
+    // is rewritten to the remaining interval. If the message has expired, it is discarded and false is returned.
+    bool resend_queued_publish(packet_id_t packet_id, std::uint8_t type) {
+        mqtt::optional<basic_message_variant<PacketIdBytes>> msg;
+        {
+            LockGuard<Mutex> lck (store_mtx_);
+            auto e = store_.find(packet_id, type);
+            if (!e) return false;
+            auto now = std::chrono::steady_clock::now();
+            if (e->expired(now)) {
+                store_.erase(packet_id);
+                packet_id_.erase(packet_id);
+                traffic_.store_size(store_.size());
+            }
+            else {
+                msg.emplace(e->message(now));
+            }
+        }
+        if (!msg) {
+            if (h_serialize_remove_) h_serialize_remove_(packet_id);
+            return false;
+        }
+        do_sync_write(*msg);
+        return true;
+    }
+
+    // Record the Receive Maximum that is sent by CONNECT or CONNACK.
+    // A Receive Maximum of 0 is a Protocol Error, so throw protocol_error before sending it.
+    void start_publish_recv_quota(std::vector<v5::property_variant> const& props) {
+        LockGuard<Mutex> lck (store_mtx_);
+        if (version_ == protocol_version::v5) {
+            auto max = find_property<v5::property::receive_maximum>(props).value_or(0xffff);
+            if (max == 0) throw protocol_error();
+            publish_recv_max_ = max;
+        }
+        publish_recv_.clear();
+    }
+
+    // Record the received QoS1 or QoS2 PUBLISH. If the peer exceeds the Receive Maximum, send DISCONNECT
+    // with receive_maximum_exceeded (MQTT v5 3.3.4) and return false.
+    bool acquire_publish_recv_quota(packet_id_t packet_id, async_handler_t const& func) {
+        if (version_ != protocol_version::v5) return true;
+        {
+            LockGuard<Mutex> lck (store_mtx_);
+            publish_recv_.insert(packet_id);
+            if (publish_recv_.size() <= publish_recv_max_) return true;
+        }
+        disconnect_by_protocol_error(v5::reason_code::receive_maximum_exceeded, func);
+        return false;
+    }
+
+    // Send DISCONNECT with the reason code and report protocol_error.
+    void disconnect_by_protocol_error(std::uint8_t reason_code, async_handler_t const& func) {
+        if (connected_) {
+            if (auto_pub_response_async_) {
+                async_send_disconnect(reason_code, {}, async_handler_t());
+            }
+            else {
+                send_disconnect(reason_code);
+            }
+        }
+        if (func) func(boost::system::errc::make_error_code(boost::system::errc::protocol_error));
+    }
+
+    void release_publish_recv_quota(packet_id_t packet_id) {
+        if (version_ != protocol_version::v5) return;
+        LockGuard<Mutex> lck (store_mtx_);
+        publish_recv_.erase(packet_id);
+    }
+
+    // Start topic alias of sending PUBLISH by the Topic Alias Maximum of the peer.
+    // If the property is absent, topic alias is not used. See MQTT v5 3.1.2.11.5 and 3.2.2.3.8.
+    void start_topic_alias_send(std::vector<v5::property_variant> const& props) {
+        LockGuard<Mutex> lck (store_mtx_);
+        topic_alias_send_.reset(find_property<v5::property::topic_alias_maximum>(props).value_or(0));
+    }
+
+    // Record the Topic Alias Maximum that is sent by CONNECT or CONNACK.
+    void start_topic_alias_recv(std::vector<v5::property_variant> const& props) {
+        topic_alias_recv_.reset(find_property<v5::property::topic_alias_maximum>(props).value_or(0));
+    }
+
+    // Start the size limit of sending packets by the Maximum Packet Size of the peer.
+    // 0 is not allowed by the spec, and it is treated as no limit.
+    void start_maximum_packet_size_send(std::vector<v5::property_variant> const& props) {
+        LockGuard<Mutex> lck (store_mtx_);
+        auto size = find_property<v5::property::maximum_packet_size>(props).value_or(0);
+        maximum_packet_size_send_ = size == 0 ? packet_size_no_limit : size;
+    }
+
+    // Advertise the maximum packet size of this endpoint by CONNECT or CONNACK.
+    void start_maximum_packet_size_recv(std::vector<v5::property_variant>& props) {
+        if (auto size = find_property<v5::property::maximum_packet_size>(props)) {
+            if (*size != 0) maximum_packet_size_recv_ = *size;
+        }
+        else if (maximum_packet_size_recv_ < packet_size_no_limit) {
+            props.emplace_back(v5::property::maximum_packet_size(static_cast<std::uint32_t>(maximum_packet_size_recv_)));
+        }
+    }
+
+    // Start the Keep Alive check of the client. See MQTT v5 3.1.2.10.
+    // The entry is shared with the keep_alive_service, and the reads only update its time.
+    void start_keep_alive(std::uint16_t keep_alive_sec) {
+        stop_keep_alive();
+        keep_alive_timed_out_ = false;
+        if (!keep_alive_service_ || keep_alive_sec == 0) return;
+        std::weak_ptr<this_type> wp = this->shared_from_this();
+        keep_alive_ = keep_alive_service_->start(
+            std::chrono::milliseconds(keep_alive_sec * 1500),
+            [wp] {
+                auto self = wp.lock();
+                if (!self) return;
+                self->socket_->post(
+                    [self] {
+                        if (!self->connected_) return;
+                        self->keep_alive_timed_out_ = true;
+                        self->force_disconnect();
+                    }
+                );
+            }
+        );
+    }
+
+    // The Server Keep Alive of CONNACK replaces the Keep Alive of CONNECT. See MQTT v5 3.2.2.3.14.
+    void start_server_keep_alive(std::vector<v5::property_variant> const& props) {
+        if (!keep_alive_service_) return;
+        if (auto keep_alive_sec = find_property<v5::property::server_keep_alive>(props)) {
+            start_keep_alive(*keep_alive_sec);
+        }
+    }
+
+    void stop_keep_alive() {
+        if (!keep_alive_) return;
+        keep_alive_service_->stop(*keep_alive_);
+        keep_alive_.reset();
+    }
+
+    // Check the message against the Maximum Packet Size of the peer. If it is too large,
+    // the message is not sent and the packet id is released. See MQTT v5 3.1.2.11.4 and 3.2.2.3.6.
+    template <typename Message>
+    bool check_maximum_packet_size_send(Message const& msg) {
+        LockGuard<Mutex> lck (store_mtx_);
+        if (msg.size() <= maximum_packet_size_send_) return true;
+        if (msg.qos() == qos::at_least_once || msg.qos() == qos::exactly_once) {
+            packet_id_.erase(msg.packet_id());
+        }
+        return false;
+    }
+
     bool handle_connect(async_handler_t const& func) {
         std::size_t i = 0;
         if (remaining_length_ < 10 || // *1
@@ -8547,17 +9320,23 @@ private:
             password = std::string(payload_.data() + i, password_length);
             i += password_length;
         }
+        if (!start_publish_send_quota(props, func)) return false;
         mqtt_connected_ = true;
 
         if (clean_session_) {
             LockGuard<Mutex> lck (store_mtx_);
             store_.clear();
+            traffic_.store_size(store_.size());
             packet_id_.clear();
         }
+        start_topic_alias_send(props);
+        start_maximum_packet_size_send(props);
+        start_keep_alive(keep_alive);
 
         switch (version_) {
         case protocol_version::v3_1_1:
             if (h_connect_) {
+                latency_.handler_begin();
                 if (h_connect_(
                         client_id,
                         user_name,
@@ -8573,6 +9352,7 @@ private:
             break;
         case protocol_version::v5:
             if (h_v5_connect_) {
+                latency_.handler_begin();
                 if (h_v5_connect_(
                         client_id,
                         user_name,
@@ -8605,26 +9385,82 @@ private:
             if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
             return false;
         }
+        std::vector<v5::property_variant> props;
+        if (version_ == protocol_version::v5) {
+            char const* b = payload_.data() + 2;
+            char const* it = b;
+            char const* e = b + payload_.size() - 2;
+            if (auto props_opt = v5::property::parse_with_length(it, e)) {
+                props = std::move(*props_opt);
+            }
+            else {
+                if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
+                return false;
+            }
+        }
+
+        if (!start_publish_send_quota(props, func)) return false;
+        // The resent messages are limited by the Maximum Packet Size of the CONNACK.
+        start_maximum_packet_size_send(props);
+        // The stored PUBLISH messages that have expired or exceed the Maximum Packet Size are not resent.
+        std::vector<packet_id_t> discarded;
         if (static_cast<std::uint8_t>(payload_[1]) == connect_return_code::accepted) {
             if (clean_session_) {
                 LockGuard<Mutex> lck (store_mtx_);
                 store_.clear();
+                traffic_.store_size(store_.size());
                 packet_id_.clear();
             }
             else {
                 LockGuard<Mutex> lck (store_mtx_);
-                auto& idx = store_.template get<tag_seq>();
-                for (auto const& e : idx) {
-                    do_sync_write(e.message());
+                auto now = std::chrono::steady_clock::now();
+                store_.for_each(
+                    [&](store const& e) {
+                        if (e.expired(now)) {
+                            discarded.push_back(e.packet_id());
+                            return;
+                        }
+                        // The resent PUBLISH consumes the quota too. PUBREL is always resent,
+                        // and the message waiting for PUBCOMP is counted. See MQTT v5 4.9.
+                        bool publish = e.expected_control_packet_type() != control_packet_type::pubcomp;
+                        auto msg = e.message(now);
+                        // See MQTT v5 3.1.2.11.4 and 3.2.2.3.6.
+                        if (publish && mqtt::size(msg) > maximum_packet_size_send_) {
+                            discarded.push_back(e.packet_id());
+                            return;
+                        }
+                        if (publish && publish_send_count_ >= publish_send_max_) {
+                            // The message is looked up again when it is sent, so that the
+                            // Message Expiry Interval is rewritten at that time.
+                            publish_send_queue_.emplace_back(
+                                [this, packet_id = e.packet_id(), type = e.expected_control_packet_type()] {
+                                    return resend_queued_publish(packet_id, type);
+                                }
+                            );
+                            return;
+                        }
+                        ++publish_send_count_;
+                        do_sync_write(msg);
+                    }
+                );
+                for (auto packet_id : discarded) {
+                    store_.erase(packet_id);
+                    packet_id_.erase(packet_id);
                 }
+                traffic_.store_size(store_.size());
             }
         }
+        if (h_serialize_remove_) {
+            for (auto packet_id : discarded) h_serialize_remove_(packet_id);
+        }
+        start_topic_alias_send(props);
         bool session_present = is_session_present(payload_[0]);
         mqtt_connected_ = true;
 
         switch (version_) {
         case protocol_version::v3_1_1:
             if (h_connack_) {
+                latency_.handler_begin();
                 return
                     h_connack_(
                         session_present,
@@ -8634,17 +9470,7 @@ private:
             break;
         case protocol_version::v5:
             if (h_v5_connack_) {
-                std::vector<v5::property_variant> props;
-                char const* b = payload_.data() + 2;
-                char const* it = b;
-                char const* e = b + payload_.size() - 2;
-                if (auto props_opt = v5::property::parse_with_length(it, e)) {
-                    props = std::move(*props_opt);
-                }
-                else {
-                    if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-                    return false;
-                }
+                latency_.handler_begin();
                 return
                     h_v5_connack_(
                         session_present,
@@ -8682,41 +9508,119 @@ private:
             if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
             return false;
         }
-        std::string topic_name(payload_.data() + i, topic_name_length);
+        string_view topic_name(payload_.data() + i, topic_name_length);
         if (utf8string::validate_contents(topic_name) != utf8string::validation::well_formed) {
             if (func) func(boost::system::errc::make_error_code(boost::system::errc::bad_message));
             return false;
         }
+        std::size_t topic_name_position = i;
         i += topic_name_length;
 
         mqtt::optional<packet_id_t> packet_id;
         auto qos = publish::get_qos(fixed_header_);
 
+        // v5 properties and the topic name that is resolved by the Topic Alias.
+        // They are resolved even if no handler is set, so that the inbound aliases are
+        // registered and the invalid ones are rejected.
+        mqtt::optional<v5::property_view> props;
+        std::shared_ptr<std::string> aliased_topic_name;
+        auto resolve_v5 =
+            [&] {
+                if (version_ != protocol_version::v5) return true;
+                // The properties are not decoded here. Only the Topic Alias is looked up.
+                std::size_t consumed = 0;
+                props = v5::property::parse_view_with_length(payload_.share().substr(i), consumed);
+                if (!props) {
+                    if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
+                    return false;
+                }
+                i += consumed;
+
+                // Resolve the topic alias and remove it from the properties. See MQTT v5 3.3.2.3.4.
+                // If this endpoint doesn't send Topic Alias Maximum, the topic alias of a non empty
+                // topic name is passed to the handler as is, and an empty topic name is a Protocol Error.
+                auto alias = props->find<v5::property::topic_alias>();
+                if (topic_alias_recv_.max() == 0) {
+                    if (topic_name.empty()) {
+                        disconnect_by_protocol_error(
+                            alias ? v5::reason_code::topic_alias_invalid : v5::reason_code::protocol_error,
+                            func
+                        );
+                        return false;
+                    }
+                    return true;
+                }
+                if (alias) {
+                    aliased_topic_name =
+                        topic_name.empty() ? topic_alias_recv_.find(alias->val())
+                                           : topic_alias_recv_.insert_or_update(alias->val(), topic_name);
+                    if (!aliased_topic_name) {
+                        disconnect_by_protocol_error(v5::reason_code::topic_alias_invalid, func);
+                        return false;
+                    }
+                    props->hide(v5::property::id::topic_alias);
+                }
+                else if (topic_name.empty()) {
+                    disconnect_by_protocol_error(v5::reason_code::protocol_error, func);
+                    return false;
+                }
+                return true;
+            };
+
+        auto has_handler =
+            [&] {
+                switch (version_) {
+                case protocol_version::v3_1_1:
+                    return h_publish_view_ || h_publish_;
+                case protocol_version::v5:
+                    return h_v5_publish_view_ || h_v5_publish_;
+                default:
+                    BOOST_ASSERT(false);
+                    return false;
+                }
+            };
+
         auto handler_call =
             [&] {
                 switch (version_) {
                 case protocol_version::v3_1_1:
+                    if (h_publish_view_) {
+                        auto payload = payload_.share();
+                        latency_.handler_begin();
+                        return h_publish_view_(
+                            fixed_header_,
+                            packet_id,
+                            payload.substr(topic_name_position, topic_name_length),
+                            payload.substr(i));
+                    }
                     if (h_publish_) {
                         std::string contents(payload_.data() + i, payload_.size() - i);
-                        return h_publish_(fixed_header_, packet_id, std::move(topic_name), std::move(contents));
+                        latency_.handler_begin();
+                        return h_publish_(fixed_header_, packet_id, std::string(topic_name.data(), topic_name.size()), std::move(contents));
                     }
                     break;
                 case protocol_version::v5:
-                    if (h_v5_publish_) {
-                        std::vector<v5::property_variant> props;
-                        char const* b = payload_.data() + i;
-                        char const* it = b;
-                        char const* e = b + payload_.size() - i;
-                        if (auto props_opt = v5::property::parse_with_length(it, e)) {
-                            props = std::move(*props_opt);
-                        }
-                        else {
-                            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-                            return false;
+                    if (h_v5_publish_view_ || h_v5_publish_) {
+                        auto payload = payload_.share();
+                        if (h_v5_publish_view_) {
+                            latency_.handler_begin();
+                            return h_v5_publish_view_(
+                                fixed_header_,
+                                packet_id,
+                                topic_name.empty()
+                                    ? buffer(string_view(*aliased_topic_name), aliased_topic_name)
+                                    : payload.substr(topic_name_position, topic_name_length),
+                                payload.substr(i),
+                                std::move(*props));
                         }
-                        i += static_cast<std::size_t>(std::distance(b, it));
                         std::string contents(payload_.data() + i, payload_.size() - i);
-                        return h_v5_publish_(fixed_header_, packet_id, std::move(topic_name), std::move(contents), std::move(props));
+                        latency_.handler_begin();
+                        return h_v5_publish_(
+                            fixed_header_,
+                            packet_id,
+                            topic_name.empty() ? *aliased_topic_name : std::string(topic_name.data(), topic_name.size()),
+                            std::move(contents),
+                            props->to_vector());
                     }
                     break;
                 default:
@@ -8728,6 +9632,7 @@ private:
 
         switch (qos) {
         case qos::at_most_once:
+            if (!resolve_v5()) return false;
             return handler_call();
         case qos::at_least_once: {
             if (remaining_length_ < i + sizeof(packet_id_t)) {
@@ -8739,6 +9644,8 @@ private:
                 payload_.data() + i + sizeof(packet_id_t)
             );
             i += sizeof(packet_id_t);
+            if (!resolve_v5()) return false;
+            if (!acquire_publish_recv_quota(*packet_id, func)) return false;
             auto res = [this, &packet_id, &func] {
                 auto_pub_response(
                     [this, &packet_id] {
@@ -8765,6 +9672,8 @@ private:
                 payload_.data() + i + sizeof(packet_id_t)
             );
             i += sizeof(packet_id_t);
+            if (!resolve_v5()) return false;
+            if (!acquire_publish_recv_quota(*packet_id, func)) return false;
             auto res = [this, &packet_id, &func] {
                 auto_pub_response(
                     [this, &packet_id] {
@@ -8776,50 +9685,16 @@ private:
                 );
             };
 
-            switch (version_) {
-            case protocol_version::v3_1_1:
-                if (h_publish_) {
-                    auto it = qos2_publish_handled_.find(*packet_id);
-                    if (it == qos2_publish_handled_.end()) {
-                        std::string contents(payload_.data() + i, payload_.size() - i);
-                        if (h_publish_(fixed_header_, packet_id, std::move(topic_name), std::move(contents))) {
-                            qos2_publish_handled_.emplace(*packet_id);
-                            res();
-                            return true;
-                        }
-                        return false;
-                    }
-                }
-                break;
-            case protocol_version::v5:
-                if (h_v5_publish_) {
-                    auto it = qos2_publish_handled_.find(*packet_id);
-                    if (it == qos2_publish_handled_.end()) {
-                        std::vector<v5::property_variant> props;
-                        char const* b = payload_.data() + i;
-                        char const* it = b;
-                        char const* e = b + payload_.size() - i;
-                        if (auto props_opt = v5::property::parse_with_length(it, e)) {
-                            props = std::move(*props_opt);
-                        }
-                        else {
-                            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
-                            return false;
-                        }
-                        i += static_cast<std::size_t>(std::distance(b, it));
-                        std::string contents(payload_.data() + i, payload_.size() - i);
-                        if (h_v5_publish_(fixed_header_, packet_id, std::move(topic_name), std::move(contents), std::move(props))) {
-                            qos2_publish_handled_.emplace(*packet_id);
-                            res();
-                            return true;
-                        }
-                        return false;
+            if (has_handler()) {
+                auto it = qos2_publish_handled_.find(*packet_id);
+                if (it == qos2_publish_handled_.end()) {
+                    if (handler_call()) {
+                        qos2_publish_handled_.emplace(*packet_id);
+                        res();
+                        return true;
                     }
+                    return false;
                 }
-                break;
-            default:
-                BOOST_ASSERT(false);
-                return false;
             }
             res();
         } break;
@@ -8839,18 +9714,21 @@ private:
             payload_.data(),
             payload_.data() + sizeof(packet_id_t)
         );
+        bool erased;
         {
             LockGuard<Mutex> lck (store_mtx_);
-            auto& idx = store_.template get<tag_packet_id_type>();
-            auto r = idx.equal_range(std::make_tuple(packet_id, control_packet_type::puback));
-            idx.erase(std::get<0>(r), std::get<1>(r));
+            record_ack_latency(packet_id, control_packet_type::puback);
+            erased = store_.erase(packet_id, control_packet_type::puback) != 0;
+            traffic_.store_size(store_.size());
             packet_id_.erase(packet_id);
         }
+        if (erased) release_publish_send_quota();
         if (h_serialize_remove_) h_serialize_remove_(packet_id);
 
         switch (version_) {
         case protocol_version::v3_1_1:
             if (h_puback_) {
+                latency_.handler_begin();
                 return h_puback_(packet_id);
             }
             break;
@@ -8859,6 +9737,7 @@ private:
                 std::vector<v5::property_variant> props;
 
                 if (remaining_length_ == sizeof(packet_id_t)) {
+                    latency_.handler_begin();
                     return h_v5_puback_(packet_id, v5::reason_code::success, std::move(props));
                 }
 
@@ -8872,6 +9751,7 @@ private:
                     if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
                     return false;
                 }
+                latency_.handler_begin();
                 return h_v5_puback_(packet_id, static_cast<std::uint8_t>(payload_[sizeof(packet_id_t)]), std::move(props));
             }
             break;
@@ -8892,15 +9772,28 @@ private:
             payload_.data(),
             payload_.data() + sizeof(packet_id_t)
         );
+        // PUBREC with a reason code 0x80 or greater ends the QoS2 flow. PUBREL is not sent,
+        // and the packet id and the send quota are released. See MQTT v5 4.3.3 and 4.9.
+        bool error =
+            version_ == protocol_version::v5 &&
+            remaining_length_ > sizeof(packet_id_t) &&
+            static_cast<std::uint8_t>(payload_[sizeof(packet_id_t)]) >= 0x80;
+        bool erased;
         {
             LockGuard<Mutex> lck (store_mtx_);
-            auto& idx = store_.template get<tag_packet_id_type>();
-            auto r = idx.equal_range(std::make_tuple(packet_id, control_packet_type::pubrec));
-            idx.erase(std::get<0>(r), std::get<1>(r));
+            record_ack_latency(packet_id, control_packet_type::pubrec);
+            erased = store_.erase(packet_id, control_packet_type::pubrec) != 0;
+            traffic_.store_size(store_.size());
             // packet_id shouldn't be erased here.
             // It is reused for pubrel/pubcomp.
+            if (error) packet_id_.erase(packet_id);
         }
-        auto res = [this, &packet_id, &func] {
+        if (error) {
+            if (erased) release_publish_send_quota();
+            if (h_serialize_remove_) h_serialize_remove_(packet_id);
+        }
+        auto res = [this, &packet_id, &func, error] {
+            if (error) return;
             auto_pub_response(
                 [this, &packet_id] {
                     if (connected_) send_pubrel(packet_id);
@@ -8916,6 +9809,7 @@ private:
         switch (version_) {
         case protocol_version::v3_1_1:
             if (h_pubrec_) {
+                latency_.handler_begin();
                 if (h_pubrec_(packet_id)) {
                     res();
                     return true;
@@ -8928,6 +9822,7 @@ private:
                 std::vector<v5::property_variant> props;
 
                 if (remaining_length_ == sizeof(packet_id_t)) {
+                    latency_.handler_begin();
                     if (h_v5_pubrec_(packet_id, v5::reason_code::success, std::move(props))) {
                         res();
                         return true;
@@ -8945,6 +9840,7 @@ private:
                     if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
                     return false;
                 }
+                latency_.handler_begin();
                 if (h_v5_pubrec_(packet_id, static_cast<std::uint8_t>(payload_[sizeof(packet_id_t)]), std::move(props))) {
                     res();
                     return true;
@@ -8984,6 +9880,7 @@ private:
         switch (version_) {
         case protocol_version::v3_1_1:
             if (h_pubrel_) {
+                latency_.handler_begin();
                 if (h_pubrel_(packet_id)) {
                     res();
                     return true;
@@ -8996,6 +9893,7 @@ private:
                 std::vector<v5::property_variant> props;
 
                 if (remaining_length_ == sizeof(packet_id_t)) {
+                    latency_.handler_begin();
                     if (h_v5_pubrel_(packet_id, v5::reason_code::success, std::move(props))) {
                         res();
                         return true;
@@ -9013,6 +9911,7 @@ private:
                     if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
                     return false;
                 }
+                latency_.handler_begin();
                 if (h_v5_pubrel_(packet_id, static_cast<std::uint8_t>(payload_[sizeof(packet_id_t)]), std::move(props))) {
                     res();
                     return true;
@@ -9038,17 +9937,20 @@ private:
             payload_.data(),
             payload_.data() + sizeof(packet_id_t)
         );
+        bool erased;
         {
             LockGuard<Mutex> lck (store_mtx_);
-            auto& idx = store_.template get<tag_packet_id_type>();
-            auto r = idx.equal_range(std::make_tuple(packet_id, control_packet_type::pubcomp));
-            idx.erase(std::get<0>(r), std::get<1>(r));
+            record_ack_latency(packet_id, control_packet_type::pubcomp);
+            erased = store_.erase(packet_id, control_packet_type::pubcomp) != 0;
+            traffic_.store_size(store_.size());
             packet_id_.erase(packet_id);
         }
+        if (erased) release_publish_send_quota();
         if (h_serialize_remove_) h_serialize_remove_(packet_id);
         switch (version_) {
         case protocol_version::v3_1_1:
             if (h_pubcomp_) {
+                latency_.handler_begin();
                 return h_pubcomp_(packet_id);
             }
             break;
@@ -9057,6 +9959,7 @@ private:
                 std::vector<v5::property_variant> props;
 
                 if (remaining_length_ == sizeof(packet_id_t)) {
+                    latency_.handler_begin();
                     return h_v5_pubcomp_(packet_id, v5::reason_code::success, std::move(props));
                 }
 
@@ -9070,6 +9973,7 @@ private:
                     if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
                     return false;
                 }
+                latency_.handler_begin();
                 return h_v5_pubcomp_(packet_id, static_cast<std::uint8_t>(payload_[sizeof(packet_id_t)]), std::move(props));
             }
             break;
@@ -9127,6 +10031,7 @@ private:
                 entries.emplace_back(std::move(topic_filter), options);
                 ++i;
             }
+            latency_.handler_begin();
             if (h_subscribe_) return h_subscribe_(packet_id, std::move(entries));
         } break;
         case protocol_version::v5: {
@@ -9176,6 +10081,7 @@ private:
                 entries.emplace_back(std::move(topic_filter), options);
                 ++i;
             }
+            latency_.handler_begin();
             if (h_v5_subscribe_) return h_v5_subscribe_(packet_id, std::move(entries), std::move(props));
         } break;
         default:
@@ -9230,6 +10136,7 @@ private:
                     results.push_back(static_cast<std::uint8_t>(*it));
                 }
             }
+            latency_.handler_begin();
             if (h_suback_) return h_suback_(packet_id, std::move(results));
         } break;
         case protocol_version::v5: {
@@ -9238,6 +10145,7 @@ private:
             auto it = payload_.cbegin() + static_cast<std::vector<char>::difference_type>(i);
             auto end = payload_.cend();
             std::copy(it, end, std::back_inserter(reasons));
+            latency_.handler_begin();
             if (h_v5_suback_) return h_v5_suback_(packet_id, std::move(reasons), std::move(props));
         } break;
         default:
@@ -9298,9 +10206,11 @@ private:
 
         switch (version_) {
         case protocol_version::v3_1_1:
+            latency_.handler_begin();
             if (h_unsubscribe_) return h_unsubscribe_(packet_id, std::move(topic_filters));
             break;
         case protocol_version::v5:
+            latency_.handler_begin();
             if (h_v5_unsubscribe_) return h_v5_unsubscribe_(packet_id, std::move(topic_filters), std::move(props));
             break;
         default:
@@ -9329,6 +10239,7 @@ private:
 
         switch (version_) {
         case protocol_version::v3_1_1:
+            latency_.handler_begin();
             if (h_unsuback_) return h_unsuback_(packet_id);
             break;
         case protocol_version::v5: {
@@ -9353,6 +10264,7 @@ private:
                 auto end = payload_.cend();
                 std::copy(it, end, std::back_inserter(reasons));
             }
+            latency_.handler_begin();
             if (h_v5_unsuback_) return h_v5_unsuback_(packet_id, std::move(reasons), std::move(props));
         } break;
         default:
@@ -9363,11 +10275,13 @@ private:
     }
 
     bool handle_pingreq(async_handler_t const& /*func*/) {
+        latency_.handler_begin();
         if (h_pingreq_) return h_pingreq_();
         return true;
     }
 
     bool handle_pingresp(async_handler_t const& /*func*/) {
+        latency_.handler_begin();
         if (h_pingresp_) return h_pingresp_();
         return true;
     }
@@ -9375,12 +10289,14 @@ private:
     void handle_disconnect(async_handler_t const& func) {
         switch (version_) {
         case protocol_version::v3_1_1:
+            latency_.handler_begin();
             if (h_disconnect_) h_disconnect_();
             break;
         case protocol_version::v5: {
             std::size_t i = 0;
             std::vector<v5::property_variant> props;
             if (remaining_length_ < 1) {
+                latency_.handler_begin();
                 if (h_v5_disconnect_) h_v5_disconnect_(v5::reason_code::normal_disconnection, std::move(props));
                 return;
             }
@@ -9399,6 +10315,7 @@ private:
                 return;
             }
 
+            latency_.handler_begin();
             if (h_v5_disconnect_) h_v5_disconnect_(reason, std::move(props));
         } break;
         default:
@@ -9415,6 +10332,7 @@ private:
             std::size_t i = 0;
             std::vector<v5::property_variant> props;
             if (remaining_length_ < 1) {
+                latency_.handler_begin();
                 if (h_v5_auth_) h_v5_auth_(v5::reason_code::success, std::move(props));
                 return true;
             }
@@ -9433,6 +10351,7 @@ private:
                 return false;
             }
 
+            latency_.handler_begin();
             if (h_v5_auth_) return h_v5_auth_(reason, std::move(props));
         } break;
         default:
@@ -9465,6 +10384,9 @@ private:
             );
             break;
         case protocol_version::v5:
+            start_publish_recv_quota(props);
+            start_topic_alias_recv(props);
+            start_maximum_packet_size_recv(props);
             do_sync_write(
                 v5::connect_message(
                     keep_alive_sec,
@@ -9498,6 +10420,10 @@ private:
             );
             break;
         case protocol_version::v5:
+            start_publish_recv_quota(props);
+            start_topic_alias_recv(props);
+            start_maximum_packet_size_recv(props);
+            start_server_keep_alive(props);
             do_sync_write(
                 v5::connack_message(
                     session_present,
@@ -9512,7 +10438,7 @@ private:
         }
     }
 
-    void send_publish(
+    bool send_publish(
         as::const_buffer topic_name,
         std::uint8_t qos,
         bool retain,
@@ -9522,41 +10448,9 @@ private:
         as::const_buffer payload,
         mqtt::any life_keeper) {
 
-        auto msg =
-            basic_publish_message<PacketIdBytes>(
-                topic_name,
-                qos,
-                retain,
-                dup,
-                packet_id,
-                payload
-            );
-
-        auto do_send_publish =
-            [&](auto msg, auto const& serialize_publish) {
-
-                if (qos == qos::at_least_once || qos == qos::exactly_once) {
-                    auto store_msg = msg;
-                    store_msg.set_dup(true);
-                    LockGuard<Mutex> lck (store_mtx_);
-                    store_.emplace(
-                        packet_id,
-                        qos == qos::at_least_once
-                         ? control_packet_type::puback
-                         : control_packet_type::pubrec,
-                        store_msg,
-                        std::move(life_keeper)
-                    );
-                    if (serialize_publish) {
-                        serialize_publish(store_msg);
-                    }
-                }
-                do_sync_write(msg);
-            };
-
         switch (version_) {
         case protocol_version::v3_1_1:
-            do_send_publish(
+            return send_publish_message(
                 v3_1_1::basic_publish_message<PacketIdBytes>(
                     topic_name,
                     qos,
@@ -9565,11 +10459,11 @@ private:
                     packet_id,
                     payload
                 ),
-                h_serialize_publish_
+                h_serialize_publish_,
+                std::move(life_keeper)
             );
-            break;
         case protocol_version::v5:
-            do_send_publish(
+            return send_publish_message(
                 v5::basic_publish_message<PacketIdBytes>(
                     topic_name,
                     qos,
@@ -9579,13 +10473,112 @@ private:
                     std::move(props),
                     payload
                 ),
-                h_serialize_v5_publish_
+                h_serialize_v5_publish_,
+                std::move(life_keeper)
             );
-            break;
         default:
             BOOST_ASSERT(false);
-            break;
+            return false;
+        }
+    }
+
+    bool send_publish(
+        std::shared_ptr<shared_publish const> body,
+        std::uint8_t qos,
+        bool retain,
+        bool dup,
+        packet_id_t packet_id) {
+
+        // body is moved to the life keeper. The message refers to the same object.
+        auto const& b = *body;
+        switch (version_) {
+        case protocol_version::v3_1_1:
+            return send_publish_message(
+                v3_1_1::basic_publish_message<PacketIdBytes>(b, qos, retain, dup, packet_id),
+                h_serialize_publish_,
+                std::move(body)
+            );
+        case protocol_version::v5:
+            return send_publish_message(
+                v5::basic_publish_message<PacketIdBytes>(b, qos, retain, dup, packet_id),
+                h_serialize_v5_publish_,
+                std::move(body)
+            );
+        default:
+            BOOST_ASSERT(false);
+            return false;
+        }
+    }
+
+    // Return false if the message is discarded by the Maximum Packet Size of the peer.
+    template <typename Message, typename SerializePublish>
+    bool send_publish_message(
+        Message msg,
+        SerializePublish const& serialize_publish,
+        mqtt::any life_keeper) {
+
+        // The message is discarded instead of closing the connection. The other messages, e.g. to the other
+        // subscribers of the broker, are not affected. See MQTT v5 3.1.2.11.4.
+        if (!check_maximum_packet_size_send(msg)) return false;
+
+        auto qos = msg.qos();
+        if (qos == qos::at_least_once || qos == qos::exactly_once) {
+            auto store_msg = msg;
+            store_msg.set_dup(true);
+            LockGuard<Mutex> lck (store_mtx_);
+            store_.insert(
+                store(
+                    msg.packet_id(),
+                    qos == qos::at_least_once
+                     ? control_packet_type::puback
+                     : control_packet_type::pubrec,
+                    store_msg,
+                    life_keeper
+                )
+            );
+            traffic_.store_size(store_.size());
+            if (serialize_publish) {
+                serialize_publish(store_msg);
+            }
+            if (publish_send_count_ >= publish_send_max_) {
+                // The message is sent when PUBACK or PUBCOMP releases the quota.
+                publish_send_queue_.emplace_back(
+                    [this, msg = std::move(msg), life_keeper = std::move(life_keeper)] () mutable {
+                        apply_topic_alias(msg);
+                        do_sync_write(msg);
+                        return true;
+                    }
+                );
+                return true;
+            }
+            ++publish_send_count_;
+        }
+        apply_topic_alias(msg);
+        do_sync_write(msg);
+        return true;
+    }
+
+    template <typename Message>
+    void apply_topic_alias(Message&) {
+    }
+
+    // Replace the topic name by the topic alias. It is applied just before writing,
+    // so the stored message keeps the topic name and the resent message doesn't depend on the aliases.
+    // The async senders apply it in the strand when the message is queued.
+    void apply_topic_alias(v5::basic_publish_message<PacketIdBytes>& msg) {
+        if (!auto_topic_alias_send_) return;
+        auto topic_name = msg.topic();
+        if (get_size(topic_name) == 0) return;
+        if (msg.has_topic_alias()) return;
+        std::pair<std::uint16_t, bool> ret;
+        {
+            LockGuard<Mutex> lck (store_mtx_);
+            // The topic alias property can make the message larger by 4 bytes at most.
+            if (msg.size() + 4 > maximum_packet_size_send_) return;
+            ret = topic_alias_send_.find_or_assign(string_view(get_pointer(topic_name), get_size(topic_name)));
         }
+        if (ret.first == 0) return;
+        msg.add_topic_alias(ret.first, !ret.second);
     }
 
     void send_puback(
@@ -9593,6 +10586,7 @@ private:
         mqtt::optional<std::uint8_t> reason = mqtt::nullopt,
         std::vector<v5::property_variant> props = {}
     ) {
+        release_publish_recv_quota(packet_id);
         switch (version_) {
         case protocol_version::v3_1_1:
             do_sync_write(v3_1_1::basic_puback_message<PacketIdBytes>(packet_id));
@@ -9613,6 +10607,8 @@ private:
         mqtt::optional<std::uint8_t> reason = mqtt::nullopt,
         std::vector<v5::property_variant> props = {}
     ) {
+        // PUBREC with an error reason code ends the QoS2 flow. See MQTT v5 4.9.
+        if (reason && *reason >= 0x80) release_publish_recv_quota(packet_id);
         switch (version_) {
         case protocol_version::v3_1_1:
             do_sync_write(v3_1_1::basic_pubrec_message<PacketIdBytes>(packet_id));
@@ -9640,12 +10636,16 @@ private:
                     // insert if not registerd (start from pubrel sending case)
                     packet_id_.insert(packet_id);
 
-                    auto ret = store_.emplace(
-                        packet_id,
-                        control_packet_type::pubcomp,
-                        msg
+                    auto ret = store_.insert(
+                        store(
+                            packet_id,
+                            control_packet_type::pubcomp,
+                            msg
+                        )
                     );
-                    BOOST_ASSERT(ret.second);
+                    traffic_.store_size(store_.size());
+                    BOOST_ASSERT(ret);
+                    static_cast<void>(ret);
                 }
 
                 if (serialize) {
@@ -9687,12 +10687,16 @@ private:
                     // insert if not registerd (start from pubrel sending case)
                     packet_id_.insert(packet_id);
 
-                    auto ret = store_.emplace(
-                        packet_id,
-                        control_packet_type::pubcomp,
-                        msg
+                    auto ret = store_.insert(
+                        store(
+                            packet_id,
+                            control_packet_type::pubcomp,
+                            msg
+                        )
                     );
-                    BOOST_ASSERT(ret.second);
+                    traffic_.store_size(store_.size());
+                    BOOST_ASSERT(ret);
+                    static_cast<void>(ret);
                 }
 
                 if (serialize) {
@@ -9724,6 +10728,7 @@ private:
         mqtt::optional<std::uint8_t> reason = mqtt::nullopt,
         std::vector<v5::property_variant> props = {}
     ) {
+        release_publish_recv_quota(packet_id);
         switch (version_) {
         case protocol_version::v3_1_1:
             do_sync_write(v3_1_1::basic_pubcomp_message<PacketIdBytes>(packet_id));
@@ -9965,8 +10970,17 @@ private:
         boost::system::error_code ec;
         if (!connected_) return;
         if (h_pre_send_) h_pre_send_();
-        write(*socket_, const_buffer_sequence<PacketIdBytes>(std::forward<MessageVariant>(mv)), ec);
-        if (ec) handle_error(ec);
+        latency_stamp write_start;
+        basic_message_variant<PacketIdBytes> const& v = std::forward<MessageVariant>(mv);
+        write(*socket_, const_buffer_sequence<PacketIdBytes>(v), ec);
+        if (ec) {
+            handle_error(ec);
+            return;
+        }
+        auto type = message_control_packet_type<PacketIdBytes>(v);
+        traffic_.write_batch();
+        traffic_.sent(type, mqtt::size<PacketIdBytes>(v));
+        latency_.record(latency_kind::write, type, write_start);
     }
 
     // Non blocking (async) senders
@@ -9997,6 +11011,9 @@ private:
             );
             break;
         case protocol_version::v5:
+            start_publish_recv_quota(props);
+            start_topic_alias_recv(props);
+            start_maximum_packet_size_recv(props);
             do_async_write(
                 v5::connect_message(
                     keep_alive_sec,
@@ -10033,6 +11050,10 @@ private:
             );
             break;
         case protocol_version::v5:
+            start_publish_recv_quota(props);
+            start_topic_alias_recv(props);
+            start_maximum_packet_size_recv(props);
+            start_server_keep_alive(props);
             do_async_write(
                 v5::connack_message(
                     session_present,
@@ -10059,38 +11080,9 @@ private:
         async_handler_t func,
         mqtt::any life_keeper) {
 
-        auto do_async_send_publish =
-            [&](auto msg, auto const& serialize_publish) {
-                if (qos == qos::at_least_once || qos == qos::exactly_once) {
-                    auto store_msg = msg;
-                    store_msg.set_dup(true);
-                    {
-                        LockGuard<Mutex> lck (store_mtx_);
-                        auto ret = store_.emplace(
-                            packet_id,
-                            qos == qos::at_least_once ? control_packet_type::puback
-                                                      : control_packet_type::pubrec,
-                            store_msg,
-                            life_keeper
-                        );
-                        BOOST_ASSERT(ret.second);
-                    }
-
-                    if (serialize_publish) {
-                        serialize_publish(store_msg);
-                    }
-                }
-                do_async_write(
-                    std::move(msg),
-                    [life_keeper = std::move(life_keeper), func = std::move(func)](boost::system::error_code const& ec) {
-                        if (func) func(ec);
-                    }
-                );
-            };
-
         switch (version_) {
         case protocol_version::v3_1_1:
-            do_async_send_publish(
+            async_send_publish_message(
                 v3_1_1::basic_publish_message<PacketIdBytes>(
                     topic_name,
                     qos,
@@ -10099,11 +11091,13 @@ private:
                     packet_id,
                     payload
                 ),
-                h_serialize_publish_
+                h_serialize_publish_,
+                std::move(func),
+                std::move(life_keeper)
             );
             break;
         case protocol_version::v5:
-            do_async_send_publish(
+            async_send_publish_message(
                 v5::basic_publish_message<PacketIdBytes>(
                     topic_name,
                     qos,
@@ -10113,7 +11107,9 @@ private:
                     std::move(props),
                     payload
                 ),
-                h_serialize_v5_publish_
+                h_serialize_v5_publish_,
+                std::move(func),
+                std::move(life_keeper)
             );
             break;
         default:
@@ -10122,12 +11118,110 @@ private:
         }
     }
 
+    void async_send_publish(
+        std::shared_ptr<shared_publish const> body,
+        std::uint8_t qos,
+        bool retain,
+        bool dup,
+        packet_id_t packet_id,
+        async_handler_t func) {
+
+        // body is moved to the life keeper. The message refers to the same object.
+        auto const& b = *body;
+        switch (version_) {
+        case protocol_version::v3_1_1:
+            async_send_publish_message(
+                v3_1_1::basic_publish_message<PacketIdBytes>(b, qos, retain, dup, packet_id),
+                h_serialize_publish_,
+                std::move(func),
+                std::move(body)
+            );
+            break;
+        case protocol_version::v5:
+            async_send_publish_message(
+                v5::basic_publish_message<PacketIdBytes>(b, qos, retain, dup, packet_id),
+                h_serialize_v5_publish_,
+                std::move(func),
+                std::move(body)
+            );
+            break;
+        default:
+            BOOST_ASSERT(false);
+            break;
+        }
+    }
+
+    template <typename Message, typename SerializePublish>
+    void async_send_publish_message(
+        Message msg,
+        SerializePublish const& serialize_publish,
+        async_handler_t func,
+        mqtt::any life_keeper) {
+
+        if (!check_maximum_packet_size_send(msg)) {
+            if (func) func(boost::system::errc::make_error_code(boost::system::errc::message_size));
+            return;
+        }
+
+        auto qos = msg.qos();
+        if (qos == qos::at_least_once || qos == qos::exactly_once) {
+            auto store_msg = msg;
+            store_msg.set_dup(true);
+            bool queued = false;
+            {
+                LockGuard<Mutex> lck (store_mtx_);
+                auto ret = store_.insert(
+                    store(
+                        msg.packet_id(),
+                        qos == qos::at_least_once ? control_packet_type::puback
+                                                  : control_packet_type::pubrec,
+                        store_msg,
+                        life_keeper
+                    )
+                );
+                traffic_.store_size(store_.size());
+                BOOST_ASSERT(ret);
+                static_cast<void>(ret);
+                if (publish_send_count_ >= publish_send_max_) {
+                    // The message is sent when PUBACK or PUBCOMP releases the quota.
+                    publish_send_queue_.emplace_back(
+                        [this, msg = std::move(msg), life_keeper = std::move(life_keeper), func = std::move(func)] () mutable {
+                            do_async_write(
+                                std::move(msg),
+                                [life_keeper, func](boost::system::error_code const& ec) {
+                                    if (func) func(ec);
+                                }
+                            );
+                            return true;
+                        }
+                    );
+                    queued = true;
+                }
+                else {
+                    ++publish_send_count_;
+                }
+            }
+
+            if (serialize_publish) {
+                serialize_publish(store_msg);
+            }
+            if (queued) return;
+        }
+        do_async_write(
+            std::move(msg),
+            [life_keeper = std::move(life_keeper), func = std::move(func)](boost::system::error_code const& ec) {
+                if (func) func(ec);
+            }
+        );
+    }
+
     void async_send_puback(
         packet_id_t packet_id,
         mqtt::optional<std::uint8_t> reason,
         std::vector<v5::property_variant> props,
         async_handler_t func
     ) {
+        release_publish_recv_quota(packet_id);
 
         auto impl =
             [&] (auto&& msg) {
@@ -10165,6 +11259,8 @@ private:
         std::vector<v5::property_variant> props,
         async_handler_t func
     ) {
+        // PUBREC with an error reason code ends the QoS2 flow. See MQTT v5 4.9.
+        if (reason && *reason >= 0x80) release_publish_recv_quota(packet_id);
         switch (version_) {
         case protocol_version::v3_1_1:
             do_async_write(
@@ -10201,29 +11297,20 @@ private:
                     // insert if not registerd (start from pubrel sending case)
                     packet_id_.insert(packet_id);
 
-                    auto ret = store_.emplace(
-                        packet_id,
-                        control_packet_type::pubcomp,
-                        msg
-                    );
                     // publish store is erased when pubrec is received.
                     // pubrel store is erased when pubcomp is received.
                     // If invalid client send pubrec twice with the same packet id,
                     // then send corresponding pubrel twice is a possible client/server
                     // implementation.
                     // In this case, overwrite store_.
-                    if (!ret.second) {
-                        store_.modify(
-                            ret.first,
-                            [&] (auto& e) {
-                                e = store(
-                                    packet_id,
-                                    control_packet_type::pubcomp,
-                                    msg
-                                );
-                            }
-                        );
-                    }
+                    store_.insert_or_assign(
+                        store(
+                            packet_id,
+                            control_packet_type::pubcomp,
+                            msg
+                        )
+                    );
+                    traffic_.store_size(store_.size());
                 }
 
                 if (serialize) {
@@ -10257,6 +11344,8 @@ private:
         std::vector<v5::property_variant> props,
         async_handler_t func
     ) {
+        release_publish_recv_quota(packet_id);
+
         auto impl =
             [&] (auto&& msg) {
                 auto self = this->shared_from_this();
@@ -10644,13 +11733,15 @@ private:
 
     // Non blocking (async) write
 
-    class async_packet {
+    // The latency stamp is the time when the packet is queued.
+    class async_packet : public latency_stamp {
     public:
         async_packet(
             basic_message_variant<PacketIdBytes> mv,
             async_handler_t h = async_handler_t())
             : mv_(std::move(mv))
-            , handler_(std::move(h)) {}
+            , handler_(std::move(h))
+            , size_(mqtt::size<PacketIdBytes>(mv_)) {}
         basic_message_variant<PacketIdBytes> const& message() const {
             return mv_;
         }
@@ -10659,9 +11750,11 @@ private:
         }
         async_handler_t const& handler() const { return handler_; }
         async_handler_t& handler() { return handler_; }
+        std::size_t size() const { return size_; }
     private:
         basic_message_variant<PacketIdBytes> mv_;
         async_handler_t handler_;
+        std::size_t size_;
     };
 
     struct write_completion_handler {
@@ -10676,16 +11769,17 @@ private:
              expected_(expected)
         {}
         void operator()(boost::system::error_code const& ec) const {
+            record_sent(ec);
             if (func_) func_(ec);
             for (std::size_t i = 0; i != num_of_messages_; ++i) {
-                self_->queue_.pop_front();
+                self_->queue_pop_front();
             }
             if (ec || // Error is handled by async_read.
                 !self_->connected_) {
                 self_->connected_ = false;
                 while (!self_->queue_.empty()) {
                     self_->queue_.front().handler()(ec);
-                    self_->queue_.pop_front();
+                    self_->queue_pop_front();
                 }
                 return;
             }
@@ -10696,16 +11790,17 @@ private:
         void operator()(
             boost::system::error_code const& ec,
             std::size_t bytes_transferred) const {
+            record_sent(ec);
             if (func_) func_(ec);
             for (std::size_t i = 0; i != num_of_messages_; ++i) {
-                self_->queue_.pop_front();
+                self_->queue_pop_front();
             }
             if (ec || // Error is handled by async_read.
                 !self_->connected_) {
                 self_->connected_ = false;
                 while (!self_->queue_.empty()) {
                     self_->queue_.front().handler()(ec);
-                    self_->queue_.pop_front();
+                    self_->queue_pop_front();
                 }
                 return;
             }
@@ -10713,7 +11808,7 @@ private:
                 self_->connected_ = false;
                 while (!self_->queue_.empty()) {
                     self_->queue_.front().handler()(ec);
-                    self_->queue_.pop_front();
+                    self_->queue_pop_front();
                 }
                 throw write_bytes_transferred_error(expected_, bytes_transferred);
             }
@@ -10721,39 +11816,54 @@ private:
                 self_->do_async_write();
             }
         }
+        void record_sent(boost::system::error_code const& ec) const {
+            if (ec) return;
+            for (std::size_t i = 0; i != num_of_messages_; ++i) {
+                auto const& elem = self_->queue_[i];
+                auto type = message_control_packet_type<PacketIdBytes>(elem.message());
+                self_->traffic_.sent(type, elem.size());
+                self_->latency_.record(latency_kind::write, type, write_start_);
+            }
+        }
         std::shared_ptr<this_type> self_;
         async_handler_t func_;
         std::size_t num_of_messages_;
         std::size_t expected_;
+        latency_stamp write_start_;
     };
 
+    void queue_pop_front() {
+        traffic_.queue_pop(queue_.front().size());
+        queue_.pop_front();
+    }
+
     void do_async_write() {
         std::vector<as::const_buffer> buf;
         std::vector<async_handler_t> handlers;
 
         std::size_t total_const_buffer_sequence = 0;
         auto start = queue_.cbegin();
-        auto end =
-            [&] {
-                if (max_queue_send_count_ == 0) return queue_.cend();
-                if (max_queue_send_count_ >= queue_.size()) return queue_.cend();
-                return
-                    start +
-                    static_cast<typename std::deque<async_packet>::const_iterator::difference_type>(max_queue_send_count_);
-            } ();
+        auto end = queue_.cend();
 
         std::size_t total = 0;
+        std::size_t num_of_messages = 0;
         for (auto it = start; it != end; ++it) {
             auto const& elem = *it;
             auto const& mv = elem.message();
-            auto size = mqtt::size<PacketIdBytes>(mv);
-
-            if (max_queue_send_size_ != 0 && max_queue_send_size_ < total + size) {
+            auto size = elem.size();
+
+            // The first message is always sent even if it is bigger than max_bytes.
+            if (num_of_messages != 0 &&
+                ((write_batch_policy_.max_messages() != 0 &&
+                  write_batch_policy_.max_messages() <= num_of_messages) ||
+                 (write_batch_policy_.max_bytes() != 0 &&
+                  write_batch_policy_.max_bytes() < total + size))) {
                 end = it;
                 break;
             }
             total += size;
             total_const_buffer_sequence += num_of_const_buffer_sequence(mv);
+            ++num_of_messages;
         }
 
         buf.reserve(total_const_buffer_sequence);
@@ -10765,9 +11875,14 @@ private:
             auto const& cbs = const_buffer_sequence(mv);
             std::copy(cbs.begin(), cbs.end(), std::back_inserter(buf));
             handlers.emplace_back(elem.handler());
+            if (latency_.enabled()) {
+                latency_.record(latency_kind::queue_wait, message_control_packet_type<PacketIdBytes>(mv), elem);
+            }
         }
 
         if (h_pre_send_) h_pre_send_();
+        if (h_write_batch_) h_write_batch_(num_of_messages, total);
+        traffic_.write_batch();
 
         async_write(
             *socket_,
@@ -10780,7 +11895,7 @@ private:
                         if (h) h(ec);
                     }
                 },
-                static_cast<std::size_t>(std::distance(start, end)),
+                num_of_messages,
                 total
             )
         );
@@ -10790,15 +11905,65 @@ private:
         // Move this job to the socket's strand so that it can be queued without mutexes.
         socket_->post(
             [self = this->shared_from_this(), mv = std::move(mv), func = std::move(func)]
-            () {
+            () mutable {
                 if (!self->connected_) {
                     // offline async publish is successfully finished, because there's nothing to do.
                     if (func) func(boost::system::errc::make_error_code(boost::system::errc::success));
                     return;
                 }
+                // The topic alias is assigned in the strand, in the same order as the messages are queued.
+                // Otherwise a message that uses the alias could be sent before the one that registers it.
+                mqtt::visit(
+                    make_lambda_visitor<void>(
+                        [&](auto& m) {
+                            self->apply_topic_alias(m);
+                        }
+                    ),
+                    mv
+                );
                 self->queue_.emplace_back(std::move(mv), std::move(func));
+                self->traffic_.queue_push(self->queue_.back().size());
+                if (self->write_lingering_) {
+                    // Waiting for more messages. Send them now if the batch is full.
+                    self->write_linger_bytes_ += self->queue_.back().size();
+                    if (!self->write_batch_policy_.full(self->queue_.size(), self->write_linger_bytes_)) return;
+                    self->write_lingering_ = false;
+                    self->write_linger_timer_->cancel();
+                    self->do_async_write();
+                    return;
+                }
                 // Only need to start async writes if there was nothing in the queue before the above item.
                 if (self->queue_.size() > 1) return;
+                self->write_linger_bytes_ = self->queue_.back().size();
+                if (self->write_batch_policy_.linger() != std::chrono::microseconds::zero() &&
+                    !self->write_batch_policy_.full(1, self->write_linger_bytes_)) {
+                    if (!self->write_linger_timer_) {
+                        self->write_linger_timer_ = std::make_unique<as::steady_timer>(
+#if BOOST_VERSION < 107000
+                            self->socket_->get_io_service()
+#else  // BOOST_VERSION < 107000
+                            self->socket_->lowest_layer().get_executor()
+#endif // BOOST_VERSION < 107000
+                        );
+                    }
+                    self->write_lingering_ = true;
+                    self->write_linger_timer_->expires_from_now(self->write_batch_policy_.linger());
+                    self->write_linger_timer_->async_wait(
+                        [self]
+                        (boost::system::error_code const& ec) {
+                            if (ec) return;
+                            self->socket_->post(
+                                [self] {
+                                    // Already sent because the batch became full.
+                                    if (!self->write_lingering_) return;
+                                    self->write_lingering_ = false;
+                                    self->do_async_write();
+                                }
+                            );
+                        }
+                    );
+                    return;
+                }
                 self->do_async_write();
             }
         );
@@ -10824,7 +11989,13 @@ private:
     std::uint8_t fixed_header_;
     std::size_t remaining_length_multiplier_;
     std::size_t remaining_length_;
-    std::vector<char> payload_;
+    receive_buffer payload_;
+    std::size_t bulk_read_buffer_size_{0};
+    std::vector<char> bulk_read_buf_;
+    std::size_t bulk_read_begin_{0};
+    std::size_t bulk_read_end_{0};
+    bool bulk_read_processing_{false};
+    mqtt::optional<async_handler_t> bulk_read_next_;
 
     // MQTT common handlers
     pingreq_handler h_pingreq_;
@@ -10863,6 +12034,8 @@ private:
     close_handler h_close_;
     error_handler h_error_;
     pub_res_sent_handler h_pub_res_sent_;
+    publish_view_handler h_publish_view_;
+    v5_publish_view_handler h_v5_publish_view_;
     serialize_publish_message_handler h_serialize_publish_;
     serialize_v5_publish_message_handler h_serialize_v5_publish_;
     serialize_pubrel_message_handler h_serialize_pubrel_;
@@ -10871,18 +12044,45 @@ private:
     pre_send_handler h_pre_send_;
     is_valid_length_handler h_is_valid_length_;
     Mutex store_mtx_;
-    mi_store store_;
+    InflightStore<store> store_;
     std::set<packet_id_t> qos2_publish_handled_;
     std::deque<async_packet> queue_;
-    packet_id_t packet_id_master_{0};
-    std::set<packet_id_t> packet_id_;
+    packet_id_allocator<packet_id_t> packet_id_;
+
+    // MQTT v5 Receive Maximum flow control. They are protected by store_mtx_.
+    // publish_send_max_ is the peer's Receive Maximum. QoS1 and QoS2 PUBLISH over it wait in publish_send_queue_.
+    // publish_recv_max_ is the Receive Maximum that this endpoint sent, and publish_recv_ is the received
+    // QoS1 and QoS2 PUBLISH packet ids that are not responded yet.
+    std::size_t publish_send_max_{std::numeric_limits<std::size_t>::max()};
+    std::size_t publish_send_count_{0};
+    std::deque<std::function<bool()>> publish_send_queue_;
+    std::size_t publish_recv_max_{std::numeric_limits<std::size_t>::max()};
+    std::set<packet_id_t> publish_recv_;
+
+    // MQTT v5 Topic Alias. topic_alias_send_ is protected by store_mtx_.
+    // topic_alias_recv_ is only accessed by the receiving handlers.
+    topic_alias_send topic_alias_send_;
+    topic_alias_recv topic_alias_recv_;
+    bool auto_topic_alias_send_{true};
+
+    // MQTT v5 Maximum Packet Size. maximum_packet_size_send_ is the peer's one, and it is protected by store_mtx_.
+    std::size_t maximum_packet_size_send_{packet_size_no_limit};
+    std::size_t maximum_packet_size_recv_{packet_size_no_limit};
     bool auto_pub_response_{true};
     bool auto_pub_response_async_{false};
     bool disconnect_requested_{false};
     bool connect_requested_{false};
-    std::size_t max_queue_send_count_{1};
-    std::size_t max_queue_send_size_{0};
+    write_batch_policy write_batch_policy_;
+    bool write_lingering_{false};
+    std::size_t write_linger_bytes_{0};
+    std::unique_ptr<as::steady_timer> write_linger_timer_;
+    write_batch_handler h_write_batch_;
     mqtt_message_processed_handler h_mqtt_message_processed_;
+    latency_recorder latency_;
+    traffic_recorder traffic_;
+    keep_alive_service* keep_alive_service_{nullptr};
+    std::shared_ptr<keep_alive_service::entry> keep_alive_;
+    bool keep_alive_timed_out_{false};
     protocol_version version_{protocol_version::undetermined};
 };
 
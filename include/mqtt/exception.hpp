@@ -10,6 +10,7 @@
 #include <exception>
 #include <sstream>
 
+#include <boost/assert.hpp>
 #include <boost/system/error_code.hpp>
 
 #include <mqtt/utf8encoded_strings.hpp>
@@ -110,6 +111,12 @@ struct property_length_error : std::exception {
     }
 };
 
+struct session_log_error : std::exception {
+    virtual char const* what() const noexcept {
+        return "session log error";
+    }
+};
+
 } // namespace mqtt
 
 #endif // MQTT_EXCEPTION_HPP
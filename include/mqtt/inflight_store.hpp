@@ -0,0 +1,410 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_INFLIGHT_STORE_HPP)
+#define MQTT_INFLIGHT_STORE_HPP
+
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+
+#include <boost/assert.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
+#include <boost/multi_index/composite_key.hpp>
+#include <boost/multi_index/mem_fun.hpp>
+
+#include <mqtt/optional.hpp>
+
+namespace mqtt {
+
+namespace mi = boost::multi_index;
+
+// Stores of the in-flight messages that wait for PUBACK, PUBREC or PUBCOMP.
+//
+// Value needs to provide the following member functions:
+//   packet_id_t  packet_id() const;
+//   std::uint8_t expected_control_packet_type() const;
+//
+// Both stores provide the same interface and keep the insertion order, that is
+// the order of resending messages on reconnect.
+
+/**
+ * @brief In-flight message store that is implemented by boost::multi_index.
+ *        Messages are indexed by ordered indexes of packet_id and
+ *        the pair of packet_id and expected_control_packet_type.
+ *        The same packet_id can be stored with different expected_control_packet_types.
+ *        This is the default store of endpoint.
+ */
+template <typename Value>
+class ordered_inflight_store {
+public:
+    using value_type = Value;
+    using packet_id_t = typename std::decay<decltype(std::declval<Value const&>().packet_id())>::type;
+
+    /**
+     * @brief Insert the value if the pair of packet_id and expected_control_packet_type is not stored.
+     * @param v value
+     * @return true if inserted, otherwise false.
+     */
+    bool insert(Value v) {
+        return store_.insert(std::move(v)).second;
+    }
+
+    /**
+     * @brief Insert the value, or overwrite the stored value that has the same key.
+     *        The overwritten value keeps its position in the insertion order.
+     * @param v value
+     */
+    void insert_or_assign(Value v) {
+        auto ret = store_.insert(v);
+        if (!ret.second) {
+            store_.modify(
+                ret.first,
+                [&] (Value& e) {
+                    e = std::move(v);
+                }
+            );
+        }
+    }
+
+    /**
+     * @brief Erase all values that have the packet_id.
+     * @param packet_id packet_id
+     * @return the number of erased values
+     */
+    std::size_t erase(packet_id_t packet_id) {
+        auto& idx = store_.template get<tag_packet_id>();
+        return idx.erase(packet_id);
+    }
+
+    /**
+     * @brief Erase the value that has the packet_id and the expected_control_packet_type.
+     * @param packet_id packet_id
+     * @param type      expected_control_packet_type
+     * @return the number of erased values
+     */
+    std::size_t erase(packet_id_t packet_id, std::uint8_t type) {
+        auto& idx = store_.template get<tag_packet_id_type>();
+        auto r = idx.equal_range(std::make_tuple(packet_id, type));
+        auto size = static_cast<std::size_t>(std::distance(r.first, r.second));
+        idx.erase(r.first, r.second);
+        return size;
+    }
+
+    /**
+     * @brief Find the value that has the packet_id and the expected_control_packet_type.
+     * @param packet_id packet_id
+     * @param type      expected_control_packet_type
+     * @return pointer to the value. nullptr if not found.
+     */
+    Value const* find(packet_id_t packet_id, std::uint8_t type) const {
+        auto& idx = store_.template get<tag_packet_id_type>();
+        auto it = idx.find(std::make_tuple(packet_id, type));
+        if (it == idx.end()) return nullptr;
+        return &*it;
+    }
+
+    /**
+     * @brief Call f for each value in the insertion order.
+     * @param f function object that is called as f(Value const&)
+     */
+    template <typename Func>
+    void for_each(Func&& f) const {
+        auto& idx = store_.template get<tag_seq>();
+        for (auto const& e : idx) {
+            f(e);
+        }
+    }
+
+    void clear() {
+        store_.clear();
+    }
+
+    std::size_t size() const {
+        return store_.size();
+    }
+
+    bool empty() const {
+        return store_.empty();
+    }
+
+private:
+    struct tag_packet_id {};
+    struct tag_packet_id_type {};
+    struct tag_seq {};
+    using mi_store = mi::multi_index_container<
+        Value,
+        mi::indexed_by<
+            mi::ordered_unique<
+                mi::tag<tag_packet_id_type>,
+                mi::composite_key<
+                    Value,
+                    mi::const_mem_fun<
+                        Value, packet_id_t,
+                        &Value::packet_id
+                    >,
+                    mi::const_mem_fun<
+                        Value, std::uint8_t,
+                        &Value::expected_control_packet_type
+                    >
+                >
+            >,
+            mi::ordered_non_unique<
+                mi::tag<tag_packet_id>,
+                mi::const_mem_fun<
+                    Value, packet_id_t,
+                    &Value::packet_id
+                >
+            >,
+            mi::sequenced<
+                mi::tag<tag_seq>
+            >
+        >
+    >;
+
+    mi_store store_;
+};
+
+/**
+ * @brief In-flight message store that is indexed by packet_id directly.
+ *        Values are kept in a vector of nodes that are linked in the insertion order
+ *        by indexes, and removed nodes are reused. The packet_id index is an open addressing
+ *        hash table with linear probing, so insert, find and erase don't allocate memory
+ *        except for growing the tables, and cost O(1) on average.
+ *        Packet ids are scattered by Fibonacci hashing. Sequentially allocated packet ids
+ *        would make one long cluster if they were used as bucket indexes directly.
+ *
+ *        Only one value is stored per packet_id. It is enough for MQTT flows because
+ *        the PUBLISH that waits for PUBREC is erased before the PUBREL for the same packet_id is stored.
+ *        Select this store by the InflightStore template parameter of endpoint or server.
+ */
+template <typename Value>
+class flat_inflight_store {
+public:
+    using value_type = Value;
+    using packet_id_t = typename std::decay<decltype(std::declval<Value const&>().packet_id())>::type;
+
+    /**
+     * @brief Insert the value if the packet_id is not stored.
+     * @param v value
+     * @return true if inserted, otherwise false.
+     */
+    bool insert(Value v) {
+        reserve(size_ + 1);
+        auto b = find_bucket(v.packet_id());
+        if (table_[b] != npos) return false;
+        table_[b] = allocate_node(std::move(v));
+        ++size_;
+        return true;
+    }
+
+    /**
+     * @brief Insert the value, or overwrite the stored value that has the same packet_id.
+     *        The overwritten value keeps its position in the insertion order.
+     * @param v value
+     */
+    void insert_or_assign(Value v) {
+        reserve(size_ + 1);
+        auto b = find_bucket(v.packet_id());
+        if (table_[b] != npos) {
+            nodes_[table_[b]].value.emplace(std::move(v));
+            return;
+        }
+        table_[b] = allocate_node(std::move(v));
+        ++size_;
+    }
+
+    /**
+     * @brief Erase the value that has the packet_id.
+     * @param packet_id packet_id
+     * @return the number of erased values
+     */
+    std::size_t erase(packet_id_t packet_id) {
+        if (size_ == 0) return 0;
+        auto b = find_bucket(packet_id);
+        if (table_[b] == npos) return 0;
+        erase_bucket(b);
+        return 1;
+    }
+
+    /**
+     * @brief Erase the value that has the packet_id and the expected_control_packet_type.
+     * @param packet_id packet_id
+     * @param type      expected_control_packet_type
+     * @return the number of erased values
+     */
+    std::size_t erase(packet_id_t packet_id, std::uint8_t type) {
+        if (size_ == 0) return 0;
+        auto b = find_bucket(packet_id);
+        if (table_[b] == npos) return 0;
+        if (nodes_[table_[b]].value->expected_control_packet_type() != type) return 0;
+        erase_bucket(b);
+        return 1;
+    }
+
+    /**
+     * @brief Find the value that has the packet_id and the expected_control_packet_type.
+     * @param packet_id packet_id
+     * @param type      expected_control_packet_type
+     * @return pointer to the value. nullptr if not found.
+     */
+    Value const* find(packet_id_t packet_id, std::uint8_t type) const {
+        if (size_ == 0) return nullptr;
+        auto b = find_bucket(packet_id);
+        if (table_[b] == npos) return nullptr;
+        auto const& v = *nodes_[table_[b]].value;
+        if (v.expected_control_packet_type() != type) return nullptr;
+        return &v;
+    }
+
+    /**
+     * @brief Call f for each value in the insertion order.
+     * @param f function object that is called as f(Value const&)
+     */
+    template <typename Func>
+    void for_each(Func&& f) const {
+        for (auto n = head_; n != npos; n = nodes_[n].next) {
+            f(*nodes_[n].value);
+        }
+    }
+
+    /**
+     * @brief Clear all values. The allocated tables are kept for reuse.
+     */
+    void clear() {
+        nodes_.clear();
+        std::fill(table_.begin(), table_.end(), npos);
+        head_ = tail_ = free_ = npos;
+        size_ = 0;
+    }
+
+    /**
+     * @brief Reserve the tables for size values
+     * @param size the number of values
+     */
+    void reserve(std::size_t size) {
+        // Keep the load factor of the hash table less than or equal to 1/2.
+        if (size * 2 <= table_.size()) return;
+        std::size_t capacity = std::max<std::size_t>(table_.size(), 16);
+        while (capacity < size * 2) capacity *= 2;
+        rehash(capacity);
+    }
+
+    std::size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+private:
+    using index_t = std::uint32_t;
+    static constexpr index_t npos = static_cast<index_t>(-1);
+
+    struct node {
+        optional<Value> value;
+        index_t prev;
+        index_t next;
+    };
+
+    std::size_t home(packet_id_t packet_id) const {
+        // 2^32 / golden ratio. The upper bits of the product are the bucket index.
+        return static_cast<std::size_t>(
+            static_cast<std::uint32_t>(static_cast<std::uint32_t>(packet_id) * 0x9e3779b9U) >> shift_
+        );
+    }
+
+    // Return the bucket that has the packet_id, or the empty bucket to insert it.
+    std::size_t find_bucket(packet_id_t packet_id) const {
+        auto mask = table_.size() - 1;
+        for (auto b = home(packet_id); ; b = (b + 1) & mask) {
+            auto n = table_[b];
+            if (n == npos || nodes_[n].value->packet_id() == packet_id) return b;
+        }
+    }
+
+    // Allocate the node at the end of the insertion order list.
+    index_t allocate_node(Value v) {
+        index_t n;
+        if (free_ != npos) {
+            n = free_;
+            free_ = nodes_[n].next;
+            nodes_[n].value.emplace(std::move(v));
+        }
+        else {
+            n = static_cast<index_t>(nodes_.size());
+            nodes_.push_back(node { optional<Value>(std::move(v)), npos, npos });
+        }
+        nodes_[n].prev = tail_;
+        nodes_[n].next = npos;
+        if (tail_ == npos) head_ = n;
+        else nodes_[tail_].next = n;
+        tail_ = n;
+        return n;
+    }
+
+    void erase_bucket(std::size_t b) {
+        auto n = table_[b];
+
+        // unlink from the insertion order list and push to the free list
+        auto& nd = nodes_[n];
+        if (nd.prev == npos) head_ = nd.next;
+        else nodes_[nd.prev].next = nd.next;
+        if (nd.next == npos) tail_ = nd.prev;
+        else nodes_[nd.next].prev = nd.prev;
+        nd.value = nullopt;
+        nd.next = free_;
+        free_ = n;
+        --size_;
+
+        // backward shift deletion. It keeps the probe sequences without tombstones.
+        auto mask = table_.size() - 1;
+        auto i = b;
+        for (auto j = (b + 1) & mask; table_[j] != npos; j = (j + 1) & mask) {
+            auto k = home(nodes_[table_[j]].value->packet_id());
+            // The entry at j can move to i if its home is not in the cyclic range (i, j].
+            bool stay = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+            if (stay) continue;
+            table_[i] = table_[j];
+            i = j;
+        }
+        table_[i] = npos;
+    }
+
+    void rehash(std::size_t capacity) {
+        BOOST_ASSERT((capacity & (capacity - 1)) == 0);
+        table_.assign(capacity, npos);
+        shift_ = 32;
+        for (auto c = capacity; c > 1; c >>= 1) --shift_;
+        auto mask = capacity - 1;
+        for (auto n = head_; n != npos; n = nodes_[n].next) {
+            auto b = home(nodes_[n].value->packet_id());
+            while (table_[b] != npos) b = (b + 1) & mask;
+            table_[b] = n;
+        }
+    }
+
+private:
+    std::vector<node> nodes_;
+    std::vector<index_t> table_;
+    index_t head_ = npos;
+    index_t tail_ = npos;
+    index_t free_ = npos;
+    std::size_t size_ = 0;
+    unsigned shift_ = 32;
+};
+
+template <typename Value>
+constexpr typename flat_inflight_store<Value>::index_t flat_inflight_store<Value>::npos;
+
+} // namespace mqtt
+
+#endif // MQTT_INFLIGHT_STORE_HPP
@@ -0,0 +1,217 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_KEEP_ALIVE_HPP)
+#define MQTT_KEEP_ALIVE_HPP
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/version.hpp>
+
+#include <mqtt/optional.hpp>
+#include <mqtt/timing_wheel.hpp>
+
+namespace mqtt {
+
+namespace as = boost::asio;
+
+/**
+ * @brief Keep alive check of the server side connections.
+ *        The server closes the connection if no control packet is received from the client within
+ *        one and a half times the Keep Alive.<BR>
+ *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901045<BR>
+ *        3.1.2.10 Keep Alive<BR>
+ *        All connections on an io_service share one timing_wheel and one timer of the service,
+ *        instead of a timer for each connection. Receiving a packet only stores the time to the entry.
+ *        When the entry's deadline comes, the deadline is recalculated from the stored time, and the
+ *        entry is added again if the connection has received a packet in the meantime.
+ *        The timer runs only while the wheel has entries.<BR>
+ *        Use as::use_service<keep_alive_service>(ios) to get the service of the io_service.
+ *        The functions are thread safe.
+ */
+template <typename T = void>
+class basic_keep_alive_service : public as::io_service::service {
+public:
+    using clock = std::chrono::steady_clock;
+
+    static as::io_service::id id;
+
+    /**
+     * @brief Resolution of the deadlines
+     */
+    static constexpr std::chrono::milliseconds tick = std::chrono::milliseconds(100);
+
+    /**
+     * @brief Keep alive state of a connection
+     */
+    class entry {
+    public:
+        /**
+         * @brief Record that a control packet is received
+         */
+        void touch() {
+            last_received_.store(clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Get the timeout
+         * @return duration from the last received packet to the disconnection
+         */
+        clock::duration timeout() const {
+            return timeout_;
+        }
+
+    private:
+        friend class basic_keep_alive_service;
+
+        entry(clock::duration timeout, std::function<void()> h)
+            :last_received_(clock::now().time_since_epoch().count()),
+             timeout_(timeout),
+             h_timeout_(std::move(h)) {}
+
+        clock::time_point deadline() const {
+            return clock::time_point(clock::duration(last_received_.load(std::memory_order_relaxed))) + timeout_;
+        }
+
+        std::atomic<clock::rep> last_received_;
+        clock::duration timeout_;
+        std::function<void()> h_timeout_;
+        // protected by the mutex of the service
+        mqtt::optional<typename timing_wheel<std::weak_ptr<entry>>::id_t> id_;
+    };
+
+    explicit basic_keep_alive_service(as::io_service& ios)
+        : as::io_service::service(ios), timer_(ios), wheel_(tick) {}
+
+    /**
+     * @brief Start the keep alive check of a connection
+     * @param timeout duration from the last received packet to the disconnection.
+     *                It is one and a half times the Keep Alive.
+     * @param h       handler that is called when the connection times out.
+     *                It is called on the thread that runs the io_service, and it should post
+     *                the disconnection to the strand of the connection.
+     * @return entry of the connection. Call entry::touch() when a packet is received, and stop()
+     *         when the connection is closed. If the entry is destroyed without stop(), it is removed
+     *         from the wheel at its deadline.
+     */
+    std::shared_ptr<entry> start(clock::duration timeout, std::function<void()> h) {
+        std::shared_ptr<entry> e(new entry(timeout, std::move(h)));
+        std::lock_guard<std::mutex> lck(mtx_);
+        e->id_ = wheel_.add(e->deadline(), e);
+        arm();
+        return e;
+    }
+
+    /**
+     * @brief Stop the keep alive check of a connection
+     * @param e entry that is returned by start()
+     */
+    void stop(entry& e) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        if (!e.id_) return;
+        wheel_.cancel(*e.id_);
+        e.id_ = nullopt;
+        if (wheel_.empty() && armed_) {
+            // Don't keep the io_service running without connections.
+            armed_ = false;
+            ++generation_;
+            boost::system::error_code ec;
+            timer_.cancel(ec);
+        }
+    }
+
+    /**
+     * @brief Get the number of the connections that are checked
+     * @return the number of the entries that are started and neither stopped nor timed out
+     */
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return wheel_.size();
+    }
+
+private:
+#if BOOST_VERSION < 106600
+    void shutdown_service() override {
+#else  // BOOST_VERSION < 106600
+    void shutdown() override {
+#endif // BOOST_VERSION < 106600
+        std::lock_guard<std::mutex> lck(mtx_);
+        armed_ = false;
+        ++generation_;
+        boost::system::error_code ec;
+        timer_.cancel(ec);
+    }
+
+    // Called with mtx_ locked.
+    void arm() {
+        if (armed_) return;
+        armed_ = true;
+        timer_.expires_from_now(tick);
+        timer_.async_wait(
+            [this, generation = generation_]
+            (boost::system::error_code const& ec) {
+                if (ec) return;
+                on_tick(generation);
+            }
+        );
+    }
+
+    void on_tick(std::uint64_t generation) {
+        std::vector<std::shared_ptr<entry>> timed_out;
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+            if (generation != generation_) return;
+            armed_ = false;
+            auto now = clock::now();
+            wheel_.advance(
+                now,
+                [&](std::weak_ptr<entry> wp) {
+                    auto e = wp.lock();
+                    if (!e) return;
+                    auto deadline = e->deadline();
+                    if (deadline <= now) {
+                        e->id_ = nullopt;
+                        timed_out.push_back(std::move(e));
+                    }
+                    else {
+                        // A packet has been received. Check again at the new deadline.
+                        e->id_ = wheel_.add(deadline, std::move(wp));
+                    }
+                }
+            );
+            if (!wheel_.empty()) arm();
+        }
+        for (auto const& e : timed_out) {
+            if (e->h_timeout_) e->h_timeout_();
+        }
+    }
+
+private:
+    mutable std::mutex mtx_;
+    as::steady_timer timer_;
+    timing_wheel<std::weak_ptr<entry>> wheel_;
+    bool armed_{false};
+    std::uint64_t generation_{0};
+};
+
+template <typename T>
+as::io_service::id basic_keep_alive_service<T>::id;
+
+template <typename T>
+constexpr std::chrono::milliseconds basic_keep_alive_service<T>::tick;
+
+using keep_alive_service = basic_keep_alive_service<>;
+
+} // namespace mqtt
+
+#endif // MQTT_KEEP_ALIVE_HPP
@@ -0,0 +1,354 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_LATENCY_HPP)
+#define MQTT_LATENCY_HPP
+
+#include <cstdint>
+#include <array>
+#include <algorithm>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+#include <boost/assert.hpp>
+
+namespace mqtt {
+
+/**
+ * @brief Latency histogram that can be recorded by many threads without locks.
+ *
+ * Values are nanoseconds. Each power of two range is divided into 16 sub buckets
+ * (HDR histogram style), so the recorded values are kept with about 6% precision.
+ * Values smaller than 16 are kept exactly, and values larger than 2^40 (about 18 minutes)
+ * are counted in the last bucket.
+ */
+class latency_histogram {
+public:
+    static constexpr std::size_t sub_bucket_bits = 4;
+    static constexpr std::size_t sub_bucket_count = std::size_t(1) << sub_bucket_bits;
+    static constexpr std::size_t max_exponent = 40;
+    static constexpr std::size_t bucket_count = sub_bucket_count * (max_exponent - sub_bucket_bits + 1);
+
+    /**
+     * @brief Consistent copy of the histogram
+     */
+    class snapshot {
+    public:
+        /**
+         * @brief Get the number of recorded values
+         * @return the number of recorded values
+         */
+        std::uint64_t count() const {
+            return count_;
+        }
+
+        /**
+         * @brief Get the largest recorded value
+         * @return the largest recorded value. 0 if no value is recorded.
+         */
+        std::uint64_t max() const {
+            return max_;
+        }
+
+        /**
+         * @brief Get the mean of the recorded values
+         * @return the mean of the recorded values. 0 if no value is recorded.
+         */
+        double mean() const {
+            return count_ == 0 ? 0.0 : static_cast<double>(sum_) / static_cast<double>(count_);
+        }
+
+        /**
+         * @brief Get the value at the percentile
+         * @param percentile percentile from 0 to 100. e.g. 99.9
+         * @return the highest value that is equivalent to the value at the percentile.
+         *         It is not larger than max(). 0 if no value is recorded.
+         */
+        std::uint64_t value_at_percentile(double percentile) const {
+            if (count_ == 0) return 0;
+            auto rank = static_cast<std::uint64_t>(percentile / 100.0 * static_cast<double>(count_) + 0.5);
+            if (rank == 0) rank = 1;
+            if (rank > count_) rank = count_;
+            std::uint64_t total = 0;
+            for (std::size_t i = 0; i != counts_.size(); ++i) {
+                total += counts_[i];
+                if (total >= rank) return std::min(highest_equivalent_value(i), max_);
+            }
+            return max_;
+        }
+
+        /**
+         * @brief Get the count of the bucket
+         * @param index bucket index that is less than bucket_count
+         * @return the count of the bucket
+         */
+        std::uint64_t count_at(std::size_t index) const {
+            return counts_[index];
+        }
+
+    private:
+        friend class latency_histogram;
+        std::vector<std::uint64_t> counts_;
+        std::uint64_t count_ = 0;
+        std::uint64_t sum_ = 0;
+        std::uint64_t max_ = 0;
+    };
+
+    latency_histogram() {
+        for (auto& c : counts_) c.store(0, std::memory_order_relaxed);
+    }
+
+    latency_histogram(latency_histogram const&) = delete;
+    latency_histogram& operator=(latency_histogram const&) = delete;
+
+    /**
+     * @brief Record the value
+     * @param value value in nanoseconds
+     */
+    void record(std::uint64_t value) {
+        counts_[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        auto m = max_.load(std::memory_order_relaxed);
+        while (m < value && !max_.compare_exchange_weak(m, value, std::memory_order_relaxed)) {}
+    }
+
+    /**
+     * @brief Record the duration
+     * @param d duration
+     */
+    template <typename Rep, typename Period>
+    void record(std::chrono::duration<Rep, Period> d) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        record(ns < 0 ? 0 : static_cast<std::uint64_t>(ns));
+    }
+
+    /**
+     * @brief Take the snapshot. It can be called while other threads are recording.
+     *        The values that are being recorded might be counted partially, e.g. in the count
+     *        but not in the sum yet.
+     * @return snapshot
+     */
+    snapshot take_snapshot() const {
+        snapshot s;
+        s.counts_.reserve(bucket_count);
+        for (auto const& c : counts_) {
+            auto v = c.load(std::memory_order_relaxed);
+            s.counts_.push_back(v);
+            s.count_ += v;
+        }
+        s.sum_ = sum_.load(std::memory_order_relaxed);
+        s.max_ = max_.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    /**
+     * @brief Get the bucket index of the value
+     * @param value value
+     * @return bucket index
+     */
+    static std::size_t bucket_index(std::uint64_t value) {
+        if (value < sub_bucket_count) return static_cast<std::size_t>(value);
+        auto msb = most_significant_bit(value);
+        if (msb >= max_exponent) return bucket_count - 1;
+        auto shift = msb - sub_bucket_bits;
+        return
+            (msb - sub_bucket_bits + 1) * sub_bucket_count +
+            static_cast<std::size_t>((value >> shift) & (sub_bucket_count - 1));
+    }
+
+    /**
+     * @brief Get the highest value that is counted in the bucket
+     * @param index bucket index
+     * @return the highest value of the bucket
+     */
+    static std::uint64_t highest_equivalent_value(std::size_t index) {
+        BOOST_ASSERT(index < bucket_count);
+        if (index < sub_bucket_count) return index;
+        auto shift = index / sub_bucket_count - 1;
+        auto sub = index % sub_bucket_count;
+        auto lowest = static_cast<std::uint64_t>(sub_bucket_count + sub) << shift;
+        return lowest + (std::uint64_t(1) << shift) - 1;
+    }
+
+private:
+    static std::size_t most_significant_bit(std::uint64_t value) {
+#if defined(__GNUC__)
+        return static_cast<std::size_t>(63 - __builtin_clzll(value));
+#else  // defined(__GNUC__)
+        std::size_t msb = 0;
+        while (value >>= 1) ++msb;
+        return msb;
+#endif // defined(__GNUC__)
+    }
+
+    std::array<std::atomic<std::uint64_t>, bucket_count> counts_;
+    std::atomic<std::uint64_t> sum_{0};
+    std::atomic<std::uint64_t> max_{0};
+};
+
+/**
+ * @brief Measured intervals of endpoint
+ */
+enum class latency_kind : std::uint8_t {
+    parse,      ///< From the received packet is complete to the handler is called.
+    handler,    ///< From the handler is called to the packet is processed.
+    queue_wait, ///< From the packet is queued by an async function to it is written to the socket.
+    write,      ///< From the packet is written to the socket to the write is completed.
+    ack,        ///< From the PUBLISH or PUBREL is stored to the PUBACK, PUBREC or PUBCOMP is received.
+};
+
+/**
+ * @brief Latency histograms of each latency_kind and control packet type.
+ *        One object can be shared by many endpoints, and can be read by other threads.
+ *        The object is large (several hundred KB), so it should be allocated dynamically.
+ */
+class latency_metrics {
+public:
+    static constexpr std::size_t num_of_kinds = 5;
+    static constexpr std::size_t num_of_control_packet_types = 16;
+
+    /**
+     * @brief Record the duration
+     * @param kind                kind of the interval
+     * @param control_packet_type control packet type
+     * @param d                   duration
+     */
+    template <typename Rep, typename Period>
+    void record(latency_kind kind, std::uint8_t control_packet_type, std::chrono::duration<Rep, Period> d) {
+        histogram(kind, control_packet_type).record(d);
+    }
+
+    /**
+     * @brief Get the histogram
+     * @param kind                kind of the interval
+     * @param control_packet_type control packet type
+     * @return histogram
+     */
+    latency_histogram& histogram(latency_kind kind, std::uint8_t control_packet_type) {
+        return histograms_[index(kind, control_packet_type)];
+    }
+
+    latency_histogram const& histogram(latency_kind kind, std::uint8_t control_packet_type) const {
+        return histograms_[index(kind, control_packet_type)];
+    }
+
+    /**
+     * @brief Take the snapshot of the histogram
+     * @param kind                kind of the interval
+     * @param control_packet_type control packet type
+     * @return snapshot
+     */
+    latency_histogram::snapshot take_snapshot(latency_kind kind, std::uint8_t control_packet_type) const {
+        return histogram(kind, control_packet_type).take_snapshot();
+    }
+
+private:
+    static std::size_t index(latency_kind kind, std::uint8_t control_packet_type) {
+        BOOST_ASSERT(static_cast<std::size_t>(kind) < num_of_kinds);
+        BOOST_ASSERT(control_packet_type < num_of_control_packet_types);
+        return static_cast<std::size_t>(kind) * num_of_control_packet_types + control_packet_type;
+    }
+
+    std::array<latency_histogram, num_of_kinds * num_of_control_packet_types> histograms_;
+};
+
+#if defined(MQTT_USE_LATENCY_METRICS)
+
+/**
+ * @brief Time point that is taken on construction
+ */
+class latency_stamp {
+public:
+    latency_stamp()
+        : time_(std::chrono::steady_clock::now()) {}
+
+    std::chrono::steady_clock::time_point time() const {
+        return time_;
+    }
+
+private:
+    std::chrono::steady_clock::time_point time_;
+};
+
+/**
+ * @brief Record the latencies of endpoint to latency_metrics if it is set.
+ */
+class latency_recorder {
+public:
+    bool enabled() const {
+        return static_cast<bool>(metrics_);
+    }
+
+    void set_metrics(std::shared_ptr<latency_metrics> metrics) {
+        metrics_ = std::move(metrics);
+    }
+
+    std::shared_ptr<latency_metrics> const& metrics() const {
+        return metrics_;
+    }
+
+    void record(latency_kind kind, std::uint8_t control_packet_type, latency_stamp const& since) const {
+        if (metrics_) metrics_->record(kind, control_packet_type, std::chrono::steady_clock::now() - since.time());
+    }
+
+    // The received packet is complete.
+    void receive_begin() {
+        if (!metrics_) return;
+        receive_ = std::chrono::steady_clock::now();
+        handler_called_ = false;
+    }
+
+    // The handler is about to be called.
+    void handler_begin() {
+        if (!metrics_) return;
+        handler_ = std::chrono::steady_clock::now();
+        handler_called_ = true;
+    }
+
+    // The received packet is processed.
+    void receive_end(std::uint8_t control_packet_type) {
+        if (!metrics_) return;
+        auto now = std::chrono::steady_clock::now();
+        if (handler_called_) {
+            metrics_->record(latency_kind::parse, control_packet_type, handler_ - receive_);
+            metrics_->record(latency_kind::handler, control_packet_type, now - handler_);
+        }
+        else {
+            metrics_->record(latency_kind::parse, control_packet_type, now - receive_);
+        }
+    }
+
+private:
+    std::shared_ptr<latency_metrics> metrics_;
+    std::chrono::steady_clock::time_point receive_;
+    std::chrono::steady_clock::time_point handler_;
+    bool handler_called_ = false;
+};
+
+#else  // defined(MQTT_USE_LATENCY_METRICS)
+
+// Empty implementations. The clock is never read, and the stamps take no space as base classes.
+
+class latency_stamp {};
+
+class latency_recorder {
+public:
+    static constexpr bool enabled() {
+        return false;
+    }
+    void record(latency_kind, std::uint8_t, latency_stamp const&) const {}
+    void receive_begin() {}
+    void handler_begin() {}
+    void receive_end(std::uint8_t) {}
+};
+
+#endif // defined(MQTT_USE_LATENCY_METRICS)
+
+} // namespace mqtt
+
+#endif // MQTT_LATENCY_HPP
@@ -32,6 +32,7 @@
 #include <mqtt/string_view.hpp>
 #include <mqtt/property.hpp>
 #include <mqtt/string_check.hpp>
+#include <mqtt/shared_publish.hpp>
 
 namespace mqtt {
 
@@ -529,6 +530,43 @@ public:
         }
     }
 
+    /**
+     * @brief Constructor
+     *        The topic name and the payload refer to the shared body. They are not validated again.
+     *        The caller needs to keep the body alive while the message is used.
+     * @param body      shared part of the message
+     * @param qos       qos
+     * @param retain    retain flag
+     * @param dup       dup flag
+     * @param packet_id packet id
+     */
+    basic_publish_message(
+        shared_publish const& body,
+        std::uint8_t qos,
+        bool retain,
+        bool dup,
+        typename packet_id_type<PacketIdBytes>::type packet_id
+    )
+        : fixed_header_(static_cast<char>(make_fixed_header(control_packet_type::publish, 0b0000))),
+          topic_name_(body.topic()),
+          topic_name_length_buf_ { MQTT_16BITNUM_TO_BYTE_SEQ(get_size(body.topic())) },
+          payload_(body.payload()),
+          remaining_length_(publish_remaining_length(topic_name_, qos, payload_))
+    {
+        publish::set_qos(fixed_header_, qos);
+        publish::set_retain(fixed_header_, retain);
+        publish::set_dup(fixed_header_, dup);
+
+        auto rb = remaining_bytes(remaining_length_);
+        for (auto e : rb) {
+            remaining_length_buf_.push_back(e);
+        }
+        if (qos == qos::at_least_once ||
+            qos == qos::exactly_once) {
+            add_packet_id_to_buf<PacketIdBytes>::apply(packet_id_, packet_id);
+        }
+    }
+
     template <typename Iterator>
     basic_publish_message(Iterator b, Iterator e) {
         if (b >= e) throw remaining_length_error();
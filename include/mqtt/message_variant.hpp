@@ -7,6 +7,7 @@
 #if !defined(MQTT_MESSAGE_VARIANT_HPP)
 #define MQTT_MESSAGE_VARIANT_HPP
 
+#include <mqtt/control_packet_type.hpp>
 #include <mqtt/message.hpp>
 #include <mqtt/v5_message.hpp>
 #include <mqtt/variant.hpp>
@@ -133,6 +134,24 @@ inline std::string continuous_buffer(basic_message_variant<PacketIdBytes> const&
     return mqtt::visit(detail::continuous_buffer_visitor(), mv);
 }
 
+/**
+ * @brief Get the control packet type of the message
+ * @param mv message variant
+ * @return control packet type
+ */
+template <std::size_t PacketIdBytes>
+inline std::uint8_t message_control_packet_type(basic_message_variant<PacketIdBytes> const& mv) {
+#if defined(MQTT_STD_VARIANT)
+    auto index = mv.index();
+#else  // defined(MQTT_STD_VARIANT)
+    auto index = static_cast<std::size_t>(mv.which());
+#endif // defined(MQTT_STD_VARIANT)
+    // The messages from connect to disconnect of v3.1.1 and v5 are in the order of control packet types.
+    // auth is the last one.
+    if (index == 28) return control_packet_type::auth;
+    return static_cast<std::uint8_t>(index % 14 + 1);
+}
+
 
 //  store_message_variant
 
@@ -0,0 +1,434 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_OFFLINE_QUEUE_HPP)
+#define MQTT_OFFLINE_QUEUE_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <memory>
+#include <limits>
+#include <atomic>
+#include <chrono>
+
+#if defined(_WIN32)
+#include <process.h>
+#else  // defined(_WIN32)
+#include <unistd.h>
+#endif // defined(_WIN32)
+
+#include <mqtt/optional.hpp>
+
+namespace mqtt {
+
+/**
+ * @brief What offline_queue does when a message exceeds the limits
+ */
+enum class offline_overflow_policy {
+    drop_oldest,     ///< Drop the oldest messages.
+    drop_qos0_first, ///< Drop the oldest QoS0 messages. If there is no QoS0 message, drop the oldest ones.
+    spill,           ///< Append the message to the spill file. If the file is full, drop the new message.
+};
+
+/**
+ * @brief Limits of offline_queue
+ */
+struct offline_queue_config {
+    /// The total size of topics and contents that are kept in memory
+    std::size_t max_bytes = std::numeric_limits<std::size_t>::max();
+    /// The number of messages that are kept in memory
+    std::size_t max_messages = std::numeric_limits<std::size_t>::max();
+    offline_overflow_policy policy = offline_overflow_policy::drop_oldest;
+    /// Path prefix of the spill files. The process id and a sequence number are appended for each queue.
+    std::string spill_path = "mqtt_offline_queue";
+    /// The size of the spill file that is not exceeded
+    std::size_t max_spill_bytes = std::numeric_limits<std::size_t>::max();
+};
+
+/**
+ * @brief FIFO queue of the messages for an offline session.
+ *
+ * The messages are kept in memory up to the limits of offline_queue_config. The size of a message
+ * is the size of its topic and contents, so the contents shared by many queues are counted
+ * by each queue. When a new message exceeds the limits, the messages are dropped or spilled by
+ * the policy.<BR>
+ * With offline_overflow_policy::spill, the message is appended to the spill file. Once a message
+ * is spilled, the following messages are also spilled until the file is drained, so that the
+ * order is kept. pop() takes the messages in memory first, and then reads the spilled messages.
+ * The file is truncated when it is drained, and removed on destruction.<BR>
+ * The messages that have an expiry are removed by expire(), and skipped by pop() if they have
+ * expired. The spilled messages are only skipped by pop().
+ * This class is not thread safe.
+ */
+class offline_queue {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct message {
+        std::shared_ptr<std::string> topic;
+        std::shared_ptr<std::string> contents;
+        std::uint8_t qos;
+        /// The time when the message expires. See MQTT v5 3.3.2.3.3 Message Expiry Interval.
+        optional<clock::time_point> expiry = nullopt;
+
+        std::size_t size() const {
+            return topic->size() + contents->size();
+        }
+    };
+
+    explicit offline_queue(offline_queue_config config = offline_queue_config())
+        : config_(std::move(config)) {}
+
+    ~offline_queue() {
+        close_spill_file();
+    }
+
+    offline_queue(offline_queue const&) = delete;
+    offline_queue& operator=(offline_queue const&) = delete;
+
+    /**
+     * @brief Push the message to the back
+     * @param m message
+     * @return true if the message is queued, false if it is dropped.
+     */
+    bool push(message m) {
+        if (spilled_ != 0) return spill(m);
+        auto size = m.size();
+        if (fits(size)) {
+            push_memory(std::move(m));
+            return true;
+        }
+        if (config_.policy == offline_overflow_policy::spill) return spill(m);
+        // The message that exceeds the limit by itself is dropped without dropping the others.
+        if (size > config_.max_bytes) {
+            ++dropped_;
+            return false;
+        }
+        if (config_.policy == offline_overflow_policy::drop_qos0_first) {
+            while (!qos0_.empty() && !fits(size)) {
+                erase_memory(qos0_.front());
+                ++dropped_;
+            }
+        }
+        while (!memory_.empty() && !fits(size)) {
+            erase_memory(memory_.begin());
+            ++dropped_;
+        }
+        if (!fits(size)) {
+            // max_messages is 0
+            ++dropped_;
+            return false;
+        }
+        push_memory(std::move(m));
+        return true;
+    }
+
+    /**
+     * @brief Pop the message from the front. The expired messages are skipped.
+     * @return message. nullopt if the queue is empty or the spill file can't be read.
+     */
+    optional<message> pop() {
+        optional<clock::time_point> now;
+        auto expired =
+            [&](message const& m) {
+                if (!m.expiry) return false;
+                if (!now) now.emplace(clock::now());
+                if (*m.expiry > *now) return false;
+                ++expired_;
+                return true;
+            };
+        while (!memory_.empty()) {
+            auto it = memory_.begin();
+            message m = it->m;
+            erase_memory(it);
+            if (!expired(m)) return m;
+        }
+        while (spilled_ != 0) {
+            auto m = read_spilled();
+            if (!m || !expired(*m)) return m;
+        }
+        return nullopt;
+    }
+
+    /**
+     * @brief Pop the messages from the front
+     * @param max the maximum number of the messages
+     * @return messages
+     */
+    std::vector<message> pop(std::size_t max) {
+        std::vector<message> ret;
+        while (ret.size() != max) {
+            auto m = pop();
+            if (!m) break;
+            ret.push_back(std::move(*m));
+        }
+        return ret;
+    }
+
+    /**
+     * @brief Remove the messages in memory that have expired
+     * @param now current time
+     * @return the number of the removed messages
+     */
+    std::size_t expire(clock::time_point now) {
+        std::size_t n = 0;
+        while (!expiries_.empty() && expiries_.begin()->first <= now) {
+            erase_memory(expiries_.begin()->second);
+            ++n;
+        }
+        expired_ += n;
+        return n;
+    }
+
+    /**
+     * @brief Get the earliest expiry of the messages in memory
+     * @return the time. nullopt if no message in memory has an expiry.
+     */
+    optional<clock::time_point> next_expiry() const {
+        if (expiries_.empty()) return nullopt;
+        return expiries_.begin()->first;
+    }
+
+    bool empty() const {
+        return memory_.empty() && spilled_ == 0;
+    }
+
+    /**
+     * @brief Get the number of the queued messages
+     *        The expired messages that are not removed yet are included.
+     * @return the number of the messages in memory and in the spill file
+     */
+    std::size_t size() const {
+        return memory_.size() + spilled_;
+    }
+
+    /**
+     * @brief Get the size of the messages in memory
+     * @return the total size of topics and contents in memory
+     */
+    std::size_t memory_bytes() const {
+        return memory_bytes_;
+    }
+
+    /**
+     * @brief Get the number of the messages in the spill file
+     * @return the number of the spilled messages
+     */
+    std::size_t spilled() const {
+        return spilled_;
+    }
+
+    /**
+     * @brief Get the number of the dropped messages
+     * @return the number of the messages that are dropped by the limits or by spill file errors
+     */
+    std::size_t dropped() const {
+        return dropped_;
+    }
+
+    /**
+     * @brief Get the number of the expired messages
+     * @return the number of the messages that are removed by expire() or skipped by pop()
+     */
+    std::size_t expired() const {
+        return expired_;
+    }
+
+    /**
+     * @brief Get the path of the spill file
+     * @return path. empty if the file is not created.
+     */
+    std::string const& spill_file() const {
+        return spill_name_;
+    }
+
+private:
+    struct entry;
+    using memory_t = std::list<entry>;
+    using qos0_t = std::list<memory_t::iterator>;
+    using expiries_t = std::multimap<clock::time_point, memory_t::iterator>;
+
+    struct entry {
+        message m;
+        // valid if m.qos is 0
+        qos0_t::iterator qos0_it;
+        // valid if m.expiry has a value
+        expiries_t::iterator expiry_it;
+    };
+
+    // Record header: topic length (4 bytes), contents length (4 bytes), QoS (1 byte) and
+    // expiry (8 bytes, the ticks of the steady clock. 0 means no expiry.)
+    static constexpr std::size_t header_size = 17;
+
+    // Check a message of the size can be pushed to memory.
+    bool fits(std::size_t bytes) const {
+        return
+            memory_.size() < config_.max_messages &&
+            bytes <= config_.max_bytes &&
+            memory_bytes_ <= config_.max_bytes - bytes;
+    }
+
+    void push_memory(message m) {
+        memory_bytes_ += m.size();
+        memory_.push_back(entry { std::move(m), qos0_t::iterator(), expiries_t::iterator() });
+        auto it = std::prev(memory_.end());
+        if (it->m.qos == 0) it->qos0_it = qos0_.insert(qos0_.end(), it);
+        if (it->m.expiry) it->expiry_it = expiries_.emplace(*it->m.expiry, it);
+    }
+
+    void erase_memory(memory_t::iterator it) {
+        if (it->m.qos == 0) qos0_.erase(it->qos0_it);
+        if (it->m.expiry) expiries_.erase(it->expiry_it);
+        memory_bytes_ -= it->m.size();
+        memory_.erase(it);
+    }
+
+    static void put_uint32(char* p, std::uint32_t v) {
+        p[0] = static_cast<char>(v >> 24);
+        p[1] = static_cast<char>(v >> 16);
+        p[2] = static_cast<char>(v >> 8);
+        p[3] = static_cast<char>(v);
+    }
+
+    static std::uint32_t get_uint32(char const* p) {
+        return
+            static_cast<std::uint32_t>(static_cast<std::uint8_t>(p[0])) << 24 |
+            static_cast<std::uint32_t>(static_cast<std::uint8_t>(p[1])) << 16 |
+            static_cast<std::uint32_t>(static_cast<std::uint8_t>(p[2])) << 8 |
+            static_cast<std::uint32_t>(static_cast<std::uint8_t>(p[3]));
+    }
+
+    static void put_uint64(char* p, std::uint64_t v) {
+        put_uint32(p, static_cast<std::uint32_t>(v >> 32));
+        put_uint32(p + 4, static_cast<std::uint32_t>(v));
+    }
+
+    static std::uint64_t get_uint64(char const* p) {
+        return static_cast<std::uint64_t>(get_uint32(p)) << 32 | get_uint32(p + 4);
+    }
+
+    // Seek the spill file. std::fseek() takes long, so the position that doesn't fit in long is rejected.
+    bool seek(std::size_t pos) {
+        if (pos > static_cast<std::size_t>(std::numeric_limits<long>::max())) return false;
+        return std::fseek(file_, static_cast<long>(pos), SEEK_SET) == 0;
+    }
+
+    bool spill(message const& m) {
+        auto record_size = header_size + m.size();
+        if (write_pos_ + record_size > config_.max_spill_bytes ||
+            write_pos_ + record_size > static_cast<std::size_t>(std::numeric_limits<long>::max()) ||
+            !open_spill_file()) {
+            ++dropped_;
+            return false;
+        }
+        char header[header_size];
+        put_uint32(header, static_cast<std::uint32_t>(m.topic->size()));
+        put_uint32(header + 4, static_cast<std::uint32_t>(m.contents->size()));
+        header[8] = static_cast<char>(m.qos);
+        put_uint64(header + 9, m.expiry ? static_cast<std::uint64_t>(m.expiry->time_since_epoch().count()) : 0);
+        if (!seek(write_pos_) ||
+            std::fwrite(header, 1, header_size, file_) != header_size ||
+            std::fwrite(m.topic->data(), 1, m.topic->size(), file_) != m.topic->size() ||
+            std::fwrite(m.contents->data(), 1, m.contents->size(), file_) != m.contents->size()) {
+            ++dropped_;
+            return false;
+        }
+        write_pos_ += record_size;
+        ++spilled_;
+        return true;
+    }
+
+    optional<message> read_spilled() {
+        char header[header_size];
+        if (!seek(read_pos_) ||
+            std::fread(header, 1, header_size, file_) != header_size) {
+            return drop_spilled();
+        }
+        auto topic = std::make_shared<std::string>(get_uint32(header), '\0');
+        auto contents = std::make_shared<std::string>(get_uint32(header + 4), '\0');
+        if (std::fread(&(*topic)[0], 1, topic->size(), file_) != topic->size() ||
+            std::fread(&(*contents)[0], 1, contents->size(), file_) != contents->size()) {
+            return drop_spilled();
+        }
+        read_pos_ += header_size + topic->size() + contents->size();
+        if (--spilled_ == 0) reset_spill_file();
+        message m { std::move(topic), std::move(contents), static_cast<std::uint8_t>(header[8]) };
+        if (auto expiry = get_uint64(header + 9)) {
+            m.expiry.emplace(clock::duration(static_cast<clock::rep>(expiry)));
+        }
+        return m;
+    }
+
+    // The rest of the file can't be read.
+    optional<message> drop_spilled() {
+        dropped_ += spilled_;
+        spilled_ = 0;
+        reset_spill_file();
+        return nullopt;
+    }
+
+    bool open_spill_file() {
+        if (file_) return true;
+        if (spill_name_.empty()) {
+            // The process id avoids the collision with the queues of the other processes.
+            static std::atomic<std::uint64_t> seq(0);
+            spill_name_ = config_.spill_path + "." + std::to_string(process_id()) + "." + std::to_string(seq++);
+        }
+        file_ = std::fopen(spill_name_.c_str(), "w+b");
+        return file_ != nullptr;
+    }
+
+    static long process_id() {
+#if defined(_WIN32)
+        return static_cast<long>(::_getpid());
+#else  // defined(_WIN32)
+        return static_cast<long>(::getpid());
+#endif // defined(_WIN32)
+    }
+
+    // Truncate the file by opening it again.
+    void reset_spill_file() {
+        if (file_) {
+            std::fclose(file_);
+            file_ = std::fopen(spill_name_.c_str(), "w+b");
+        }
+        read_pos_ = 0;
+        write_pos_ = 0;
+    }
+
+    void close_spill_file() {
+        if (file_) {
+            std::fclose(file_);
+            file_ = nullptr;
+        }
+        if (!spill_name_.empty()) std::remove(spill_name_.c_str());
+    }
+
+private:
+    offline_queue_config config_;
+    memory_t memory_;
+    // The QoS0 messages in memory from the oldest
+    qos0_t qos0_;
+    // The messages in memory that have an expiry, ordered by it
+    expiries_t expiries_;
+    std::size_t memory_bytes_ = 0;
+    std::size_t dropped_ = 0;
+    std::size_t expired_ = 0;
+
+    std::string spill_name_;
+    std::FILE* file_ = nullptr;
+    std::size_t spilled_ = 0;
+    std::size_t read_pos_ = 0;
+    std::size_t write_pos_ = 0;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_OFFLINE_QUEUE_HPP
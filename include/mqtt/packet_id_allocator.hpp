@@ -0,0 +1,219 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_PACKET_ID_ALLOCATOR_HPP)
+#define MQTT_PACKET_ID_ALLOCATOR_HPP
+
+#include <cstdint>
+#include <array>
+#include <limits>
+#include <unordered_map>
+
+#include <boost/assert.hpp>
+
+#include <mqtt/exception.hpp>
+
+namespace mqtt {
+
+namespace detail {
+
+// Return the index of the lowest set bit. v must not be 0.
+inline std::size_t count_trailing_zeros(std::uint64_t v) {
+    BOOST_ASSERT(v != 0);
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<std::size_t>(__builtin_ctzll(v));
+#else  // defined(__GNUC__) || defined(__clang__)
+    std::size_t n = 0;
+    while ((v & 1) == 0) {
+        v >>= 1;
+        ++n;
+    }
+    return n;
+#endif // defined(__GNUC__) || defined(__clang__)
+}
+
+} // namespace detail
+
+/**
+ * @brief Packet identifier allocator.
+ *        Used ids are recorded in bitmap pages that cover 4096 ids each.
+ *        Pages are allocated on demand and released when they become empty,
+ *        so 4 bytes packet ids don't need the whole 2^32 bits bitmap.
+ *        acquire() searches the next free id after the last acquired one (next fit),
+ *        and it skips full pages by their counts, so acquire and release are amortized O(1).
+ * @tparam PacketId std::uint16_t or std::uint32_t
+ */
+template <typename PacketId>
+class packet_id_allocator {
+public:
+    using packet_id_t = PacketId;
+
+    /**
+     * @brief Acquire the next unused packet id.
+     *        If all packet ids are already in use, then throw packet_id_exhausted_error exception.
+     * @return packet id
+     */
+    packet_id_t acquire() {
+        if (size_ == max_id) throw packet_id_exhausted_error();
+        auto prev_page = page_index(last_);
+        std::uint64_t id = find_free(static_cast<std::uint64_t>(last_) + 1);
+        if (id > max_id) id = find_free(1);
+        BOOST_ASSERT(id != 0 && id <= max_id);
+
+        auto pid = static_cast<packet_id_t>(id);
+        auto idx = page_index(pid);
+        set(pages_[idx], pid);
+        last_ = pid;
+
+        // The page of the previous cursor is kept while the cursor stays there. Release it now if it is empty.
+        if (idx != prev_page) {
+            auto it = pages_.find(prev_page);
+            if (it != pages_.end() && it->second.used == 0) pages_.erase(it);
+        }
+        return pid;
+    }
+
+    /**
+     * @brief Mark the packet id as used.
+     * @param packet_id packet id
+     * @return true if the packet id was unused, otherwise false. 0 is never registered.
+     */
+    bool insert(packet_id_t packet_id) {
+        if (packet_id == 0) return false;
+        auto& p = pages_[page_index(packet_id)];
+        if (test(p, packet_id)) return false;
+        set(p, packet_id);
+        return true;
+    }
+
+    /**
+     * @brief Mark the packet id as unused.
+     * @param packet_id packet id
+     * @return true if the packet id was used, otherwise false.
+     */
+    bool erase(packet_id_t packet_id) {
+        auto idx = page_index(packet_id);
+        auto it = pages_.find(idx);
+        if (it == pages_.end() || !test(it->second, packet_id)) return false;
+        auto& p = it->second;
+        p.words[word_index(packet_id)] &= ~bit(packet_id);
+        --p.used;
+        --size_;
+        if (p.used == 0 && idx != page_index(last_)) pages_.erase(it);
+        return true;
+    }
+
+    /**
+     * @brief Check the packet id is used.
+     * @param packet_id packet id
+     * @return true if the packet id is used, otherwise false.
+     */
+    bool contains(packet_id_t packet_id) const {
+        auto it = pages_.find(page_index(packet_id));
+        return it != pages_.end() && test(it->second, packet_id);
+    }
+
+    /**
+     * @brief Mark all packet ids as unused.
+     *        The next acquire() continues from the last acquired packet id.
+     */
+    void clear() {
+        pages_.clear();
+        size_ = 0;
+    }
+
+    std::size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+private:
+    static constexpr std::uint64_t max_id = std::numeric_limits<packet_id_t>::max();
+    static constexpr std::size_t word_bits = 64;
+    static constexpr std::size_t page_bits = 4096;
+    static constexpr std::size_t words_per_page = page_bits / word_bits;
+    static constexpr std::uint64_t num_of_pages = (max_id + 1) / page_bits;
+
+    struct page {
+        std::array<std::uint64_t, words_per_page> words {};
+        std::size_t used = 0;
+    };
+
+    static std::uint64_t page_index(std::uint64_t id) {
+        return id / page_bits;
+    }
+
+    static std::size_t word_index(std::uint64_t id) {
+        return static_cast<std::size_t>(id % page_bits / word_bits);
+    }
+
+    static std::uint64_t bit(std::uint64_t id) {
+        return std::uint64_t(1) << (id % word_bits);
+    }
+
+    static bool test(page const& p, std::uint64_t id) {
+        return (p.words[word_index(id)] & bit(id)) != 0;
+    }
+
+    void set(page& p, std::uint64_t id) {
+        BOOST_ASSERT(!test(p, id));
+        p.words[word_index(id)] |= bit(id);
+        ++p.used;
+        ++size_;
+    }
+
+    // Return the first unused id that is greater than or equal to first, or max_id + 1 if there is no such id.
+    std::uint64_t find_free(std::uint64_t first) const {
+        for (auto idx = page_index(first); idx < num_of_pages; ++idx) {
+            std::uint64_t page_begin = idx * page_bits;
+            if (first < page_begin) first = page_begin;
+            auto it = pages_.find(idx);
+            // A page that is not allocated has no used ids.
+            if (it == pages_.end()) return first;
+            auto const& p = it->second;
+            if (p.used == page_bits) continue;
+            auto w = word_index(first);
+            // Treat the bits lower than first as used.
+            auto free_bits = ~p.words[w] & ~(bit(first) - 1);
+            while (free_bits == 0) {
+                if (++w == words_per_page) break;
+                free_bits = ~p.words[w];
+            }
+            if (w == words_per_page) continue;
+            auto id = page_begin + w * word_bits + detail::count_trailing_zeros(free_bits);
+            if (id > max_id) break;
+            return id;
+        }
+        return max_id + 1;
+    }
+
+private:
+    std::unordered_map<std::uint64_t, page> pages_;
+    std::size_t size_ = 0;
+    packet_id_t last_ = 0;
+};
+
+template <typename PacketId>
+constexpr std::uint64_t packet_id_allocator<PacketId>::max_id;
+
+template <typename PacketId>
+constexpr std::size_t packet_id_allocator<PacketId>::word_bits;
+
+template <typename PacketId>
+constexpr std::size_t packet_id_allocator<PacketId>::page_bits;
+
+template <typename PacketId>
+constexpr std::size_t packet_id_allocator<PacketId>::words_per_page;
+
+template <typename PacketId>
+constexpr std::uint64_t packet_id_allocator<PacketId>::num_of_pages;
+
+} // namespace mqtt
+
+#endif // MQTT_PACKET_ID_ALLOCATOR_HPP
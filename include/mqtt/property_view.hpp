@@ -0,0 +1,238 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_PROPERTY_VIEW_HPP)
+#define MQTT_PROPERTY_VIEW_HPP
+
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include <mqtt/buffer.hpp>
+#include <mqtt/optional.hpp>
+#include <mqtt/property_id.hpp>
+#include <mqtt/property_parse.hpp>
+#include <mqtt/property_variant.hpp>
+#include <mqtt/variable_length.hpp>
+#include <mqtt/visitor_util.hpp>
+
+namespace mqtt {
+namespace v5 {
+
+/**
+ * @brief Properties that are not decoded yet.
+ *        It refers to the encoded properties in the receive buffer, and each property is
+ *        decoded when it is accessed. Constructing, copying and iterating a property_view
+ *        don't allocate memory.
+ *        The decoded properties are the same types as v5::property::parse() returns,
+ *        e.g. property::content_type_ref for Content Type. They refer to the buffer.
+ *        Like v5::property::parse(), the iteration stops at the first malformed property.
+ */
+class property_view {
+public:
+    /**
+     * @brief Forward iterator that decodes the property on each position.
+     */
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = property_variant;
+        using difference_type = std::ptrdiff_t;
+        using pointer = property_variant const*;
+        using reference = property_variant const&;
+
+        const_iterator() = default;
+
+        reference operator*() const {
+            return *current_;
+        }
+
+        pointer operator->() const {
+            return &*current_;
+        }
+
+        const_iterator& operator++() {
+            it_ = next_;
+            decode();
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            auto ret = *this;
+            ++*this;
+            return ret;
+        }
+
+        /**
+         * @brief Get the property id without decoding
+         * @return property id
+         */
+        property::id id() const {
+            return static_cast<property::id>(*it_);
+        }
+
+        friend bool operator==(const_iterator const& lhs, const_iterator const& rhs) {
+            return lhs.it_ == rhs.it_;
+        }
+
+        friend bool operator!=(const_iterator const& lhs, const_iterator const& rhs) {
+            return !(lhs == rhs);
+        }
+
+    private:
+        friend class property_view;
+
+        const_iterator(char const* it, char const* end, std::uint64_t hidden)
+            : it_(it), next_(it), end_(end), hidden_(hidden) {
+            decode();
+        }
+
+        void decode() {
+            while (it_ != end_) {
+                auto next = it_;
+                current_ = property::parse_one(next, end_);
+                if (!current_) {
+                    it_ = end_;
+                    return;
+                }
+                if (!is_hidden(hidden_, id())) {
+                    next_ = next;
+                    return;
+                }
+                it_ = next;
+            }
+        }
+
+        char const* it_ = nullptr;
+        char const* next_ = nullptr;
+        char const* end_ = nullptr;
+        std::uint64_t hidden_ = 0;
+        mqtt::optional<property_variant> current_;
+    };
+
+    /**
+     * @brief Constructor
+     * @param buf encoded properties without the property length
+     */
+    explicit property_view(buffer buf = buffer())
+        : buf_(std::move(buf)) {}
+
+    const_iterator begin() const {
+        return const_iterator(buf_.data(), buf_.data() + buf_.size(), hidden_);
+    }
+
+    const_iterator end() const {
+        auto e = buf_.data() + buf_.size();
+        return const_iterator(e, e, hidden_);
+    }
+
+    /**
+     * @brief Check the view has no property
+     * @return true if no property is visible, otherwise false
+     */
+    bool empty() const {
+        return begin() == end();
+    }
+
+    /**
+     * @brief Get the number of the properties. The properties are decoded to count them.
+     * @return the number of the properties
+     */
+    std::size_t size() const {
+        return static_cast<std::size_t>(std::distance(begin(), end()));
+    }
+
+    /**
+     * @brief Find the first property of the type.
+     *        Only the properties before it are decoded.
+     * @tparam Property property type, e.g. property::topic_alias or property::content_type
+     * @return the received type of the property, e.g. property::content_type_ref.
+     *         nullopt if it is not found.
+     */
+    template <typename Property>
+    mqtt::optional<typename Property::recv> find() const {
+        using recv = typename Property::recv;
+        mqtt::optional<recv> ret;
+        for (auto it = begin(), e = end(); it != e && !ret; ++it) {
+            mqtt::visit(
+                make_lambda_visitor<void>(
+                    [&](recv const& p) {
+                        ret.emplace(p);
+                    },
+                    [](auto const&) {}
+                ),
+                *it
+            );
+        }
+        return ret;
+    }
+
+    /**
+     * @brief Hide the properties of the id. They are skipped by the iteration.
+     *        e.g. The endpoint hides the Topic Alias that it has resolved.
+     * @param id property id
+     */
+    void hide(property::id id) {
+        hidden_ |= std::uint64_t(1) << static_cast<std::size_t>(id);
+    }
+
+    /**
+     * @brief Decode all properties into the vector
+     *        The elements refer to the buffer, so the view (or the buffer) needs to be kept alive
+     *        while they are used.
+     * @return properties
+     */
+    std::vector<property_variant> to_vector() const {
+        return std::vector<property_variant>(begin(), end());
+    }
+
+    /**
+     * @brief Get the encoded properties
+     *        The hidden properties are included.
+     * @return buffer of the encoded properties
+     */
+    buffer const& raw() const {
+        return buf_;
+    }
+
+private:
+    static bool is_hidden(std::uint64_t hidden, property::id id) {
+        auto i = static_cast<std::size_t>(id);
+        return i < 64 && (hidden & (std::uint64_t(1) << i));
+    }
+
+    buffer buf_;
+    std::uint64_t hidden_ = 0;
+};
+
+namespace property {
+
+/**
+ * @brief Parse the property length and make the view of the properties.
+ *        No property is decoded.
+ * @param buf buffer that begins with the property length
+ * @param consumed the size of the property length and the properties is set
+ * @return property_view. nullopt if the property length is malformed or exceeds buf.
+ */
+inline
+mqtt::optional<property_view> parse_view_with_length(buffer const& buf, std::size_t& consumed) {
+    auto b = buf.data();
+    auto e = b + buf.size();
+    auto r = variable_length(b, std::min(b + 4, e));
+    auto property_length = std::get<0>(r);
+    auto length_bytes = std::get<1>(r);
+    if (length_bytes == 0 && !buf.empty()) return mqtt::nullopt;
+    if (buf.size() < length_bytes + property_length) return mqtt::nullopt;
+    consumed = length_bytes + property_length;
+    return property_view(buf.substr(length_bytes, property_length));
+}
+
+} // namespace property
+
+} // namespace v5
+} // namespace mqtt
+
+#endif // MQTT_PROPERTY_VIEW_HPP
@@ -11,6 +11,18 @@
 
 namespace mqtt {
 
+// The maximum size of a control packet. 1 byte fixed header, 4 bytes remaining length,
+// and 268,435,455 bytes remaining length. See MQTT v5 1.5.5 and 2.1.4.
+constexpr std::size_t const packet_size_no_limit = 1 + 4 + 0x0fffffff;
+
+inline std::size_t
+remaining_length_size(std::size_t remaining_length) {
+    if (remaining_length < 0x80) return 1;
+    if (remaining_length < 0x4000) return 2;
+    if (remaining_length < 0x200000) return 3;
+    return 4;
+}
+
 inline std::string
 remaining_bytes(std::size_t size) {
     auto bytes = variable_bytes(size);
@@ -0,0 +1,258 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_RETAINED_INDEX_HPP)
+#define MQTT_RETAINED_INDEX_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+#include <boost/functional/hash.hpp>
+
+#include <mqtt/optional.hpp>
+#include <mqtt/string_view.hpp>
+
+namespace mqtt {
+
+/**
+ * @brief Map of topic names to retained messages that can be searched by topic filters.
+ *        It is the reverse of subscription_map. Topic names are stored in a tree of topic levels,
+ *        and a topic filter is matched by walking the tree. A level of the filter visits one child,
+ *        '+' visits all children, and '#' visits the whole subtree. So the cost is proportional to
+ *        the number of visited nodes, not the number of retained messages.
+ *        Filters that start with a wildcard don't match topic names that start with '$'.
+ *        This class is not thread safe.
+ *
+ * @tparam Value retained message
+ */
+template <typename Value>
+class retained_index {
+public:
+    retained_index() = default;
+    retained_index(retained_index const&) = delete;
+    retained_index(retained_index&&) = delete;
+    retained_index& operator=(retained_index const&) = delete;
+    retained_index& operator=(retained_index&&) = delete;
+
+    /**
+     * @brief Insert the value, or overwrite it if the topic already has a value.
+     * @param topic topic name. It should be valid. See validate_topic_name().
+     * @param value retained message
+     * @return true if inserted, false if overwritten.
+     */
+    bool insert_or_assign(string_view topic, Value value) {
+        node* n = &root_;
+        for_each_level(
+            topic,
+            [&](string_view level) {
+                n = &n->child(level);
+            }
+        );
+        bool inserted = !n->value;
+        n->value.emplace(std::move(value));
+        if (inserted) ++size_;
+        return inserted;
+    }
+
+    /**
+     * @brief Erase the value of the topic
+     * @param topic topic name
+     * @return true if erased, false if not found.
+     */
+    bool erase(string_view topic) {
+        node* n = find_node(topic);
+        if (!n || !n->value) return false;
+        n->value = nullopt;
+        --size_;
+        prune(n);
+        return true;
+    }
+
+    /**
+     * @brief Find the value of the topic. Wildcards are not expanded.
+     * @param topic topic name
+     * @return pointer to the value. nullptr if not found.
+     */
+    Value const* find(string_view topic) const {
+        auto n = const_cast<retained_index*>(this)->find_node(topic);
+        if (!n || !n->value) return nullptr;
+        return &*n->value;
+    }
+
+    /**
+     * @brief Call f for each value whose topic name matches the filter.
+     *        The values must not be inserted or erased in f.
+     * @param filter topic filter. It should be valid. See validate_topic_filter().
+     * @param f      function object that is called as f(Value const&)
+     */
+    template <typename Func>
+    void match(string_view filter, Func&& f) const {
+        // nodes that match the levels processed so far
+        std::vector<node const*> current { &root_ };
+        std::vector<node const*> next;
+        bool first = true;
+        bool hash = false;
+        for_each_level(
+            filter,
+            [&](string_view level) {
+                if (hash) return;
+                next.clear();
+                if (level == "#") {
+                    hash = true;
+                    for (auto n : current) {
+                        // "a/#" matches "a" too
+                        if (n != &root_ && n->value) f(*n->value);
+                        for (auto const& c : n->children) {
+                            if (first && is_dollar(c.first)) continue;
+                            visit_subtree(*c.second, f);
+                        }
+                    }
+                    return;
+                }
+                for (auto n : current) {
+                    if (level == "+") {
+                        for (auto const& c : n->children) {
+                            if (first && is_dollar(c.first)) continue;
+                            next.push_back(c.second.get());
+                        }
+                    }
+                    else if (auto c = n->find_child(level)) {
+                        next.push_back(c);
+                    }
+                }
+                first = false;
+                std::swap(current, next);
+            }
+        );
+        if (hash) return;
+        for (auto n : current) {
+            if (n->value) f(*n->value);
+        }
+    }
+
+    /**
+     * @brief Get the values whose topic name matches the filter
+     * @param filter topic filter
+     * @return copies of the matched values
+     */
+    std::vector<Value> match(string_view filter) const {
+        std::vector<Value> ret;
+        match(
+            filter,
+            [&](Value const& v) {
+                ret.push_back(v);
+            }
+        );
+        return ret;
+    }
+
+    /**
+     * @brief Get the number of the values
+     * @return the number of the topics that have a value
+     */
+    std::size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+private:
+    struct string_view_hash {
+        std::size_t operator()(string_view sv) const {
+            return boost::hash_range(sv.begin(), sv.end());
+        }
+    };
+
+    struct node {
+        node() = default;
+        node(node* parent, string_view name)
+            :parent(parent), name(name.data(), name.size()) {}
+
+        node& child(string_view level) {
+            auto it = children.find(level);
+            if (it != children.end()) return *it->second;
+            auto c = std::make_unique<node>(this, level);
+            auto p = c.get();
+            // The key refers to the name in the node. The node is never moved.
+            children.emplace(string_view(p->name), std::move(c));
+            return *p;
+        }
+
+        node* find_child(string_view level) const {
+            auto it = children.find(level);
+            if (it == children.end()) return nullptr;
+            return it->second.get();
+        }
+
+        bool unused() const {
+            return !value && children.empty();
+        }
+
+        node* parent = nullptr;
+        std::string name;
+        optional<Value> value;
+        std::unordered_map<string_view, std::unique_ptr<node>, string_view_hash> children;
+    };
+
+    static bool is_dollar(string_view level) {
+        return !level.empty() && level.front() == '$';
+    }
+
+    template <typename Func>
+    static void for_each_level(string_view s, Func&& f) {
+        std::size_t b = 0;
+        while (true) {
+            auto e = s.find('/', b);
+            if (e == string_view::npos) {
+                f(s.substr(b));
+                return;
+            }
+            f(s.substr(b, e - b));
+            b = e + 1;
+        }
+    }
+
+    template <typename Func>
+    static void visit_subtree(node const& n, Func& f) {
+        if (n.value) f(*n.value);
+        for (auto const& c : n.children) {
+            visit_subtree(*c.second, f);
+        }
+    }
+
+    node* find_node(string_view topic) {
+        node* n = &root_;
+        for_each_level(
+            topic,
+            [&](string_view level) {
+                if (!n) return;
+                n = n->find_child(level);
+            }
+        );
+        return n;
+    }
+
+    // Remove unused nodes from n to the root
+    void prune(node* n) {
+        while (n != &root_ && n->unused()) {
+            auto p = n->parent;
+            p->children.erase(string_view(n->name));
+            n = p;
+        }
+    }
+
+private:
+    node root_;
+    std::size_t size_ = 0;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_RETAINED_INDEX_HPP
@@ -23,6 +23,11 @@
 #endif // defined(MQTT_USE_WS)
 
 #include <mqtt/endpoint.hpp>
+#include <mqtt/buffer_pool.hpp>
+#include <mqtt/write_batch_policy.hpp>
+#include <mqtt/latency.hpp>
+#include <mqtt/keep_alive.hpp>
+#include <mqtt/traffic_stats.hpp>
 #include <mqtt/null_strand.hpp>
 
 namespace mqtt {
@@ -33,12 +38,13 @@ template <
     typename Strand = as::io_service::strand,
     typename Mutex = std::mutex,
     template<typename...> class LockGuard = std::lock_guard,
-    std::size_t PacketIdBytes = 2
+    std::size_t PacketIdBytes = 2,
+    template<typename...> class InflightStore = ordered_inflight_store
 >
 class server {
 public:
     using socket_t = tcp_endpoint<as::ip::tcp::socket, Strand>;
-    using endpoint_t = endpoint<socket_t, Mutex, LockGuard, PacketIdBytes>;
+    using endpoint_t = endpoint<socket_t, Mutex, LockGuard, PacketIdBytes, InflightStore>;
 
     /**
      * @brief Accept handler
@@ -52,6 +58,12 @@ public:
      */
     using error_handler = std::function<void(boost::system::error_code const& ec)>;
 
+    /**
+     * @brief io_service selector
+     * @return io_service that is used by the next accepted connection
+     */
+    using io_service_selector = std::function<as::io_service&()>;
+
     template <typename AsioEndpoint, typename AcceptorConfig>
     server(
         AsioEndpoint&& ep,
@@ -137,9 +149,83 @@ public:
         version_ = version;
     }
 
+    /**
+     * @brief Set buffer pool for receiving messages
+     * @param pool buffer pool that is set to each accepted endpoint.
+     * The pool can be shared with other servers, e.g. servers on the same io_service.
+     * See endpoint::set_buffer_pool().
+     */
+    void set_buffer_pool(std::shared_ptr<buffer_pool> pool) {
+        pool_ = std::move(pool);
+    }
+
+    /**
+     * @brief Set write batch policy
+     * @param policy write batch policy that is set to each accepted endpoint.
+     * See endpoint::set_write_batch_policy().
+     */
+    void set_write_batch_policy(write_batch_policy policy) {
+        write_batch_policy_ = policy;
+    }
+
+    /**
+     * @brief Set the maximum packet size that accepted endpoints receive
+     * @param size maximum packet size that is set to each accepted endpoint.
+     * See endpoint::set_maximum_packet_size_recv().
+     */
+    void set_maximum_packet_size_recv(std::size_t size) {
+        maximum_packet_size_recv_ = size;
+    }
+
+    /**
+     * @brief Enforce the Keep Alive of the clients
+     * @param b If true, accepted endpoints close the connection when no control packet is received
+     * within one and a half times the Keep Alive. The connections on the same io_service share
+     * the keep_alive_service of the io_service.
+     * See endpoint::set_keep_alive_service().
+     */
+    void set_enforce_keep_alive(bool b = true) {
+        enforce_keep_alive_ = b;
+    }
+
+#if defined(MQTT_USE_LATENCY_METRICS)
+
+    /**
+     * @brief Set the latency metrics that accepted endpoints record
+     * @param metrics latency metrics that is shared by all accepted endpoints.
+     * See endpoint::set_latency_metrics().
+     */
+    void set_latency_metrics(std::shared_ptr<latency_metrics> metrics) {
+        latency_metrics_ = std::move(metrics);
+    }
+
+#endif // defined(MQTT_USE_LATENCY_METRICS)
+
+    /**
+     * @brief Get the traffic statistics of the endpoints that are accepted by this server
+     * @return snapshot of the counters. Bytes and packets are summed up over all accepted endpoints.
+     *         Queue and store gauges are summed up over the living endpoints.
+     * See endpoint::stats().
+     */
+    traffic_stats stats() const {
+        return traffic_->take_snapshot();
+    }
+
+    /**
+     * @brief Set io_service selector
+     * @param selector function that returns io_service for the next accepted connection.
+     * It is called on the ios_accept thread when the server prepares the socket for the next accept.
+     * It can be used to distribute connections over io_services that are run on different threads.
+     * If it is not set, ios_con passed to the constructor is used.
+     */
+    void set_io_service_selector(io_service_selector selector = io_service_selector()) {
+        ios_con_selector_ = std::move(selector);
+    }
+
 private:
     void renew_socket() {
-        socket_.reset(new socket_t(ios_con_));
+        socket_ios_ = &(ios_con_selector_ ? ios_con_selector_() : ios_con_);
+        socket_.reset(new socket_t(*socket_ios_));
     }
 
     void do_accept() {
@@ -154,6 +240,14 @@ private:
                     return;
                 }
                 auto sp = std::make_shared<endpoint_t>(std::move(socket_), version_);
+                if (pool_) sp->set_buffer_pool(pool_);
+                sp->set_write_batch_policy(write_batch_policy_);
+                sp->set_maximum_packet_size_recv(maximum_packet_size_recv_);
+                if (enforce_keep_alive_) sp->set_keep_alive_service(&as::use_service<keep_alive_service>(*socket_ios_));
+#if defined(MQTT_USE_LATENCY_METRICS)
+                sp->set_latency_metrics(latency_metrics_);
+#endif // defined(MQTT_USE_LATENCY_METRICS)
+                sp->set_traffic_counters(traffic_);
                 if (h_accept_) h_accept_(*sp);
                 renew_socket();
                 do_accept();
@@ -165,6 +259,8 @@ private:
     as::ip::tcp::endpoint ep_;
     as::io_service& ios_accept_;
     as::io_service& ios_con_;
+    io_service_selector ios_con_selector_;
+    as::io_service* socket_ios_{nullptr};
     mqtt::optional<as::ip::tcp::acceptor> acceptor_;
     std::function<void(as::ip::tcp::acceptor&)> config_;
     std::unique_ptr<socket_t> socket_;
@@ -172,6 +268,14 @@ private:
     accept_handler h_accept_;
     error_handler h_error_;
     mqtt::protocol_version version_ = protocol_version::undetermined;
+    std::shared_ptr<buffer_pool> pool_;
+    write_batch_policy write_batch_policy_;
+    std::size_t maximum_packet_size_recv_{packet_size_no_limit};
+    bool enforce_keep_alive_{false};
+#if defined(MQTT_USE_LATENCY_METRICS)
+    std::shared_ptr<latency_metrics> latency_metrics_;
+#endif // defined(MQTT_USE_LATENCY_METRICS)
+    std::shared_ptr<traffic_counters> traffic_{std::make_shared<traffic_counters>()};
 };
 
 #if !defined(MQTT_NO_TLS)
@@ -180,12 +284,13 @@ template <
     typename Strand = as::io_service::strand,
     typename Mutex = std::mutex,
     template<typename...> class LockGuard = std::lock_guard,
-    std::size_t PacketIdBytes = 2
+    std::size_t PacketIdBytes = 2,
+    template<typename...> class InflightStore = ordered_inflight_store
 >
 class server_tls {
 public:
     using socket_t = tcp_endpoint<as::ssl::stream<as::ip::tcp::socket>, Strand>;
-    using endpoint_t = endpoint<socket_t, Mutex, LockGuard, PacketIdBytes>;
+    using endpoint_t = endpoint<socket_t, Mutex, LockGuard, PacketIdBytes, InflightStore>;
 
     /**
      * @brief Accept handler
@@ -199,6 +304,12 @@ public:
      */
     using error_handler = std::function<void(boost::system::error_code const& ec)>;
 
+    /**
+     * @brief io_service selector
+     * @return io_service that is used by the next accepted connection
+     */
+    using io_service_selector = std::function<as::io_service&()>;
+
     template <typename AsioEndpoint, typename AcceptorConfig>
     server_tls(
         AsioEndpoint&& ep,
@@ -289,9 +400,83 @@ public:
         version_ = version;
     }
 
+    /**
+     * @brief Set buffer pool for receiving messages
+     * @param pool buffer pool that is set to each accepted endpoint.
+     * The pool can be shared with other servers, e.g. servers on the same io_service.
+     * See endpoint::set_buffer_pool().
+     */
+    void set_buffer_pool(std::shared_ptr<buffer_pool> pool) {
+        pool_ = std::move(pool);
+    }
+
+    /**
+     * @brief Set write batch policy
+     * @param policy write batch policy that is set to each accepted endpoint.
+     * See endpoint::set_write_batch_policy().
+     */
+    void set_write_batch_policy(write_batch_policy policy) {
+        write_batch_policy_ = policy;
+    }
+
+    /**
+     * @brief Set the maximum packet size that accepted endpoints receive
+     * @param size maximum packet size that is set to each accepted endpoint.
+     * See endpoint::set_maximum_packet_size_recv().
+     */
+    void set_maximum_packet_size_recv(std::size_t size) {
+        maximum_packet_size_recv_ = size;
+    }
+
+    /**
+     * @brief Enforce the Keep Alive of the clients
+     * @param b If true, accepted endpoints close the connection when no control packet is received
+     * within one and a half times the Keep Alive. The connections on the same io_service share
+     * the keep_alive_service of the io_service.
+     * See endpoint::set_keep_alive_service().
+     */
+    void set_enforce_keep_alive(bool b = true) {
+        enforce_keep_alive_ = b;
+    }
+
+#if defined(MQTT_USE_LATENCY_METRICS)
+
+    /**
+     * @brief Set the latency metrics that accepted endpoints record
+     * @param metrics latency metrics that is shared by all accepted endpoints.
+     * See endpoint::set_latency_metrics().
+     */
+    void set_latency_metrics(std::shared_ptr<latency_metrics> metrics) {
+        latency_metrics_ = std::move(metrics);
+    }
+
+#endif // defined(MQTT_USE_LATENCY_METRICS)
+
+    /**
+     * @brief Get the traffic statistics of the endpoints that are accepted by this server
+     * @return snapshot of the counters. Bytes and packets are summed up over all accepted endpoints.
+     *         Queue and store gauges are summed up over the living endpoints.
+     * See endpoint::stats().
+     */
+    traffic_stats stats() const {
+        return traffic_->take_snapshot();
+    }
+
+    /**
+     * @brief Set io_service selector
+     * @param selector function that returns io_service for the next accepted connection.
+     * It is called on the ios_accept thread when the server prepares the socket for the next accept.
+     * It can be used to distribute connections over io_services that are run on different threads.
+     * If it is not set, ios_con passed to the constructor is used.
+     */
+    void set_io_service_selector(io_service_selector selector = io_service_selector()) {
+        ios_con_selector_ = std::move(selector);
+    }
+
 private:
     void renew_socket() {
-        socket_.reset(new socket_t(ios_con_, ctx_));
+        socket_ios_ = &(ios_con_selector_ ? ios_con_selector_() : ios_con_);
+        socket_.reset(new socket_t(*socket_ios_, ctx_));
     }
 
     void do_accept() {
@@ -315,6 +500,14 @@ private:
                             return;
                         }
                         auto sp = std::make_shared<endpoint_t>(std::move(socket_), version_);
+                        if (pool_) sp->set_buffer_pool(pool_);
+                        sp->set_write_batch_policy(write_batch_policy_);
+                        sp->set_maximum_packet_size_recv(maximum_packet_size_recv_);
+                        if (enforce_keep_alive_) sp->set_keep_alive_service(&as::use_service<keep_alive_service>(*socket_ios_));
+#if defined(MQTT_USE_LATENCY_METRICS)
+                        sp->set_latency_metrics(latency_metrics_);
+#endif // defined(MQTT_USE_LATENCY_METRICS)
+                        sp->set_traffic_counters(traffic_);
                         if (h_accept_) h_accept_(*sp);
                         renew_socket();
                         do_accept();
@@ -328,6 +521,8 @@ private:
     as::ip::tcp::endpoint ep_;
     as::io_service& ios_accept_;
     as::io_service& ios_con_;
+    io_service_selector ios_con_selector_;
+    as::io_service* socket_ios_{nullptr};
     mqtt::optional<as::ip::tcp::acceptor> acceptor_;
     std::function<void(as::ip::tcp::acceptor&)> config_;
     std::unique_ptr<socket_t> socket_;
@@ -336,6 +531,14 @@ private:
     error_handler h_error_;
     as::ssl::context ctx_;
     mqtt::protocol_version version_ = protocol_version::undetermined;
+    std::shared_ptr<buffer_pool> pool_;
+    write_batch_policy write_batch_policy_;
+    std::size_t maximum_packet_size_recv_{packet_size_no_limit};
+    bool enforce_keep_alive_{false};
+#if defined(MQTT_USE_LATENCY_METRICS)
+    std::shared_ptr<latency_metrics> latency_metrics_;
+#endif // defined(MQTT_USE_LATENCY_METRICS)
+    std::shared_ptr<traffic_counters> traffic_{std::make_shared<traffic_counters>()};
 };
 
 #endif // !defined(MQTT_NO_TLS)
@@ -361,12 +564,13 @@ template <
     typename Strand = as::io_service::strand,
     typename Mutex = std::mutex,
     template<typename...> class LockGuard = std::lock_guard,
-    std::size_t PacketIdBytes = 2
+    std::size_t PacketIdBytes = 2,
+    template<typename...> class InflightStore = ordered_inflight_store
 >
 class server_ws {
 public:
     using socket_t = ws_endpoint<as::ip::tcp::socket, Strand>;
-    using endpoint_t = endpoint<socket_t, Mutex, LockGuard, PacketIdBytes>;
+    using endpoint_t = endpoint<socket_t, Mutex, LockGuard, PacketIdBytes, InflightStore>;
 
     /**
      * @brief Accept handler
@@ -380,6 +584,12 @@ public:
      */
     using error_handler = std::function<void(boost::system::error_code const& ec)>;
 
+    /**
+     * @brief io_service selector
+     * @return io_service that is used by the next accepted connection
+     */
+    using io_service_selector = std::function<as::io_service&()>;
+
     template <typename AsioEndpoint, typename AcceptorConfig>
     server_ws(
         AsioEndpoint&& ep,
@@ -465,9 +675,83 @@ public:
         version_ = version;
     }
 
+    /**
+     * @brief Set buffer pool for receiving messages
+     * @param pool buffer pool that is set to each accepted endpoint.
+     * The pool can be shared with other servers, e.g. servers on the same io_service.
+     * See endpoint::set_buffer_pool().
+     */
+    void set_buffer_pool(std::shared_ptr<buffer_pool> pool) {
+        pool_ = std::move(pool);
+    }
+
+    /**
+     * @brief Set write batch policy
+     * @param policy write batch policy that is set to each accepted endpoint.
+     * See endpoint::set_write_batch_policy().
+     */
+    void set_write_batch_policy(write_batch_policy policy) {
+        write_batch_policy_ = policy;
+    }
+
+    /**
+     * @brief Set the maximum packet size that accepted endpoints receive
+     * @param size maximum packet size that is set to each accepted endpoint.
+     * See endpoint::set_maximum_packet_size_recv().
+     */
+    void set_maximum_packet_size_recv(std::size_t size) {
+        maximum_packet_size_recv_ = size;
+    }
+
+    /**
+     * @brief Enforce the Keep Alive of the clients
+     * @param b If true, accepted endpoints close the connection when no control packet is received
+     * within one and a half times the Keep Alive. The connections on the same io_service share
+     * the keep_alive_service of the io_service.
+     * See endpoint::set_keep_alive_service().
+     */
+    void set_enforce_keep_alive(bool b = true) {
+        enforce_keep_alive_ = b;
+    }
+
+#if defined(MQTT_USE_LATENCY_METRICS)
+
+    /**
+     * @brief Set the latency metrics that accepted endpoints record
+     * @param metrics latency metrics that is shared by all accepted endpoints.
+     * See endpoint::set_latency_metrics().
+     */
+    void set_latency_metrics(std::shared_ptr<latency_metrics> metrics) {
+        latency_metrics_ = std::move(metrics);
+    }
+
+#endif // defined(MQTT_USE_LATENCY_METRICS)
+
+    /**
+     * @brief Get the traffic statistics of the endpoints that are accepted by this server
+     * @return snapshot of the counters. Bytes and packets are summed up over all accepted endpoints.
+     *         Queue and store gauges are summed up over the living endpoints.
+     * See endpoint::stats().
+     */
+    traffic_stats stats() const {
+        return traffic_->take_snapshot();
+    }
+
+    /**
+     * @brief Set io_service selector
+     * @param selector function that returns io_service for the next accepted connection.
+     * It is called on the ios_accept thread when the server prepares the socket for the next accept.
+     * It can be used to distribute connections over io_services that are run on different threads.
+     * If it is not set, ios_con passed to the constructor is used.
+     */
+    void set_io_service_selector(io_service_selector selector = io_service_selector()) {
+        ios_con_selector_ = std::move(selector);
+    }
+
 private:
     void renew_socket() {
-        socket_.reset(new socket_t(ios_con_));
+        socket_ios_ = &(ios_con_selector_ ? ios_con_selector_() : ios_con_);
+        socket_.reset(new socket_t(*socket_ios_));
     }
 
     void do_accept() {
@@ -516,6 +800,14 @@ private:
                                     return;
                                 }
                                 auto sp = std::make_shared<endpoint_t>(std::move(socket_), version_);
+                                if (pool_) sp->set_buffer_pool(pool_);
+                                sp->set_write_batch_policy(write_batch_policy_);
+                                sp->set_maximum_packet_size_recv(maximum_packet_size_recv_);
+                                if (enforce_keep_alive_) sp->set_keep_alive_service(&as::use_service<keep_alive_service>(*socket_ios_));
+#if defined(MQTT_USE_LATENCY_METRICS)
+                                sp->set_latency_metrics(latency_metrics_);
+#endif // defined(MQTT_USE_LATENCY_METRICS)
+                                sp->set_traffic_counters(traffic_);
                                 if (h_accept_) h_accept_(*sp);
                                 renew_socket();
                                 do_accept();
@@ -531,6 +823,8 @@ private:
     as::ip::tcp::endpoint ep_;
     as::io_service& ios_accept_;
     as::io_service& ios_con_;
+    io_service_selector ios_con_selector_;
+    as::io_service* socket_ios_{nullptr};
     mqtt::optional<as::ip::tcp::acceptor> acceptor_;
     std::function<void(as::ip::tcp::acceptor&)> config_;
     std::unique_ptr<socket_t> socket_;
@@ -538,6 +832,14 @@ private:
     accept_handler h_accept_;
     error_handler h_error_;
     mqtt::protocol_version version_ = protocol_version::undetermined;
+    std::shared_ptr<buffer_pool> pool_;
+    write_batch_policy write_batch_policy_;
+    std::size_t maximum_packet_size_recv_{packet_size_no_limit};
+    bool enforce_keep_alive_{false};
+#if defined(MQTT_USE_LATENCY_METRICS)
+    std::shared_ptr<latency_metrics> latency_metrics_;
+#endif // defined(MQTT_USE_LATENCY_METRICS)
+    std::shared_ptr<traffic_counters> traffic_{std::make_shared<traffic_counters>()};
 };
 
 
@@ -547,12 +849,13 @@ template <
     typename Strand = as::io_service::strand,
     typename Mutex = std::mutex,
     template<typename...> class LockGuard = std::lock_guard,
-    std::size_t PacketIdBytes = 2
+    std::size_t PacketIdBytes = 2,
+    template<typename...> class InflightStore = ordered_inflight_store
 >
 class server_tls_ws {
 public:
     using socket_t = mqtt::ws_endpoint<as::ssl::stream<as::ip::tcp::socket>, Strand>;
-    using endpoint_t = endpoint<socket_t, Mutex, LockGuard, PacketIdBytes>;
+    using endpoint_t = endpoint<socket_t, Mutex, LockGuard, PacketIdBytes, InflightStore>;
 
     /**
      * @brief Accept handler
@@ -566,6 +869,12 @@ public:
      */
     using error_handler = std::function<void(boost::system::error_code const& ec)>;
 
+    /**
+     * @brief io_service selector
+     * @return io_service that is used by the next accepted connection
+     */
+    using io_service_selector = std::function<as::io_service&()>;
+
     template <typename AsioEndpoint, typename AcceptorConfig>
     server_tls_ws(
         AsioEndpoint&& ep,
@@ -656,9 +965,83 @@ public:
         version_ = version;
     }
 
+    /**
+     * @brief Set buffer pool for receiving messages
+     * @param pool buffer pool that is set to each accepted endpoint.
+     * The pool can be shared with other servers, e.g. servers on the same io_service.
+     * See endpoint::set_buffer_pool().
+     */
+    void set_buffer_pool(std::shared_ptr<buffer_pool> pool) {
+        pool_ = std::move(pool);
+    }
+
+    /**
+     * @brief Set write batch policy
+     * @param policy write batch policy that is set to each accepted endpoint.
+     * See endpoint::set_write_batch_policy().
+     */
+    void set_write_batch_policy(write_batch_policy policy) {
+        write_batch_policy_ = policy;
+    }
+
+    /**
+     * @brief Set the maximum packet size that accepted endpoints receive
+     * @param size maximum packet size that is set to each accepted endpoint.
+     * See endpoint::set_maximum_packet_size_recv().
+     */
+    void set_maximum_packet_size_recv(std::size_t size) {
+        maximum_packet_size_recv_ = size;
+    }
+
+    /**
+     * @brief Enforce the Keep Alive of the clients
+     * @param b If true, accepted endpoints close the connection when no control packet is received
+     * within one and a half times the Keep Alive. The connections on the same io_service share
+     * the keep_alive_service of the io_service.
+     * See endpoint::set_keep_alive_service().
+     */
+    void set_enforce_keep_alive(bool b = true) {
+        enforce_keep_alive_ = b;
+    }
+
+#if defined(MQTT_USE_LATENCY_METRICS)
+
+    /**
+     * @brief Set the latency metrics that accepted endpoints record
+     * @param metrics latency metrics that is shared by all accepted endpoints.
+     * See endpoint::set_latency_metrics().
+     */
+    void set_latency_metrics(std::shared_ptr<latency_metrics> metrics) {
+        latency_metrics_ = std::move(metrics);
+    }
+
+#endif // defined(MQTT_USE_LATENCY_METRICS)
+
+    /**
+     * @brief Get the traffic statistics of the endpoints that are accepted by this server
+     * @return snapshot of the counters. Bytes and packets are summed up over all accepted endpoints.
+     *         Queue and store gauges are summed up over the living endpoints.
+     * See endpoint::stats().
+     */
+    traffic_stats stats() const {
+        return traffic_->take_snapshot();
+    }
+
+    /**
+     * @brief Set io_service selector
+     * @param selector function that returns io_service for the next accepted connection.
+     * It is called on the ios_accept thread when the server prepares the socket for the next accept.
+     * It can be used to distribute connections over io_services that are run on different threads.
+     * If it is not set, ios_con passed to the constructor is used.
+     */
+    void set_io_service_selector(io_service_selector selector = io_service_selector()) {
+        ios_con_selector_ = std::move(selector);
+    }
+
 private:
     void renew_socket() {
-        socket_.reset(new socket_t(ios_con_, ctx_));
+        socket_ios_ = &(ios_con_selector_ ? ios_con_selector_() : ios_con_);
+        socket_.reset(new socket_t(*socket_ios_, ctx_));
     }
 
     void do_accept() {
@@ -716,6 +1099,14 @@ private:
                                             return;
                                         }
                                         auto sp = std::make_shared<endpoint_t>(std::move(socket_), version_);
+                                        if (pool_) sp->set_buffer_pool(pool_);
+                                        sp->set_write_batch_policy(write_batch_policy_);
+                                        sp->set_maximum_packet_size_recv(maximum_packet_size_recv_);
+                                        if (enforce_keep_alive_) sp->set_keep_alive_service(&as::use_service<keep_alive_service>(*socket_ios_));
+#if defined(MQTT_USE_LATENCY_METRICS)
+                                        sp->set_latency_metrics(latency_metrics_);
+#endif // defined(MQTT_USE_LATENCY_METRICS)
+                                        sp->set_traffic_counters(traffic_);
                                         if (h_accept_) h_accept_(*sp);
                                         renew_socket();
                                         do_accept();
@@ -733,6 +1124,8 @@ private:
     as::ip::tcp::endpoint ep_;
     as::io_service& ios_accept_;
     as::io_service& ios_con_;
+    io_service_selector ios_con_selector_;
+    as::io_service* socket_ios_{nullptr};
     mqtt::optional<as::ip::tcp::acceptor> acceptor_;
     std::function<void(as::ip::tcp::acceptor&)> config_;
     std::unique_ptr<socket_t> socket_;
@@ -741,6 +1134,14 @@ private:
     error_handler h_error_;
     as::ssl::context ctx_;
     mqtt::protocol_version version_ = protocol_version::undetermined;
+    std::shared_ptr<buffer_pool> pool_;
+    write_batch_policy write_batch_policy_;
+    std::size_t maximum_packet_size_recv_{packet_size_no_limit};
+    bool enforce_keep_alive_{false};
+#if defined(MQTT_USE_LATENCY_METRICS)
+    std::shared_ptr<latency_metrics> latency_metrics_;
+#endif // defined(MQTT_USE_LATENCY_METRICS)
+    std::shared_ptr<traffic_counters> traffic_{std::make_shared<traffic_counters>()};
 };
 
 #endif // !defined(MQTT_NO_TLS)
@@ -0,0 +1,722 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_SESSION_LOG_HPP)
+#define MQTT_SESSION_LOG_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+#if defined(_WIN32)
+#include <io.h>
+#else  // defined(_WIN32)
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#endif // defined(_WIN32)
+
+#include <boost/asio/buffer.hpp>
+#include <boost/crc.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <mqtt/protocol_version.hpp>
+#include <mqtt/exception.hpp>
+
+namespace mqtt {
+
+namespace as = boost::asio;
+
+/**
+ * @brief File-backed store of the QoS1 and QoS2 messages that are not acknowledged yet.
+ *
+ * The messages given by the serialize handlers of endpoint are appended to segment files
+ * `<path>.<n>`. A record of a message replaces the older record of the same packet id,
+ * and a remove record invalidates it.<BR>
+ * The records are written and fsynced by a dedicated thread, so the callers are not blocked.
+ * All records that are appended while the previous write is in progress are committed by
+ * one fsync (group commit). flush() waits until the appended records are durable.<BR>
+ * When a segment reaches the segment size, the next segment is started. The oldest segment is
+ * deleted when it has no live records. When the dead records exceed the live records by more than
+ * two segments, the live records of the oldest segment are copied to the current segment and
+ * the oldest segment is deleted (compaction). So the files are at most about twice as large as
+ * the live records. The first segment number is kept in `<path>.head`. The head is replaced
+ * atomically before the segment is deleted. If the head is missing or broken, the lowest existing
+ * segment is used as the first segment.<BR>
+ * On construction, the existing segments are scanned, and the records after a broken record
+ * (e.g. the tail that was being written on crash) are ignored. restore() passes the live messages
+ * to the endpoint in the order they were stored. Each record has a sequence number for that,
+ * because a compacted record is placed after the records that were stored later.
+ * The segments are memory mapped, and the restored messages refer to the mappings directly
+ * instead of copying them.
+ */
+class session_log {
+public:
+    /**
+     * @brief Constructor
+     *        Open the log and recover the live records.
+     * @param path         path prefix of the log files
+     * @param segment_size size of a segment file that starts the next segment
+     */
+    explicit session_log(std::string path, std::size_t segment_size = 16 * 1024 * 1024)
+        : path_(std::move(path)),
+          segment_size_(segment_size) {
+        recover();
+        writer_ = std::thread([this] { run(); });
+    }
+
+    /**
+     * @brief Destructor
+     *        The appended records are written before the destruction.
+     */
+    ~session_log() {
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        writer_.join();
+        if (file_) std::fclose(file_);
+    }
+
+    session_log(session_log const&) = delete;
+    session_log& operator=(session_log const&) = delete;
+
+    /**
+     * @brief Set the commit interval
+     * @param interval
+     *        The writer waits for the interval before writing to gather more records into one fsync.
+     *        The default value is zero, that means the records are written as soon as possible,
+     *        and the records appended during the write are committed together.
+     */
+    void set_commit_interval(std::chrono::steady_clock::duration interval) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        commit_interval_ = interval;
+    }
+
+    /**
+     * @brief Set the serialize handlers of the endpoint to store the messages to this log.
+     *        Both MQTT v3.1.1 and v5 handlers are set. The messages are appended without
+     *        creating continuous buffers.
+     * @param ep endpoint
+     */
+    template <typename Endpoint>
+    void set_serialize_handlers(Endpoint& ep) {
+        auto h_store =
+            [this](auto msg) {
+                store(msg.packet_id(), msg.const_buffer_sequence());
+            };
+        auto h_remove =
+            [this](typename Endpoint::packet_id_t packet_id) {
+                remove(packet_id);
+            };
+        ep.set_serialize_handlers(
+            typename Endpoint::serialize_publish_message_handler(h_store),
+            typename Endpoint::serialize_pubrel_message_handler(h_store),
+            h_remove
+        );
+        ep.set_v5_serialize_handlers(
+            typename Endpoint::serialize_v5_publish_message_handler(h_store),
+            typename Endpoint::serialize_v5_pubrel_message_handler(h_store),
+            h_remove
+        );
+    }
+
+    /**
+     * @brief Restore the live messages to the endpoint.
+     *        This function should be called before connect.
+     *        restore_v5_serialized_message() is used if the protocol version of the endpoint is v5,
+     *        otherwise restore_serialized_message() is used.
+     *        The messages are not copied. They refer to the memory mapped segments, and each message
+     *        keeps the mapping of its segment until it is acknowledged.
+     * @param ep endpoint
+     */
+    template <typename Endpoint>
+    void restore(Endpoint& ep) {
+        using packet_id_t = typename Endpoint::packet_id_t;
+        bool v5 = ep.get_protocol_version() == protocol_version::v5;
+        for_each_mapped(
+            [&](std::uint32_t packet_id, char const* b, char const* e, std::shared_ptr<mapping> const& m) {
+                if (v5) {
+                    ep.restore_v5_serialized_message(static_cast<packet_id_t>(packet_id), b, e, m);
+                }
+                else {
+                    ep.restore_serialized_message(static_cast<packet_id_t>(packet_id), b, e, m);
+                }
+            }
+        );
+    }
+
+    /**
+     * @brief Call the function for each live message in the stored order.
+     *        The appended records are flushed first, and each segment is memory mapped.
+     *        [begin, end) is valid only during the call.
+     * @param f function that is called as f(packet_id, begin, end) with the serialized message
+     */
+    template <typename Function>
+    void for_each(Function&& f) {
+        for_each_mapped(
+            [&](std::uint32_t packet_id, char const* b, char const* e, std::shared_ptr<mapping> const&) {
+                f(packet_id, b, e);
+            }
+        );
+    }
+
+    /**
+     * @brief Append the message of the packet id.
+     *        The message replaces the older message of the same packet id.
+     * @param packet_id packet id
+     * @param buffers   serialized message
+     */
+    template <typename ConstBufferSequence>
+    void store(std::uint32_t packet_id, ConstBufferSequence const& buffers) {
+        std::size_t size = 0;
+        for (auto const& b : buffers) size += as::buffer_size(b);
+        std::lock_guard<std::mutex> lck(mtx_);
+        auto loc = append_header(record_type::store, packet_id, next_order_++, size);
+        auto& chunk = pending_.back().second;
+        for (auto const& b : buffers) {
+            chunk.append(static_cast<char const*>(b.data()), as::buffer_size(b));
+        }
+        finish_record(chunk, loc);
+        set_live(packet_id, loc);
+    }
+
+    /**
+     * @brief Remove the message of the packet id.
+     * @param packet_id packet id
+     */
+    void remove(std::uint32_t packet_id) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        remove_impl(packet_id);
+    }
+
+    /**
+     * @brief Remove all messages.
+     */
+    void clear() {
+        std::lock_guard<std::mutex> lck(mtx_);
+        while (!live_.empty()) {
+            remove_impl(live_.begin()->first);
+        }
+    }
+
+    /**
+     * @brief Wait until all appended records are written and fsynced.
+     *        If writing failed, session_log_error is thrown.
+     */
+    void flush() {
+        std::unique_lock<std::mutex> lck(mtx_);
+        auto target = appended_;
+        flush_requested_ = true;
+        cv_.notify_all();
+        durable_cv_.wait(lck, [&] { return durable_ >= target || failed_; });
+        if (failed_) throw session_log_error();
+    }
+
+    /**
+     * @brief Get the number of live messages
+     * @return the number of live messages
+     */
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return live_.size();
+    }
+
+    /**
+     * @brief Get the number of segment files
+     * @return the number of segment files including the current one
+     */
+    std::size_t num_of_segments() const {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return segments_.size();
+    }
+
+private:
+    // record: body size (4 bytes), crc32 of body (4 bytes), body
+    // body:   record type (1 byte), packet id (4 bytes), sequence number (8 bytes), serialized message
+    // The sequence number is the stored order of the message. It is kept by compaction.
+    static constexpr std::size_t record_header_size = 8;
+    static constexpr std::size_t body_header_size = 13;
+
+    enum class record_type : std::uint8_t {
+        store = 1,
+        remove = 2,
+    };
+
+    struct location {
+        std::uint64_t seq;
+        std::size_t offset;
+        std::size_t size;
+        std::uint64_t order;
+    };
+
+    struct segment {
+        std::size_t live = 0;
+        std::size_t size = 0;
+        bool deleting = false;
+    };
+
+    static void put_uint32(std::string& s, std::uint32_t v) {
+        for (std::size_t i = 0; i != 4; ++i) {
+            s.push_back(static_cast<char>((v >> (i * 8)) & 0xff));
+        }
+    }
+
+    static void put_uint64(std::string& s, std::uint64_t v) {
+        for (std::size_t i = 0; i != 8; ++i) {
+            s.push_back(static_cast<char>((v >> (i * 8)) & 0xff));
+        }
+    }
+
+    static std::uint32_t get_uint32(char const* p) {
+        std::uint32_t v = 0;
+        for (std::size_t i = 0; i != 4; ++i) {
+            v |= static_cast<std::uint32_t>(static_cast<std::uint8_t>(p[i])) << (i * 8);
+        }
+        return v;
+    }
+
+    static std::uint64_t get_uint64(char const* p) {
+        std::uint64_t v = 0;
+        for (std::size_t i = 0; i != 8; ++i) {
+            v |= static_cast<std::uint64_t>(static_cast<std::uint8_t>(p[i])) << (i * 8);
+        }
+        return v;
+    }
+
+    static std::uint32_t crc(char const* p, std::size_t size) {
+        boost::crc_32_type c;
+        c.process_bytes(p, size);
+        return c.checksum();
+    }
+
+    using mapping = boost::interprocess::mapped_region;
+
+    template <typename Function>
+    void for_each_mapped(Function&& f) {
+        flush();
+        std::vector<std::pair<std::uint32_t, location>> records;
+        std::map<std::uint64_t, std::shared_ptr<mapping>> mappings;
+        {
+            // Segments are deleted by the writer with the lock.
+            // Once mapped, the mapping stays valid even if the segment file is deleted.
+            std::lock_guard<std::mutex> lck(mtx_);
+            for (auto const& e : live_) {
+                records.emplace_back(e.first, e.second);
+                auto& m = mappings[e.second.seq];
+                if (m) continue;
+                m = map_file(segment_name(e.second.seq));
+                if (!m || m->get_size() == 0) throw session_log_error();
+            }
+        }
+        // The segment and the offset are not the stored order after compaction.
+        std::sort(
+            records.begin(),
+            records.end(),
+            [](auto const& lhs, auto const& rhs) { return lhs.second.order < rhs.second.order; }
+        );
+        for (auto const& r : records) {
+            auto const& m = mappings[r.second.seq];
+            auto p = static_cast<char const*>(m->get_address()) + r.second.offset;
+            auto body_size = get_uint32(p);
+            f(r.first, p + record_header_size + body_header_size, p + record_header_size + body_size, m);
+        }
+    }
+
+    // Map the whole file read only. nullptr is returned if the file doesn't exist.
+    static std::shared_ptr<mapping> map_file(std::string const& name) {
+        namespace ipc = boost::interprocess;
+        std::unique_ptr<ipc::file_mapping> file;
+        try {
+            file.reset(new ipc::file_mapping(name.c_str(), ipc::read_only));
+        }
+        catch (ipc::interprocess_exception const&) {
+            return nullptr;
+        }
+        try {
+            return std::make_shared<mapping>(*file, ipc::read_only);
+        }
+        catch (ipc::interprocess_exception const&) {
+            // An empty file can't be mapped.
+            return std::make_shared<mapping>();
+        }
+    }
+
+    static bool read_file(std::string const& name, std::string& data) {
+        std::FILE* fp = std::fopen(name.c_str(), "rb");
+        if (!fp) return false;
+        data.clear();
+        char buf[64 * 1024];
+        std::size_t n;
+        while ((n = std::fread(buf, 1, sizeof(buf), fp)) != 0) {
+            data.append(buf, n);
+        }
+        std::fclose(fp);
+        return true;
+    }
+
+    static bool sync(std::FILE* fp) {
+        if (std::fflush(fp) != 0) return false;
+#if defined(_WIN32)
+        return ::_commit(::_fileno(fp)) == 0;
+#else  // defined(_WIN32)
+        return ::fsync(::fileno(fp)) == 0;
+#endif // defined(_WIN32)
+    }
+
+    // Replace the target by the source atomically.
+    static bool replace_file(std::string const& source, std::string const& target) {
+#if defined(_WIN32)
+        // rename() on Windows fails if the target exists.
+        std::remove(target.c_str());
+#endif // defined(_WIN32)
+        return std::rename(source.c_str(), target.c_str()) == 0;
+    }
+
+    // Make the creation, rename, and deletion of the files in the directory durable.
+    static bool sync_dir(std::string const& dir) {
+#if defined(_WIN32)
+        static_cast<void>(dir);
+        return true;
+#else  // defined(_WIN32)
+        int fd = ::open(dir.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        bool ok = ::fsync(fd) == 0;
+        ::close(fd);
+        return ok;
+#endif // defined(_WIN32)
+    }
+
+    // Parse a segment number. Return 0 if the string is not a segment number.
+    static std::uint64_t parse_seq(std::string const& s) {
+        if (s.empty() || s.size() > 19) return 0;
+        std::uint64_t v = 0;
+        for (auto c : s) {
+            if (c < '0' || c > '9') return 0;
+            v = v * 10 + static_cast<std::uint64_t>(c - '0');
+        }
+        return v;
+    }
+
+    std::string dir_name() const {
+        auto pos = path_.find_last_of("/\\");
+        if (pos == std::string::npos) return ".";
+        if (pos == 0) return path_.substr(0, 1);
+        return path_.substr(0, pos);
+    }
+
+    // Find the lowest segment number in the directory. Return 0 if no segment exists.
+    std::uint64_t lowest_segment() const {
+        auto pos = path_.find_last_of("/\\");
+        auto prefix = (pos == std::string::npos ? path_ : path_.substr(pos + 1)) + ".";
+        std::uint64_t lowest = 0;
+        auto check =
+            [&](std::string const& name) {
+                if (name.compare(0, prefix.size(), prefix) != 0) return;
+                auto seq = parse_seq(name.substr(prefix.size()));
+                if (seq != 0 && (lowest == 0 || seq < lowest)) lowest = seq;
+            };
+#if defined(_WIN32)
+        ::_finddata_t fd;
+        auto h = ::_findfirst((dir_name() + "/" + prefix + "*").c_str(), &fd);
+        if (h == -1) return 0;
+        do {
+            check(fd.name);
+        } while (::_findnext(h, &fd) == 0);
+        ::_findclose(h);
+#else  // defined(_WIN32)
+        ::DIR* d = ::opendir(dir_name().c_str());
+        if (!d) return 0;
+        while (::dirent* e = ::readdir(d)) {
+            check(e->d_name);
+        }
+        ::closedir(d);
+#endif // defined(_WIN32)
+        return lowest;
+    }
+
+    std::string segment_name(std::uint64_t seq) const {
+        return path_ + "." + std::to_string(seq);
+    }
+
+    std::string head_name() const {
+        return path_ + ".head";
+    }
+
+    void recover() {
+        std::uint64_t first = 0;
+        {
+            std::string head;
+            if (read_file(head_name(), head)) first = parse_seq(head);
+        }
+        // The head is missing or broken, or it points to a segment that doesn't exist.
+        if (first == 0 || !map_file(segment_name(first))) {
+            if (auto lowest = lowest_segment()) first = lowest;
+            if (first == 0) first = 1;
+        }
+        // The segments before the head are left if the process stopped while deleting them.
+        auto stale = first;
+        while (stale > 1 && std::remove(segment_name(stale - 1).c_str()) == 0) --stale;
+
+        auto seq = first;
+        while (auto m = map_file(segment_name(seq))) {
+            auto& s = segments_[seq];
+            auto data = static_cast<char const*>(m->get_address());
+            auto size = m->get_size();
+            std::size_t offset = 0;
+            while (size - offset >= record_header_size + body_header_size) {
+                char const* p = data + offset;
+                auto body_size = get_uint32(p);
+                if (body_size < body_header_size ||
+                    size - offset - record_header_size < body_size ||
+                    crc(p + record_header_size, body_size) != get_uint32(p + 4)) {
+                    break;
+                }
+                auto type = static_cast<record_type>(p[record_header_size]);
+                auto packet_id = get_uint32(p + record_header_size + 1);
+                auto order = get_uint64(p + record_header_size + 5);
+                location loc { seq, offset, record_header_size + body_size, order };
+                if (type == record_type::store) {
+                    set_live(packet_id, loc);
+                    next_order_ = std::max(next_order_, order + 1);
+                }
+                else {
+                    unset_live(packet_id);
+                }
+                offset += loc.size;
+            }
+            s.size = size;
+            total_size_ += s.size;
+            ++seq;
+        }
+        // New records are written to a new segment. The recovered segments are not modified.
+        active_ = seq;
+        segments_[active_];
+    }
+
+    void set_live(std::uint32_t packet_id, location const& loc) {
+        auto ret = live_.emplace(packet_id, loc);
+        if (!ret.second) {
+            --segments_[ret.first->second.seq].live;
+            live_size_ -= ret.first->second.size;
+            ret.first->second = loc;
+        }
+        ++segments_[loc.seq].live;
+        live_size_ += loc.size;
+    }
+
+    bool unset_live(std::uint32_t packet_id) {
+        auto it = live_.find(packet_id);
+        if (it == live_.end()) return false;
+        --segments_[it->second.seq].live;
+        live_size_ -= it->second.size;
+        live_.erase(it);
+        return true;
+    }
+
+    void remove_impl(std::uint32_t packet_id) {
+        if (!unset_live(packet_id)) return;
+        auto loc = append_header(record_type::remove, packet_id, 0, 0);
+        finish_record(pending_.back().second, loc);
+    }
+
+    // Append the record header and the body header to the pending chunk of the current segment.
+    // The crc is filled by finish_record().
+    location append_header(record_type type, std::uint32_t packet_id, std::uint64_t order, std::size_t message_size) {
+        auto size = record_header_size + body_header_size + message_size;
+        auto* s = &segments_[active_];
+        if (s->size != 0 && s->size + size > segment_size_) {
+            ++active_;
+            s = &segments_[active_];
+        }
+        if (pending_.empty() || pending_.back().first != active_) {
+            pending_.emplace_back(active_, std::string());
+        }
+        auto& chunk = pending_.back().second;
+        location loc { active_, s->size, size, order };
+        put_uint32(chunk, static_cast<std::uint32_t>(body_header_size + message_size));
+        put_uint32(chunk, 0);
+        chunk.push_back(static_cast<char>(type));
+        put_uint32(chunk, packet_id);
+        put_uint64(chunk, order);
+        s->size += size;
+        total_size_ += size;
+        ++appended_;
+        return loc;
+    }
+
+    void finish_record(std::string& chunk, location const& loc) {
+        auto p = &chunk[chunk.size() - loc.size];
+        auto c = crc(p + record_header_size, loc.size - record_header_size);
+        for (std::size_t i = 0; i != 4; ++i) {
+            p[4 + i] = static_cast<char>((c >> (i * 8)) & 0xff);
+        }
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lck(mtx_);
+        while (true) {
+            cv_.wait(lck, [this] { return stop_ || flush_requested_ || !pending_.empty(); });
+            if (pending_.empty()) {
+                if (stop_) break;
+                flush_requested_ = false;
+                continue;
+            }
+            if (!stop_ && !flush_requested_ && commit_interval_ != std::chrono::steady_clock::duration::zero()) {
+                cv_.wait_for(lck, commit_interval_, [this] { return stop_ || flush_requested_; });
+            }
+            flush_requested_ = false;
+            auto batch = std::move(pending_);
+            pending_.clear();
+            auto appended = appended_;
+            lck.unlock();
+
+            bool ok = write(batch);
+
+            lck.lock();
+            if (!ok) failed_ = true;
+            durable_ = appended;
+            durable_cv_.notify_all();
+            if (ok) {
+                delete_segments();
+                compact(lck);
+            }
+        }
+    }
+
+    bool write(std::vector<std::pair<std::uint64_t, std::string>> const& batch) {
+        for (auto const& c : batch) {
+            if (!file_ || file_seq_ != c.first) {
+                if (file_) {
+                    if (!sync(file_)) return false;
+                    std::fclose(file_);
+                }
+                file_ = std::fopen(segment_name(c.first).c_str(), "ab");
+                if (!file_) return false;
+                file_seq_ = c.first;
+            }
+            if (std::fwrite(c.second.data(), 1, c.second.size(), file_) != c.second.size()) return false;
+        }
+        return sync(file_);
+    }
+
+    // Delete the oldest segments that have no live records. The copies of their live records are durable.
+    void delete_segments() {
+        while (segments_.size() > 1) {
+            auto it = segments_.begin();
+            if (it->first == active_ || it->second.live != 0) break;
+            if (!it->second.deleting) {
+                it->second.deleting = true;
+                delete_after_.emplace_back(it->first, appended_);
+            }
+            if (delete_after_.front().second > durable_) break;
+            auto seq = it->first;
+            // Update the head before deleting the segment, so that the head never points to a deleted segment.
+            std::string head_tmp = head_name() + ".tmp";
+            if (std::FILE* fp = std::fopen(head_tmp.c_str(), "wb")) {
+                auto s = std::to_string(seq + 1);
+                bool ok = std::fwrite(s.data(), 1, s.size(), fp) == s.size() && sync(fp);
+                std::fclose(fp);
+                // The old head is kept if the new head is not written.
+                if (!ok || !replace_file(head_tmp, head_name())) break;
+                // The new head must be durable before the segment is deleted.
+                if (!sync_dir(dir_name())) break;
+            }
+            else {
+                break;
+            }
+            std::remove(segment_name(seq).c_str());
+            total_size_ -= it->second.size;
+            segments_.erase(it);
+            delete_after_.erase(delete_after_.begin());
+        }
+    }
+
+    // Copy the live records of the oldest segment to the current segment if there are many dead records.
+    void compact(std::unique_lock<std::mutex>& lck) {
+        auto it = segments_.begin();
+        if (it->first == active_ || it->second.deleting || it->second.live == 0) return;
+        if (total_size_ - live_size_ <= live_size_ + 2 * segment_size_) return;
+        auto seq = it->first;
+
+        std::vector<std::pair<std::uint32_t, location>> records;
+        for (auto const& e : live_) {
+            if (e.second.seq == seq) records.emplace_back(e.first, e.second);
+        }
+        lck.unlock();
+        std::string data;
+        bool ok = read_file(segment_name(seq), data);
+        lck.lock();
+        if (!ok) return;
+
+        std::sort(
+            records.begin(),
+            records.end(),
+            [](auto const& lhs, auto const& rhs) { return lhs.second.offset < rhs.second.offset; }
+        );
+        for (auto const& r : records) {
+            auto it = live_.find(r.first);
+            // The record might be replaced or removed while reading.
+            if (it == live_.end() || it->second.seq != seq || it->second.offset != r.second.offset) continue;
+            auto p = data.data() + r.second.offset;
+            auto message_size = r.second.size - record_header_size - body_header_size;
+            // The copy keeps the sequence number, so the stored order is kept.
+            auto loc = append_header(record_type::store, r.first, r.second.order, message_size);
+            auto& chunk = pending_.back().second;
+            chunk.append(p + record_header_size + body_header_size, message_size);
+            finish_record(chunk, loc);
+            set_live(r.first, loc);
+        }
+        // The segment is deleted after the copies are written.
+        if (segments_.begin()->second.live == 0) {
+            segments_.begin()->second.deleting = true;
+            delete_after_.emplace_back(seq, appended_);
+        }
+    }
+
+private:
+    std::string path_;
+    std::size_t segment_size_;
+
+    mutable std::mutex mtx_;
+    std::condition_variable cv_;
+    std::condition_variable durable_cv_;
+    std::unordered_map<std::uint32_t, location> live_;
+    std::map<std::uint64_t, segment> segments_;
+    std::uint64_t active_ = 1;
+    std::size_t total_size_ = 0;
+    std::size_t live_size_ = 0;
+    std::vector<std::pair<std::uint64_t, std::string>> pending_;
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> delete_after_; // segment and the appended count to wait
+    std::uint64_t appended_ = 0;
+    std::uint64_t durable_ = 0;
+    std::uint64_t next_order_ = 0;
+    std::chrono::steady_clock::duration commit_interval_ = std::chrono::steady_clock::duration::zero();
+    bool flush_requested_ = false;
+    bool failed_ = false;
+    bool stop_ = false;
+
+    // accessed only by the writer thread
+    std::FILE* file_ = nullptr;
+    std::uint64_t file_seq_ = 0;
+    std::thread writer_;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_SESSION_LOG_HPP
@@ -0,0 +1,163 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_SHARED_PUBLISH_HPP)
+#define MQTT_SHARED_PUBLISH_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <numeric>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/container/static_vector.hpp>
+
+#include <mqtt/two_byte_util.hpp>
+#include <mqtt/const_buffer_util.hpp>
+#include <mqtt/variable_length.hpp>
+#include <mqtt/string_check.hpp>
+#include <mqtt/property_variant.hpp>
+#include <mqtt/any.hpp>
+
+namespace mqtt {
+
+namespace as = boost::asio;
+
+/**
+ * @brief Immutable part of PUBLISH messages that are sent to many subscribers.
+ *        The topic name, the encoded properties and the payload are prepared once,
+ *        and each subscriber only adds its own fixed header, remaining length and packet id.
+ *        See endpoint::publish(std::shared_ptr<shared_publish const>, std::uint8_t, bool).
+ *        The topic name and the payload are not copied. They need to be kept alive by life_keeper.
+ */
+class shared_publish {
+public:
+    /**
+     * @brief Constructor
+     * @param topic_name  topic name. It is validated as UTF-8 string here.
+     * @param payload     payload
+     * @param life_keeper An object that keeps topic_name and payload alive.
+     * @param props       Properties. They are encoded here, and sent only to MQTT v5 endpoints.
+     */
+    shared_publish(
+        as::const_buffer topic_name,
+        as::const_buffer payload,
+        mqtt::any life_keeper,
+        std::vector<v5::property_variant> const& props = {}
+    )
+        : topic_name_(topic_name),
+          topic_name_length_buf_ { MQTT_16BITNUM_TO_BYTE_SEQ(get_size(topic_name)) },
+          payload_(payload),
+          life_keeper_(std::move(life_keeper))
+    {
+        utf8string_check(string_view(get_pointer(topic_name), get_size(topic_name)));
+
+        auto property_length =
+            std::accumulate(
+                props.begin(),
+                props.end(),
+                std::size_t(0),
+                [](std::size_t total, v5::property_variant const& pv) {
+                    return total + v5::size(pv);
+                }
+            );
+        v5_property_length_buf_ = variable_bytes(property_length);
+        v5_props_.resize(property_length);
+        auto it = v5_props_.begin();
+        auto end = v5_props_.end();
+        for (auto const& p : props) {
+            v5::fill(p, it, end);
+            it += static_cast<std::string::difference_type>(v5::size(p));
+        }
+    }
+
+    shared_publish(shared_publish const&) = delete;
+    shared_publish& operator=(shared_publish const&) = delete;
+
+    /**
+     * @brief Get topic name
+     * @return topic name
+     */
+    as::const_buffer topic() const {
+        return topic_name_;
+    }
+
+    /**
+     * @brief Get encoded topic name length
+     * @return two bytes length
+     */
+    as::const_buffer topic_name_length_buf() const {
+        return as::buffer(topic_name_length_buf_.data(), topic_name_length_buf_.size());
+    }
+
+    /**
+     * @brief Get payload
+     * @return payload
+     */
+    as::const_buffer payload() const {
+        return payload_;
+    }
+
+    /**
+     * @brief Get length of the encoded properties
+     * @return length of the encoded properties. It doesn't contain property length field.
+     */
+    std::size_t v5_property_length() const {
+        return v5_props_.size();
+    }
+
+    /**
+     * @brief Get encoded property length field
+     * @return variable byte integer
+     */
+    std::string const& v5_property_length_buf() const {
+        return v5_property_length_buf_;
+    }
+
+    /**
+     * @brief Get encoded properties
+     * @return encoded properties
+     */
+    as::const_buffer v5_properties() const {
+        return as::buffer(v5_props_);
+    }
+
+    /**
+     * @brief Get lifetime keeper of the topic name and the payload
+     * @return life_keeper
+     */
+    mqtt::any const& life_keeper() const {
+        return life_keeper_;
+    }
+
+private:
+    as::const_buffer topic_name_;
+    boost::container::static_vector<char, 2> topic_name_length_buf_;
+    as::const_buffer payload_;
+    mqtt::any life_keeper_;
+    std::string v5_property_length_buf_;
+    std::string v5_props_;
+};
+
+/**
+ * @brief Create shared_publish
+ * @param topic_name  topic name
+ * @param payload     payload
+ * @param life_keeper An object that keeps topic_name and payload alive.
+ * @param props       Properties for MQTT v5 endpoints
+ * @return shared_ptr of shared_publish
+ */
+inline std::shared_ptr<shared_publish const> make_shared_publish(
+    as::const_buffer topic_name,
+    as::const_buffer payload,
+    mqtt::any life_keeper,
+    std::vector<v5::property_variant> const& props = {}) {
+    return std::make_shared<shared_publish const>(topic_name, payload, std::move(life_keeper), props);
+}
+
+} // namespace mqtt
+
+#endif // MQTT_SHARED_PUBLISH_HPP
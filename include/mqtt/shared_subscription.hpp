@@ -0,0 +1,234 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_SHARED_SUBSCRIPTION_HPP)
+#define MQTT_SHARED_SUBSCRIPTION_HPP
+
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <functional>
+
+#include <boost/assert.hpp>
+#include <boost/functional/hash.hpp>
+
+#include <mqtt/optional.hpp>
+#include <mqtt/string_view.hpp>
+#include <mqtt/subscription_map.hpp>
+
+namespace mqtt {
+
+/**
+ * @brief Parse the shared subscription
+ *        See https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901250<BR>
+ *        4.8.2 Shared Subscriptions
+ * @param filter topic filter of SUBSCRIBE or UNSUBSCRIBE
+ * @return pair of the share name and the topic filter if the filter is "$share/{ShareName}/{filter}".
+ *         nullopt if the filter is not a shared subscription, or the share name or the filter is invalid.
+ *         The string_views refer to the parameter.
+ */
+inline optional<std::pair<string_view, string_view>> parse_shared_subscription(string_view filter) {
+    string_view const prefix("$share/");
+    if (filter.substr(0, prefix.size()) != prefix) return nullopt;
+    filter.remove_prefix(prefix.size());
+    auto pos = filter.find('/');
+    if (pos == string_view::npos || pos == 0) return nullopt;
+    auto name = filter.substr(0, pos);
+    if (name.find_first_of("+#") != string_view::npos) return nullopt;
+    auto rest = filter.substr(pos + 1);
+    if (!validate_topic_filter(rest)) return nullopt;
+    return std::make_pair(name, rest);
+}
+
+/**
+ * @brief How a shared_subscription_group chooses the member that receives a message
+ */
+enum class shared_subscription_strategy {
+    round_robin,    ///< The members take turns.
+    least_inflight, ///< The member that has the fewest unacknowledged messages. Ties are taken in turns.
+    hash_topic,     ///< The member chosen by the hash of the topic name, so a topic keeps its order
+                    ///< while the members don't change. If the member is full, the next one is taken.
+};
+
+/**
+ * @brief Members of a shared subscription.
+ *
+ * A message that matches a shared subscription is delivered to one member of the group.
+ * select() chooses the member by the strategy. The messages that need acknowledgement
+ * (QoS1 and QoS2) are counted as in-flight of the member until release() is called, and
+ * a member that has as many in-flight messages as its window is skipped. If all the members
+ * are full, select() returns nullptr and the caller should keep the message until release().<BR>
+ * The members are kept in a vector, because a group is expected to have a small number of
+ * members compared with the number of messages.
+ * This class is not thread safe.
+ *
+ * @tparam Member  member identifier, e.g. a connection
+ * @tparam Value   subscription data, e.g. QoS
+ * @tparam Equal   equality of Member
+ */
+template <typename Member, typename Value, typename Equal = std::equal_to<Member>>
+class shared_subscription_group {
+public:
+    struct member {
+        Member key;
+        Value value;
+        /// The number of the messages that are selected and not released
+        std::size_t inflight;
+        /// The maximum number of the in-flight messages. e.g. Receive Maximum of the client.
+        std::size_t window;
+    };
+
+    explicit shared_subscription_group(shared_subscription_strategy strategy = shared_subscription_strategy::round_robin)
+        :strategy_(strategy) {}
+
+    /**
+     * @brief Insert a member, or overwrite the value and the window if the member exists.
+     *        The in-flight count of the existing member is kept.
+     * @param key    member
+     * @param value  subscription data
+     * @param window the maximum number of the in-flight messages. It must be greater than 0.
+     * @return true if inserted, false if overwritten.
+     */
+    bool insert_or_assign(Member const& key, Value value, std::size_t window) {
+        BOOST_ASSERT(window > 0);
+        auto it = find(key);
+        if (it != members_.end()) {
+            it->value = std::move(value);
+            it->window = window;
+            return false;
+        }
+        members_.push_back(member { key, std::move(value), 0, window });
+        return true;
+    }
+
+    /**
+     * @brief Erase a member
+     * @param key member
+     * @return true if erased, false if not found.
+     */
+    bool erase(Member const& key) {
+        auto it = find(key);
+        if (it == members_.end()) return false;
+        auto idx = static_cast<std::size_t>(it - members_.begin());
+        members_.erase(it);
+        // Keep the turn of the next member.
+        if (idx < next_) --next_;
+        if (next_ >= members_.size()) next_ = 0;
+        return true;
+    }
+
+    /**
+     * @brief Choose the member that receives the message
+     * @param topic   topic name of the message. Used by shared_subscription_strategy::hash_topic.
+     * @param counted true if the message is counted as in-flight, i.e. it is delivered with QoS1 or QoS2.
+     *                If false, the window is not checked.
+     * @return pointer to the chosen member. nullptr if the group is empty, or all the members are full.
+     *         The pointer is valid until the members are changed.
+     */
+    member const* select(string_view topic, bool counted) {
+        if (members_.empty()) return nullptr;
+        auto size = members_.size();
+        auto available =
+            [&](member const& m) {
+                return !counted || m.inflight < m.window;
+            };
+        member* chosen = nullptr;
+        switch (strategy_) {
+        case shared_subscription_strategy::round_robin:
+            for (std::size_t i = 0; i != size; ++i) {
+                auto& m = members_[(next_ + i) % size];
+                if (available(m)) {
+                    chosen = &m;
+                    break;
+                }
+            }
+            break;
+        case shared_subscription_strategy::least_inflight:
+            for (std::size_t i = 0; i != size; ++i) {
+                auto& m = members_[(next_ + i) % size];
+                if (!available(m)) continue;
+                if (!chosen || m.inflight < chosen->inflight) chosen = &m;
+            }
+            break;
+        case shared_subscription_strategy::hash_topic: {
+            auto start = boost::hash_range(topic.begin(), topic.end()) % size;
+            for (std::size_t i = 0; i != size; ++i) {
+                auto& m = members_[(start + i) % size];
+                if (available(m)) {
+                    chosen = &m;
+                    break;
+                }
+            }
+        } break;
+        }
+        if (!chosen) return nullptr;
+        next_ = (static_cast<std::size_t>(chosen - members_.data()) + 1) % size;
+        if (counted) ++chosen->inflight;
+        return chosen;
+    }
+
+    /**
+     * @brief Release the in-flight message of the member
+     *        Call it when the message that is selected with counted is acknowledged or abandoned.
+     * @param key member
+     * @return true if released, false if the member is not found or has no in-flight message.
+     */
+    bool release(Member const& key) {
+        auto it = find(key);
+        if (it == members_.end() || it->inflight == 0) return false;
+        --it->inflight;
+        return true;
+    }
+
+    /**
+     * @brief Find the member
+     * @param key member
+     * @return pointer to the member. nullptr if not found.
+     */
+    member const* get(Member const& key) const {
+        auto it = const_cast<shared_subscription_group*>(this)->find(key);
+        if (it == members_.end()) return nullptr;
+        return &*it;
+    }
+
+    std::vector<member> const& members() const {
+        return members_;
+    }
+
+    shared_subscription_strategy strategy() const {
+        return strategy_;
+    }
+
+    std::size_t size() const {
+        return members_.size();
+    }
+
+    bool empty() const {
+        return members_.empty();
+    }
+
+private:
+    typename std::vector<member>::iterator find(Member const& key) {
+        return std::find_if(
+            members_.begin(),
+            members_.end(),
+            [&](member const& m) {
+                return Equal()(m.key, key);
+            }
+        );
+    }
+
+private:
+    shared_subscription_strategy strategy_;
+    std::vector<member> members_;
+    // The position that the next turn starts from
+    std::size_t next_ = 0;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_SHARED_SUBSCRIPTION_HPP
@@ -0,0 +1,313 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_SUBSCRIPTION_MAP_HPP)
+#define MQTT_SUBSCRIPTION_MAP_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <functional>
+
+#include <boost/functional/hash.hpp>
+
+#include <mqtt/string_view.hpp>
+
+namespace mqtt {
+
+/**
+ * @brief Check the topic filter is valid.
+ *        See http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718106<BR>
+ *        4.7 Topic Names and Topic Filters
+ * @param filter topic filter
+ * @return true if the filter is valid, otherwise false.
+ */
+inline bool validate_topic_filter(string_view filter) {
+    if (filter.empty()) return false;
+    for (std::size_t i = 0; i != filter.size(); ++i) {
+        switch (filter[i]) {
+        case '+':
+            // '+' must occupy an entire level
+            if (i != 0 && filter[i - 1] != '/') return false;
+            if (i + 1 != filter.size() && filter[i + 1] != '/') return false;
+            break;
+        case '#':
+            // '#' must be the last character and occupy an entire level
+            if (i != 0 && filter[i - 1] != '/') return false;
+            if (i + 1 != filter.size()) return false;
+            break;
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Check the topic name is valid.
+ *        Topic names must not contain wildcard characters.
+ * @param topic topic name
+ * @return true if the topic name is valid, otherwise false.
+ */
+inline bool validate_topic_name(string_view topic) {
+    if (topic.empty()) return false;
+    return topic.find_first_of("+#") == string_view::npos;
+}
+
+/**
+ * @brief Map of topic filters to subscribers.
+ *        Topic filters are stored in a tree of topic levels, so that matching a topic name
+ *        costs O(number of levels) lookups regardless of the number of filters, except for
+ *        walking the wildcard branches.
+ *        Single level ('+') and multi level ('#') wildcards are supported. Filters that start
+ *        with a wildcard don't match topic names that start with '$'.
+ *        Each filter can have multiple subscribers identified by Key. Subscribing the same
+ *        filter by the same Key again overwrites the Value.
+ *        This class is not thread safe.
+ *
+ * @tparam Key     subscriber identifier, e.g. a connection or a session
+ * @tparam Value   subscription data, e.g. QoS
+ * @tparam Compare comparator of Key
+ */
+template <typename Key, typename Value, typename Compare = std::less<Key>>
+class subscription_map {
+public:
+    using subscribers_t = std::map<Key, Value, Compare>;
+
+    subscription_map() = default;
+    subscription_map(subscription_map const&) = delete;
+    subscription_map(subscription_map&&) = delete;
+    subscription_map& operator=(subscription_map const&) = delete;
+    subscription_map& operator=(subscription_map&&) = delete;
+
+    /**
+     * @brief Insert a subscription, or overwrite the value if key already subscribes the filter.
+     * @param filter topic filter. It should be valid. See validate_topic_filter().
+     * @param key    subscriber
+     * @param value  subscription data
+     * @return true if inserted, false if overwritten.
+     */
+    bool insert_or_assign(string_view filter, Key const& key, Value value) {
+        node* n = &root_;
+        for_each_level(
+            filter,
+            [&](string_view level) {
+                n = &n->child(level);
+            }
+        );
+        auto r = n->subscribers.emplace(key, value);
+        if (r.second) {
+            ++size_;
+            return true;
+        }
+        r.first->second = std::move(value);
+        return false;
+    }
+
+    /**
+     * @brief Erase a subscription
+     * @param filter topic filter
+     * @param key    subscriber
+     * @return true if erased, false if not found.
+     */
+    bool erase(string_view filter, Key const& key) {
+        node* n = find_node(filter);
+        if (!n) return false;
+        if (n->subscribers.erase(key) == 0) return false;
+        --size_;
+        prune(n);
+        return true;
+    }
+
+    /**
+     * @brief Find the subscribers of the filter itself. Wildcards are not expanded.
+     * @param filter topic filter
+     * @return pointer to subscribers. nullptr if nobody subscribes the filter.
+     */
+    subscribers_t const* find_filter(string_view filter) const {
+        auto n = const_cast<subscription_map*>(this)->find_node(filter);
+        if (!n || n->subscribers.empty()) return nullptr;
+        return &n->subscribers;
+    }
+
+    /**
+     * @brief Call f for each subscription whose filter matches the topic name.
+     *        If a key subscribes overlapping filters, f is called for each of them.
+     *        Use match_merged() to get one entry per key.
+     * @param topic topic name
+     * @param f     function object that is called as f(Key const&, Value const&)
+     */
+    template <typename Func>
+    void match(string_view topic, Func&& f) const {
+        bool dollar = !topic.empty() && topic.front() == '$';
+        // nodes that match the levels processed so far
+        std::vector<node const*> current { &root_ };
+        std::vector<node const*> next;
+        bool first = true;
+        for_each_level(
+            topic,
+            [&](string_view level) {
+                next.clear();
+                for (auto n : current) {
+                    // "a/#" matches "a/b", "a/b/c", ...
+                    if (n->hash && !(first && dollar)) call(*n->hash, f);
+                    if (auto c = n->find_child(level)) next.push_back(c);
+                    if (n->plus && !(first && dollar)) next.push_back(n->plus.get());
+                }
+                first = false;
+                std::swap(current, next);
+            }
+        );
+        for (auto n : current) {
+            call(*n, f);
+            // "a/#" matches "a" too
+            if (n->hash) call(*n->hash, f);
+        }
+    }
+
+    /**
+     * @brief Find subscriptions whose filter matches the topic name.
+     *        Overlapping subscriptions of the same key are merged into one entry.
+     * @param topic topic name
+     * @param merge function object that merges Value of overlapping subscriptions as
+     *              merge(Value& merged, Value const& other). e.g. take the maximum QoS.
+     * @return map of keys and merged values
+     */
+    template <typename Merge>
+    subscribers_t match_merged(string_view topic, Merge&& merge) const {
+        subscribers_t ret;
+        match(
+            topic,
+            [&](Key const& key, Value const& value) {
+                auto r = ret.emplace(key, value);
+                if (!r.second) merge(r.first->second, value);
+            }
+        );
+        return ret;
+    }
+
+    /**
+     * @brief Get the number of subscriptions
+     * @return the number of pairs of filter and key
+     */
+    std::size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+private:
+    struct string_view_hash {
+        std::size_t operator()(string_view sv) const {
+            return boost::hash_range(sv.begin(), sv.end());
+        }
+    };
+
+    struct node {
+        node() = default;
+        node(node* parent, string_view name)
+            :parent(parent), name(name.data(), name.size()) {}
+
+        node& child(string_view level) {
+            if (level == "+") {
+                if (!plus) plus = std::make_unique<node>(this, level);
+                return *plus;
+            }
+            if (level == "#") {
+                if (!hash) hash = std::make_unique<node>(this, level);
+                return *hash;
+            }
+            auto it = children.find(level);
+            if (it != children.end()) return *it->second;
+            auto c = std::make_unique<node>(this, level);
+            auto p = c.get();
+            // The key refers to the name in the node. The node is never moved.
+            children.emplace(string_view(p->name), std::move(c));
+            return *p;
+        }
+
+        node* find_child(string_view level) const {
+            auto it = children.find(level);
+            if (it == children.end()) return nullptr;
+            return it->second.get();
+        }
+
+        bool unused() const {
+            return subscribers.empty() && children.empty() && !plus && !hash;
+        }
+
+        node* parent = nullptr;
+        std::string name;
+        subscribers_t subscribers;
+        std::unordered_map<string_view, std::unique_ptr<node>, string_view_hash> children;
+        std::unique_ptr<node> plus;
+        std::unique_ptr<node> hash;
+    };
+
+    template <typename Func>
+    static void for_each_level(string_view s, Func&& f) {
+        std::size_t b = 0;
+        while (true) {
+            auto e = s.find('/', b);
+            if (e == string_view::npos) {
+                f(s.substr(b));
+                return;
+            }
+            f(s.substr(b, e - b));
+            b = e + 1;
+        }
+    }
+
+    template <typename Func>
+    static void call(node const& n, Func& f) {
+        for (auto const& s : n.subscribers) {
+            f(s.first, s.second);
+        }
+    }
+
+    node* find_node(string_view filter) {
+        node* n = &root_;
+        for_each_level(
+            filter,
+            [&](string_view level) {
+                if (!n) return;
+                if (level == "+") n = n->plus.get();
+                else if (level == "#") n = n->hash.get();
+                else n = n->find_child(level);
+            }
+        );
+        return n;
+    }
+
+    // Remove unused nodes from n to the root
+    void prune(node* n) {
+        while (n != &root_ && n->unused()) {
+            auto p = n->parent;
+            if (n == p->plus.get()) {
+                p->plus.reset();
+            }
+            else if (n == p->hash.get()) {
+                p->hash.reset();
+            }
+            else {
+                p->children.erase(string_view(n->name));
+            }
+            n = p;
+        }
+    }
+
+private:
+    node root_;
+    std::size_t size_ = 0;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_SUBSCRIPTION_MAP_HPP
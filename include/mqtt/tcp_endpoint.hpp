@@ -71,6 +71,15 @@ public:
             strand_.wrap(std::forward<ReadHandler>(handler)));
     }
 
+    template <typename MutableBufferSequence, typename ReadHandler>
+    void async_read_some(
+        MutableBufferSequence && buffers,
+        ReadHandler&& handler) {
+        tcp_.async_read_some(
+            std::forward<MutableBufferSequence>(buffers),
+            strand_.wrap(std::forward<ReadHandler>(handler)));
+    }
+
     template <typename... Args>
     std::size_t write(Args&& ... args) {
         return as::write(tcp_, std::forward<Args>(args)...);
@@ -105,6 +114,14 @@ inline void async_read(
     ep.async_read(std::forward<MutableBufferSequence>(buffers), std::forward<ReadHandler>(handler));
 }
 
+template <typename Socket, typename Strand, typename MutableBufferSequence, typename ReadHandler>
+inline void async_read_some(
+    tcp_endpoint<Socket, Strand>& ep,
+    MutableBufferSequence && buffers,
+    ReadHandler&& handler) {
+    ep.async_read_some(std::forward<MutableBufferSequence>(buffers), std::forward<ReadHandler>(handler));
+}
+
 template <typename Socket, typename Strand, typename ConstBufferSequence>
 inline std::size_t write(
     tcp_endpoint<Socket, Strand>& ep,
@@ -0,0 +1,227 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_TIMING_WHEEL_HPP)
+#define MQTT_TIMING_WHEEL_HPP
+
+#include <cstdint>
+#include <array>
+#include <list>
+#include <chrono>
+#include <unordered_map>
+
+#include <boost/assert.hpp>
+
+namespace mqtt {
+
+/**
+ * @brief Hierarchical timing wheel.
+ *        Many deadlines are tracked without a timer for each of them. The time is divided into
+ *        ticks, and the entries are kept in 4 levels of 64 slots. Level n has slots of 64^n ticks,
+ *        and an entry is moved to the lower level when the current tick reaches its slot.
+ *        So add() and cancel() are O(1), and advance() is O(1) per tick and per expired entry.
+ *        Deadlines after 64^4 ticks are kept in the last level until they come into range.<BR>
+ *        The wheel doesn't have a timer. The owner calls advance() periodically, or lazily when
+ *        it handles other events. An entry expires on the first advance() after its deadline,
+ *        never before it.
+ *        This class is not thread safe.
+ *
+ * @tparam Value the value that is passed to the function of advance() when the entry expires
+ */
+template <typename Value>
+class timing_wheel {
+public:
+    using clock = std::chrono::steady_clock;
+    using id_t = std::uint64_t;
+
+    /**
+     * @brief Constructor
+     * @param tick   resolution of the deadlines
+     * @param origin time of the tick 0
+     */
+    explicit timing_wheel(clock::duration tick, clock::time_point origin = clock::now())
+        :tick_(tick), origin_(origin) {
+        BOOST_ASSERT(tick > clock::duration::zero());
+    }
+
+    timing_wheel(timing_wheel const&) = delete;
+    timing_wheel& operator=(timing_wheel const&) = delete;
+
+    /**
+     * @brief Add an entry
+     * @param deadline the entry expires after the deadline
+     * @param value    value of the entry
+     * @return id to cancel the entry
+     */
+    id_t add(clock::time_point deadline, Value value) {
+        auto& l = levels_[0][0];
+        l.push_front(entry { next_id_, deadline_tick(deadline), 0, 0, std::move(value) });
+        ++counts_[0];
+        auto it = l.begin();
+        index_.emplace(next_id_, it);
+        place(l, it);
+        return next_id_++;
+    }
+
+    /**
+     * @brief Cancel the entry
+     * @param id id that is returned by add()
+     * @return true if cancelled, false if the entry has already expired or been cancelled.
+     */
+    bool cancel(id_t id) {
+        auto i = index_.find(id);
+        if (i == index_.end()) return false;
+        auto it = i->second;
+        index_.erase(i);
+        if (it->level == levels) {
+            expiring_.erase(it);
+        }
+        else {
+            --counts_[it->level];
+            levels_[it->level][it->slot].erase(it);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Advance the current time, and call f for each expired entry
+     *        f can add and cancel entries, but must not call advance().
+     * @param now current time
+     * @param f   function object that is called as f(Value&&)
+     * @return the number of the expired entries
+     */
+    template <typename Func>
+    std::size_t advance(clock::time_point now, Func&& f) {
+        std::size_t expired = 0;
+        auto target = now_tick(now);
+        while (current_ < target) {
+            if (index_.empty()) {
+                current_ = target;
+                break;
+            }
+            if (counts_[0] == 0) {
+                // Skip the ticks until the next cascade. No entry expires on them.
+                auto boundary = (current_ | (slots - 1)) + 1;
+                if (boundary > target) {
+                    current_ = target;
+                    break;
+                }
+                current_ = boundary - 1;
+            }
+            ++current_;
+            for (std::size_t level = 1; level != levels; ++level) {
+                if ((current_ & mask(level)) != 0) break;
+                cascade(level, slot_of(current_, level));
+            }
+            auto& l = levels_[0][slot_of(current_, 0)];
+            for (auto& e : l) e.level = levels;
+            counts_[0] -= l.size();
+            expiring_.splice(expiring_.end(), l);
+            while (!expiring_.empty()) {
+                auto it = expiring_.begin();
+                index_.erase(it->id);
+                Value v = std::move(it->value);
+                expiring_.erase(it);
+                ++expired;
+                f(std::move(v));
+            }
+        }
+        return expired;
+    }
+
+    /**
+     * @brief Get the number of the entries
+     * @return the number of the entries that are neither expired nor cancelled
+     */
+    std::size_t size() const {
+        return index_.size();
+    }
+
+    bool empty() const {
+        return index_.empty();
+    }
+
+    /**
+     * @brief Get the resolution of the deadlines
+     * @return duration of a tick
+     */
+    clock::duration tick() const {
+        return tick_;
+    }
+
+private:
+    static constexpr std::size_t slot_bits = 6;
+    static constexpr std::size_t slots = std::size_t(1) << slot_bits;
+    static constexpr std::size_t levels = 4;
+
+    struct entry {
+        id_t id;
+        std::uint64_t deadline;
+        // levels means that the entry is in expiring_
+        std::size_t level;
+        std::size_t slot;
+        Value value;
+    };
+    using list_t = std::list<entry>;
+
+    // The ticks of a slot of the level - 1
+    static std::uint64_t mask(std::size_t level) {
+        return (std::uint64_t(1) << (slot_bits * level)) - 1;
+    }
+
+    static std::size_t slot_of(std::uint64_t tick, std::size_t level) {
+        return static_cast<std::size_t>((tick >> (slot_bits * level)) & (slots - 1));
+    }
+
+    // Round up, so that an entry never expires before its deadline.
+    std::uint64_t deadline_tick(clock::time_point tp) const {
+        if (tp <= origin_) return 0;
+        auto d = tp - origin_;
+        return static_cast<std::uint64_t>(d / tick_) + (d % tick_ == clock::duration::zero() ? 0 : 1);
+    }
+
+    std::uint64_t now_tick(clock::time_point tp) const {
+        if (tp <= origin_) return 0;
+        return static_cast<std::uint64_t>((tp - origin_) / tick_);
+    }
+
+    // Move the entry from the list to the slot of its deadline.
+    // The iterator is kept valid, so index_ is not updated.
+    void place(list_t& from, typename list_t::iterator it) {
+        // The deadlines that have passed expire on the next tick.
+        auto deadline = std::max(it->deadline, current_ + 1);
+        auto delta = deadline - current_;
+        std::size_t level = 0;
+        while (level != levels - 1 && delta > mask(level + 1)) ++level;
+        if (delta > mask(levels)) deadline = current_ + mask(levels);
+        --counts_[it->level];
+        ++counts_[level];
+        it->level = level;
+        it->slot = slot_of(deadline, level);
+        auto& to = levels_[level][it->slot];
+        to.splice(to.end(), from, it);
+    }
+
+    void cascade(std::size_t level, std::size_t slot) {
+        auto& l = levels_[level][slot];
+        while (!l.empty()) place(l, l.begin());
+    }
+
+private:
+    clock::duration tick_;
+    clock::time_point origin_;
+    std::uint64_t current_ = 0;
+    id_t next_id_ = 0;
+    std::array<std::array<list_t, slots>, levels> levels_;
+    // the number of the entries in each level
+    std::array<std::size_t, levels> counts_ {};
+    list_t expiring_;
+    std::unordered_map<id_t, typename list_t::iterator> index_;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_TIMING_WHEEL_HPP
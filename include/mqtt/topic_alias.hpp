@@ -0,0 +1,193 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_TOPIC_ALIAS_HPP)
+#define MQTT_TOPIC_ALIAS_HPP
+
+#include <string>
+#include <memory>
+#include <utility>
+#include <unordered_map>
+
+#include <boost/functional/hash.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
+#include <boost/multi_index/member.hpp>
+
+#include <mqtt/string_view.hpp>
+
+namespace mqtt {
+
+namespace mi = boost::multi_index;
+
+/**
+ * @brief Topic alias table of the sending side.
+ *        Topic names are mapped to aliases from 1 to the Topic Alias Maximum of the peer.
+ *        When all aliases are used, the alias of the least recently used topic name is reassigned.
+ */
+class topic_alias_send {
+public:
+    /**
+     * @brief Constructor
+     * @param max Topic Alias Maximum of the peer. 0 means topic alias is not used.
+     */
+    explicit topic_alias_send(std::uint16_t max = 0)
+        : max_(max) {}
+
+    /**
+     * @brief Find the alias of the topic name, or assign an alias to it.
+     *        The topic name becomes the most recently used one.
+     * @param topic_name topic name
+     * @return pair of the alias and the registration flag. If the flag is true, the alias is newly
+     *         assigned and the topic name needs to be sent with the alias.
+     *         If max is 0, the alias is 0.
+     */
+    std::pair<std::uint16_t, bool> find_or_assign(string_view topic_name) {
+        if (max_ == 0) return { 0, false };
+        auto& idx = aliases_.get<tag_topic_name>();
+        auto it = idx.find(topic_name, hash(), equal());
+        if (it != idx.end()) {
+            auto& seq = aliases_.get<tag_seq>();
+            seq.relocate(seq.end(), aliases_.project<tag_seq>(it));
+            return { it->alias, false };
+        }
+
+        std::uint16_t alias;
+        auto& seq = aliases_.get<tag_seq>();
+        if (aliases_.size() < max_) {
+            alias = static_cast<std::uint16_t>(aliases_.size() + 1);
+        }
+        else {
+            alias = seq.front().alias;
+            seq.pop_front();
+        }
+        seq.emplace_back(std::string(topic_name.data(), topic_name.size()), alias);
+        return { alias, true };
+    }
+
+    /**
+     * @brief Remove all aliases and set the new Topic Alias Maximum
+     * @param max Topic Alias Maximum of the peer
+     */
+    void reset(std::uint16_t max) {
+        aliases_.clear();
+        max_ = max;
+    }
+
+    std::uint16_t max() const {
+        return max_;
+    }
+
+    std::size_t size() const {
+        return aliases_.size();
+    }
+
+private:
+    struct entry {
+        entry(std::string topic_name, std::uint16_t alias)
+            : topic_name(std::move(topic_name)), alias(alias) {}
+        std::string topic_name;
+        std::uint16_t alias;
+    };
+
+    // string_view and std::string need the same hash values to find entries by string_view.
+    struct hash {
+        std::size_t operator()(string_view s) const {
+            return boost::hash_range(s.begin(), s.end());
+        }
+    };
+    struct equal {
+        bool operator()(string_view lhs, string_view rhs) const {
+            return lhs == rhs;
+        }
+    };
+
+    struct tag_topic_name {};
+    struct tag_seq {};
+    using mi_alias = mi::multi_index_container<
+        entry,
+        mi::indexed_by<
+            mi::hashed_unique<
+                mi::tag<tag_topic_name>,
+                mi::member<entry, std::string, &entry::topic_name>,
+                hash,
+                equal
+            >,
+            // least recently used first
+            mi::sequenced<
+                mi::tag<tag_seq>
+            >
+        >
+    >;
+
+    std::uint16_t max_;
+    mi_alias aliases_;
+};
+
+/**
+ * @brief Topic alias table of the receiving side.
+ *        Topic names are kept by shared_ptr, so received messages can refer to them without copy.
+ */
+class topic_alias_recv {
+public:
+    /**
+     * @brief Constructor
+     * @param max Topic Alias Maximum that is sent to the peer. 0 means topic alias is not accepted.
+     */
+    explicit topic_alias_recv(std::uint16_t max = 0)
+        : max_(max) {}
+
+    /**
+     * @brief Register or overwrite the alias
+     * @param alias      topic alias
+     * @param topic_name topic name
+     * @return the registered topic name. nullptr if the alias is out of range.
+     */
+    std::shared_ptr<std::string> insert_or_update(std::uint16_t alias, string_view topic_name) {
+        if (!valid(alias)) return nullptr;
+        auto sp = std::make_shared<std::string>(topic_name.data(), topic_name.size());
+        aliases_[alias] = sp;
+        return sp;
+    }
+
+    /**
+     * @brief Find the topic name of the alias
+     * @param alias topic alias
+     * @return the topic name. nullptr if the alias is not registered or out of range.
+     */
+    std::shared_ptr<std::string> find(std::uint16_t alias) const {
+        if (!valid(alias)) return nullptr;
+        auto it = aliases_.find(alias);
+        if (it == aliases_.end()) return nullptr;
+        return it->second;
+    }
+
+    /**
+     * @brief Remove all aliases and set the new Topic Alias Maximum
+     * @param max Topic Alias Maximum that is sent to the peer
+     */
+    void reset(std::uint16_t max) {
+        aliases_.clear();
+        max_ = max;
+    }
+
+    std::uint16_t max() const {
+        return max_;
+    }
+
+private:
+    bool valid(std::uint16_t alias) const {
+        return alias != 0 && alias <= max_;
+    }
+
+    std::uint16_t max_;
+    std::unordered_map<std::uint16_t, std::shared_ptr<std::string>> aliases_;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_TOPIC_ALIAS_HPP
@@ -0,0 +1,210 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_TRAFFIC_STATS_HPP)
+#define MQTT_TRAFFIC_STATS_HPP
+
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include <memory>
+
+namespace mqtt {
+
+/**
+ * @brief Snapshot of the traffic counters
+ */
+struct traffic_stats {
+    static constexpr std::size_t num_of_control_packet_types = 16;
+
+    /// Received bytes of the processed packets
+    std::uint64_t bytes_in = 0;
+    /// Written bytes
+    std::uint64_t bytes_out = 0;
+    /// Processed packets indexed by control packet type
+    std::array<std::uint64_t, num_of_control_packet_types> packets_in {{}};
+    /// Written packets indexed by control packet type. Resent packets are included.
+    std::array<std::uint64_t, num_of_control_packet_types> packets_out {{}};
+    /// The number of packets that wait in the async write queue
+    std::uint64_t queue_depth = 0;
+    /// The total size of packets that wait in the async write queue
+    std::uint64_t queue_bytes = 0;
+    /// The number of stored messages that wait for PUBACK, PUBREC or PUBCOMP
+    std::uint64_t store_size = 0;
+    /// The number of writes to the socket. An async write can contain many packets.
+    std::uint64_t write_batches = 0;
+    /// The number of reads from the socket
+    std::uint64_t read_calls = 0;
+};
+
+/**
+ * @brief Traffic counters that can be updated and read by many threads without locks.
+ *        queue_depth, queue_bytes and store_size are gauges. Others only increase.
+ */
+class traffic_counters {
+public:
+    traffic_counters() {
+        for (auto& p : packets_in_) p.store(0, std::memory_order_relaxed);
+        for (auto& p : packets_out_) p.store(0, std::memory_order_relaxed);
+    }
+
+    traffic_counters(traffic_counters const&) = delete;
+    traffic_counters& operator=(traffic_counters const&) = delete;
+
+    void received(std::uint8_t control_packet_type, std::size_t bytes) {
+        packets_in_[control_packet_type & 0x0f].fetch_add(1, std::memory_order_relaxed);
+        bytes_in_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void sent(std::uint8_t control_packet_type, std::size_t bytes) {
+        packets_out_[control_packet_type & 0x0f].fetch_add(1, std::memory_order_relaxed);
+        bytes_out_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void write_batch() {
+        write_batches_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void read_call() {
+        read_calls_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Gauges are updated by differences, so that the counters can be summed up.
+    void add_queue(std::int64_t depth, std::int64_t bytes) {
+        queue_depth_.fetch_add(static_cast<std::uint64_t>(depth), std::memory_order_relaxed);
+        queue_bytes_.fetch_add(static_cast<std::uint64_t>(bytes), std::memory_order_relaxed);
+    }
+
+    void add_store(std::int64_t size) {
+        store_size_.fetch_add(static_cast<std::uint64_t>(size), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Take the snapshot. Each value is read atomically, but the values are not consistent
+     *        with each other while other threads are updating them.
+     * @return snapshot
+     */
+    traffic_stats take_snapshot() const {
+        traffic_stats s;
+        s.bytes_in = bytes_in_.load(std::memory_order_relaxed);
+        s.bytes_out = bytes_out_.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i != traffic_stats::num_of_control_packet_types; ++i) {
+            s.packets_in[i] = packets_in_[i].load(std::memory_order_relaxed);
+            s.packets_out[i] = packets_out_[i].load(std::memory_order_relaxed);
+        }
+        s.queue_depth = queue_depth_.load(std::memory_order_relaxed);
+        s.queue_bytes = queue_bytes_.load(std::memory_order_relaxed);
+        s.store_size = store_size_.load(std::memory_order_relaxed);
+        s.write_batches = write_batches_.load(std::memory_order_relaxed);
+        s.read_calls = read_calls_.load(std::memory_order_relaxed);
+        return s;
+    }
+
+private:
+    std::atomic<std::uint64_t> bytes_in_{0};
+    std::atomic<std::uint64_t> bytes_out_{0};
+    std::array<std::atomic<std::uint64_t>, traffic_stats::num_of_control_packet_types> packets_in_;
+    std::array<std::atomic<std::uint64_t>, traffic_stats::num_of_control_packet_types> packets_out_;
+    std::atomic<std::uint64_t> queue_depth_{0};
+    std::atomic<std::uint64_t> queue_bytes_{0};
+    std::atomic<std::uint64_t> store_size_{0};
+    std::atomic<std::uint64_t> write_batches_{0};
+    std::atomic<std::uint64_t> read_calls_{0};
+};
+
+/**
+ * @brief Traffic counters of an endpoint. The updates are also applied to the shared counters
+ *        (e.g. the counters of the server that accepted the endpoint) if they are set.
+ *        On destruction, the gauges of the endpoint are removed from the shared counters.
+ */
+class traffic_recorder {
+public:
+    traffic_recorder() = default;
+    traffic_recorder(traffic_recorder const&) = delete;
+    traffic_recorder& operator=(traffic_recorder const&) = delete;
+
+    ~traffic_recorder() {
+        if (shared_) remove_gauges(*shared_);
+    }
+
+    /**
+     * @brief Set the shared counters. The current gauges are moved to the new shared counters.
+     * @param shared shared counters
+     */
+    void set_shared(std::shared_ptr<traffic_counters> shared) {
+        if (shared_) remove_gauges(*shared_);
+        shared_ = std::move(shared);
+        if (shared_) {
+            auto s = own_.take_snapshot();
+            shared_->add_queue(
+                static_cast<std::int64_t>(s.queue_depth),
+                static_cast<std::int64_t>(s.queue_bytes)
+            );
+            shared_->add_store(static_cast<std::int64_t>(s.store_size));
+        }
+    }
+
+    void received(std::uint8_t control_packet_type, std::size_t bytes) {
+        own_.received(control_packet_type, bytes);
+        if (shared_) shared_->received(control_packet_type, bytes);
+    }
+
+    void sent(std::uint8_t control_packet_type, std::size_t bytes) {
+        own_.sent(control_packet_type, bytes);
+        if (shared_) shared_->sent(control_packet_type, bytes);
+    }
+
+    void write_batch() {
+        own_.write_batch();
+        if (shared_) shared_->write_batch();
+    }
+
+    void read_call() {
+        own_.read_call();
+        if (shared_) shared_->read_call();
+    }
+
+    void queue_push(std::size_t bytes) {
+        add_queue(1, static_cast<std::int64_t>(bytes));
+    }
+
+    void queue_pop(std::size_t bytes) {
+        add_queue(-1, -static_cast<std::int64_t>(bytes));
+    }
+
+    // Called with the new size whenever the store is modified.
+    void store_size(std::size_t size) {
+        auto diff = static_cast<std::int64_t>(size) - static_cast<std::int64_t>(store_size_);
+        if (diff == 0) return;
+        store_size_ = size;
+        own_.add_store(diff);
+        if (shared_) shared_->add_store(diff);
+    }
+
+    traffic_stats take_snapshot() const {
+        return own_.take_snapshot();
+    }
+
+private:
+    void add_queue(std::int64_t depth, std::int64_t bytes) {
+        own_.add_queue(depth, bytes);
+        if (shared_) shared_->add_queue(depth, bytes);
+    }
+
+    void remove_gauges(traffic_counters& c) const {
+        auto s = own_.take_snapshot();
+        c.add_queue(-static_cast<std::int64_t>(s.queue_depth), -static_cast<std::int64_t>(s.queue_bytes));
+        c.add_store(-static_cast<std::int64_t>(s.store_size));
+    }
+
+    traffic_counters own_;
+    std::shared_ptr<traffic_counters> shared_;
+    std::size_t store_size_ = 0;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_TRAFFIC_STATS_HPP
@@ -7,9 +7,23 @@
 #if !defined(MQTT_UTF8ENCODED_STRINGS_HPP)
 #define MQTT_UTF8ENCODED_STRINGS_HPP
 
+#include <cstddef>
+#include <algorithm>
+
 #include <mqtt/utility.hpp>
 #include <mqtt/string_view.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MQTT_UTF8_SSE2
+#include <emmintrin.h>
+#endif // defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+// AVX2 code is compiled by the target attribute and used if the running CPU supports it.
+#if defined(MQTT_UTF8_SSE2) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define MQTT_UTF8_AVX2
+#include <immintrin.h>
+#endif // defined(MQTT_UTF8_SSE2) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+
 namespace mqtt {
 
 namespace utf8string {
@@ -43,103 +57,210 @@ is_valid_length(string_view str) {
     return str.size() <= 0xffff;
 }
 
-inline validation
-validate_contents(string_view str) {
-    // This code is based on https://www.cl.cam.ac.uk/~mgk25/ucs/utf8_check.c
-    auto result = validation::well_formed;
-#if defined(MQTT_USE_STR_CHECK)
-    auto it = str.begin();
-    auto end = str.end();
+namespace detail {
 
-    while (it != end) {
-        if (static_cast<unsigned char>(*(it + 0)) < 0b1000'0000) {
-            // 0xxxxxxxxx
-            if (static_cast<unsigned char>(*(it + 0)) == 0x00) {
-                result = validation::ill_formed;
-                break;
-            }
-            if ((static_cast<unsigned char>(*(it + 0)) >= 0x01 &&
-                 static_cast<unsigned char>(*(it + 0)) <= 0x1f) ||
-                static_cast<unsigned char>(*(it + 0)) == 0x7f) {
-                result = validation::well_formed_with_non_charactor;
-            }
-            ++it;
+// Validate one character at it and advance it to the next character.
+// Returns false if the character is ill formed.
+// This code is based on https://www.cl.cam.ac.uk/~mgk25/ucs/utf8_check.c
+inline bool
+validate_one(char const*& it, char const* end, validation& result) {
+    if (static_cast<unsigned char>(*(it + 0)) < 0b1000'0000) {
+        // 0xxxxxxxxx
+        if (static_cast<unsigned char>(*(it + 0)) == 0x00) {
+            return false;
+        }
+        if ((static_cast<unsigned char>(*(it + 0)) >= 0x01 &&
+             static_cast<unsigned char>(*(it + 0)) <= 0x1f) ||
+            static_cast<unsigned char>(*(it + 0)) == 0x7f) {
+            result = validation::well_formed_with_non_charactor;
+        }
+        ++it;
+    }
+    else if ((static_cast<unsigned char>(*(it + 0)) & 0b1110'0000) == 0b1100'0000) {
+        // 110XXXXx 10xxxxxx
+        if (it + 1 >= end) {
+            return false;
+        }
+        if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'0000) != 0b1000'0000 ||
+            (static_cast<unsigned char>(*(it + 0)) & 0b1111'1110) == 0b1100'0000) { // overlong
+            return false;
+        }
+        if (static_cast<unsigned char>(*(it + 0)) == 0b1100'0010 &&
+            static_cast<unsigned char>(*(it + 1)) >= 0b1000'0000 &&
+            static_cast<unsigned char>(*(it + 1)) <= 0b1001'1111) {
+            result = validation::well_formed_with_non_charactor;
+        }
+        it += 2;
+    }
+    else if ((static_cast<unsigned char>(*(it + 0)) & 0b1111'0000) == 0b1110'0000) {
+        // 1110XXXX 10Xxxxxx 10xxxxxx
+        if (it + 2 >= end) {
+            return false;
         }
-        else if ((static_cast<unsigned char>(*(it + 0)) & 0b1110'0000) == 0b1100'0000) {
-            // 110XXXXx 10xxxxxx
-            if (it + 1 >= end) {
-                result = validation::ill_formed;
-                break;
-            }
-            if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'0000) != 0b1000'0000 ||
-                (static_cast<unsigned char>(*(it + 0)) & 0b1111'1110) == 0b1100'0000) { // overlong
-                result = validation::ill_formed;
-                break;
-            }
-            if (static_cast<unsigned char>(*(it + 0)) == 0b1100'0010 &&
-                static_cast<unsigned char>(*(it + 1)) >= 0b1000'0000 &&
-                static_cast<unsigned char>(*(it + 1)) <= 0b1001'1111) {
-                result = validation::well_formed_with_non_charactor;
-            }
-            it += 2;
+        if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'0000) != 0b1000'0000 ||
+            (static_cast<unsigned char>(*(it + 2)) & 0b1100'0000) != 0b1000'0000 ||
+            (static_cast<unsigned char>(*(it + 0)) == 0b1110'0000 &&
+             (static_cast<unsigned char>(*(it + 1)) & 0b1110'0000) == 0b1000'0000) || // overlong?
+            (static_cast<unsigned char>(*(it + 0)) == 0b1110'1101 &&
+             (static_cast<unsigned char>(*(it + 1)) & 0b1110'0000) == 0b1010'0000)) { // surrogate?
+            return false;
         }
-        else if ((static_cast<unsigned char>(*(it + 0)) & 0b1111'0000) == 0b1110'0000) {
-            // 1110XXXX 10Xxxxxx 10xxxxxx
-            if (it + 2 >= end) {
-                result = validation::ill_formed;
-                break;
-            }
-            if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'0000) != 0b1000'0000 ||
-                (static_cast<unsigned char>(*(it + 2)) & 0b1100'0000) != 0b1000'0000 ||
-                (static_cast<unsigned char>(*(it + 0)) == 0b1110'0000 &&
-                 (static_cast<unsigned char>(*(it + 1)) & 0b1110'0000) == 0b1000'0000) || // overlong?
-                (static_cast<unsigned char>(*(it + 0)) == 0b1110'1101 &&
-                 (static_cast<unsigned char>(*(it + 1)) & 0b1110'0000) == 0b1010'0000)) { // surrogate?
-                result = validation::ill_formed;
-                break;
-            }
-            if (static_cast<unsigned char>(*(it + 0)) == 0b1110'1111 &&
-                static_cast<unsigned char>(*(it + 1)) == 0b1011'1111 &&
-                (static_cast<unsigned char>(*(it + 2)) & 0b1111'1110) == 0b1011'1110) {
-                // U+FFFE or U+FFFF?
-                result = validation::well_formed_with_non_charactor;
-            }
-            it += 3;
+        if (static_cast<unsigned char>(*(it + 0)) == 0b1110'1111 &&
+            static_cast<unsigned char>(*(it + 1)) == 0b1011'1111 &&
+            (static_cast<unsigned char>(*(it + 2)) & 0b1111'1110) == 0b1011'1110) {
+            // U+FFFE or U+FFFF?
+            result = validation::well_formed_with_non_charactor;
         }
-        else if ((static_cast<unsigned char>(*(it + 0)) & 0b1111'1000) == 0b1111'0000) {
-            // 11110XXX 10XXxxxx 10xxxxxx 10xxxxxx
-            if (it + 3 >= end) {
-                result = validation::ill_formed;
-                break;
-            }
-            if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'0000) != 0b1000'0000 ||
-                (static_cast<unsigned char>(*(it + 2)) & 0b1100'0000) != 0b1000'0000 ||
-                (static_cast<unsigned char>(*(it + 3)) & 0b1100'0000) != 0b1000'0000 ||
-                (static_cast<unsigned char>(*(it + 0)) == 0b1111'0000 &&
-                 (static_cast<unsigned char>(*(it + 1)) & 0b1111'0000) == 0b1000'0000) ||    // overlong?
-                (static_cast<unsigned char>(*(it + 0)) == 0b1111'0100 &&
-                 static_cast<unsigned char>(*(it + 1)) > 0b1000'1111) ||
-                static_cast<unsigned char>(*(it + 0)) > 0b1111'0100) { // > U+10FFFF?
-                result = validation::ill_formed;
-                break;
-            }
-            if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'1111) == 0b1000'1111 &&
-                static_cast<unsigned char>(*(it + 2)) == 0b1011'1111 &&
-                (static_cast<unsigned char>(*(it + 3)) & 0b1111'1110) == 0b1011'1110) {
-                // U+nFFFE or U+nFFFF?
-                result = validation::well_formed_with_non_charactor;
-            }
-            it += 4;
+        it += 3;
+    }
+    else if ((static_cast<unsigned char>(*(it + 0)) & 0b1111'1000) == 0b1111'0000) {
+        // 11110XXX 10XXxxxx 10xxxxxx 10xxxxxx
+        if (it + 3 >= end) {
+            return false;
+        }
+        if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'0000) != 0b1000'0000 ||
+            (static_cast<unsigned char>(*(it + 2)) & 0b1100'0000) != 0b1000'0000 ||
+            (static_cast<unsigned char>(*(it + 3)) & 0b1100'0000) != 0b1000'0000 ||
+            (static_cast<unsigned char>(*(it + 0)) == 0b1111'0000 &&
+             (static_cast<unsigned char>(*(it + 1)) & 0b1111'0000) == 0b1000'0000) ||    // overlong?
+            (static_cast<unsigned char>(*(it + 0)) == 0b1111'0100 &&
+             static_cast<unsigned char>(*(it + 1)) > 0b1000'1111) ||
+            static_cast<unsigned char>(*(it + 0)) > 0b1111'0100) { // > U+10FFFF?
+            return false;
+        }
+        if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'1111) == 0b1000'1111 &&
+            static_cast<unsigned char>(*(it + 2)) == 0b1011'1111 &&
+            (static_cast<unsigned char>(*(it + 3)) & 0b1111'1110) == 0b1011'1110) {
+            // U+nFFFE or U+nFFFF?
+            result = validation::well_formed_with_non_charactor;
+        }
+        it += 4;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+inline validation
+validate_scalar(char const* it, char const* end) {
+    auto result = validation::well_formed;
+    while (it != end) {
+        if (!validate_one(it, end, result)) return validation::ill_formed;
+    }
+    return result;
+}
+
+// Validate the characters that start before limit. The last one can end after limit.
+inline bool
+validate_until(char const*& it, char const* limit, char const* end, validation& result) {
+    while (it < limit) {
+        if (!validate_one(it, end, result)) return false;
+    }
+    return true;
+}
+
+// Topic names and most string properties are printable ASCII. The characters 0x20-0x7e
+// are well formed and are not control characters, so a chunk of them is skipped at once.
+// If a chunk has other characters, the following scalar_span bytes are validated by validate_one(),
+// so that strings of multi byte characters don't pay the chunk check for each chunk.
+// validate_one() stops at a character boundary, so the next chunk starts at the boundary
+// even if a multi byte character is across the chunks.
+
+static constexpr std::ptrdiff_t scalar_span = 64;
+
+#if defined(MQTT_UTF8_SSE2)
+
+inline validation
+validate_sse2(char const* it, char const* end) {
+    auto result = validation::well_formed;
+    while (end - it >= 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(it));
+        // Signed comparison. Bytes that have the most significant bit are negative.
+        auto printable = _mm_and_si128(
+            _mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)),
+            _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f))
+        );
+        if (_mm_movemask_epi8(printable) == 0xffff) {
+            it += 16;
+            continue;
         }
-        else {
-            result = validation::ill_formed;
-            break;
+        if (!validate_until(it, std::min(it + scalar_span, end), end, result)) return validation::ill_formed;
+    }
+    if (!validate_until(it, end, end, result)) return validation::ill_formed;
+    return result;
+}
+
+#endif // defined(MQTT_UTF8_SSE2)
+
+#if defined(MQTT_UTF8_AVX2)
+
+__attribute__((target("avx2")))
+inline validation
+validate_avx2(char const* it, char const* end) {
+    auto result = validation::well_formed;
+    while (end - it >= 32) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(it));
+        auto printable = _mm256_and_si256(
+            _mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x1f)),
+            _mm256_cmpgt_epi8(_mm256_set1_epi8(0x7f), v)
+        );
+        if (_mm256_movemask_epi8(printable) == -1) {
+            it += 32;
+            continue;
         }
+        if (!validate_until(it, std::min(it + scalar_span, end), end, result)) return validation::ill_formed;
     }
+    if (end - it >= 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(it));
+        auto printable = _mm_and_si128(
+            _mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)),
+            _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f))
+        );
+        if (_mm_movemask_epi8(printable) == 0xffff) it += 16;
+    }
+    if (!validate_until(it, end, end, result)) return validation::ill_formed;
+    return result;
+}
+
+inline bool
+avx2_supported() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif // defined(MQTT_UTF8_AVX2)
+
+using validate_func = validation (*)(char const*, char const*);
+
+// Choose the fastest implementation that the running CPU supports.
+inline validate_func
+select_validate() {
+#if defined(MQTT_UTF8_AVX2)
+    if (avx2_supported()) return &validate_avx2;
+#endif // defined(MQTT_UTF8_AVX2)
+#if defined(MQTT_UTF8_SSE2)
+    return &validate_sse2;
+#else  // defined(MQTT_UTF8_SSE2)
+    return &validate_scalar;
+#endif // defined(MQTT_UTF8_SSE2)
+}
+
+} // namespace detail
+
+inline validation
+validate_contents(string_view str) {
+#if defined(MQTT_USE_STR_CHECK)
+    auto b = str.data();
+    auto e = b + str.size();
+    // Short strings are not worth the indirect call.
+    if (str.size() < 16) return detail::validate_scalar(b, e);
+    static detail::validate_func const f = detail::select_validate();
+    return f(b, e);
 #else // MQTT_USE_STR_CHECK
     static_cast<void>(str);
+    return validation::well_formed;
 #endif // MQTT_USE_STR_CHECK
-    return result;
 }
 
 } // namespace utf8string
@@ -29,9 +29,12 @@
 #include <mqtt/exception.hpp>
 #include <mqtt/utf8encoded_strings.hpp>
 #include <mqtt/string_check.hpp>
+#include <mqtt/shared_publish.hpp>
 #include <mqtt/property.hpp>
 #include <mqtt/property_variant.hpp>
 #include <mqtt/property_parse.hpp>
+#include <mqtt/property_view.hpp>
+#include <mqtt/visitor_util.hpp>
 #include <mqtt/packet_id_type.hpp>
 
 namespace mqtt {
@@ -506,6 +509,8 @@ public:
         ret.push_back(static_cast<char>(connect_acknowledge_flags_));
         ret.push_back(static_cast<char>(reason_code_));
 
+        ret.append(property_length_buf_.data(), property_length_buf_.size());
+
         auto it = ret.end();
         ret.resize(ret.size() + property_length_);
         auto end = ret.end();
@@ -604,6 +609,59 @@ public:
         }
     }
 
+    /**
+     * @brief Constructor
+     *        The topic name, the encoded properties and the payload refer to the shared body.
+     *        They are not validated and encoded again.
+     *        The caller needs to keep the body alive while the message is used.
+     * @param body      shared part of the message
+     * @param qos       qos
+     * @param retain    retain flag
+     * @param dup       dup flag
+     * @param packet_id packet id
+     */
+    basic_publish_message(
+        shared_publish const& body,
+        std::uint8_t qos,
+        bool retain,
+        bool dup,
+        typename packet_id_type<PacketIdBytes>::type packet_id
+    )
+        : fixed_header_(make_fixed_header(control_packet_type::publish, 0b0000)),
+          topic_name_(body.topic()),
+          topic_name_length_buf_ { MQTT_16BITNUM_TO_BYTE_SEQ(get_size(body.topic())) },
+          property_length_(body.v5_property_length()),
+          property_length_buf_(body.v5_property_length_buf().begin(), body.v5_property_length_buf().end()),
+          encoded_props_(body.v5_properties()),
+          payload_(body.payload()),
+          remaining_length_(publish_remaining_length(topic_name_, qos, payload_)),
+          num_of_const_buffer_sequence_(
+              1 +                   // fixed header
+              1 +                   // remaining length
+              1 +                   // topic name length
+              1 +                   // topic name
+              (qos == qos::at_most_once ? 0U : 1U) + // packet id
+              1 +                   // property length
+              (property_length_ == 0 ? 0U : 1U) + // encoded properties
+              1                     // payload
+          )
+    {
+        publish::set_qos(fixed_header_, qos);
+        publish::set_retain(fixed_header_, retain);
+        publish::set_dup(fixed_header_, dup);
+
+        remaining_length_ += property_length_buf_.size() + property_length_;
+
+        auto rb = remaining_bytes(remaining_length_);
+        for (auto e : rb) {
+            remaining_length_buf_.push_back(e);
+        }
+        if (qos == qos::at_least_once ||
+            qos == qos::exactly_once) {
+            add_packet_id_to_buf<PacketIdBytes>::apply(packet_id_, packet_id);
+        }
+    }
+
     template <typename Iterator>
     basic_publish_message(Iterator b, Iterator e) {
         if (b >= e) throw remaining_length_error();
@@ -698,9 +756,15 @@ public:
         }
 
         ret.emplace_back(as::buffer(property_length_buf_.data(), property_length_buf_.size()));
+        if (!topic_alias_prop_.empty()) {
+            ret.emplace_back(as::buffer(topic_alias_prop_.data(), topic_alias_prop_.size()));
+        }
         for (auto const& p : props_) {
             v5::add_const_buffer_sequence(ret, p);
         }
+        if (get_size(encoded_props_) != 0) {
+            ret.emplace_back(encoded_props_);
+        }
 
         ret.emplace_back(payload_);
 
@@ -746,13 +810,19 @@ public:
         ret.append(packet_id_.data(), packet_id_.size());
 
         ret.append(property_length_buf_.data(), property_length_buf_.size());
+        ret.append(topic_alias_prop_.data(), topic_alias_prop_.size());
 
-        auto it = ret.end();
-        ret.resize(ret.size() + property_length_);
-        auto end = ret.end();
-        for (auto const& p : props_) {
-            v5::fill(p, it, end);
-            it += static_cast<std::string::difference_type>(v5::size(p));
+        if (get_size(encoded_props_) != 0) {
+            ret.append(get_pointer(encoded_props_), get_size(encoded_props_));
+        }
+        else {
+            auto it = ret.end();
+            ret.resize(ret.size() + property_length_ - topic_alias_prop_.size());
+            auto end = ret.end();
+            for (auto const& p : props_) {
+                v5::fill(p, it, end);
+                it += static_cast<std::string::difference_type>(v5::size(p));
+            }
         }
 
         ret.append(get_pointer(payload_), get_size(payload_));
@@ -808,6 +878,15 @@ public:
         return payload_;
     }
 
+    /**
+     * @brief Get properties
+     *        The properties encoded by shared_publish are not included.
+     * @return properties
+     */
+    properties const& props() const {
+        return props_;
+    }
+
     /**
      * @brief Set dup flag
      * @param dup flag value to set
@@ -816,8 +895,135 @@ public:
         publish::set_dup(fixed_header_, dup);
     }
 
+    /**
+     * @brief Check whether the message has the Topic Alias property
+     *        The properties encoded by shared_publish and the one added by add_topic_alias()
+     *        are also searched.
+     * @return true if the message has the property
+     */
+    bool has_topic_alias() const {
+        if (!topic_alias_prop_.empty()) return true;
+        if (get_size(encoded_props_) != 0) {
+            return static_cast<bool>(encoded_props_view().template find<property::topic_alias>());
+        }
+        return std::any_of(
+            props_.begin(),
+            props_.end(),
+            [](property_variant const& pv) {
+                return mqtt::visit(
+                    make_lambda_visitor<bool>(
+                        [](property::topic_alias const&) { return true; },
+                        [](auto const&) { return false; }
+                    ),
+                    pv
+                );
+            }
+        );
+    }
+
+    /**
+     * @brief Get the Message Expiry Interval property
+     *        The properties encoded by shared_publish are also searched.
+     * @return the interval in seconds. nullopt if the message doesn't have the property.
+     */
+    mqtt::optional<std::uint32_t> message_expiry_interval() const {
+        if (get_size(encoded_props_) != 0) {
+            if (auto p = encoded_props_view().template find<property::message_expiry_interval>()) {
+                return p->val();
+            }
+            return mqtt::nullopt;
+        }
+        for (auto const& p : props_) {
+            if (auto v = get_message_expiry_interval(p)) return v;
+        }
+        return mqtt::nullopt;
+    }
+
+    /**
+     * @brief Rewrite the value of the Message Expiry Interval property, e.g. to the remaining
+     *        interval when the stored message is resent.
+     *        The size of the message is not changed. If the properties are encoded by
+     *        shared_publish, they are decoded to the properties of this message, because
+     *        the encoded properties are shared by other messages.
+     * @param interval interval in seconds
+     * @return true if rewritten, false if the message doesn't have the property.
+     */
+    bool update_message_expiry_interval(std::uint32_t interval) {
+        if (get_size(encoded_props_) != 0) {
+            auto view = encoded_props_view();
+            if (!view.template find<property::message_expiry_interval>()) return false;
+            // The decoded properties refer to the shared body that is kept by the life keeper.
+            props_ = view.to_vector();
+            encoded_props_ = as::const_buffer();
+            --num_of_const_buffer_sequence_;
+            for (auto const& p : props_) {
+                num_of_const_buffer_sequence_ += v5::num_of_const_buffer_sequence(p);
+            }
+        }
+        for (auto& p : props_) {
+            if (get_message_expiry_interval(p)) {
+                p = property::message_expiry_interval(interval);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Add topic alias property in front of the other properties.
+     *        It is used by endpoint to replace topic names by topic aliases automatically.
+     *        The properties must not contain topic alias.
+     * @param alias           topic alias
+     * @param omit_topic_name If true, the topic name is sent as a zero length string.
+     */
+    void add_topic_alias(std::uint16_t alias, bool omit_topic_name) {
+        BOOST_ASSERT(topic_alias_prop_.empty());
+        remaining_length_ -= property_length_buf_.size();
+        topic_alias_prop_ = {
+            static_cast<char>(property::id::topic_alias),
+            MQTT_16BITNUM_TO_BYTE_SEQ(alias)
+        };
+        property_length_ += topic_alias_prop_.size();
+        property_length_buf_.clear();
+        auto pb = variable_bytes(property_length_);
+        for (auto e : pb) {
+            property_length_buf_.push_back(e);
+        }
+        remaining_length_ += property_length_buf_.size() + topic_alias_prop_.size();
+
+        if (omit_topic_name) {
+            remaining_length_ -= get_size(topic_name_);
+            topic_name_ = as::const_buffer();
+            topic_name_length_buf_ = { 0, 0 };
+        }
+
+        remaining_length_buf_.clear();
+        auto rb = remaining_bytes(remaining_length_);
+        for (auto e : rb) {
+            remaining_length_buf_.push_back(e);
+        }
+        ++num_of_const_buffer_sequence_;
+    }
 
 private:
+    property_view encoded_props_view() const {
+        return property_view(buffer(string_view(get_pointer(encoded_props_), get_size(encoded_props_))));
+    }
+
+    static mqtt::optional<std::uint32_t> get_message_expiry_interval(property_variant const& pv) {
+        return mqtt::visit(
+            make_lambda_visitor<mqtt::optional<std::uint32_t>>(
+                [](property::message_expiry_interval const& p) -> mqtt::optional<std::uint32_t> {
+                    return p.val();
+                },
+                [](auto const&) -> mqtt::optional<std::uint32_t> {
+                    return mqtt::nullopt;
+                }
+            ),
+            pv
+        );
+    }
+
     static std::size_t publish_remaining_length(
         as::const_buffer const& topic_name,
         std::uint8_t qos,
@@ -843,7 +1049,11 @@ private:
     boost::container::static_vector<char, PacketIdBytes> packet_id_;
     std::size_t property_length_;
     boost::container::static_vector<char, 4> property_length_buf_;
+    // topic alias property that is added by add_topic_alias()
+    boost::container::static_vector<char, 3> topic_alias_prop_;
     properties props_;
+    // properties encoded by shared_publish
+    as::const_buffer encoded_props_;
     as::const_buffer payload_;
     std::size_t remaining_length_;
     boost::container::static_vector<char, 4> remaining_length_buf_;
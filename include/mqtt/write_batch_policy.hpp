@@ -0,0 +1,116 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_WRITE_BATCH_POLICY_HPP)
+#define MQTT_WRITE_BATCH_POLICY_HPP
+
+#include <cstddef>
+#include <chrono>
+
+namespace mqtt {
+
+/**
+ * @brief Policy of concatenating queued messages into one async_write.
+ *        When async message sending function is called during asynchronous
+ *        processing, the message is enqueued. When current asynchronous
+ *        message is processed, queued messages are concatenated and sent
+ *        as one batch within the limits of the policy.
+ */
+class write_batch_policy {
+public:
+    /**
+     * @brief Constructor
+     * @param max_messages maximum number of messages in a batch. 0 means infinity.
+     * @param max_bytes    maximum size of a batch. 0 means infinity.
+     *                     A message that is bigger than max_bytes is sent alone.
+     * @param linger       time to wait for more messages before the first message
+     *                     of an idle endpoint is sent. 0 means no waiting.
+     */
+    explicit write_batch_policy(
+        std::size_t max_messages = 0,
+        std::size_t max_bytes = 0,
+        std::chrono::microseconds linger = std::chrono::microseconds::zero())
+        :max_messages_(max_messages),
+         max_bytes_(max_bytes),
+         linger_(linger)
+    {}
+
+    /**
+     * @brief Send all queued messages at once. This is the default policy.
+     */
+    static write_batch_policy drain_all() {
+        return write_batch_policy();
+    }
+
+    /**
+     * @brief Send one message per async_write.
+     */
+    static write_batch_policy one_by_one() {
+        return write_batch_policy(1);
+    }
+
+    /**
+     * @brief Send queued messages up to bytes at once.
+     * @param bytes maximum size of a batch.
+     */
+    static write_batch_policy up_to_bytes(std::size_t bytes) {
+        return write_batch_policy(0, bytes);
+    }
+
+    /**
+     * @brief Wait up to linger to gather more messages, then send them at once.
+     *        If max_bytes is reached during waiting, the batch is sent immediately.
+     * @param linger    time to wait for more messages.
+     * @param max_bytes maximum size of a batch. 0 means infinity.
+     */
+    static write_batch_policy linger_for(
+        std::chrono::microseconds linger,
+        std::size_t max_bytes = 0) {
+        return write_batch_policy(0, max_bytes, linger);
+    }
+
+    std::size_t max_messages() const {
+        return max_messages_;
+    }
+    void set_max_messages(std::size_t max_messages) {
+        max_messages_ = max_messages;
+    }
+
+    std::size_t max_bytes() const {
+        return max_bytes_;
+    }
+    void set_max_bytes(std::size_t max_bytes) {
+        max_bytes_ = max_bytes;
+    }
+
+    std::chrono::microseconds linger() const {
+        return linger_;
+    }
+    void set_linger(std::chrono::microseconds linger) {
+        linger_ = linger;
+    }
+
+    /**
+     * @brief Check the batch is full.
+     * @param messages number of messages in the batch
+     * @param bytes    size of the batch
+     * @return true if no more message can be added to the batch.
+     */
+    bool full(std::size_t messages, std::size_t bytes) const {
+        return
+            (max_messages_ != 0 && messages >= max_messages_) ||
+            (max_bytes_ != 0 && bytes >= max_bytes_);
+    }
+
+private:
+    std::size_t max_messages_;
+    std::size_t max_bytes_;
+    std::chrono::microseconds linger_;
+};
+
+} // namespace mqtt
+
+#endif // MQTT_WRITE_BATCH_POLICY_HPP
@@ -0,0 +1,196 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+#include "combi_test.hpp"
+#include "checker.hpp"
+
+#include <mqtt/buffer_pool.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_buffer_pool)
+
+BOOST_AUTO_TEST_CASE( size_class ) {
+    auto pool = std::make_shared<mqtt::buffer_pool>(std::vector<std::size_t>{ 64, 256 }, 1);
+    {
+        auto m1 = pool->allocate(1);
+        BOOST_TEST(m1.second == 64U);
+        auto m2 = pool->allocate(65);
+        BOOST_TEST(m2.second == 256U);
+        auto m3 = pool->allocate(257);
+        BOOST_TEST(m3.second == 257U);
+        auto m4 = pool->allocate(64);
+        BOOST_TEST(m4.second == 64U);
+        auto s = pool->get_stats();
+        BOOST_TEST(s.hit == 0U);
+        BOOST_TEST(s.miss == 3U);
+        BOOST_TEST(s.oversize == 1U);
+    }
+    auto s = pool->get_stats();
+    // max_cached_per_class is 1, so one of two 64 bytes slabs is discarded.
+    BOOST_TEST(s.returned == 2U);
+    BOOST_TEST(s.discarded == 1U);
+    BOOST_TEST(s.cached == 2U);
+
+    auto m = pool->allocate(10);
+    BOOST_TEST(m.second == 64U);
+    s = pool->get_stats();
+    BOOST_TEST(s.hit == 1U);
+    BOOST_TEST(s.cached == 1U);
+}
+
+BOOST_AUTO_TEST_CASE( slab_outlives_pool ) {
+    auto pool = std::make_shared<mqtt::buffer_pool>();
+    auto m = pool->allocate(10);
+    pool.reset();
+    // the slab is freed by delete[] instead of returning to the pool
+    m.first.reset();
+}
+
+BOOST_AUTO_TEST_CASE( receive_buffer ) {
+    auto pool = std::make_shared<mqtt::buffer_pool>(std::vector<std::size_t>{ 64, 256 });
+    mqtt::receive_buffer rb;
+    rb.set_pool(pool);
+    std::string data("abc");
+    rb.assign(data.begin(), data.end());
+    BOOST_TEST(rb.size() == 3U);
+    auto kept = rb.share();
+    BOOST_TEST(kept == "abc");
+    rb.clear();
+    // kept buffer refers to the slab, so the next message needs another one.
+    std::string data2("defg");
+    rb.assign(data2.begin(), data2.end());
+    BOOST_TEST(kept == "abc");
+    BOOST_TEST(std::string(rb.data(), rb.size()) == "defg");
+    BOOST_TEST(pool->get_stats().miss == 2U);
+    kept = mqtt::buffer();
+    BOOST_TEST(pool->get_stats().returned == 1U);
+    rb.clear();
+    // nobody else refers to the slab, so it is reused.
+    rb.assign(data.begin(), data.end());
+    BOOST_TEST(pool->get_stats().miss == 2U);
+    BOOST_TEST(pool->get_stats().hit == 0U);
+}
+
+BOOST_AUTO_TEST_CASE( pubsub ) {
+    auto test = [](boost::asio::io_service& ios, auto& c, auto& s, auto& /*b*/) {
+        using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+        c->set_clean_session(true);
+
+        auto pool = std::make_shared<mqtt::buffer_pool>();
+        c->set_buffer_pool(pool);
+        BOOST_TEST(c->get_buffer_pool() == pool);
+
+        std::vector<mqtt::buffer> kept;
+
+        checker chk = {
+            // connect
+            cont("h_connack"),
+            // subscribe topic1 QoS0
+            cont("h_suback"),
+            // publish topic1 QoS0 * 3
+            cont("h_publish0"),
+            cont("h_publish1"),
+            cont("h_publish2"),
+            // disconnect
+            cont("h_close"),
+        };
+
+        auto on_suback =
+            [&] {
+                MQTT_CHK("h_suback");
+                for (int i = 0; i != 3; ++i) {
+                    c->publish_at_most_once("topic1", "topic1_contents" + std::to_string(i));
+                }
+            };
+        auto on_publish =
+            [&]
+            (mqtt::buffer contents) {
+                auto i = kept.size();
+                MQTT_CHK("h_publish" + std::to_string(i));
+                BOOST_TEST(contents == "topic1_contents" + std::to_string(i));
+                kept.push_back(std::move(contents));
+                if (kept.size() == 3) c->disconnect();
+            };
+
+        switch (c->get_protocol_version()) {
+        case mqtt::protocol_version::v3_1_1:
+            c->set_connack_handler(
+                [&chk, &c]
+                (bool /*sp*/, std::uint8_t /*connack_return_code*/) {
+                    MQTT_CHK("h_connack");
+                    c->subscribe("topic1", mqtt::qos::at_most_once);
+                    return true;
+                });
+            c->set_suback_handler(
+                [&on_suback]
+                (packet_id_t /*packet_id*/, std::vector<mqtt::optional<std::uint8_t>> /*results*/) {
+                    on_suback();
+                    return true;
+                });
+            c->set_publish_view_handler(
+                [&on_publish]
+                (std::uint8_t /*header*/,
+                 mqtt::optional<packet_id_t> /*packet_id*/,
+                 mqtt::buffer /*topic*/,
+                 mqtt::buffer contents) {
+                    on_publish(std::move(contents));
+                    return true;
+                });
+            break;
+        case mqtt::protocol_version::v5:
+            c->set_v5_connack_handler(
+                [&chk, &c]
+                (bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                    MQTT_CHK("h_connack");
+                    c->subscribe("topic1", mqtt::qos::at_most_once);
+                    return true;
+                });
+            c->set_v5_suback_handler(
+                [&on_suback]
+                (packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                    on_suback();
+                    return true;
+                });
+            c->set_v5_publish_view_handler(
+                [&on_publish]
+                (std::uint8_t /*header*/,
+                 mqtt::optional<packet_id_t> /*packet_id*/,
+                 mqtt::buffer /*topic*/,
+                 mqtt::buffer contents,
+                 mqtt::v5::property_view /*props*/) {
+                    on_publish(std::move(contents));
+                    return true;
+                });
+            break;
+        default:
+            BOOST_CHECK(false);
+            break;
+        }
+
+        c->set_close_handler(
+            [&chk, &s]
+            () {
+                MQTT_CHK("h_close");
+                s.close();
+            });
+        c->set_error_handler(
+            []
+            (boost::system::error_code const&) {
+                BOOST_CHECK(false);
+            });
+        c->connect();
+        ios.run();
+        BOOST_TEST(chk.all());
+
+        // Each kept publish message occupies its own slab.
+        auto before = pool->get_stats().returned;
+        kept.clear();
+        BOOST_TEST(pool->get_stats().returned == before + 3);
+    };
+    do_combi_test_sync(test);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,173 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+#include "combi_test.hpp"
+#include "checker.hpp"
+
+#include <mqtt/optional.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_bulk_read)
+
+template <typename Client, typename Server>
+inline void pubsub_bulk(
+    boost::asio::io_service& ios,
+    Client& c,
+    Server& s,
+    std::size_t buffer_size,
+    std::string const& contents,
+    std::size_t count) {
+    using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+    c->set_clean_session(true);
+    c->set_bulk_read_buffer_size(buffer_size);
+    BOOST_TEST(c->get_bulk_read_buffer_size() == buffer_size);
+
+    std::size_t received = 0;
+
+    checker chk = {
+        // connect
+        cont("h_connack"),
+        // subscribe topic1 QoS0
+        cont("h_suback"),
+        // publish topic1 QoS0 * count
+        cont("h_publish_all"),
+        cont("h_unsuback"),
+        // disconnect
+        cont("h_close"),
+    };
+
+    auto publish_all =
+        [&] {
+            for (std::size_t i = 0; i != count; ++i) {
+                c->publish_at_most_once("topic1", contents + std::to_string(i));
+            }
+        };
+    auto on_publish =
+        [&]
+        (std::uint8_t header, std::string const& topic, std::string const& received_contents) {
+            BOOST_TEST(mqtt::publish::get_qos(header) == mqtt::qos::at_most_once);
+            BOOST_TEST(topic == "topic1");
+            BOOST_TEST(received_contents == contents + std::to_string(received));
+            if (++received == count) {
+                MQTT_CHK("h_publish_all");
+                c->unsubscribe("topic1");
+            }
+        };
+
+    switch (c->get_protocol_version()) {
+    case mqtt::protocol_version::v3_1_1:
+        c->set_connack_handler(
+            [&chk, &c]
+            (bool sp, std::uint8_t connack_return_code) {
+                MQTT_CHK("h_connack");
+                BOOST_TEST(sp == false);
+                BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+                c->subscribe("topic1", mqtt::qos::at_most_once);
+                return true;
+            });
+        c->set_suback_handler(
+            [&chk, &publish_all]
+            (packet_id_t /*packet_id*/, std::vector<mqtt::optional<std::uint8_t>> /*results*/) {
+                MQTT_CHK("h_suback");
+                publish_all();
+                return true;
+            });
+        c->set_unsuback_handler(
+            [&chk, &c]
+            (packet_id_t /*packet_id*/) {
+                MQTT_CHK("h_unsuback");
+                c->disconnect();
+                return true;
+            });
+        c->set_publish_handler(
+            [&on_publish]
+            (std::uint8_t header,
+             mqtt::optional<packet_id_t> /*packet_id*/,
+             std::string topic,
+             std::string contents) {
+                on_publish(header, topic, contents);
+                return true;
+            });
+        break;
+    case mqtt::protocol_version::v5:
+        c->set_v5_connack_handler(
+            [&chk, &c]
+            (bool sp, std::uint8_t connack_return_code, std::vector<mqtt::v5::property_variant> /*props*/) {
+                MQTT_CHK("h_connack");
+                BOOST_TEST(sp == false);
+                BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+                c->subscribe("topic1", mqtt::qos::at_most_once);
+                return true;
+            });
+        c->set_v5_suback_handler(
+            [&chk, &publish_all]
+            (packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                MQTT_CHK("h_suback");
+                publish_all();
+                return true;
+            });
+        c->set_v5_unsuback_handler(
+            [&chk, &c]
+            (packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                MQTT_CHK("h_unsuback");
+                c->disconnect();
+                return true;
+            });
+        c->set_v5_publish_handler(
+            [&on_publish]
+            (std::uint8_t header,
+             mqtt::optional<packet_id_t> /*packet_id*/,
+             std::string topic,
+             std::string contents,
+             std::vector<mqtt::v5::property_variant> /*props*/) {
+                on_publish(header, topic, contents);
+                return true;
+            });
+        break;
+    default:
+        BOOST_CHECK(false);
+        break;
+    }
+
+    c->set_close_handler(
+        [&chk, &s]
+        () {
+            MQTT_CHK("h_close");
+            s.close();
+        });
+    c->set_error_handler(
+        []
+        (boost::system::error_code const&) {
+            BOOST_CHECK(false);
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(received == count);
+    BOOST_TEST(chk.all());
+}
+
+BOOST_AUTO_TEST_CASE( small_messages ) {
+    auto test = [](boost::asio::io_service& ios, auto& c, auto& s, auto& /*b*/) {
+        pubsub_bulk(ios, c, s, 1024, "contents", 100);
+    };
+    do_combi_test_sync(test);
+}
+
+BOOST_AUTO_TEST_CASE( messages_larger_than_buffer ) {
+    auto test = [](boost::asio::io_service& ios, auto& c, auto& s, auto& /*b*/) {
+        pubsub_bulk(ios, c, s, 16, std::string(1000, 'x'), 10);
+    };
+    do_combi_test_sync(test);
+}
+
+BOOST_AUTO_TEST_CASE( buffer_smaller_than_header ) {
+    auto test = [](boost::asio::io_service& ios, auto& c, auto& s, auto& /*b*/) {
+        pubsub_bulk(ios, c, s, 1, std::string(200, 'x'), 10);
+    };
+    do_combi_test_sync(test);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1038,7 +1038,7 @@ BOOST_AUTO_TEST_CASE( connack_prop ) {
 
         std::vector<mqtt::v5::property_variant> ps {
             mqtt::v5::property::session_expiry_interval(0),
-            mqtt::v5::property::receive_maximum(0),
+            mqtt::v5::property::receive_maximum(0x1234U),
             mqtt::v5::property::maximum_qos(2),
             mqtt::v5::property::retain_available(true),
             mqtt::v5::property::maximum_packet_size(0),
@@ -1078,7 +1078,7 @@ BOOST_AUTO_TEST_CASE( connack_prop ) {
                                 BOOST_TEST(t.val() == 0);
                             },
                             [&](mqtt::v5::property::receive_maximum::recv const& t) {
-                                BOOST_TEST(t.val() == 0);
+                                BOOST_TEST(t.val() == 0x1234U);
                             },
                             [&](mqtt::v5::property::maximum_qos::recv const& t) {
                                 BOOST_TEST(t.val() == 2);
@@ -0,0 +1,243 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+#include "test_settings.hpp"
+
+#include <map>
+#include <list>
+#include <random>
+
+#include <mqtt_client_cpp.hpp>
+#include <mqtt_server_cpp.hpp>
+#include <mqtt/inflight_store.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_inflight_store)
+
+namespace {
+
+struct entry {
+    entry(std::uint16_t id, std::uint8_t type, int val)
+        : id(id), type(type), val(val) {}
+    std::uint16_t packet_id() const { return id; }
+    std::uint8_t expected_control_packet_type() const { return type; }
+    std::uint16_t id;
+    std::uint8_t type;
+    int val;
+};
+
+template <typename Store>
+std::vector<int> values(Store const& s) {
+    std::vector<int> ret;
+    s.for_each([&](entry const& e) { ret.push_back(e.val); });
+    return ret;
+}
+
+template <typename Store>
+void basic() {
+    Store s;
+    BOOST_TEST(s.empty());
+    BOOST_TEST(s.insert(entry(1, mqtt::control_packet_type::puback, 10)));
+    BOOST_TEST(s.insert(entry(2, mqtt::control_packet_type::pubrec, 20)));
+    BOOST_TEST(s.insert(entry(3, mqtt::control_packet_type::pubcomp, 30)));
+    BOOST_TEST(!s.insert(entry(2, mqtt::control_packet_type::pubrec, 21)));
+    BOOST_TEST(s.size() == 3U);
+    BOOST_TEST(values(s) == (std::vector<int>{ 10, 20, 30 }));
+
+    // overwrite keeps the position
+    s.insert_or_assign(entry(2, mqtt::control_packet_type::pubrec, 22));
+    BOOST_TEST(values(s) == (std::vector<int>{ 10, 22, 30 }));
+
+    // find
+    BOOST_TEST(s.find(2, mqtt::control_packet_type::pubrec)->val == 22);
+    BOOST_TEST(!s.find(2, mqtt::control_packet_type::puback));
+    BOOST_TEST(!s.find(4, mqtt::control_packet_type::puback));
+
+    // type mismatch
+    BOOST_TEST(s.erase(1, mqtt::control_packet_type::pubrec) == 0U);
+    BOOST_TEST(s.erase(1, mqtt::control_packet_type::puback) == 1U);
+    BOOST_TEST(s.erase(1) == 0U);
+    BOOST_TEST(values(s) == (std::vector<int>{ 22, 30 }));
+
+    // inserted at the end
+    s.insert_or_assign(entry(1, mqtt::control_packet_type::puback, 11));
+    BOOST_TEST(values(s) == (std::vector<int>{ 22, 30, 11 }));
+
+    BOOST_TEST(s.erase(3) == 1U);
+    BOOST_TEST(values(s) == (std::vector<int>{ 22, 11 }));
+
+    s.clear();
+    BOOST_TEST(s.empty());
+    BOOST_TEST(values(s).empty());
+    BOOST_TEST(s.insert(entry(2, mqtt::control_packet_type::pubrec, 23)));
+    BOOST_TEST(values(s) == (std::vector<int>{ 23 }));
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( ordered_basic ) {
+    basic<mqtt::ordered_inflight_store<entry>>();
+}
+
+BOOST_AUTO_TEST_CASE( flat_basic ) {
+    basic<mqtt::flat_inflight_store<entry>>();
+}
+
+BOOST_AUTO_TEST_CASE( flat_random ) {
+    // Compare with the reference implementation. Packet ids are acquired sequentially
+    // and wrap around like endpoint does, and they are released in random order.
+    mqtt::flat_inflight_store<entry> s;
+    std::map<std::uint16_t, std::list<int>::iterator> ref_index;
+    std::list<int> ref_order;
+    std::mt19937 rng(0);
+
+    std::uint16_t next = 1;
+    for (int i = 0; i != 200000; ++i) {
+        if (ref_index.size() < 3000 && rng() % 3 != 0) {
+            while (ref_index.count(next)) {
+                if (++next == 0) next = 1;
+            }
+            BOOST_REQUIRE(s.insert(entry(next, mqtt::control_packet_type::puback, i)));
+            ref_order.push_back(i);
+            ref_index.emplace(next, std::prev(ref_order.end()));
+            if (++next == 0) next = 1;
+        }
+        else if (!ref_index.empty()) {
+            auto it = ref_index.begin();
+            std::advance(it, static_cast<long>(rng() % ref_index.size()));
+            BOOST_REQUIRE(s.erase(it->first, mqtt::control_packet_type::puback) == 1U);
+            ref_order.erase(it->second);
+            ref_index.erase(it);
+        }
+        BOOST_REQUIRE(s.size() == ref_index.size());
+    }
+    BOOST_TEST(values(s) == std::vector<int>(ref_order.begin(), ref_order.end()));
+    for (auto const& e : ref_index) {
+        BOOST_TEST(s.erase(e.first) == 1U);
+    }
+    BOOST_TEST(s.empty());
+}
+
+BOOST_AUTO_TEST_CASE( flat_endpoint ) {
+    // The server echoes back QoS2 messages. Its endpoint keeps the in-flight messages
+    // in flat_inflight_store.
+    using server_t = mqtt::server<
+        boost::asio::io_service::strand,
+        std::mutex,
+        std::lock_guard,
+        2,
+        mqtt::flat_inflight_store
+    >;
+    using packet_id_t = server_t::endpoint_t::packet_id_t;
+    constexpr std::size_t num_of_messages = 100;
+
+    boost::asio::io_service ios;
+    server_t s(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), broker_notls_port),
+        ios
+    );
+    std::size_t server_pubcomp = 0;
+    std::size_t server_stored = 1;
+    std::shared_ptr<server_t::endpoint_t> sep;
+    s.set_accept_handler(
+        [&](server_t::endpoint_t& ep) {
+            sep = ep.shared_from_this();
+            ep.start_session();
+            ep.set_connect_handler(
+                [&ep]
+                (std::string const& /*client_id*/,
+                 mqtt::optional<std::string> const& /*username*/,
+                 mqtt::optional<std::string> const& /*password*/,
+                 mqtt::optional<mqtt::will>,
+                 bool /*clean_session*/,
+                 std::uint16_t /*keep_alive*/) {
+                    ep.connack(false, mqtt::connect_return_code::accepted);
+                    return true;
+                });
+            ep.set_publish_handler(
+                [&ep]
+                (std::uint8_t header,
+                 mqtt::optional<packet_id_t> /*packet_id*/,
+                 std::string topic,
+                 std::string contents) {
+                    ep.publish(std::move(topic), std::move(contents), mqtt::publish::get_qos(header));
+                    return true;
+                });
+            ep.set_pubcomp_handler(
+                [&]
+                (packet_id_t /*packet_id*/) {
+                    ++server_pubcomp;
+                    return true;
+                });
+            ep.set_disconnect_handler(
+                [&] {
+                    server_stored = 0;
+                    sep->for_each_store([&](char const*, std::size_t) { ++server_stored; });
+                    // The socket is closed when the endpoint is released.
+                    sep.reset();
+                });
+        }
+    );
+    s.listen();
+
+    auto c = mqtt::make_client(ios, broker_url, broker_notls_port);
+    c->set_client_id("cid1");
+    c->set_clean_session(true);
+
+    std::size_t client_pubcomp = 0;
+    std::size_t client_received = 0;
+    std::size_t client_res_sent = 0;
+    auto finish =
+        [&] {
+            if (client_pubcomp == num_of_messages && client_res_sent == num_of_messages) {
+                c->disconnect();
+            }
+        };
+    c->set_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t connack_return_code) {
+            BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+            for (std::size_t i = 0; i != num_of_messages; ++i) {
+                c->publish_exactly_once("topic1", "contents" + std::to_string(i));
+            }
+            return true;
+        });
+    c->set_publish_handler(
+        [&]
+        (std::uint8_t header,
+         mqtt::optional<packet_id_t> /*packet_id*/,
+         std::string /*topic*/,
+         std::string contents) {
+            BOOST_TEST(mqtt::publish::get_qos(header) == mqtt::qos::exactly_once);
+            BOOST_TEST(contents == "contents" + std::to_string(client_received));
+            ++client_received;
+            return true;
+        });
+    c->set_pubcomp_handler(
+        [&]
+        (packet_id_t /*packet_id*/) {
+            ++client_pubcomp;
+            finish();
+            return true;
+        });
+    c->set_pub_res_sent_handler(
+        [&]
+        (packet_id_t /*packet_id*/) {
+            ++client_res_sent;
+            finish();
+        });
+    c->set_close_handler(
+        [&] {
+            s.close();
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(client_received == num_of_messages);
+    BOOST_TEST(server_pubcomp == num_of_messages);
+    BOOST_TEST(server_stored == 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,217 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+#include "test_settings.hpp"
+#include "test_broker.hpp"
+#include "test_server_no_tls.hpp"
+
+#include <mqtt/client.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_keep_alive)
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+// Keep Alive 1 second is enforced in 1.5 seconds, and the resolution of the check is 100 milliseconds.
+bool timed_out_in_time(clock::duration d) {
+    return d >= std::chrono::milliseconds(1500) && d < std::chrono::milliseconds(3000);
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( timeout ) {
+    for (auto version : { mqtt::protocol_version::v3_1_1, mqtt::protocol_version::v5 }) {
+        boost::asio::io_service ios;
+        test_broker b(ios);
+        test_server_no_tls s(ios, b);
+        s.server().set_enforce_keep_alive();
+
+        // c1 doesn't send PINGREQ in the Keep Alive.
+        auto c1 = mqtt::make_client(ios, broker_url, broker_notls_port, version);
+        c1->set_client_id("cid1");
+        c1->set_clean_session(true);
+        c1->set_will(mqtt::will("topic1", "will_contents"));
+        c1->set_keep_alive_sec_ping_ms(1, 60 * 1000);
+
+        auto c2 = mqtt::make_client(ios, broker_url, broker_notls_port, version);
+        using packet_id_t = typename std::remove_reference_t<decltype(*c2)>::packet_id_t;
+        c2->set_client_id("cid2");
+        c2->set_clean_session(true);
+
+        clock::time_point connected;
+        mqtt::optional<clock::duration> c1_closed;
+        bool will_received = false;
+
+        auto on_c2_subscribed =
+            [&] {
+                connected = clock::now();
+                c1->connect();
+            };
+        c2->set_suback_handler(
+            [&](packet_id_t /*packet_id*/, std::vector<mqtt::optional<std::uint8_t>> /*results*/) {
+                on_c2_subscribed();
+                return true;
+            });
+        c2->set_v5_suback_handler(
+            [&](packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                on_c2_subscribed();
+                return true;
+            });
+        c2->set_connack_handler(
+            [&](bool /*sp*/, std::uint8_t /*connack_return_code*/) {
+                c2->subscribe("topic1", mqtt::qos::at_most_once);
+                return true;
+            });
+        c2->set_v5_connack_handler(
+            [&](bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                c2->subscribe("topic1", mqtt::qos::at_most_once);
+                return true;
+            });
+        auto on_will =
+            [&](std::string const& contents) {
+                BOOST_TEST(contents == "will_contents");
+                will_received = true;
+                c2->disconnect();
+            };
+        c2->set_publish_handler(
+            [&](std::uint8_t /*header*/, mqtt::optional<packet_id_t> /*packet_id*/, std::string /*topic*/, std::string contents) {
+                on_will(contents);
+                return true;
+            });
+        c2->set_v5_publish_handler(
+            [&](std::uint8_t /*header*/,
+                mqtt::optional<packet_id_t> /*packet_id*/,
+                std::string /*topic*/,
+                std::string contents,
+                std::vector<mqtt::v5::property_variant> /*props*/) {
+                on_will(contents);
+                return true;
+            });
+        c2->set_close_handler(
+            [&] {
+                s.close();
+            });
+        c2->set_error_handler(
+            [&](boost::system::error_code const&) {
+                BOOST_CHECK(false);
+                s.close();
+            });
+
+        // The server closes the connection as a network failure.
+        c1->set_close_handler(
+            [&] {
+                BOOST_CHECK(false);
+            });
+        c1->set_error_handler(
+            [&](boost::system::error_code const&) {
+                c1_closed = clock::now() - connected;
+            });
+
+        c2->connect();
+        ios.run();
+        BOOST_TEST(will_received);
+        BOOST_TEST(c1_closed.has_value());
+        if (c1_closed) BOOST_TEST(timed_out_in_time(*c1_closed));
+    }
+}
+
+BOOST_AUTO_TEST_CASE( ping ) {
+    for (auto version : { mqtt::protocol_version::v3_1_1, mqtt::protocol_version::v5 }) {
+        boost::asio::io_service ios;
+        test_broker b(ios);
+        test_server_no_tls s(ios, b);
+        s.server().set_enforce_keep_alive();
+
+        auto c = mqtt::make_client(ios, broker_url, broker_notls_port, version);
+        c->set_client_id("cid1");
+        c->set_clean_session(true);
+        c->set_keep_alive_sec(1);
+
+        // The connection is kept by PINGREQ longer than the Keep Alive.
+        std::size_t pingresp = 0;
+        boost::asio::steady_timer tim(ios);
+        auto on_connack =
+            [&] {
+                tim.expires_from_now(std::chrono::seconds(3));
+                tim.async_wait(
+                    [&](boost::system::error_code const& ec) {
+                        BOOST_TEST(!ec);
+                        c->disconnect();
+                    });
+            };
+        c->set_connack_handler(
+            [&](bool /*sp*/, std::uint8_t /*connack_return_code*/) {
+                on_connack();
+                return true;
+            });
+        c->set_v5_connack_handler(
+            [&](bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                on_connack();
+                return true;
+            });
+        c->set_pingresp_handler(
+            [&] {
+                ++pingresp;
+                return true;
+            });
+        bool closed = false;
+        c->set_close_handler(
+            [&] {
+                closed = true;
+                s.close();
+            });
+        c->set_error_handler(
+            [&](boost::system::error_code const&) {
+                BOOST_CHECK(false);
+                tim.cancel();
+                s.close();
+            });
+        c->connect();
+        ios.run();
+        BOOST_TEST(closed);
+        BOOST_TEST(pingresp >= 4U);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( server_keep_alive ) {
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    // The Server Keep Alive overrides the Keep Alive of CONNECT.
+    b.set_connack_props({ mqtt::v5::property::server_keep_alive(1) });
+    test_server_no_tls s(ios, b);
+    s.server().set_enforce_keep_alive();
+
+    auto c = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    c->set_client_id("cid1");
+    c->set_clean_session(true);
+    c->set_keep_alive_sec_ping_ms(60, 0);
+
+    clock::time_point connected;
+    mqtt::optional<clock::duration> closed;
+    c->set_v5_connack_handler(
+        [&](bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            connected = clock::now();
+            return true;
+        });
+    c->set_close_handler(
+        [&] {
+            BOOST_CHECK(false);
+            s.close();
+        });
+    c->set_error_handler(
+        [&](boost::system::error_code const&) {
+            closed = clock::now() - connected;
+            s.close();
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(closed.has_value());
+    if (closed) BOOST_TEST(timed_out_in_time(*closed));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
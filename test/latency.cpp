@@ -0,0 +1,153 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_USE_LATENCY_METRICS)
+#define MQTT_USE_LATENCY_METRICS
+#endif // !defined(MQTT_USE_LATENCY_METRICS)
+
+#include "test_main.hpp"
+#include "test_settings.hpp"
+#include "test_broker.hpp"
+#include "test_server_no_tls.hpp"
+
+#include <thread>
+#include <atomic>
+
+#include <mqtt/client.hpp>
+#include <mqtt/latency.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_latency)
+
+BOOST_AUTO_TEST_CASE( bucket ) {
+    using h = mqtt::latency_histogram;
+    std::size_t prev = 0;
+    for (std::uint64_t v = 0; v != 100000; ++v) {
+        auto i = h::bucket_index(v);
+        // Buckets are contiguous and each value is in its bucket.
+        BOOST_TEST((i == prev || i == prev + 1));
+        BOOST_TEST(v <= h::highest_equivalent_value(i));
+        if (i != 0) BOOST_TEST(h::highest_equivalent_value(i - 1) < v);
+        prev = i;
+    }
+    BOOST_TEST(h::bucket_index(std::uint64_t(1) << 50) == h::bucket_count - 1);
+    BOOST_TEST(h::bucket_index(std::numeric_limits<std::uint64_t>::max()) == h::bucket_count - 1);
+}
+
+BOOST_AUTO_TEST_CASE( percentile ) {
+    mqtt::latency_histogram h;
+    BOOST_TEST(h.take_snapshot().count() == 0U);
+    BOOST_TEST(h.take_snapshot().value_at_percentile(99) == 0U);
+
+    for (std::uint64_t v = 1; v <= 1000; ++v) {
+        h.record(std::chrono::nanoseconds(v));
+    }
+    auto s = h.take_snapshot();
+    BOOST_TEST(s.count() == 1000U);
+    BOOST_TEST(s.max() == 1000U);
+    BOOST_TEST(s.mean() == 500.5);
+    auto p50 = s.value_at_percentile(50);
+    BOOST_TEST(p50 >= 500U);
+    BOOST_TEST(p50 <= 500U + 500U / 16);
+    auto p99 = s.value_at_percentile(99);
+    BOOST_TEST(p99 >= 990U);
+    BOOST_TEST(p99 <= 1000U);
+    BOOST_TEST(s.value_at_percentile(100) == 1000U);
+}
+
+BOOST_AUTO_TEST_CASE( concurrent ) {
+    mqtt::latency_histogram h;
+    std::atomic<bool> done(false);
+    std::thread reader(
+        [&] {
+            std::uint64_t prev = 0;
+            while (!done) {
+                auto c = h.take_snapshot().count();
+                BOOST_TEST(prev <= c);
+                prev = c;
+            }
+        }
+    );
+    std::vector<std::thread> writers;
+    for (std::size_t i = 0; i != 4; ++i) {
+        writers.emplace_back(
+            [&] {
+                for (std::uint64_t v = 0; v != 10000; ++v) h.record(v);
+            }
+        );
+    }
+    for (auto& t : writers) t.join();
+    done = true;
+    reader.join();
+    auto s = h.take_snapshot();
+    BOOST_TEST(s.count() == 40000U);
+    BOOST_TEST(s.max() == 9999U);
+}
+
+BOOST_AUTO_TEST_CASE( endpoint ) {
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    test_server_no_tls s(ios, b);
+    auto c = mqtt::make_client(ios, broker_url, broker_notls_port);
+    c->set_clean_session(true);
+    auto metrics = std::make_shared<mqtt::latency_metrics>();
+    c->set_latency_metrics(metrics);
+    BOOST_TEST(c->get_latency_metrics() == metrics);
+
+    c->set_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t connack_return_code) {
+            BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+            c->async_publish_at_least_once("topic1", "topic1_contents");
+            c->publish_exactly_once("topic1", "topic1_contents");
+            return true;
+        });
+    std::size_t acked = 0;
+    auto ack =
+        [&](std::uint16_t) {
+            if (++acked == 2) c->disconnect();
+            return true;
+        };
+    c->set_puback_handler(ack);
+    c->set_pubcomp_handler(ack);
+    c->set_close_handler(
+        [&] {
+            s.close();
+        });
+    c->set_error_handler(
+        [&]
+        (boost::system::error_code const&) {
+            BOOST_CHECK(false);
+            s.close();
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(acked == 2U);
+
+    auto count =
+        [&](mqtt::latency_kind kind, std::uint8_t type) {
+            return metrics->take_snapshot(kind, type).count();
+        };
+    using mqtt::latency_kind;
+    namespace cpt = mqtt::control_packet_type;
+    // received packets
+    BOOST_TEST(count(latency_kind::parse, cpt::connack) == 1U);
+    BOOST_TEST(count(latency_kind::handler, cpt::connack) == 1U);
+    BOOST_TEST(count(latency_kind::parse, cpt::puback) == 1U);
+    BOOST_TEST(count(latency_kind::parse, cpt::pubrec) == 1U);
+    BOOST_TEST(count(latency_kind::parse, cpt::pubcomp) == 1U);
+    // sent packets. The async publish is queued and the others are written synchronously.
+    BOOST_TEST(count(latency_kind::write, cpt::connect) == 1U);
+    BOOST_TEST(count(latency_kind::queue_wait, cpt::publish) == 1U);
+    BOOST_TEST(count(latency_kind::write, cpt::publish) == 2U);
+    BOOST_TEST(count(latency_kind::write, cpt::pubrel) == 1U);
+    BOOST_TEST(count(latency_kind::write, cpt::disconnect) == 1U);
+    // acknowledgements
+    BOOST_TEST(count(latency_kind::ack, cpt::puback) == 1U);
+    BOOST_TEST(count(latency_kind::ack, cpt::pubrec) == 1U);
+    BOOST_TEST(count(latency_kind::ack, cpt::pubcomp) == 1U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
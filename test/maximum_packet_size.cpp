@@ -0,0 +1,351 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+#include "test_settings.hpp"
+#include "test_broker.hpp"
+#include "test_server_no_tls.hpp"
+
+#include <thread>
+
+#include <mqtt/client.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_maximum_packet_size)
+
+BOOST_AUTO_TEST_CASE( send_limit ) {
+    // The broker accepts packets up to 64 bytes. The client doesn't send larger PUBLISH.
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    b.set_connack_props(
+        std::vector<mqtt::v5::property_variant> {
+            mqtt::v5::property::maximum_packet_size(64)
+        }
+    );
+    std::size_t broker_received = 0;
+    b.set_publish_props_handler(
+        [&](std::vector<mqtt::v5::property_variant> const&) {
+            ++broker_received;
+        });
+    test_server_no_tls s(ios, b);
+    auto c = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+    c->set_clean_session(true);
+
+    bool closed = false;
+    std::size_t puback = 0;
+    c->set_v5_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t connack_return_code, std::vector<mqtt::v5::property_variant> /*props*/) {
+            BOOST_TEST(connack_return_code == mqtt::v5::reason_code::success);
+            // The message is discarded without an exception, and 0 is returned instead of the packet id.
+            BOOST_TEST(c->publish_at_least_once("topic1", std::string(64, 'a')) == 0U);
+            // The packet id 1 of the discarded message is released.
+            BOOST_TEST(c->publish(1, "topic1", std::string(32, 'a'), mqtt::qos::at_least_once));
+            return true;
+        });
+    c->set_v5_puback_handler(
+        [&]
+        (packet_id_t /*packet_id*/, std::uint8_t reason_code, std::vector<mqtt::v5::property_variant> /*props*/) {
+            BOOST_TEST(reason_code == mqtt::v5::reason_code::success);
+            ++puback;
+            c->disconnect();
+            return true;
+        });
+    c->set_close_handler(
+        [&] {
+            closed = true;
+            s.close();
+        });
+    c->set_error_handler(
+        [&]
+        (boost::system::error_code const&) {
+            BOOST_CHECK(false);
+            s.close();
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(closed);
+    BOOST_TEST(puback == 1U);
+    BOOST_TEST(broker_received == 1U);
+}
+
+BOOST_AUTO_TEST_CASE( resend_limit ) {
+    // The stored messages that exceed the Maximum Packet Size of the CONNACK are not resent.
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    b.set_connack_props(
+        std::vector<mqtt::v5::property_variant> {
+            mqtt::v5::property::maximum_packet_size(64)
+        }
+    );
+    std::size_t broker_received = 0;
+    b.set_publish_props_handler(
+        [&](std::vector<mqtt::v5::property_variant> const&) {
+            ++broker_received;
+        });
+    test_server_no_tls s(ios, b);
+    auto c = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+    c->set_client_id("cid1");
+    c->set_clean_session(false);
+
+    // The messages that have been sent before the connection is lost.
+    std::string topic = "topic1";
+    std::string large(64, 'a');
+    std::string small(32, 'a');
+    for (auto const& e : { std::make_pair(1, &large), std::make_pair(2, &small) }) {
+        c->restore_v5_serialized_message(
+            mqtt::v5::publish_message(
+                boost::asio::buffer(topic),
+                mqtt::qos::at_least_once,
+                false,
+                true,
+                static_cast<packet_id_t>(e.first),
+                {},
+                boost::asio::buffer(*e.second)
+            ),
+            mqtt::any()
+        );
+    }
+    std::vector<packet_id_t> serialize_removed;
+    c->set_v5_serialize_handlers(
+        [](mqtt::v5::publish_message) {},
+        [](mqtt::v5::pubrel_message) {},
+        [&](packet_id_t packet_id) {
+            serialize_removed.push_back(packet_id);
+        }
+    );
+
+    bool closed = false;
+    c->set_v5_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            // The large message is removed without resending, and its packet id is released.
+            std::size_t stored = 0;
+            c->for_each_store([&](mqtt::message_variant const&) { ++stored; });
+            BOOST_TEST(stored == 1U);
+            BOOST_TEST(c->register_packet_id(1));
+            BOOST_TEST(c->release_packet_id(1));
+            BOOST_TEST(serialize_removed == (std::vector<packet_id_t>{ 1 }));
+            return true;
+        });
+    c->set_v5_puback_handler(
+        [&]
+        (packet_id_t packet_id, std::uint8_t /*reason_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            BOOST_TEST(packet_id == 2U);
+            c->disconnect();
+            return true;
+        });
+    c->set_close_handler(
+        [&] {
+            closed = true;
+            s.close();
+        });
+    c->set_error_handler(
+        [&]
+        (boost::system::error_code const&) {
+            BOOST_CHECK(false);
+            s.close();
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(closed);
+    BOOST_TEST(broker_received == 1U);
+}
+
+BOOST_AUTO_TEST_CASE( broker_fan_out ) {
+    // c2 accepts packets up to 64 bytes. The broker discards the large message only for c2,
+    // and keeps delivering to c1.
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    test_server_no_tls s(ios, b);
+    auto c1 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    auto c2 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c1)>::packet_id_t;
+    c1->set_client_id("cid1");
+    c1->set_clean_session(true);
+    c2->set_client_id("cid2");
+    c2->set_clean_session(true);
+
+    std::string large(64, 'a');
+    std::vector<std::string> received1;
+    std::vector<std::string> received2;
+    std::size_t closed = 0;
+    auto finish =
+        [&] {
+            if (received1.size() == 2 && received2.size() == 1) {
+                c1->disconnect();
+                c2->disconnect();
+            }
+        };
+    auto on_close =
+        [&] {
+            if (++closed == 2) s.close();
+        };
+    auto on_error =
+        [&]
+        (boost::system::error_code const&) {
+            BOOST_CHECK(false);
+            s.close();
+        };
+
+    c2->set_v5_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t connack_return_code, std::vector<mqtt::v5::property_variant> /*props*/) {
+            BOOST_TEST(connack_return_code == mqtt::v5::reason_code::success);
+            c2->subscribe("topic1", mqtt::qos::at_least_once);
+            return true;
+        });
+    c2->set_v5_suback_handler(
+        [&]
+        (packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c1->connect();
+            return true;
+        });
+    c2->set_v5_publish_handler(
+        [&]
+        (std::uint8_t /*header*/,
+         mqtt::optional<packet_id_t> /*packet_id*/,
+         std::string /*topic*/,
+         std::string contents,
+         std::vector<mqtt::v5::property_variant> /*props*/) {
+            received2.push_back(std::move(contents));
+            finish();
+            return true;
+        });
+    c2->set_close_handler(on_close);
+    c2->set_error_handler(on_error);
+
+    c1->set_v5_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t connack_return_code, std::vector<mqtt::v5::property_variant> /*props*/) {
+            BOOST_TEST(connack_return_code == mqtt::v5::reason_code::success);
+            c1->subscribe("topic1", mqtt::qos::at_least_once);
+            return true;
+        });
+    c1->set_v5_suback_handler(
+        [&]
+        (packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c1->publish_at_least_once("topic1", large);
+            c1->publish_at_least_once("topic1", "small");
+            return true;
+        });
+    c1->set_v5_publish_handler(
+        [&]
+        (std::uint8_t /*header*/,
+         mqtt::optional<packet_id_t> /*packet_id*/,
+         std::string /*topic*/,
+         std::string contents,
+         std::vector<mqtt::v5::property_variant> /*props*/) {
+            received1.push_back(std::move(contents));
+            finish();
+            return true;
+        });
+    c1->set_close_handler(on_close);
+    c1->set_error_handler(on_error);
+
+    c2->connect(
+        std::vector<mqtt::v5::property_variant> {
+            mqtt::v5::property::maximum_packet_size(64)
+        }
+    );
+    ios.run();
+    BOOST_TEST(closed == 2U);
+    BOOST_TEST((received1 == std::vector<std::string> { large, "small" }));
+    BOOST_TEST((received2 == std::vector<std::string> { "small" }));
+}
+
+BOOST_AUTO_TEST_CASE( recv_limit ) {
+    // The server accepts packets up to 64 bytes. It is advertised by CONNACK automatically.
+    boost::asio::io_service ios;
+    mqtt::server<> s(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), broker_notls_port),
+        ios
+    );
+    s.set_maximum_packet_size_recv(64);
+    using endpoint_t = mqtt::server<>::endpoint_t;
+    using packet_id_t = endpoint_t::packet_id_t;
+    std::shared_ptr<endpoint_t> sep;
+    std::size_t received = 0;
+    bool error = false;
+    s.set_accept_handler(
+        [&](endpoint_t& ep) {
+            sep = ep.shared_from_this();
+            ep.start_session();
+            ep.set_v5_connect_handler(
+                [&]
+                (std::string const& /*client_id*/,
+                 mqtt::optional<std::string> const& /*username*/,
+                 mqtt::optional<std::string> const& /*password*/,
+                 mqtt::optional<mqtt::will>,
+                 bool /*clean_session*/,
+                 std::uint16_t /*keep_alive*/,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    sep->connack(false, mqtt::v5::reason_code::success);
+                    return true;
+                });
+            ep.set_v5_publish_handler(
+                [&]
+                (std::uint8_t /*header*/,
+                 mqtt::optional<packet_id_t> /*packet_id*/,
+                 std::string /*topic*/,
+                 std::string /*contents*/,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    ++received;
+                    return true;
+                });
+            ep.set_error_handler(
+                [&]
+                (boost::system::error_code const& ec) {
+                    BOOST_TEST(ec == boost::system::errc::message_size);
+                    error = true;
+                });
+        });
+    s.listen();
+    std::thread th([&] { ios.run(); });
+
+    boost::asio::ip::tcp::socket socket(ios);
+    socket.connect(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), broker_notls_port)
+    );
+    std::string out =
+        mqtt::v5::connect_message(
+            0, "cid1", true, mqtt::nullopt, mqtt::nullopt, mqtt::nullopt, {}
+        ).continuous_buffer();
+    std::string topic = "topic1";
+    std::string small(32, 'a');
+    std::string large(64, 'a');
+    out += mqtt::v5::publish_message(
+        boost::asio::buffer(topic), mqtt::qos::at_most_once, false, false, 0, {}, boost::asio::buffer(small)
+    ).continuous_buffer();
+    out += mqtt::v5::publish_message(
+        boost::asio::buffer(topic), mqtt::qos::at_most_once, false, false, 0, {}, boost::asio::buffer(large)
+    ).continuous_buffer();
+    boost::asio::write(socket, boost::asio::buffer(out));
+
+    std::string expected =
+        mqtt::v5::connack_message(
+            false,
+            mqtt::v5::reason_code::success,
+            { mqtt::v5::property::maximum_packet_size(64) }
+        ).continuous_buffer() +
+        mqtt::v5::disconnect_message(mqtt::v5::reason_code::packet_too_large, {}).continuous_buffer();
+    std::string in(expected.size(), '\0');
+    boost::asio::read(socket, boost::asio::buffer(&in[0], in.size()));
+    BOOST_TEST(in == expected);
+
+    socket.close();
+    ios.post(
+        [&] {
+            sep.reset();
+            s.close();
+        });
+    th.join();
+    BOOST_TEST(received == 1U);
+    BOOST_TEST(error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,356 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+#include "test_settings.hpp"
+#include "test_broker.hpp"
+#include "test_server_no_tls.hpp"
+
+#include <mqtt/client.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_message_expiry)
+
+namespace {
+
+mqtt::optional<std::uint32_t> expiry_interval(std::vector<mqtt::v5::property_variant> const& props) {
+    mqtt::optional<std::uint32_t> ret;
+    for (auto const& p : props) {
+        mqtt::visit(
+            mqtt::make_lambda_visitor<void>(
+                [&](mqtt::v5::property::message_expiry_interval const& t) {
+                    ret = t.val();
+                },
+                [](auto const&) {}
+            ),
+            p
+        );
+    }
+    return ret;
+}
+
+// The interval that has been waiting for a moment in the broker.
+bool remaining(mqtt::optional<std::uint32_t> interval, std::uint32_t sent) {
+    return interval && *interval <= sent && *interval + 10 > sent;
+}
+
+std::vector<mqtt::v5::property_variant> expires_after(std::uint32_t interval) {
+    return { mqtt::v5::property::message_expiry_interval(interval) };
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( message ) {
+    std::string topic = "topic1";
+    std::string contents = "contents";
+    std::vector<mqtt::v5::property_variant> props {
+        mqtt::v5::property::payload_format_indicator(mqtt::v5::property::payload_format_indicator::string),
+        mqtt::v5::property::message_expiry_interval(3600),
+        mqtt::v5::property::content_type("text/plain"),
+    };
+    std::vector<mqtt::v5::property_variant> updated_props {
+        mqtt::v5::property::payload_format_indicator(mqtt::v5::property::payload_format_indicator::string),
+        mqtt::v5::property::message_expiry_interval(10),
+        mqtt::v5::property::content_type("text/plain"),
+    };
+    auto expected =
+        mqtt::v5::publish_message(
+            boost::asio::buffer(topic), mqtt::qos::at_least_once, false, true, 1, updated_props, boost::asio::buffer(contents)
+        ).continuous_buffer();
+    auto check =
+        [&](mqtt::v5::publish_message m) {
+            BOOST_TEST(*m.message_expiry_interval() == 3600U);
+            BOOST_TEST(m.update_message_expiry_interval(10));
+            BOOST_TEST(*m.message_expiry_interval() == 10U);
+            BOOST_TEST(m.continuous_buffer() == expected);
+            std::string seq;
+            for (auto const& b : m.const_buffer_sequence()) {
+                seq.append(static_cast<char const*>(b.data()), b.size());
+            }
+            BOOST_TEST(seq == expected);
+        };
+
+    check(
+        mqtt::v5::publish_message(
+            boost::asio::buffer(topic), mqtt::qos::at_least_once, false, true, 1, props, boost::asio::buffer(contents)
+        )
+    );
+    // The encoded properties of the shared body are not modified.
+    auto body = mqtt::make_shared_publish(boost::asio::buffer(topic), boost::asio::buffer(contents), mqtt::any(), props);
+    check(mqtt::v5::publish_message(*body, mqtt::qos::at_least_once, false, true, 1));
+    BOOST_TEST(*mqtt::v5::publish_message(*body, mqtt::qos::at_least_once, false, true, 2).message_expiry_interval() == 3600U);
+
+    mqtt::v5::publish_message no_expiry(
+        boost::asio::buffer(topic), mqtt::qos::at_least_once, false, false, 1, {}, boost::asio::buffer(contents)
+    );
+    BOOST_TEST(!no_expiry.message_expiry_interval());
+    BOOST_TEST(!no_expiry.update_message_expiry_interval(10));
+}
+
+BOOST_AUTO_TEST_CASE( retain ) {
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    test_server_no_tls s(ios, b);
+    auto c = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+    c->set_clean_session(true);
+
+    std::vector<std::string> received;
+    bool closed = false;
+
+    c->set_v5_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c->publish_at_most_once("topic1", "expired", true, expires_after(0));
+            c->publish_at_most_once("topic2", "alive", true, expires_after(3600));
+            c->publish_at_most_once("topic3", "no expiry", true);
+            c->subscribe("+", mqtt::qos::at_most_once);
+            return true;
+        });
+    c->set_v5_publish_handler(
+        [&]
+        (std::uint8_t /*header*/,
+         mqtt::optional<packet_id_t> /*packet_id*/,
+         std::string topic,
+         std::string contents,
+         std::vector<mqtt::v5::property_variant> props) {
+            if (topic == "topic2") {
+                BOOST_TEST(contents == "alive");
+                // The remaining interval is sent.
+                BOOST_TEST(remaining(expiry_interval(props), 3600));
+            }
+            else {
+                BOOST_TEST(!expiry_interval(props));
+            }
+            received.push_back(std::move(topic));
+            if (received.size() == 2) c->disconnect();
+            return true;
+        });
+    c->set_close_handler(
+        [&] {
+            closed = true;
+            s.close();
+        });
+    c->set_error_handler(
+        [&]
+        (boost::system::error_code const&) {
+            BOOST_CHECK(false);
+            s.close();
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(closed);
+    std::sort(received.begin(), received.end());
+    BOOST_TEST(received == (std::vector<std::string>{ "topic2", "topic3" }));
+}
+
+BOOST_AUTO_TEST_CASE( retain_overwrite ) {
+    // The removal of the retained message is cancelled when it is overwritten or removed.
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    test_server_no_tls s(ios, b);
+    auto c = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+    c->set_clean_session(true);
+
+    std::size_t puback = 0;
+    bool closed = false;
+
+    c->set_v5_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            for (std::size_t i = 0; i != 3; ++i) {
+                c->publish_at_least_once("topic1", "contents", true, expires_after(3600));
+            }
+            return true;
+        });
+    c->set_v5_puback_handler(
+        [&]
+        (packet_id_t /*packet_id*/, std::uint8_t /*reason_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            switch (++puback) {
+            case 3:
+                BOOST_TEST(b.num_of_expiry_entries() == 1U);
+                c->publish_at_least_once("topic1", "", true);
+                break;
+            case 4:
+                BOOST_TEST(b.num_of_expiry_entries() == 0U);
+                c->disconnect();
+                break;
+            }
+            return true;
+        });
+    c->set_close_handler(
+        [&] {
+            closed = true;
+            s.close();
+        });
+    c->set_error_handler(
+        [&]
+        (boost::system::error_code const&) {
+            BOOST_CHECK(false);
+            s.close();
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(closed);
+    BOOST_TEST(puback == 4U);
+}
+
+BOOST_AUTO_TEST_CASE( offline ) {
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    test_server_no_tls s(ios, b);
+    auto c = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+    c->set_client_id("cid1");
+    c->set_clean_session(false);
+
+    std::size_t connected = 0;
+    std::vector<std::string> received;
+
+    c->set_v5_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            if (++connected == 1) c->subscribe("topic1", mqtt::qos::at_least_once);
+            return true;
+        });
+    c->set_v5_suback_handler(
+        [&]
+        (packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c->disconnect();
+            return true;
+        });
+    c->set_v5_publish_handler(
+        [&]
+        (std::uint8_t /*header*/,
+         mqtt::optional<packet_id_t> /*packet_id*/,
+         std::string /*topic*/,
+         std::string contents,
+         std::vector<mqtt::v5::property_variant> props) {
+            if (contents == "alive") {
+                BOOST_TEST(remaining(expiry_interval(props), 3600));
+            }
+            else {
+                BOOST_TEST(!expiry_interval(props));
+            }
+            received.push_back(std::move(contents));
+            if (received.size() == 2) c->disconnect();
+            return true;
+        });
+    c->set_close_handler(
+        [&] {
+            if (connected == 1) {
+                // The broker has saved the session on DISCONNECT.
+                for (auto const& e : { std::make_pair("expired", 0), std::make_pair("alive", 3600) }) {
+                    b.deliver_publish(
+                        std::make_shared<std::string>("topic1"),
+                        std::make_shared<std::string>(e.first),
+                        mqtt::qos::at_least_once,
+                        false,
+                        expires_after(static_cast<std::uint32_t>(e.second)));
+                }
+                b.deliver_publish(
+                    std::make_shared<std::string>("topic1"),
+                    std::make_shared<std::string>("no expiry"),
+                    mqtt::qos::at_least_once,
+                    false,
+                    {});
+                c->connect();
+            }
+            else {
+                s.close();
+            }
+        });
+    c->set_error_handler(
+        [&]
+        (boost::system::error_code const&) {
+            BOOST_CHECK(false);
+            s.close();
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(connected == 2U);
+    BOOST_TEST(received == (std::vector<std::string>{ "alive", "no expiry" }));
+}
+
+BOOST_AUTO_TEST_CASE( resend ) {
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    std::vector<mqtt::optional<std::uint32_t>> broker_received;
+    b.set_publish_props_handler(
+        [&](std::vector<mqtt::v5::property_variant> const& props) {
+            broker_received.push_back(expiry_interval(props));
+        });
+    test_server_no_tls s(ios, b);
+    auto c = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+    c->set_client_id("cid1");
+    c->set_clean_session(false);
+
+    // The messages that have been sent before the connection is lost.
+    std::string topic = "topic1";
+    std::string contents = "contents";
+    for (auto const& e : { std::make_pair(1, 0), std::make_pair(2, 3600) }) {
+        c->restore_v5_serialized_message(
+            mqtt::v5::publish_message(
+                boost::asio::buffer(topic),
+                mqtt::qos::at_least_once,
+                false,
+                true,
+                static_cast<packet_id_t>(e.first),
+                expires_after(static_cast<std::uint32_t>(e.second)),
+                boost::asio::buffer(contents)
+            ),
+            mqtt::any()
+        );
+    }
+    std::vector<packet_id_t> serialize_removed;
+    c->set_v5_serialize_handlers(
+        [](mqtt::v5::publish_message) {},
+        [](mqtt::v5::pubrel_message) {},
+        [&](packet_id_t packet_id) {
+            serialize_removed.push_back(packet_id);
+        }
+    );
+
+    bool closed = false;
+    c->set_v5_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            // The expired message is removed without resending.
+            std::size_t stored = 0;
+            c->for_each_store([&](mqtt::message_variant const&) { ++stored; });
+            BOOST_TEST(stored == 1U);
+            BOOST_TEST(c->register_packet_id(1));
+            BOOST_TEST(c->release_packet_id(1));
+            BOOST_TEST(serialize_removed == (std::vector<packet_id_t>{ 1 }));
+            return true;
+        });
+    c->set_v5_puback_handler(
+        [&]
+        (packet_id_t packet_id, std::uint8_t /*reason_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            BOOST_TEST(packet_id == 2U);
+            c->disconnect();
+            return true;
+        });
+    c->set_close_handler(
+        [&] {
+            closed = true;
+            s.close();
+        });
+    c->set_error_handler(
+        [&]
+        (boost::system::error_code const&) {
+            BOOST_CHECK(false);
+            s.close();
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(closed);
+    BOOST_TEST(broker_received.size() == 1U);
+    BOOST_TEST(remaining(broker_received.front(), 3600));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,468 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+#include "combi_test.hpp"
+#include "checker.hpp"
+
+#include <fstream>
+#include <algorithm>
+
+#include <mqtt/offline_queue.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_offline_queue)
+
+namespace {
+
+mqtt::offline_queue::message make_message(std::string const& contents, std::uint8_t qos = 1) {
+    return {
+        std::make_shared<std::string>("topic"),
+        std::make_shared<std::string>(contents),
+        qos
+    };
+}
+
+std::vector<std::string> pop_all(mqtt::offline_queue& q) {
+    std::vector<std::string> ret;
+    for (auto const& m : q.pop(q.size())) {
+        ret.push_back(*m.contents);
+    }
+    BOOST_TEST(q.empty());
+    return ret;
+}
+
+bool exists(std::string const& path) {
+    return std::ifstream(path).good();
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( drop_oldest ) {
+    mqtt::offline_queue_config config;
+    config.max_messages = 3;
+    mqtt::offline_queue q(config);
+    for (auto const& c : { "1", "2", "3", "4", "5" }) {
+        BOOST_TEST(q.push(make_message(c)));
+    }
+    BOOST_TEST(q.size() == 3U);
+    BOOST_TEST(q.dropped() == 2U);
+    BOOST_TEST(q.memory_bytes() == 3 * (5U + 1U));
+    BOOST_TEST(pop_all(q) == (std::vector<std::string>{ "3", "4", "5" }));
+    BOOST_TEST(q.memory_bytes() == 0U);
+
+    // topic (5 bytes) and contents
+    config.max_messages = std::numeric_limits<std::size_t>::max();
+    config.max_bytes = 20;
+    mqtt::offline_queue qb(config);
+    BOOST_TEST(qb.push(make_message("12345")));
+    BOOST_TEST(qb.push(make_message("123")));
+    BOOST_TEST(qb.push(make_message("1234567")));
+    BOOST_TEST(pop_all(qb) == (std::vector<std::string>{ "123", "1234567" }));
+    // The message that exceeds the limit by itself is dropped, and the queued messages are kept.
+    BOOST_TEST(qb.push(make_message("123")));
+    BOOST_TEST(!qb.push(make_message(std::string(16, 'x'))));
+    BOOST_TEST(qb.dropped() == 2U);
+    BOOST_TEST(pop_all(qb) == (std::vector<std::string>{ "123" }));
+
+    config.policy = mqtt::offline_overflow_policy::drop_qos0_first;
+    mqtt::offline_queue qq(config);
+    BOOST_TEST(qq.push(make_message("123", 0)));
+    BOOST_TEST(!qq.push(make_message(std::string(16, 'x'))));
+    BOOST_TEST(qq.dropped() == 1U);
+    BOOST_TEST(pop_all(qq) == (std::vector<std::string>{ "123" }));
+}
+
+BOOST_AUTO_TEST_CASE( drop_qos0_first ) {
+    mqtt::offline_queue_config config;
+    config.max_messages = 3;
+    config.policy = mqtt::offline_overflow_policy::drop_qos0_first;
+    mqtt::offline_queue q(config);
+    q.push(make_message("a1", 1));
+    q.push(make_message("b0", 0));
+    q.push(make_message("c1", 1));
+    q.push(make_message("d0", 0));
+    BOOST_TEST(q.dropped() == 1U);
+    q.push(make_message("e2", 2));
+    BOOST_TEST(q.dropped() == 2U);
+    BOOST_TEST(pop_all(q) == (std::vector<std::string>{ "a1", "c1", "e2" }));
+
+    // No QoS0 message is left, so the oldest one is dropped.
+    q.push(make_message("f1", 1));
+    q.push(make_message("g0", 0));
+    q.push(make_message("h1", 1));
+    // popping the QoS0 message from the front keeps the index consistent.
+    BOOST_TEST(*q.pop()->contents == "f1");
+    BOOST_TEST(*q.pop()->contents == "g0");
+    q.push(make_message("i1", 1));
+    q.push(make_message("j1", 1));
+    q.push(make_message("k1", 1));
+    BOOST_TEST(pop_all(q) == (std::vector<std::string>{ "i1", "j1", "k1" }));
+}
+
+BOOST_AUTO_TEST_CASE( spill ) {
+    std::string file;
+    {
+        mqtt::offline_queue_config config;
+        config.max_messages = 2;
+        config.policy = mqtt::offline_overflow_policy::spill;
+        config.spill_path = "offline_queue_test";
+        mqtt::offline_queue q(config);
+        for (auto const& c : { "1", "2", "3", "4" }) {
+            BOOST_TEST(q.push(make_message(c, 2)));
+        }
+        BOOST_TEST(q.size() == 4U);
+        BOOST_TEST(q.spilled() == 2U);
+        BOOST_TEST(q.dropped() == 0U);
+        file = q.spill_file();
+        BOOST_TEST(exists(file));
+        // The process id and the sequence number are appended to the path.
+        BOOST_TEST(file.find("offline_queue_test.") == 0U);
+        BOOST_TEST(std::count(file.begin(), file.end(), '.') == 2);
+
+        // The messages are spilled until the file is drained to keep the order.
+        auto m1 = q.pop();
+        BOOST_TEST(*m1->contents == "1");
+        BOOST_TEST(q.push(make_message("5", 2)));
+        BOOST_TEST(q.spilled() == 3U);
+        auto m2 = q.pop();
+        BOOST_TEST(*m2->contents == "2");
+        auto m3 = q.pop();
+        BOOST_TEST(*m3->topic == "topic");
+        BOOST_TEST(*m3->contents == "3");
+        BOOST_TEST(m3->qos == 2U);
+        BOOST_TEST(pop_all(q) == (std::vector<std::string>{ "4", "5" }));
+        BOOST_TEST(q.spilled() == 0U);
+
+        // After the file is drained, the messages are kept in memory again.
+        q.push(make_message("6"));
+        BOOST_TEST(q.spilled() == 0U);
+        q.push(make_message("7"));
+        q.push(make_message("8"));
+        BOOST_TEST(q.spilled() == 1U);
+        BOOST_TEST(pop_all(q) == (std::vector<std::string>{ "6", "7", "8" }));
+    }
+    // The file is removed on destruction.
+    BOOST_TEST(!exists(file));
+
+    mqtt::offline_queue_config config;
+    config.max_messages = 1;
+    config.policy = mqtt::offline_overflow_policy::spill;
+    config.spill_path = "offline_queue_test";
+    // header (17 bytes), topic (5 bytes) and contents (1 byte)
+    config.max_spill_bytes = 2 * 23;
+    mqtt::offline_queue q(config);
+    for (auto const& c : { "1", "2", "3", "4" }) {
+        q.push(make_message(c));
+    }
+    BOOST_TEST(q.dropped() == 1U);
+    BOOST_TEST(pop_all(q) == (std::vector<std::string>{ "1", "2", "3" }));
+}
+
+BOOST_AUTO_TEST_CASE( expire ) {
+    auto now = mqtt::offline_queue::clock::now();
+    auto expiring =
+        [&](std::string const& contents, std::uint8_t qos, std::chrono::seconds after) {
+            auto m = make_message(contents, qos);
+            m.expiry.emplace(now + after);
+            return m;
+        };
+
+    mqtt::offline_queue_config config;
+    config.max_messages = 3;
+    config.policy = mqtt::offline_overflow_policy::drop_qos0_first;
+    mqtt::offline_queue q(config);
+    q.push(expiring("a0", 0, std::chrono::seconds(20)));
+    q.push(make_message("b0", 0));
+    q.push(expiring("c1", 1, std::chrono::seconds(10)));
+    BOOST_CHECK(*q.next_expiry() == now + std::chrono::seconds(10));
+
+    BOOST_TEST(q.expire(now + std::chrono::seconds(9)) == 0U);
+    BOOST_TEST(q.expire(now + std::chrono::seconds(10)) == 1U);
+    BOOST_CHECK(*q.next_expiry() == now + std::chrono::seconds(20));
+    BOOST_TEST(q.size() == 2U);
+    BOOST_TEST(q.memory_bytes() == 2 * (5U + 2U));
+
+    // The QoS0 message in the middle is removed from the index of the policy.
+    BOOST_TEST(q.expire(now + std::chrono::seconds(20)) == 1U);
+    BOOST_TEST(!q.next_expiry());
+    q.push(make_message("d1"));
+    q.push(make_message("e1"));
+    q.push(make_message("f1"));
+    BOOST_TEST(q.dropped() == 1U);
+    BOOST_TEST(q.expired() == 2U);
+    BOOST_TEST(pop_all(q) == (std::vector<std::string>{ "d1", "e1", "f1" }));
+
+    // pop() skips the expired messages that are not removed by expire().
+    q.push(expiring("g1", 1, std::chrono::seconds(0)));
+    q.push(expiring("h1", 1, std::chrono::seconds(3600)));
+    auto m = q.pop();
+    BOOST_TEST(*m->contents == "h1");
+    BOOST_CHECK(*m->expiry == now + std::chrono::seconds(3600));
+    BOOST_TEST(q.expired() == 3U);
+
+    // The expiry is kept in the spill file.
+    config.max_messages = 1;
+    config.policy = mqtt::offline_overflow_policy::spill;
+    config.spill_path = "offline_queue_test";
+    mqtt::offline_queue qs(config);
+    qs.push(make_message("1"));
+    qs.push(expiring("2", 1, std::chrono::seconds(0)));
+    qs.push(expiring("3", 1, std::chrono::seconds(3600)));
+    BOOST_TEST(qs.spilled() == 2U);
+    BOOST_TEST(pop_all(qs) == (std::vector<std::string>{ "1", "3" }));
+    BOOST_TEST(qs.expired() == 1U);
+}
+
+BOOST_AUTO_TEST_CASE( broker_replay ) {
+    auto test = [](boost::asio::io_service& ios, auto& c, auto& s, auto& b) {
+        using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+        c->set_client_id("cid1");
+        c->set_clean_session(false);
+
+        mqtt::offline_queue_config config;
+        config.max_messages = 3;
+        b.set_offline_queue_config(config);
+        b.set_offline_replay_batch_size(2);
+
+        std::vector<std::string> received;
+
+        checker chk = {
+            cont("start"),
+            // connect
+            cont("h_connack1"),
+            cont("h_suback"),
+            // disconnect
+            cont("h_close1"),
+            // publish 5 messages to the offline session
+            // connect
+            cont("h_connack2"),
+            cont("h_publish"),
+            // disconnect
+            cont("h_close2"),
+        };
+
+        auto on_connack =
+            [&](bool sp) {
+                auto ret = chk.match(
+                    "start",
+                    [&] {
+                        MQTT_CHK("h_connack1");
+                        BOOST_TEST(sp == false);
+                        c->subscribe("topic1", mqtt::qos::at_most_once);
+                    },
+                    "h_close1",
+                    [&] {
+                        MQTT_CHK("h_connack2");
+                        BOOST_TEST(sp == true);
+                    }
+                );
+                BOOST_TEST(ret);
+            };
+        auto on_suback =
+            [&] {
+                MQTT_CHK("h_suback");
+                c->disconnect();
+            };
+        auto on_publish =
+            [&](std::string contents) {
+                received.push_back(std::move(contents));
+                if (received.size() == 3) {
+                    MQTT_CHK("h_publish");
+                    // The oldest messages are dropped by the limit.
+                    BOOST_TEST(received == (std::vector<std::string>{ "3", "4", "5" }));
+                    c->disconnect();
+                }
+            };
+
+        switch (c->get_protocol_version()) {
+        case mqtt::protocol_version::v3_1_1:
+            c->set_connack_handler(
+                [&]
+                (bool sp, std::uint8_t /*connack_return_code*/) {
+                    on_connack(sp);
+                    return true;
+                });
+            c->set_suback_handler(
+                [&]
+                (packet_id_t /*packet_id*/, std::vector<mqtt::optional<std::uint8_t>> /*results*/) {
+                    on_suback();
+                    return true;
+                });
+            c->set_publish_handler(
+                [&]
+                (std::uint8_t /*header*/,
+                 mqtt::optional<packet_id_t> /*packet_id*/,
+                 std::string /*topic*/,
+                 std::string contents) {
+                    on_publish(std::move(contents));
+                    return true;
+                });
+            break;
+        case mqtt::protocol_version::v5:
+            c->set_v5_connack_handler(
+                [&]
+                (bool sp, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                    on_connack(sp);
+                    return true;
+                });
+            c->set_v5_suback_handler(
+                [&]
+                (packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                    on_suback();
+                    return true;
+                });
+            c->set_v5_publish_handler(
+                [&]
+                (std::uint8_t /*header*/,
+                 mqtt::optional<packet_id_t> /*packet_id*/,
+                 std::string /*topic*/,
+                 std::string contents,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    on_publish(std::move(contents));
+                    return true;
+                });
+            break;
+        default:
+            BOOST_CHECK(false);
+            break;
+        }
+
+        c->set_close_handler(
+            [&]
+            () {
+                auto ret = chk.match(
+                    "h_suback",
+                    [&] {
+                        MQTT_CHK("h_close1");
+                        // The broker has saved the session on DISCONNECT.
+                        for (auto const& m : { "1", "2", "3", "4", "5" }) {
+                            b.deliver_publish(
+                                std::make_shared<std::string>("topic1"),
+                                std::make_shared<std::string>(m),
+                                mqtt::qos::at_most_once,
+                                false,
+                                std::vector<mqtt::v5::property_variant>());
+                        }
+                        c->connect();
+                    },
+                    "h_publish",
+                    [&] {
+                        MQTT_CHK("h_close2");
+                        s.close();
+                    }
+                );
+                BOOST_TEST(ret);
+            });
+        c->set_error_handler(
+            []
+            (boost::system::error_code const&) {
+                BOOST_CHECK(false);
+            });
+        MQTT_CHK("start");
+        c->connect();
+        ios.run();
+        BOOST_TEST(chk.all());
+    };
+    do_combi_test_sync(test);
+}
+
+BOOST_AUTO_TEST_CASE( broker_replay_backpressure ) {
+    // The client accepts 1 QoS1 message at a time, and sends PUBACK 1.5 seconds after the message.
+    // The broker passes 1 queued message at a time to the connection, so the rest stay
+    // in the queue and expire there.
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    b.set_offline_replay_batch_size(1);
+    test_server_no_tls s(ios, b);
+    auto c = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+    c->set_client_id("cid1");
+    c->set_clean_session(false);
+    c->set_auto_pub_response(false);
+
+    std::vector<std::string> received;
+    std::size_t connack = 0;
+    boost::asio::steady_timer tim_puback(ios);
+    boost::asio::steady_timer tim_finish(ios);
+
+    c->set_v5_connack_handler(
+        [&]
+        (bool sp, std::uint8_t connack_return_code, std::vector<mqtt::v5::property_variant> /*props*/) {
+            BOOST_TEST(connack_return_code == mqtt::v5::reason_code::success);
+            if (++connack == 1) {
+                BOOST_TEST(sp == false);
+                c->subscribe("topic1", mqtt::qos::at_least_once);
+            }
+            else {
+                BOOST_TEST(sp == true);
+                tim_finish.expires_from_now(std::chrono::seconds(4));
+                tim_finish.async_wait(
+                    [&](boost::system::error_code const& ec) {
+                        if (!ec) c->disconnect();
+                    });
+            }
+            return true;
+        });
+    c->set_v5_suback_handler(
+        [&]
+        (packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c->disconnect();
+            return true;
+        });
+    c->set_v5_publish_handler(
+        [&]
+        (std::uint8_t /*header*/,
+         mqtt::optional<packet_id_t> packet_id,
+         std::string /*topic*/,
+         std::string contents,
+         std::vector<mqtt::v5::property_variant> /*props*/) {
+            received.push_back(std::move(contents));
+            tim_puback.expires_from_now(std::chrono::milliseconds(1500));
+            tim_puback.async_wait(
+                [&, packet_id](boost::system::error_code const& ec) {
+                    if (!ec) c->puback(*packet_id);
+                });
+            return true;
+        });
+    c->set_close_handler(
+        [&] {
+            if (connack == 1) {
+                // The broker has saved the session on DISCONNECT.
+                for (auto const& m : { "1", "2", "3" }) {
+                    b.deliver_publish(
+                        std::make_shared<std::string>("topic1"),
+                        std::make_shared<std::string>(m),
+                        mqtt::qos::at_least_once,
+                        false,
+                        std::vector<mqtt::v5::property_variant> {
+                            mqtt::v5::property::message_expiry_interval(1)
+                        });
+                }
+                c->connect(
+                    std::vector<mqtt::v5::property_variant> {
+                        mqtt::v5::property::receive_maximum(1)
+                    }
+                );
+            }
+            else {
+                tim_puback.cancel();
+                s.close();
+            }
+        });
+    c->set_error_handler(
+        [&]
+        (boost::system::error_code const&) {
+            BOOST_CHECK(false);
+            s.close();
+        });
+    c->connect();
+    ios.run();
+    // "2" is passed to the connection when "1" is written, and waits for the quota.
+    // "3" has expired in the queue before "2" is written.
+    BOOST_TEST(received == (std::vector<std::string>{ "1", "2" }));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
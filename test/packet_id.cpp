@@ -7,7 +7,11 @@
 #include "test_main.hpp"
 #include "test_settings.hpp"
 
+#include <set>
+#include <random>
+
 #include <mqtt/client.hpp>
+#include <mqtt/packet_id_allocator.hpp>
 
 BOOST_AUTO_TEST_SUITE(test_packet_id)
 
@@ -87,4 +91,57 @@ BOOST_AUTO_TEST_CASE( exhausted ) {
     }
 }
 
+BOOST_AUTO_TEST_CASE( allocator_random ) {
+    // Compare with the next fit search on std::set.
+    mqtt::packet_id_allocator<std::uint16_t> a;
+    std::set<std::uint16_t> ref;
+    std::uint16_t ref_last = 0;
+    std::mt19937 rng(0);
+    for (int i = 0; i != 300000; ++i) {
+        // Keep about 60000 ids in use to cover full pages and wrap around.
+        if (ref.size() < 60000 && rng() % 2 == 0) {
+            std::uint16_t expected = ref_last;
+            do {
+                expected = expected == 0xffff ? 1 : static_cast<std::uint16_t>(expected + 1);
+            } while (ref.count(expected));
+            BOOST_REQUIRE(a.acquire() == expected);
+            ref.insert(expected);
+            ref_last = expected;
+        }
+        else if (!ref.empty()) {
+            auto it = ref.lower_bound(static_cast<std::uint16_t>(rng()));
+            if (it == ref.end()) it = ref.begin();
+            BOOST_REQUIRE(a.erase(*it));
+            BOOST_REQUIRE(!a.contains(*it));
+            ref.erase(it);
+        }
+        BOOST_REQUIRE(a.size() == ref.size());
+    }
+    for (auto id : ref) {
+        BOOST_TEST(a.contains(id));
+    }
+}
+
+BOOST_AUTO_TEST_CASE( allocator_4bytes ) {
+    mqtt::packet_id_allocator<std::uint32_t> a;
+    BOOST_TEST(!a.insert(0));
+    BOOST_TEST(a.insert(0xffffffff));
+    BOOST_TEST(!a.insert(0xffffffff));
+    BOOST_TEST(a.insert(4097));
+    for (std::uint32_t i = 1; i != 10000; ++i) {
+        BOOST_TEST(a.acquire() == (i < 4097 ? i : i + 1));
+    }
+    BOOST_TEST(a.size() == 10001U);
+    for (std::uint32_t i = 1; i != 4096; ++i) {
+        BOOST_TEST(a.erase(i));
+    }
+    BOOST_TEST(!a.erase(1));
+    BOOST_TEST(a.acquire() == 10001U);
+    BOOST_TEST(a.erase(0xffffffff));
+    BOOST_TEST(!a.contains(0xffffffff));
+    a.clear();
+    BOOST_TEST(a.empty());
+    BOOST_TEST(a.acquire() == 10002U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,142 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+
+#include <mqtt/property_view.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_property_view)
+
+namespace {
+
+std::string encode(std::vector<mqtt::v5::property_variant> const& props) {
+    std::string ret;
+    for (auto const& p : props) {
+        std::string s(mqtt::v5::size(p), '\0');
+        mqtt::v5::fill(p, s.begin(), s.end());
+        ret += s;
+    }
+    return ret;
+}
+
+std::string encode_with_length(std::vector<mqtt::v5::property_variant> const& props) {
+    auto body = encode(props);
+    return mqtt::variable_bytes(body.size()) + body;
+}
+
+std::vector<mqtt::v5::property_variant> sample() {
+    return {
+        mqtt::v5::property::payload_format_indicator(mqtt::v5::property::payload_format_indicator::string),
+        mqtt::v5::property::message_expiry_interval(0x12345678),
+        mqtt::v5::property::content_type("text/plain"),
+        mqtt::v5::property::topic_alias(3),
+        mqtt::v5::property::subscription_identifier(300),
+        mqtt::v5::property::user_property("key", "value1"),
+        mqtt::v5::property::correlation_data("corr"),
+    };
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( parse_with_length ) {
+    auto encoded = encode_with_length(sample()) + "payload";
+    mqtt::buffer buf(encoded);
+
+    std::size_t consumed = 0;
+    auto view = mqtt::v5::property::parse_view_with_length(buf, consumed);
+    BOOST_TEST(view.has_value());
+    BOOST_TEST(consumed == encoded.size() - 7);
+    BOOST_TEST(view->raw() == encode(sample()));
+
+    // The decoded properties are the same as v5::property::parse().
+    auto it = encoded.cbegin();
+    auto props = mqtt::v5::property::parse_with_length(it, encoded.cend());
+    BOOST_TEST(props.has_value());
+    BOOST_TEST(view->size() == props->size());
+    BOOST_TEST(encode(view->to_vector()) == encode(*props));
+    BOOST_TEST(encode(view->to_vector()) == encode(sample()));
+
+    // The property length exceeds the buffer.
+    mqtt::buffer truncated(mqtt::string_view(encoded.data(), consumed - 1));
+    BOOST_TEST(!mqtt::v5::property::parse_view_with_length(truncated, consumed));
+
+    // No property
+    std::string zero(1, '\0');
+    auto empty = mqtt::v5::property::parse_view_with_length(mqtt::buffer(zero), consumed);
+    BOOST_TEST(empty.has_value());
+    BOOST_TEST(consumed == 1U);
+    BOOST_TEST(empty->empty());
+    BOOST_TEST(empty->size() == 0U);
+}
+
+BOOST_AUTO_TEST_CASE( find ) {
+    auto encoded = encode(sample());
+    mqtt::v5::property_view view{mqtt::buffer(encoded)};
+
+    auto ct = view.find<mqtt::v5::property::content_type>();
+    BOOST_TEST(ct.has_value());
+    BOOST_TEST(ct->val() == "text/plain");
+    // It refers to the buffer.
+    BOOST_CHECK(ct->val().data() >= encoded.data());
+    BOOST_CHECK(ct->val().data() < encoded.data() + encoded.size());
+
+    auto ta = view.find<mqtt::v5::property::topic_alias>();
+    BOOST_TEST(ta.has_value());
+    BOOST_TEST(ta->val() == 3U);
+
+    auto mei = view.find<mqtt::v5::property::message_expiry_interval>();
+    BOOST_TEST(mei.has_value());
+    BOOST_TEST(mei->val() == 0x12345678U);
+
+    auto up = view.find<mqtt::v5::property::user_property>();
+    BOOST_TEST(up.has_value());
+    BOOST_TEST(up->key() == "key");
+    BOOST_TEST(up->val() == "value1");
+
+    BOOST_TEST(!view.find<mqtt::v5::property::reason_string>());
+}
+
+BOOST_AUTO_TEST_CASE( hide ) {
+    auto encoded = encode(sample());
+    mqtt::v5::property_view view{mqtt::buffer(encoded)};
+    auto all = view.size();
+
+    auto hidden = view;
+    hidden.hide(mqtt::v5::property::id::topic_alias);
+    BOOST_TEST(hidden.size() == all - 1);
+    BOOST_TEST(!hidden.find<mqtt::v5::property::topic_alias>());
+    BOOST_TEST(hidden.find<mqtt::v5::property::content_type>().has_value());
+    for (auto it = hidden.begin(); it != hidden.end(); ++it) {
+        BOOST_CHECK(it.id() != mqtt::v5::property::id::topic_alias);
+    }
+    // The original view is not affected.
+    BOOST_TEST(view.size() == all);
+
+    // Hide the first and the last properties.
+    hidden.hide(mqtt::v5::property::id::payload_format_indicator);
+    hidden.hide(mqtt::v5::property::id::correlation_data);
+    BOOST_TEST(hidden.size() == all - 3);
+    BOOST_CHECK(hidden.begin().id() == mqtt::v5::property::id::message_expiry_interval);
+}
+
+BOOST_AUTO_TEST_CASE( malformed ) {
+    auto encoded = encode(sample());
+    // The last property is truncated. The iteration stops before it like v5::property::parse().
+    auto truncated = encoded.substr(0, encoded.size() - 1);
+    mqtt::v5::property_view view{mqtt::buffer(truncated)};
+    BOOST_TEST(view.size() == sample().size() - 1);
+    BOOST_TEST(!view.find<mqtt::v5::property::correlation_data>());
+
+    auto it = truncated.cbegin();
+    auto props = mqtt::v5::property::parse(it, truncated.cend());
+    BOOST_TEST(props.size() == view.size());
+
+    // Unknown property id
+    std::string unknown = std::string(1, '\x7f') + encoded;
+    BOOST_TEST(mqtt::v5::property_view{mqtt::buffer(unknown)}.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
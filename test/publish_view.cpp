@@ -0,0 +1,191 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+#include "combi_test.hpp"
+#include "checker.hpp"
+
+#include <mqtt/optional.hpp>
+#include <mqtt/buffer.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_publish_view)
+
+BOOST_AUTO_TEST_CASE( pub_qos0_1_2_sub_qos2 ) {
+    auto test = [](boost::asio::io_service& ios, auto& c, auto& s, auto& /*b*/) {
+        using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+        c->set_clean_session(true);
+
+        std::vector<mqtt::buffer> topics;
+        std::vector<mqtt::buffer> contents;
+
+        checker chk = {
+            // connect
+            cont("h_connack"),
+            // subscribe topic1 QoS2
+            cont("h_suback"),
+            // publish topic1 QoS0, QoS1, QoS2
+            cont("h_publish0"),
+            cont("h_publish1"),
+            cont("h_publish2"),
+            cont("h_unsuback"),
+            // disconnect
+            cont("h_close"),
+        };
+
+        auto on_suback =
+            [&] {
+                MQTT_CHK("h_suback");
+                c->publish_at_most_once("topic1", "topic1_contents0");
+                c->publish_at_least_once("topic1", "topic1_contents1");
+                c->publish_exactly_once("topic1", "topic1_contents2");
+            };
+        auto on_publish =
+            [&]
+            (std::uint8_t header, mqtt::buffer topic, mqtt::buffer contents_buf) {
+                BOOST_TEST(topic.has_life());
+                BOOST_TEST(contents_buf.has_life());
+                BOOST_TEST(topic == "topic1");
+                switch (mqtt::publish::get_qos(header)) {
+                case mqtt::qos::at_most_once:
+                    MQTT_CHK("h_publish0");
+                    break;
+                case mqtt::qos::at_least_once:
+                    MQTT_CHK("h_publish1");
+                    break;
+                case mqtt::qos::exactly_once:
+                    MQTT_CHK("h_publish2");
+                    c->unsubscribe("topic1");
+                    break;
+                default:
+                    BOOST_CHECK(false);
+                    break;
+                }
+                // keep the received buffers without copying the contents
+                topics.push_back(std::move(topic));
+                contents.push_back(std::move(contents_buf));
+            };
+
+        switch (c->get_protocol_version()) {
+        case mqtt::protocol_version::v3_1_1:
+            c->set_connack_handler(
+                [&chk, &c]
+                (bool sp, std::uint8_t connack_return_code) {
+                    MQTT_CHK("h_connack");
+                    BOOST_TEST(sp == false);
+                    BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+                    c->subscribe("topic1", mqtt::qos::exactly_once);
+                    return true;
+                });
+            c->set_suback_handler(
+                [&on_suback]
+                (packet_id_t /*packet_id*/, std::vector<mqtt::optional<std::uint8_t>> /*results*/) {
+                    on_suback();
+                    return true;
+                });
+            c->set_unsuback_handler(
+                [&chk, &c]
+                (packet_id_t /*packet_id*/) {
+                    MQTT_CHK("h_unsuback");
+                    c->disconnect();
+                    return true;
+                });
+            c->set_publish_handler(
+                []
+                (std::uint8_t /*header*/,
+                 mqtt::optional<packet_id_t> /*packet_id*/,
+                 std::string /*topic*/,
+                 std::string /*contents*/) {
+                    // publish_view_handler takes precedence
+                    BOOST_CHECK(false);
+                    return true;
+                });
+            c->set_publish_view_handler(
+                [&on_publish]
+                (std::uint8_t header,
+                 mqtt::optional<packet_id_t> /*packet_id*/,
+                 mqtt::buffer topic,
+                 mqtt::buffer contents) {
+                    on_publish(header, std::move(topic), std::move(contents));
+                    return true;
+                });
+            break;
+        case mqtt::protocol_version::v5:
+            c->set_v5_connack_handler(
+                [&chk, &c]
+                (bool sp, std::uint8_t connack_return_code, std::vector<mqtt::v5::property_variant> /*props*/) {
+                    MQTT_CHK("h_connack");
+                    BOOST_TEST(sp == false);
+                    BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+                    c->subscribe("topic1", mqtt::qos::exactly_once);
+                    return true;
+                });
+            c->set_v5_suback_handler(
+                [&on_suback]
+                (packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                    on_suback();
+                    return true;
+                });
+            c->set_v5_unsuback_handler(
+                [&chk, &c]
+                (packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                    MQTT_CHK("h_unsuback");
+                    c->disconnect();
+                    return true;
+                });
+            c->set_v5_publish_handler(
+                []
+                (std::uint8_t /*header*/,
+                 mqtt::optional<packet_id_t> /*packet_id*/,
+                 std::string /*topic*/,
+                 std::string /*contents*/,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    // v5_publish_view_handler takes precedence
+                    BOOST_CHECK(false);
+                    return true;
+                });
+            c->set_v5_publish_view_handler(
+                [&on_publish]
+                (std::uint8_t header,
+                 mqtt::optional<packet_id_t> /*packet_id*/,
+                 mqtt::buffer topic,
+                 mqtt::buffer contents,
+                 mqtt::v5::property_view /*props*/) {
+                    on_publish(header, std::move(topic), std::move(contents));
+                    return true;
+                });
+            break;
+        default:
+            BOOST_CHECK(false);
+            break;
+        }
+
+        c->set_close_handler(
+            [&chk, &s]
+            () {
+                MQTT_CHK("h_close");
+                s.close();
+            });
+        c->set_error_handler(
+            []
+            (boost::system::error_code const&) {
+                BOOST_CHECK(false);
+            });
+        c->connect();
+        ios.run();
+        BOOST_TEST(chk.all());
+
+        // The kept buffers are still valid after the endpoint received other messages.
+        BOOST_TEST(topics.size() == 3U);
+        BOOST_TEST(contents.size() == 3U);
+        for (std::size_t i = 0; i != topics.size(); ++i) {
+            BOOST_TEST(topics[i] == "topic1");
+            BOOST_TEST(contents[i] == "topic1_contents" + std::to_string(i));
+        }
+    };
+    do_combi_test_sync(test);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
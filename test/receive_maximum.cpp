@@ -0,0 +1,605 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+#include "test_settings.hpp"
+#include "test_broker.hpp"
+#include "test_server_no_tls.hpp"
+
+#include <thread>
+#include <algorithm>
+
+#include <mqtt/client.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_receive_maximum)
+
+BOOST_AUTO_TEST_CASE( send_quota ) {
+    // The broker accepts 2 QoS1 and QoS2 PUBLISH at a time. It disconnects the client
+    // with receive_maximum_exceeded if the client doesn't wait for PUBACK and PUBCOMP.
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    b.set_connack_props(
+        std::vector<mqtt::v5::property_variant> {
+            mqtt::v5::property::receive_maximum(2)
+        }
+    );
+    test_server_no_tls s(ios, b);
+    auto c = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+    c->set_clean_session(true);
+
+    constexpr std::size_t num_of_messages = 5;
+    std::size_t puback = 0;
+    std::size_t pubcomp = 0;
+    bool closed = false;
+    auto finish =
+        [&] {
+            if (puback == num_of_messages && pubcomp == num_of_messages) {
+                c->disconnect();
+            }
+        };
+
+    c->set_v5_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t connack_return_code, std::vector<mqtt::v5::property_variant> /*props*/) {
+            BOOST_TEST(connack_return_code == mqtt::v5::reason_code::success);
+            for (std::size_t i = 0; i != num_of_messages; ++i) {
+                c->publish_at_least_once("topic1", "topic1_contents");
+                c->publish_exactly_once("topic1", "topic1_contents");
+            }
+            return true;
+        });
+    c->set_v5_puback_handler(
+        [&]
+        (packet_id_t /*packet_id*/, std::uint8_t reason_code, std::vector<mqtt::v5::property_variant> /*props*/) {
+            BOOST_TEST(reason_code == mqtt::v5::reason_code::success);
+            ++puback;
+            finish();
+            return true;
+        });
+    c->set_v5_pubcomp_handler(
+        [&]
+        (packet_id_t /*packet_id*/, std::uint8_t reason_code, std::vector<mqtt::v5::property_variant> /*props*/) {
+            BOOST_TEST(reason_code == mqtt::v5::reason_code::success);
+            ++pubcomp;
+            finish();
+            return true;
+        });
+    c->set_v5_disconnect_handler(
+        [&]
+        (std::uint8_t reason_code, std::vector<mqtt::v5::property_variant> /*props*/) {
+            BOOST_TEST(reason_code != mqtt::v5::reason_code::receive_maximum_exceeded);
+            c->force_disconnect();
+        });
+    c->set_close_handler(
+        [&] {
+            closed = true;
+            s.close();
+        });
+    c->set_error_handler(
+        [&]
+        (boost::system::error_code const&) {
+            BOOST_CHECK(false);
+            s.close();
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(closed);
+    BOOST_TEST(puback == num_of_messages);
+    BOOST_TEST(pubcomp == num_of_messages);
+}
+
+BOOST_AUTO_TEST_CASE( recv_quota_exceeded ) {
+    // The server advertises Receive Maximum 1 and doesn't respond to PUBLISH.
+    // The raw client ignores it and sends 2 QoS1 PUBLISH.
+    boost::asio::io_service ios;
+    mqtt::server<> s(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), broker_notls_port),
+        ios
+    );
+    using endpoint_t = mqtt::server<>::endpoint_t;
+    using packet_id_t = endpoint_t::packet_id_t;
+    std::vector<mqtt::v5::property_variant> connack_props {
+        mqtt::v5::property::receive_maximum(1)
+    };
+    std::shared_ptr<endpoint_t> sep;
+    std::size_t received = 0;
+    s.set_accept_handler(
+        [&](endpoint_t& ep) {
+            sep = ep.shared_from_this();
+            ep.set_auto_pub_response(false);
+            ep.start_session();
+            ep.set_v5_connect_handler(
+                [&]
+                (std::string const& /*client_id*/,
+                 mqtt::optional<std::string> const& /*username*/,
+                 mqtt::optional<std::string> const& /*password*/,
+                 mqtt::optional<mqtt::will>,
+                 bool /*clean_session*/,
+                 std::uint16_t /*keep_alive*/,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    sep->connack(false, mqtt::v5::reason_code::success, connack_props);
+                    return true;
+                });
+            ep.set_v5_publish_handler(
+                [&]
+                (std::uint8_t /*header*/,
+                 mqtt::optional<packet_id_t> /*packet_id*/,
+                 std::string /*topic*/,
+                 std::string /*contents*/,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    ++received;
+                    return true;
+                });
+        });
+    s.listen();
+    std::thread th([&] { ios.run(); });
+
+    boost::asio::ip::tcp::socket socket(ios);
+    socket.connect(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), broker_notls_port)
+    );
+    std::string out =
+        mqtt::v5::connect_message(
+            0, "cid1", true, mqtt::nullopt, mqtt::nullopt, mqtt::nullopt, {}
+        ).continuous_buffer();
+    std::string topic = "topic1";
+    std::string contents = "contents";
+    for (packet_id_t packet_id = 1; packet_id != 3; ++packet_id) {
+        out += mqtt::v5::publish_message(
+            boost::asio::buffer(topic), mqtt::qos::at_least_once, false, false, packet_id, {}, boost::asio::buffer(contents)
+        ).continuous_buffer();
+    }
+    boost::asio::write(socket, boost::asio::buffer(out));
+
+    std::string expected =
+        mqtt::v5::connack_message(false, mqtt::v5::reason_code::success, connack_props).continuous_buffer() +
+        mqtt::v5::disconnect_message(mqtt::v5::reason_code::receive_maximum_exceeded, {}).continuous_buffer();
+    std::string in(expected.size(), '\0');
+    boost::asio::read(socket, boost::asio::buffer(&in[0], in.size()));
+    BOOST_TEST(in == expected);
+
+    socket.close();
+    ios.post(
+        [&] {
+            sep.reset();
+            s.close();
+        });
+    th.join();
+    BOOST_TEST(received == 1U);
+}
+
+BOOST_AUTO_TEST_CASE( resend_quota ) {
+    // The client publishes 3 QoS1 messages, and the server closes the connection without PUBACK.
+    // On reconnection, the server advertises Receive Maximum 1. The client resends
+    // the stored messages one at a time.
+    boost::asio::io_service ios;
+    mqtt::server<> s(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), broker_notls_port),
+        ios
+    );
+    using endpoint_t = mqtt::server<>::endpoint_t;
+    using packet_id_t = endpoint_t::packet_id_t;
+    constexpr std::size_t num_of_messages = 3;
+    std::vector<std::shared_ptr<endpoint_t>> seps;
+    std::size_t received = 0;
+    std::size_t resent = 0;
+    std::size_t outstanding = 0;
+    boost::asio::steady_timer tim(ios);
+    s.set_accept_handler(
+        [&](endpoint_t& ep) {
+            seps.push_back(ep.shared_from_this());
+            auto sep = &ep;
+            bool first = seps.size() == 1;
+            ep.set_auto_pub_response(false);
+            ep.start_session();
+            ep.set_v5_connect_handler(
+                [&, sep, first]
+                (std::string const& /*client_id*/,
+                 mqtt::optional<std::string> const& /*username*/,
+                 mqtt::optional<std::string> const& /*password*/,
+                 mqtt::optional<mqtt::will>,
+                 bool /*clean_session*/,
+                 std::uint16_t /*keep_alive*/,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    sep->connack(
+                        !first,
+                        mqtt::v5::reason_code::success,
+                        std::vector<mqtt::v5::property_variant> {
+                            mqtt::v5::property::receive_maximum(first ? static_cast<std::uint16_t>(num_of_messages) : 1)
+                        }
+                    );
+                    return true;
+                });
+            ep.set_v5_publish_handler(
+                [&, sep, first]
+                (std::uint8_t /*header*/,
+                 mqtt::optional<packet_id_t> packet_id,
+                 std::string /*topic*/,
+                 std::string /*contents*/,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    if (first) {
+                        if (++received == num_of_messages) sep->force_disconnect();
+                        return true;
+                    }
+                    ++resent;
+                    BOOST_TEST(++outstanding == 1U);
+                    // Give the client time to send the next message if it ignores the quota.
+                    tim.expires_from_now(std::chrono::milliseconds(50));
+                    tim.async_wait(
+                        [&, sep = sep->shared_from_this(), packet_id](boost::system::error_code const& ec) {
+                            BOOST_TEST(!ec);
+                            --outstanding;
+                            sep->puback(*packet_id, mqtt::v5::reason_code::success, {});
+                        });
+                    return true;
+                });
+            ep.set_v5_disconnect_handler(
+                [&]
+                (std::uint8_t /*reason_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                    seps.clear();
+                    s.close();
+                });
+        });
+    s.listen();
+
+    auto c = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using client_packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+    c->set_client_id("cid1");
+    c->set_clean_session(false);
+    std::size_t connack = 0;
+    std::size_t puback = 0;
+    c->set_v5_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            if (++connack == 1) {
+                for (std::size_t i = 0; i != num_of_messages; ++i) {
+                    c->publish_at_least_once("topic1", "topic1_contents");
+                }
+            }
+            return true;
+        });
+    c->set_v5_puback_handler(
+        [&]
+        (client_packet_id_t /*packet_id*/, std::uint8_t /*reason_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            if (++puback == num_of_messages) c->disconnect();
+            return true;
+        });
+    c->set_error_handler(
+        [&]
+        (boost::system::error_code const&) {
+            // Reconnect once after the server closes the first connection.
+            BOOST_TEST(connack == 1U);
+            if (connack == 1) c->connect();
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(received == num_of_messages);
+    BOOST_TEST(resent == num_of_messages);
+    BOOST_TEST(puback == num_of_messages);
+}
+
+BOOST_AUTO_TEST_CASE( resend_quota_expiry ) {
+    // The client publishes 3 QoS1 messages, and the server closes the connection without PUBACK.
+    // On reconnection, the server advertises Receive Maximum 1 and holds the first PUBACK for 2.5 seconds.
+    // The second message expires while it waits for the quota, so it is not resent.
+    // The Message Expiry Interval of the third message is rewritten when it is resent.
+    boost::asio::io_service ios;
+    mqtt::server<> s(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), broker_notls_port),
+        ios
+    );
+    using endpoint_t = mqtt::server<>::endpoint_t;
+    using packet_id_t = endpoint_t::packet_id_t;
+    constexpr std::size_t num_of_messages = 3;
+    std::vector<std::shared_ptr<endpoint_t>> seps;
+    std::size_t received = 0;
+    std::vector<std::string> resent;
+    std::vector<std::uint32_t> intervals;
+    boost::asio::steady_timer tim(ios);
+    s.set_accept_handler(
+        [&](endpoint_t& ep) {
+            seps.push_back(ep.shared_from_this());
+            auto sep = &ep;
+            bool first = seps.size() == 1;
+            ep.set_auto_pub_response(false);
+            ep.start_session();
+            ep.set_v5_connect_handler(
+                [&, sep, first]
+                (std::string const& /*client_id*/,
+                 mqtt::optional<std::string> const& /*username*/,
+                 mqtt::optional<std::string> const& /*password*/,
+                 mqtt::optional<mqtt::will>,
+                 bool /*clean_session*/,
+                 std::uint16_t /*keep_alive*/,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    sep->connack(
+                        !first,
+                        mqtt::v5::reason_code::success,
+                        std::vector<mqtt::v5::property_variant> {
+                            mqtt::v5::property::receive_maximum(first ? static_cast<std::uint16_t>(num_of_messages) : 1)
+                        }
+                    );
+                    return true;
+                });
+            ep.set_v5_publish_handler(
+                [&, sep, first]
+                (std::uint8_t /*header*/,
+                 mqtt::optional<packet_id_t> packet_id,
+                 std::string /*topic*/,
+                 std::string contents,
+                 std::vector<mqtt::v5::property_variant> props) {
+                    if (first) {
+                        if (++received == num_of_messages) sep->force_disconnect();
+                        return true;
+                    }
+                    resent.push_back(contents);
+                    for (auto const& p : props) {
+                        mqtt::visit(
+                            mqtt::make_lambda_visitor<void>(
+                                [&](mqtt::v5::property::message_expiry_interval const& t) {
+                                    intervals.push_back(t.val());
+                                },
+                                [](auto&&) {}
+                            ),
+                            p
+                        );
+                    }
+                    tim.expires_from_now(std::chrono::milliseconds(resent.size() == 1 ? 2500 : 0));
+                    tim.async_wait(
+                        [&, sep = sep->shared_from_this(), packet_id](boost::system::error_code const& ec) {
+                            BOOST_TEST(!ec);
+                            sep->puback(*packet_id, mqtt::v5::reason_code::success, {});
+                        });
+                    return true;
+                });
+            ep.set_v5_disconnect_handler(
+                [&]
+                (std::uint8_t /*reason_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                    seps.clear();
+                    s.close();
+                });
+        });
+    s.listen();
+
+    auto c = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using client_packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+    c->set_client_id("cid1");
+    c->set_clean_session(false);
+    std::vector<client_packet_id_t> pids;
+    std::vector<client_packet_id_t> removed;
+    c->set_v5_serialize_handlers(
+        [](auto const&) {},
+        [](auto const&) {},
+        [&](client_packet_id_t packet_id) {
+            removed.push_back(packet_id);
+        }
+    );
+    std::size_t connack = 0;
+    std::size_t puback = 0;
+    c->set_v5_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            if (++connack == 1) {
+                pids.push_back(c->publish("topic1", "1", mqtt::qos::at_least_once));
+                pids.push_back(
+                    c->publish(
+                        "topic1", "2", mqtt::qos::at_least_once, false,
+                        std::vector<mqtt::v5::property_variant> { mqtt::v5::property::message_expiry_interval(2) }
+                    )
+                );
+                pids.push_back(
+                    c->publish(
+                        "topic1", "3", mqtt::qos::at_least_once, false,
+                        std::vector<mqtt::v5::property_variant> { mqtt::v5::property::message_expiry_interval(10) }
+                    )
+                );
+            }
+            return true;
+        });
+    c->set_v5_puback_handler(
+        [&]
+        (client_packet_id_t /*packet_id*/, std::uint8_t /*reason_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            if (++puback == 2) c->disconnect();
+            return true;
+        });
+    c->set_error_handler(
+        [&]
+        (boost::system::error_code const&) {
+            // Reconnect once after the server closes the first connection.
+            BOOST_TEST(connack == 1U);
+            if (connack == 1) c->connect();
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(received == num_of_messages);
+    BOOST_TEST(resent == (std::vector<std::string>{ "1", "3" }));
+    BOOST_TEST(intervals.size() == 1U);
+    if (!intervals.empty()) BOOST_TEST(intervals.front() <= 8U);
+    // The expired message is removed from the serialized messages.
+    BOOST_TEST(removed.size() == num_of_messages);
+    BOOST_TEST((pids.size() == num_of_messages && std::count(removed.begin(), removed.end(), pids[1]) == 1));
+}
+
+BOOST_AUTO_TEST_CASE( pubrec_error_releases_quota ) {
+    // The server advertises Receive Maximum 1 and rejects QoS2 PUBLISH by PUBREC with an error.
+    // The rejected message releases the quota without PUBREL and PUBCOMP.
+    boost::asio::io_service ios;
+    mqtt::server<> s(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), broker_notls_port),
+        ios
+    );
+    using endpoint_t = mqtt::server<>::endpoint_t;
+    using packet_id_t = endpoint_t::packet_id_t;
+    constexpr std::size_t num_of_messages = 3;
+    std::shared_ptr<endpoint_t> sep;
+    std::size_t received = 0;
+    s.set_accept_handler(
+        [&](endpoint_t& ep) {
+            sep = ep.shared_from_this();
+            ep.set_auto_pub_response(false);
+            ep.start_session();
+            ep.set_v5_connect_handler(
+                [&]
+                (std::string const& /*client_id*/,
+                 mqtt::optional<std::string> const& /*username*/,
+                 mqtt::optional<std::string> const& /*password*/,
+                 mqtt::optional<mqtt::will>,
+                 bool /*clean_session*/,
+                 std::uint16_t /*keep_alive*/,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    sep->connack(
+                        false,
+                        mqtt::v5::reason_code::success,
+                        std::vector<mqtt::v5::property_variant> {
+                            mqtt::v5::property::receive_maximum(1)
+                        }
+                    );
+                    return true;
+                });
+            ep.set_v5_publish_handler(
+                [&]
+                (std::uint8_t /*header*/,
+                 mqtt::optional<packet_id_t> packet_id,
+                 std::string /*topic*/,
+                 std::string /*contents*/,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    ++received;
+                    sep->pubrec(*packet_id, mqtt::v5::reason_code::unspecified_error, {});
+                    return true;
+                });
+            ep.set_v5_pubrel_handler(
+                [&]
+                (packet_id_t /*packet_id*/, std::uint8_t /*reason_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                    BOOST_CHECK(false);
+                    return true;
+                });
+            ep.set_v5_disconnect_handler(
+                [&]
+                (std::uint8_t /*reason_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                    sep.reset();
+                    s.close();
+                });
+        });
+    s.listen();
+
+    auto c = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using client_packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+    c->set_clean_session(true);
+    std::size_t pubrec = 0;
+    c->set_v5_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            for (std::size_t i = 0; i != num_of_messages; ++i) {
+                c->publish_exactly_once("topic1", "topic1_contents");
+            }
+            return true;
+        });
+    c->set_v5_pubrec_handler(
+        [&]
+        (client_packet_id_t /*packet_id*/, std::uint8_t reason_code, std::vector<mqtt::v5::property_variant> /*props*/) {
+            BOOST_TEST(reason_code == mqtt::v5::reason_code::unspecified_error);
+            if (++pubrec == num_of_messages) c->disconnect();
+            return true;
+        });
+    c->set_error_handler(
+        [&]
+        (boost::system::error_code const&) {
+            BOOST_CHECK(false);
+            sep.reset();
+            s.close();
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(received == num_of_messages);
+    BOOST_TEST(pubrec == num_of_messages);
+}
+
+BOOST_AUTO_TEST_CASE( zero_rejected ) {
+    // A Receive Maximum of 0 is a Protocol Error. The server sends DISCONNECT instead of CONNACK.
+    // The server can't send it either.
+    boost::asio::io_service ios;
+    mqtt::server<> s(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), broker_notls_port),
+        ios
+    );
+    using endpoint_t = mqtt::server<>::endpoint_t;
+    std::shared_ptr<endpoint_t> sep;
+    std::size_t connected = 0;
+    std::vector<boost::system::error_code> errors;
+    s.set_accept_handler(
+        [&](endpoint_t& ep) {
+            sep = ep.shared_from_this();
+            ep.start_session(
+                [&](boost::system::error_code const& ec) {
+                    errors.push_back(ec);
+                });
+            ep.set_v5_connect_handler(
+                [&]
+                (std::string const& /*client_id*/,
+                 mqtt::optional<std::string> const& /*username*/,
+                 mqtt::optional<std::string> const& /*password*/,
+                 mqtt::optional<mqtt::will>,
+                 bool /*clean_session*/,
+                 std::uint16_t /*keep_alive*/,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    ++connected;
+                    BOOST_CHECK_THROW(
+                        sep->connack(
+                            false,
+                            mqtt::v5::reason_code::success,
+                            std::vector<mqtt::v5::property_variant> { mqtt::v5::property::receive_maximum(0) }
+                        ),
+                        mqtt::protocol_error
+                    );
+                    sep->connack(false, mqtt::v5::reason_code::success);
+                    return true;
+                });
+        });
+    s.listen();
+    std::thread th([&] { ios.run(); });
+
+    auto connect =
+        [&](std::vector<mqtt::v5::property_variant> props, std::string const& expected) {
+            boost::asio::ip::tcp::socket socket(ios);
+            socket.connect(
+                boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), broker_notls_port)
+            );
+            std::string out =
+                mqtt::v5::connect_message(
+                    0, "cid1", true, mqtt::nullopt, mqtt::nullopt, mqtt::nullopt, std::move(props)
+                ).continuous_buffer();
+            boost::asio::write(socket, boost::asio::buffer(out));
+            std::string in(expected.size(), '\0');
+            boost::asio::read(socket, boost::asio::buffer(&in[0], in.size()));
+            BOOST_TEST(in == expected);
+            socket.close();
+        };
+
+    connect(
+        std::vector<mqtt::v5::property_variant> { mqtt::v5::property::receive_maximum(0) },
+        mqtt::v5::disconnect_message(mqtt::v5::reason_code::protocol_error, {}).continuous_buffer()
+    );
+    connect(
+        {},
+        mqtt::v5::connack_message(false, mqtt::v5::reason_code::success, {}).continuous_buffer()
+    );
+
+    ios.post(
+        [&] {
+            sep.reset();
+            s.close();
+        });
+    th.join();
+    BOOST_TEST(connected == 1U);
+    // The other errors are the end of the connections.
+    BOOST_TEST(
+        std::count(errors.begin(), errors.end(), boost::system::errc::make_error_code(boost::system::errc::protocol_error))
+        == 1
+    );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -10,6 +10,8 @@
 
 #include <mqtt/optional.hpp>
 
+#include <set>
+
 BOOST_AUTO_TEST_SUITE(test_retain)
 
 BOOST_AUTO_TEST_CASE( simple ) {
@@ -787,4 +789,239 @@ BOOST_AUTO_TEST_CASE( prop ) {
 }
 
 
+BOOST_AUTO_TEST_CASE( prop_after_other_packets ) {
+    // The broker receives other packets between the retained PUBLISH and SUBSCRIBE.
+    // The string properties of the retained message are kept after the receive buffer is reused.
+    auto test = [](boost::asio::io_service& ios, auto& c, auto& s, auto& /*b*/) {
+        if (c->get_protocol_version() != mqtt::protocol_version::v5) return;
+
+        using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+        c->set_clean_session(true);
+
+        checker chk = {
+            // connect
+            cont("h_connack"),
+            // publish topic1 QoS0 retain
+            // publish topic2 QoS0 x 10
+            // subscribe topic1 QoS0
+            cont("h_suback"),
+            cont("h_publish"),
+            // disconnect
+            cont("h_close"),
+        };
+
+        c->set_v5_connack_handler(
+            [&chk, &c]
+            (bool /*sp*/, std::uint8_t connack_return_code, std::vector<mqtt::v5::property_variant> /*props*/) {
+                MQTT_CHK("h_connack");
+                BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+                c->publish_at_most_once(
+                    "topic1", "retained_contents", true,
+                    std::vector<mqtt::v5::property_variant> {
+                        mqtt::v5::property::content_type("content type"),
+                        mqtt::v5::property::response_topic("response topic"),
+                        mqtt::v5::property::user_property("key1", "val1"),
+                    }
+                );
+                for (std::size_t i = 0; i != 10; ++i) {
+                    c->publish_at_most_once(
+                        "topic2", "other_contents_____", false,
+                        std::vector<mqtt::v5::property_variant> {
+                            mqtt::v5::property::content_type("xxxxxxxxxxxx"),
+                            mqtt::v5::property::response_topic("xxxxxxxxxxxxxx"),
+                            mqtt::v5::property::user_property("xxxx", "xxxx"),
+                        }
+                    );
+                }
+                c->subscribe("topic1", mqtt::qos::at_most_once);
+                return true;
+            });
+        c->set_v5_suback_handler(
+            [&chk]
+            (packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                MQTT_CHK("h_suback");
+                return true;
+            });
+        c->set_v5_publish_handler(
+            [&chk, &c]
+            (std::uint8_t header,
+             mqtt::optional<packet_id_t> /*packet_id*/,
+             std::string topic,
+             std::string contents,
+             std::vector<mqtt::v5::property_variant> props) {
+                MQTT_CHK("h_publish");
+                BOOST_TEST(mqtt::publish::is_retain(header) == true);
+                BOOST_TEST(topic == "topic1");
+                BOOST_TEST(contents == "retained_contents");
+                BOOST_TEST(props.size() == 3U);
+                for (auto const& p : props) {
+                    mqtt::visit(
+                        mqtt::make_lambda_visitor<void>(
+                            [&](mqtt::v5::property::content_type::recv const& t) {
+                                BOOST_TEST(t.val() == "content type");
+                            },
+                            [&](mqtt::v5::property::response_topic::recv const& t) {
+                                BOOST_TEST(t.val() == "response topic");
+                            },
+                            [&](mqtt::v5::property::user_property::recv const& t) {
+                                BOOST_TEST(t.key() == "key1");
+                                BOOST_TEST(t.val() == "val1");
+                            },
+                            [&](auto&& ...) {
+                                BOOST_TEST(false);
+                            }
+                        ),
+                        p
+                    );
+                }
+                c->disconnect();
+                return true;
+            });
+        c->set_close_handler(
+            [&chk, &s]
+            () {
+                MQTT_CHK("h_close");
+                s.close();
+            });
+        c->set_error_handler(
+            []
+            (boost::system::error_code const&) {
+                BOOST_CHECK(false);
+            });
+        c->connect();
+        ios.run();
+        BOOST_TEST(chk.all());
+    };
+    do_combi_test_sync(test);
+}
+
+BOOST_AUTO_TEST_CASE( wildcard ) {
+    auto test = [](boost::asio::io_service& ios, auto& c, auto& s, auto& b) {
+        using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+        c->set_clean_session(true);
+        // The matched retained messages are published in several batches.
+        b.set_retained_batch_size(2);
+
+        std::set<std::string> expected { "a", "a/1", "a/2", "a/b/3" };
+        std::set<std::string> received;
+
+        checker chk = {
+            // connect
+            cont("h_connack"),
+            // publish retained messages
+            // subscribe a/#
+            cont("h_suback"),
+            cont("h_publish"),
+            cont("h_unsuback"),
+            // disconnect
+            cont("h_close"),
+        };
+
+        auto on_connack =
+            [&] {
+                MQTT_CHK("h_connack");
+                for (auto const& t : { "a", "a/1", "a/2", "a/b/3", "b/4", "ab/5", "$SYS/a/6" }) {
+                    c->publish_at_most_once(t, "retained_contents", true);
+                }
+                c->subscribe("a/#", mqtt::qos::at_least_once);
+            };
+        auto on_publish =
+            [&]
+            (std::uint8_t header, std::string topic, std::string contents) {
+                BOOST_TEST(mqtt::publish::is_retain(header) == true);
+                BOOST_TEST(mqtt::publish::get_qos(header) == mqtt::qos::at_most_once);
+                BOOST_TEST(contents == "retained_contents");
+                BOOST_TEST(received.insert(topic).second);
+                if (received.size() == expected.size()) {
+                    MQTT_CHK("h_publish");
+                    BOOST_TEST(received == expected);
+                    c->unsubscribe("a/#");
+                }
+            };
+
+        switch (c->get_protocol_version()) {
+        case mqtt::protocol_version::v3_1_1:
+            c->set_connack_handler(
+                [&]
+                (bool /*sp*/, std::uint8_t /*connack_return_code*/) {
+                    on_connack();
+                    return true;
+                });
+            c->set_suback_handler(
+                [&chk]
+                (packet_id_t /*packet_id*/, std::vector<mqtt::optional<std::uint8_t>> /*results*/) {
+                    MQTT_CHK("h_suback");
+                    return true;
+                });
+            c->set_unsuback_handler(
+                [&chk, &c]
+                (packet_id_t /*packet_id*/) {
+                    MQTT_CHK("h_unsuback");
+                    c->disconnect();
+                    return true;
+                });
+            c->set_publish_handler(
+                [&]
+                (std::uint8_t header,
+                 mqtt::optional<packet_id_t> /*packet_id*/,
+                 std::string topic,
+                 std::string contents) {
+                    on_publish(header, std::move(topic), std::move(contents));
+                    return true;
+                });
+            break;
+        case mqtt::protocol_version::v5:
+            c->set_v5_connack_handler(
+                [&]
+                (bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                    on_connack();
+                    return true;
+                });
+            c->set_v5_suback_handler(
+                [&chk]
+                (packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                    MQTT_CHK("h_suback");
+                    return true;
+                });
+            c->set_v5_unsuback_handler(
+                [&chk, &c]
+                (packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                    MQTT_CHK("h_unsuback");
+                    c->disconnect();
+                    return true;
+                });
+            c->set_v5_publish_handler(
+                [&]
+                (std::uint8_t header,
+                 mqtt::optional<packet_id_t> /*packet_id*/,
+                 std::string topic,
+                 std::string contents,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    on_publish(header, std::move(topic), std::move(contents));
+                    return true;
+                });
+            break;
+        default:
+            BOOST_CHECK(false);
+            break;
+        }
+
+        c->set_close_handler(
+            [&chk, &s]
+            () {
+                MQTT_CHK("h_close");
+                s.close();
+            });
+        c->set_error_handler(
+            []
+            (boost::system::error_code const&) {
+                BOOST_CHECK(false);
+            });
+        c->connect();
+        ios.run();
+        BOOST_TEST(chk.all());
+    };
+    do_combi_test_sync(test);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
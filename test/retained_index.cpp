@@ -0,0 +1,136 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+
+#include <random>
+
+#include <mqtt/retained_index.hpp>
+#include <mqtt/subscription_map.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_retained_index)
+
+namespace {
+
+using index_t = mqtt::retained_index<std::string>;
+
+std::vector<std::string> match(index_t const& idx, mqtt::string_view filter) {
+    auto ret = idx.match(filter);
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+void insert(index_t& idx, std::vector<std::string> const& topics) {
+    for (auto const& t : topics) idx.insert_or_assign(t, t);
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( wildcard ) {
+    index_t idx;
+    insert(idx, { "a", "a/b", "a/b/c", "a/x/c", "a//c", "b/c/d", "/" });
+    BOOST_TEST(idx.size() == 7U);
+
+    BOOST_TEST(match(idx, "a/b/c") == (std::vector<std::string>{ "a/b/c" }));
+    BOOST_TEST(match(idx, "a/+/c") == (std::vector<std::string>{ "a//c", "a/b/c", "a/x/c" }));
+    // "a/#" matches the parent level "a"
+    BOOST_TEST(match(idx, "a/#") == (std::vector<std::string>{ "a", "a//c", "a/b", "a/b/c", "a/x/c" }));
+    BOOST_TEST(match(idx, "a/b/#") == (std::vector<std::string>{ "a/b", "a/b/c" }));
+    BOOST_TEST(match(idx, "+/+") == (std::vector<std::string>{ "/", "a/b" }));
+    BOOST_TEST(match(idx, "+/+/+") == (std::vector<std::string>{ "a//c", "a/b/c", "a/x/c", "b/c/d" }));
+    BOOST_TEST(match(idx, "+/c/#") == (std::vector<std::string>{ "b/c/d" }));
+    BOOST_TEST(match(idx, "#").size() == 7U);
+    BOOST_TEST(match(idx, "+") == (std::vector<std::string>{ "a" }));
+    BOOST_TEST(match(idx, "x/#").empty());
+    BOOST_TEST(match(idx, "a/b/c/d").empty());
+}
+
+BOOST_AUTO_TEST_CASE( dollar ) {
+    index_t idx;
+    insert(idx, { "$SYS/monitor/Clients", "SYS/monitor/Clients" });
+
+    // Wildcards at the first level don't match topics that start with '$'.
+    BOOST_TEST(match(idx, "#") == (std::vector<std::string>{ "SYS/monitor/Clients" }));
+    BOOST_TEST(match(idx, "+/monitor/Clients") == (std::vector<std::string>{ "SYS/monitor/Clients" }));
+    BOOST_TEST(match(idx, "$SYS/#") == (std::vector<std::string>{ "$SYS/monitor/Clients" }));
+    BOOST_TEST(match(idx, "$SYS/monitor/+") == (std::vector<std::string>{ "$SYS/monitor/Clients" }));
+}
+
+BOOST_AUTO_TEST_CASE( erase ) {
+    index_t idx;
+    BOOST_TEST(idx.insert_or_assign("a/b/c", "1"));
+    BOOST_TEST(idx.insert_or_assign("a/b", "2"));
+    // overwrite
+    BOOST_TEST(!idx.insert_or_assign("a/b/c", "3"));
+    BOOST_TEST(idx.size() == 2U);
+    BOOST_TEST(*idx.find("a/b/c") == "3");
+    BOOST_TEST(!idx.find("a"));
+
+    BOOST_TEST(!idx.erase("a"));
+    BOOST_TEST(!idx.erase("a/b/c/d"));
+    BOOST_TEST(idx.erase("a/b/c"));
+    BOOST_TEST(!idx.find("a/b/c"));
+    BOOST_TEST(match(idx, "a/#") == (std::vector<std::string>{ "2" }));
+    BOOST_TEST(idx.erase("a/b"));
+    BOOST_TEST(match(idx, "#").empty());
+    BOOST_TEST(idx.empty());
+
+    // nodes are pruned and can be created again
+    idx.insert_or_assign("a/b/c", "4");
+    BOOST_TEST(match(idx, "a/+/c") == (std::vector<std::string>{ "4" }));
+}
+
+// Compare with subscription_map that matches in the opposite direction.
+BOOST_AUTO_TEST_CASE( random ) {
+    std::mt19937 gen(20191018);
+    std::vector<std::string> levels { "a", "b", "$c", "" };
+    auto make =
+        [&](bool filter) {
+            std::string ret;
+            auto n = std::uniform_int_distribution<std::size_t>(1, 4)(gen);
+            for (std::size_t i = 0; i != n; ++i) {
+                if (i != 0) ret += '/';
+                auto r = std::uniform_int_distribution<std::size_t>(0, levels.size() + 1)(gen);
+                if (filter && r == levels.size()) {
+                    ret += '+';
+                }
+                else if (filter && r == levels.size() + 1) {
+                    ret += '#';
+                    break;
+                }
+                else {
+                    ret += levels[r % levels.size()];
+                }
+            }
+            return ret;
+        };
+
+    index_t idx;
+    for (std::size_t i = 0; i != 200; ++i) {
+        auto t = make(false);
+        if (!t.empty()) idx.insert_or_assign(t, t);
+    }
+    auto topics = idx.match("#");
+    for (auto const& t : idx.match("$c/#")) topics.push_back(t);
+    BOOST_TEST(topics.size() == idx.size());
+
+    for (std::size_t i = 0; i != 200; ++i) {
+        auto f = make(true);
+        if (f.empty()) continue;
+        mqtt::subscription_map<std::string, int> m;
+        m.insert_or_assign(f, "", 0);
+        std::vector<std::string> expected;
+        for (auto const& t : topics) {
+            bool matched = false;
+            m.match(t, [&](std::string const&, int) { matched = true; });
+            if (matched) expected.push_back(t);
+        }
+        std::sort(expected.begin(), expected.end());
+        BOOST_TEST(match(idx, f) == expected, "filter: " << f);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,305 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+#include "test_settings.hpp"
+#include "test_broker.hpp"
+#include "test_server_no_tls.hpp"
+
+#include <cstdio>
+#include <algorithm>
+#include <map>
+
+#include <mqtt/client.hpp>
+#include <mqtt/session_log.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_session_log)
+
+namespace {
+
+void remove_log(std::string const& path) {
+    std::remove((path + ".head").c_str());
+    std::remove((path + ".head.tmp").c_str());
+    for (std::size_t i = 1; i != 1000; ++i) {
+        std::remove((path + "." + std::to_string(i)).c_str());
+    }
+}
+
+std::string publish(std::uint16_t packet_id, std::string const& contents) {
+    return mqtt::publish_message(
+        boost::asio::buffer("topic1", 6),
+        mqtt::qos::at_least_once,
+        false,
+        false,
+        packet_id,
+        boost::asio::buffer(contents)
+    ).continuous_buffer();
+}
+
+void store(mqtt::session_log& log, std::uint32_t packet_id, std::string const& packet) {
+    log.store(packet_id, std::vector<boost::asio::const_buffer> { boost::asio::buffer(packet) });
+}
+
+std::map<std::uint32_t, std::string> load(mqtt::session_log& log, std::vector<std::uint32_t>* order = nullptr) {
+    std::map<std::uint32_t, std::string> ret;
+    log.for_each(
+        [&](std::uint32_t packet_id, char const* b, char const* e) {
+            ret.emplace(packet_id, std::string(b, e));
+            if (order) order->push_back(packet_id);
+        }
+    );
+    return ret;
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( recover ) {
+    std::string path = "session_log_recover";
+    remove_log(path);
+    std::map<std::uint32_t, std::string> expected {
+        { 3, publish(3, "c") },
+        { 1, publish(1, "a2") },
+    };
+    {
+        mqtt::session_log log(path);
+        store(log, 1, publish(1, "a"));
+        store(log, 2, publish(2, "b"));
+        store(log, 3, publish(3, "c"));
+        log.remove(2);
+        log.remove(4);
+        store(log, 1, publish(1, "a2"));
+        BOOST_TEST(log.size() == 2U);
+    }
+    {
+        mqtt::session_log log(path);
+        BOOST_TEST(log.size() == 2U);
+        std::vector<std::uint32_t> order;
+        BOOST_TEST((load(log, &order) == expected));
+        // stored order
+        BOOST_TEST((order == std::vector<std::uint32_t> { 3, 1 }));
+    }
+
+    // A broken record at the tail is ignored.
+    {
+        std::FILE* fp = std::fopen((path + ".1").c_str(), "ab");
+        BOOST_REQUIRE(fp);
+        std::fwrite("\x20\x00\x00\x00\x01\x02", 1, 6, fp);
+        std::fclose(fp);
+    }
+    {
+        mqtt::session_log log(path);
+        BOOST_TEST((load(log) == expected));
+        log.clear();
+        BOOST_TEST(log.size() == 0U);
+    }
+    {
+        mqtt::session_log log(path);
+        BOOST_TEST(load(log).empty());
+    }
+    remove_log(path);
+}
+
+BOOST_AUTO_TEST_CASE( compaction ) {
+    // A segment has about 6 records. One record out of 16 is kept alive.
+    std::string path = "session_log_compaction";
+    remove_log(path);
+    std::map<std::uint32_t, std::string> expected;
+    std::vector<std::uint32_t> expected_order;
+    {
+        mqtt::session_log log(path, 256);
+        for (std::uint16_t i = 1; i != 256; ++i) {
+            auto packet = publish(i, "contents");
+            store(log, i, packet);
+            if (i % 16 == 0) {
+                expected.emplace(i, packet);
+                expected_order.push_back(i);
+            }
+            else {
+                log.remove(i);
+            }
+            log.flush();
+        }
+        BOOST_TEST(log.size() == expected.size());
+        BOOST_TEST(log.num_of_segments() < 16U);
+        // The compacted records are copied after the newer records, but they keep the stored order.
+        std::vector<std::uint32_t> order;
+        BOOST_TEST((load(log, &order) == expected));
+        BOOST_TEST(order == expected_order);
+    }
+    {
+        mqtt::session_log log(path, 256);
+        std::vector<std::uint32_t> order;
+        BOOST_TEST((load(log, &order) == expected));
+        BOOST_TEST(order == expected_order);
+        // New records are stored after the recovered ones.
+        store(log, 1, publish(1, "contents"));
+        expected_order.push_back(1);
+        order.clear();
+        load(log, &order);
+        BOOST_TEST(order == expected_order);
+    }
+    remove_log(path);
+}
+
+BOOST_AUTO_TEST_CASE( broken_head ) {
+    // The first segments are deleted, so the head points to a later segment.
+    std::string path = "session_log_broken_head";
+    remove_log(path);
+    std::map<std::uint32_t, std::string> expected;
+    {
+        mqtt::session_log log(path, 256);
+        for (std::uint16_t i = 1; i != 64; ++i) {
+            auto packet = publish(i, "contents");
+            store(log, i, packet);
+            if (i % 16 == 0) {
+                expected.emplace(i, packet);
+            }
+            else {
+                log.remove(i);
+            }
+            log.flush();
+        }
+    }
+    std::FILE* fp = std::fopen((path + ".1").c_str(), "rb");
+    BOOST_TEST(!fp);
+    if (fp) std::fclose(fp);
+
+    // The head is missing.
+    std::remove((path + ".head").c_str());
+    {
+        mqtt::session_log log(path, 256);
+        BOOST_TEST(log.size() == expected.size());
+        BOOST_TEST((load(log) == expected));
+    }
+
+    // The head is broken.
+    for (auto const& contents : { std::string(), std::string("x1"), std::string("99999999999999999999999") }) {
+        fp = std::fopen((path + ".head").c_str(), "wb");
+        BOOST_REQUIRE(fp);
+        std::fwrite(contents.data(), 1, contents.size(), fp);
+        std::fclose(fp);
+        mqtt::session_log log(path, 256);
+        BOOST_TEST(log.size() == expected.size());
+        BOOST_TEST((load(log) == expected));
+    }
+    remove_log(path);
+}
+
+BOOST_AUTO_TEST_CASE( restore_mapped ) {
+    // The restored messages refer to the mapped segments. They are still valid
+    // after the log is destroyed and the segment files are removed.
+    std::string path = "session_log_restore_mapped";
+    remove_log(path);
+    std::string topic = "topic1";
+    std::string contents = "contents";
+    std::vector<std::string> expected {
+        mqtt::v5::publish_message(
+            boost::asio::buffer(topic), mqtt::qos::at_least_once, false, false, 1,
+            { mqtt::v5::property::content_type("text/plain") }, boost::asio::buffer(contents)
+        ).continuous_buffer(),
+        mqtt::v5::publish_message(
+            boost::asio::buffer(topic), mqtt::qos::exactly_once, false, false, 2, {}, boost::asio::buffer(contents)
+        ).continuous_buffer(),
+        mqtt::v5::pubrel_message(
+            3, mqtt::v5::reason_code::success, { mqtt::v5::property::reason_string("reason") }
+        ).continuous_buffer(),
+    };
+    {
+        mqtt::session_log log(path);
+        for (std::size_t i = 0; i != expected.size(); ++i) {
+            store(log, static_cast<std::uint32_t>(i + 1), expected[i]);
+        }
+    }
+
+    boost::asio::io_service ios;
+    auto c = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    {
+        mqtt::session_log log(path);
+        log.restore(*c);
+    }
+    remove_log(path);
+
+    std::vector<std::string> restored;
+    c->for_each_store(
+        [&](char const* data, std::size_t size) {
+            restored.emplace_back(data, size);
+        }
+    );
+    std::sort(restored.begin(), restored.end());
+    std::sort(expected.begin(), expected.end());
+    BOOST_TEST(restored == expected);
+}
+
+BOOST_AUTO_TEST_CASE( endpoint ) {
+    // c1 publishes QoS1 message and is disconnected before PUBACK.
+    // c2 restores it from the log and resends it.
+    std::string path = "session_log_endpoint";
+    remove_log(path);
+
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    test_server_no_tls s(ios, b);
+
+    auto c1 = mqtt::make_client(ios, broker_url, broker_notls_port);
+    c1->set_client_id("cid1");
+    c1->set_clean_session(false);
+    auto c2 = mqtt::make_client(ios, broker_url, broker_notls_port);
+    c2->set_client_id("cid1");
+    c2->set_clean_session(false);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c1)>::packet_id_t;
+
+    std::unique_ptr<mqtt::session_log> log(new mqtt::session_log(path));
+    log->set_serialize_handlers(*c1);
+
+    packet_id_t pid_pub = 0;
+    bool puback = false;
+    c1->set_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t connack_return_code) {
+            BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+            pid_pub = c1->publish_at_least_once("topic1", "topic1_contents");
+            c1->force_disconnect();
+            return true;
+        });
+    c1->set_error_handler(
+        [&]
+        (boost::system::error_code const&) {
+            // restart
+            log.reset();
+            log.reset(new mqtt::session_log(path));
+            BOOST_TEST(log->size() == 1U);
+            log->set_serialize_handlers(*c2);
+            log->restore(*c2);
+            c2->connect();
+        });
+    c2->set_connack_handler(
+        [&]
+        (bool sp, std::uint8_t connack_return_code) {
+            BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+            BOOST_TEST(sp);
+            return true;
+        });
+    c2->set_puback_handler(
+        [&]
+        (packet_id_t packet_id) {
+            BOOST_TEST(packet_id == pid_pub);
+            puback = true;
+            c2->disconnect();
+            return true;
+        });
+    c2->set_close_handler(
+        [&] {
+            s.close();
+        });
+    c1->connect();
+    ios.run();
+    BOOST_TEST(puback);
+    BOOST_TEST(log->size() == 0U);
+    log.reset();
+    remove_log(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,589 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+#include "test_settings.hpp"
+#include "sharded_broker.hpp"
+#include "checker.hpp"
+
+#include <mqtt_client_cpp.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_sharded_broker)
+
+BOOST_AUTO_TEST_CASE( pubsub_across_shards ) {
+    boost::asio::io_service ios;
+    sharded_broker sb(2);
+    mqtt::server<> s(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), broker_notls_port),
+        ios
+    );
+    std::vector<std::size_t> selected;
+    s.set_io_service_selector(
+        [&]() -> boost::asio::io_service& {
+            auto& ios_con = sb.next_io_service();
+            for (std::size_t i = 0; i != sb.num_of_shards(); ++i) {
+                if (&ios_con == &sb.io_service(i)) selected.push_back(i);
+            }
+            return ios_con;
+        }
+    );
+    s.set_accept_handler(
+        [&](mqtt::server<>::endpoint_t& ep) {
+            sb.handle_accept(ep);
+        }
+    );
+    s.listen();
+    sb.run();
+
+    auto c1 = mqtt::make_client(ios, broker_url, broker_notls_port);
+    auto c2 = mqtt::make_client(ios, broker_url, broker_notls_port);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c1)>::packet_id_t;
+    c1->set_client_id("cid1");
+    c1->set_clean_session(true);
+    c2->set_client_id("cid2");
+    c2->set_clean_session(true);
+
+    checker chk = {
+        // c1 connect and subscribe
+        cont("h_connack1"),
+        cont("h_suback1"),
+        // c2 connect and publish
+        cont("h_connack2"),
+        // c1 receives the message via the other shard
+        cont("h_publish1"),
+        deps("h_puback2", "h_connack2"),
+    };
+
+    std::size_t closed = 0;
+    auto on_close =
+        [&] {
+            if (++closed == 2) s.close();
+        };
+
+    c1->set_connack_handler(
+        [&chk, &c1]
+        (bool /*sp*/, std::uint8_t connack_return_code) {
+            MQTT_CHK("h_connack1");
+            BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+            c1->subscribe("topic1", mqtt::qos::at_least_once);
+            return true;
+        });
+    c1->set_suback_handler(
+        [&chk, &c2]
+        (packet_id_t /*packet_id*/, std::vector<mqtt::optional<std::uint8_t>> /*results*/) {
+            MQTT_CHK("h_suback1");
+            c2->connect();
+            return true;
+        });
+    c1->set_publish_handler(
+        [&chk, &c1]
+        (std::uint8_t header,
+         mqtt::optional<packet_id_t> /*packet_id*/,
+         std::string topic,
+         std::string contents) {
+            MQTT_CHK("h_publish1");
+            BOOST_TEST(mqtt::publish::get_qos(header) == mqtt::qos::at_least_once);
+            BOOST_TEST(topic == "topic1");
+            BOOST_TEST(contents == "topic1_contents");
+            c1->disconnect();
+            return true;
+        });
+    c1->set_close_handler(on_close);
+
+    c2->set_connack_handler(
+        [&chk, &c2]
+        (bool /*sp*/, std::uint8_t connack_return_code) {
+            MQTT_CHK("h_connack2");
+            BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+            c2->publish_at_least_once("topic1", "topic1_contents");
+            return true;
+        });
+    c2->set_puback_handler(
+        [&chk, &c2]
+        (packet_id_t /*packet_id*/) {
+            MQTT_CHK("h_puback2");
+            c2->disconnect();
+            return true;
+        });
+    c2->set_close_handler(on_close);
+
+    c1->connect();
+    ios.run();
+    BOOST_TEST(chk.all());
+    // c1 and c2 are connected to different shards
+    BOOST_TEST(selected.size() >= 2U);
+    BOOST_TEST(selected[0] != selected[1]);
+}
+
+BOOST_AUTO_TEST_CASE( props_across_shards ) {
+    boost::asio::io_service ios;
+    sharded_broker sb(2);
+    mqtt::server<> s(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), broker_notls_port),
+        ios
+    );
+    s.set_io_service_selector(
+        [&]() -> boost::asio::io_service& {
+            return sb.next_io_service();
+        }
+    );
+    s.set_accept_handler(
+        [&](mqtt::server<>::endpoint_t& ep) {
+            sb.handle_accept(ep);
+        }
+    );
+    s.listen();
+    sb.run();
+
+    auto c1 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    auto c2 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c1)>::packet_id_t;
+    c1->set_client_id("cid1");
+    c1->set_clean_session(true);
+    c2->set_client_id("cid2");
+    c2->set_clean_session(true);
+
+    std::size_t const num_of_messages = 100;
+    std::vector<std::string> expected;
+    for (std::size_t i = 0; i != num_of_messages; ++i) expected.push_back(std::to_string(i % 10));
+    std::vector<std::string> received;
+    std::size_t closed = 0;
+    auto on_close =
+        [&] {
+            if (++closed == 2) s.close();
+        };
+
+    c1->set_v5_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c1->subscribe("topic1", mqtt::qos::at_least_once);
+            return true;
+        });
+    c1->set_v5_suback_handler(
+        [&]
+        (packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c2->connect();
+            return true;
+        });
+    c1->set_v5_publish_handler(
+        [&]
+        (std::uint8_t /*header*/,
+         mqtt::optional<packet_id_t> /*packet_id*/,
+         std::string topic,
+         std::string contents,
+         std::vector<mqtt::v5::property_variant> props) {
+            BOOST_TEST(topic == "topic1");
+            received.push_back(contents);
+            std::size_t checked = 0;
+            for (auto const& p : props) {
+                mqtt::visit(
+                    mqtt::make_lambda_visitor<void>(
+                        [&](mqtt::v5::property::content_type::recv const& t) {
+                            BOOST_TEST(t.val() == "text/plain");
+                            ++checked;
+                        },
+                        [&](mqtt::v5::property::user_property::recv const& t) {
+                            BOOST_TEST(t.key() == "key");
+                            BOOST_TEST(t.val() == "val" + contents);
+                            ++checked;
+                        },
+                        [&](auto const&) {
+                        }
+                    ),
+                    p
+                );
+            }
+            BOOST_TEST(checked == 2U);
+            if (received.size() == num_of_messages) {
+                c1->disconnect();
+                c2->disconnect();
+            }
+            return true;
+        });
+    c1->set_close_handler(on_close);
+
+    c2->set_v5_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            // The following messages overwrite the receive buffer of the publisher's shard
+            // while the subscriber's shard delivers the previous ones.
+            for (auto const& c : expected) {
+                c2->publish(
+                    std::string("topic1"),
+                    c,
+                    mqtt::qos::at_least_once,
+                    false,
+                    std::vector<mqtt::v5::property_variant> {
+                        mqtt::v5::property::content_type("text/plain"),
+                        mqtt::v5::property::user_property("key", std::string("val") + c)
+                    }
+                );
+            }
+            return true;
+        });
+    c2->set_close_handler(on_close);
+
+    c1->connect();
+    ios.run();
+    BOOST_TEST(received == expected);
+}
+
+BOOST_AUTO_TEST_CASE( shared_subscription_across_shards ) {
+    // c1 and c2 are members of the same shared subscription on different shards.
+    // Each message is delivered to only one of them.
+    boost::asio::io_service ios;
+    sharded_broker sb(2);
+    mqtt::server<> s(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), broker_notls_port),
+        ios
+    );
+    std::vector<std::size_t> selected;
+    s.set_io_service_selector(
+        [&]() -> boost::asio::io_service& {
+            auto& ios_con = sb.next_io_service();
+            for (std::size_t i = 0; i != sb.num_of_shards(); ++i) {
+                if (&ios_con == &sb.io_service(i)) selected.push_back(i);
+            }
+            return ios_con;
+        }
+    );
+    s.set_accept_handler(
+        [&](mqtt::server<>::endpoint_t& ep) {
+            sb.handle_accept(ep);
+        }
+    );
+    s.listen();
+    sb.run();
+
+    auto c1 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    auto c2 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    auto c3 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c1)>::packet_id_t;
+    c1->set_client_id("cid1");
+    c2->set_client_id("cid2");
+    c3->set_client_id("cid3");
+    for (auto const& c : { c1, c2, c3 }) c->set_clean_session(true);
+
+    std::size_t const num_of_messages = 10;
+    std::vector<std::string> received1;
+    std::vector<std::string> received2;
+    std::size_t puback = 0;
+    bool finished = false;
+    std::size_t closed = 0;
+    auto on_close =
+        [&] {
+            if (++closed == 3) s.close();
+        };
+    auto finish =
+        [&] {
+            if (finished || puback != num_of_messages) return;
+            if (received1.size() + received2.size() < num_of_messages) return;
+            finished = true;
+            // Wait for the duplicated deliveries if any.
+            auto tim = std::make_shared<boost::asio::steady_timer>(ios, std::chrono::milliseconds(100));
+            tim->async_wait(
+                [&, tim](boost::system::error_code const&) {
+                    c1->disconnect();
+                    c2->disconnect();
+                    c3->disconnect();
+                });
+        };
+
+    c1->set_v5_connack_handler(
+        [&](bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c1->subscribe("$share/group/topic1", mqtt::qos::at_least_once);
+            return true;
+        });
+    c1->set_v5_suback_handler(
+        [&](packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c2->connect();
+            return true;
+        });
+    c1->set_v5_publish_handler(
+        [&](std::uint8_t /*header*/,
+            mqtt::optional<packet_id_t> /*packet_id*/,
+            std::string /*topic*/,
+            std::string contents,
+            std::vector<mqtt::v5::property_variant> /*props*/) {
+            received1.push_back(contents);
+            finish();
+            return true;
+        });
+    c2->set_v5_connack_handler(
+        [&](bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c2->subscribe("$share/group/topic1", mqtt::qos::at_least_once);
+            return true;
+        });
+    c2->set_v5_suback_handler(
+        [&](packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c3->connect();
+            return true;
+        });
+    c2->set_v5_publish_handler(
+        [&](std::uint8_t /*header*/,
+            mqtt::optional<packet_id_t> /*packet_id*/,
+            std::string /*topic*/,
+            std::string contents,
+            std::vector<mqtt::v5::property_variant> /*props*/) {
+            received2.push_back(contents);
+            finish();
+            return true;
+        });
+    c3->set_v5_connack_handler(
+        [&](bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            for (std::size_t i = 0; i != num_of_messages; ++i) {
+                c3->publish(std::string("topic1"), std::to_string(i), mqtt::qos::at_least_once);
+            }
+            return true;
+        });
+    c3->set_v5_puback_handler(
+        [&](packet_id_t /*packet_id*/, std::uint8_t /*reason_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            ++puback;
+            finish();
+            return true;
+        });
+    for (auto const& c : { c1, c2, c3 }) c->set_close_handler(on_close);
+
+    c1->connect();
+    ios.run();
+    // c1 and c2 are connected to different shards
+    BOOST_TEST(selected.size() >= 2U);
+    BOOST_TEST(selected[0] != selected[1]);
+    // Both shards deliver, and each message is delivered once.
+    BOOST_TEST(!received1.empty());
+    BOOST_TEST(!received2.empty());
+    std::set<std::string> all(received1.begin(), received1.end());
+    all.insert(received2.begin(), received2.end());
+    BOOST_TEST(received1.size() + received2.size() == num_of_messages);
+    BOOST_TEST(all.size() == num_of_messages);
+}
+
+BOOST_AUTO_TEST_CASE( reconnect_to_other_shard ) {
+    // c1 subscribes with clean_session = false, and reconnects to another shard.
+    // The session and the message that is published while c1 is offline are handed over.
+    boost::asio::io_service ios;
+    sharded_broker sb(3);
+    mqtt::server<> s(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), broker_notls_port),
+        ios
+    );
+    std::vector<std::size_t> selected;
+    s.set_io_service_selector(
+        [&]() -> boost::asio::io_service& {
+            auto& ios_con = sb.next_io_service();
+            for (std::size_t i = 0; i != sb.num_of_shards(); ++i) {
+                if (&ios_con == &sb.io_service(i)) selected.push_back(i);
+            }
+            return ios_con;
+        }
+    );
+    s.set_accept_handler(
+        [&](mqtt::server<>::endpoint_t& ep) {
+            sb.handle_accept(ep);
+        }
+    );
+    s.listen();
+    sb.run();
+
+    auto c1 = mqtt::make_client(ios, broker_url, broker_notls_port);
+    auto c2 = mqtt::make_client(ios, broker_url, broker_notls_port);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c1)>::packet_id_t;
+    c1->set_client_id("cid1");
+    c1->set_clean_session(false);
+    c2->set_client_id("cid2");
+    c2->set_clean_session(true);
+
+    checker chk = {
+        cont("start"),
+        // c1 connects, subscribes and disconnects
+        cont("h_connack1_1"),
+        cont("h_suback1"),
+        cont("h_close1_1"),
+        // c2 connects to another shard and publishes
+        cont("h_connack2"),
+        cont("h_puback2"),
+        // c1 reconnects to the third shard
+        cont("h_connack1_2"),
+        cont("h_publish1"),
+    };
+
+    std::size_t closed = 0;
+    auto on_close =
+        [&] {
+            if (++closed == 2) s.close();
+        };
+
+    c1->set_connack_handler(
+        [&chk, &c1, &c2]
+        (bool sp, std::uint8_t connack_return_code) {
+            BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+            auto ret = chk.match(
+                "start",
+                [&] {
+                    MQTT_CHK("h_connack1_1");
+                    BOOST_TEST(sp == false);
+                    c1->subscribe("topic1", mqtt::qos::at_least_once);
+                },
+                "h_puback2",
+                [&] {
+                    MQTT_CHK("h_connack1_2");
+                    BOOST_TEST(sp == true);
+                    if (!sp) {
+                        c1->disconnect();
+                        c2->disconnect();
+                    }
+                }
+            );
+            BOOST_TEST(ret);
+            return true;
+        });
+    c1->set_suback_handler(
+        [&chk, &c1]
+        (packet_id_t /*packet_id*/, std::vector<mqtt::optional<std::uint8_t>> /*results*/) {
+            MQTT_CHK("h_suback1");
+            c1->disconnect();
+            return true;
+        });
+    c1->set_publish_handler(
+        [&chk, &c1, &c2]
+        (std::uint8_t header,
+         mqtt::optional<packet_id_t> /*packet_id*/,
+         std::string topic,
+         std::string contents) {
+            MQTT_CHK("h_publish1");
+            BOOST_TEST(mqtt::publish::get_qos(header) == mqtt::qos::at_least_once);
+            BOOST_TEST(topic == "topic1");
+            BOOST_TEST(contents == "topic1_contents");
+            c1->disconnect();
+            c2->disconnect();
+            return true;
+        });
+    c1->set_close_handler(
+        [&chk, &c2, &on_close]
+        () {
+            auto ret = chk.match(
+                "h_suback1",
+                [&] {
+                    MQTT_CHK("h_close1_1");
+                    c2->connect();
+                },
+                "h_connack1_2",
+                on_close
+            );
+            BOOST_TEST(ret);
+        });
+
+    c2->set_connack_handler(
+        [&chk, &c2]
+        (bool /*sp*/, std::uint8_t connack_return_code) {
+            MQTT_CHK("h_connack2");
+            BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+            c2->publish_at_least_once("topic1", "topic1_contents");
+            return true;
+        });
+    c2->set_puback_handler(
+        [&chk, &c1]
+        (packet_id_t /*packet_id*/) {
+            MQTT_CHK("h_puback2");
+            c1->connect();
+            return true;
+        });
+    c2->set_close_handler(on_close);
+
+    MQTT_CHK("start");
+    c1->connect();
+    ios.run();
+    BOOST_TEST(chk.all());
+    // c1 reconnects to a different shard
+    BOOST_TEST(selected.size() >= 3U);
+    BOOST_TEST(selected[0] != selected[2]);
+}
+
+BOOST_AUTO_TEST_CASE( duplicate_client_id_across_shards ) {
+    // c1 and c2 have the same client id and connect to different shards.
+    // The connection of c1 is closed by the broker when c2 connects.
+    boost::asio::io_service ios;
+    sharded_broker sb(2);
+    mqtt::server<> s(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), broker_notls_port),
+        ios
+    );
+    std::vector<std::size_t> order = { 0, 1 };
+    std::size_t accepted = 0;
+    s.set_io_service_selector(
+        [&]() -> boost::asio::io_service& {
+            return sb.io_service(order[accepted++ % order.size()]);
+        }
+    );
+    s.set_accept_handler(
+        [&](mqtt::server<>::endpoint_t& ep) {
+            sb.handle_accept(ep);
+        }
+    );
+    s.listen();
+    sb.run();
+
+    auto c1 = mqtt::make_client(ios, broker_url, broker_notls_port);
+    auto c2 = mqtt::make_client(ios, broker_url, broker_notls_port);
+    c1->set_client_id("cid1");
+    c1->set_clean_session(true);
+    c2->set_client_id("cid1");
+    c2->set_clean_session(true);
+
+    checker chk = {
+        cont("h_connack1"),
+        cont("h_connack2"),
+        deps("h_close1", "h_connack1"),
+    };
+
+    bool connected2 = false;
+    bool closed1 = false;
+    auto finish =
+        [&] {
+            if (connected2 && closed1) c2->disconnect();
+        };
+
+    c1->set_connack_handler(
+        [&chk, &c2]
+        (bool /*sp*/, std::uint8_t connack_return_code) {
+            MQTT_CHK("h_connack1");
+            BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+            c2->connect();
+            return true;
+        });
+    auto on_close1 =
+        [&] {
+            MQTT_CHK("h_close1");
+            closed1 = true;
+            finish();
+        };
+    c1->set_close_handler(on_close1);
+    c1->set_error_handler(
+        [&]
+        (boost::system::error_code const& /*ec*/) {
+            on_close1();
+        });
+
+    c2->set_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t connack_return_code) {
+            MQTT_CHK("h_connack2");
+            BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+            connected2 = true;
+            finish();
+            return true;
+        });
+    c2->set_close_handler(
+        [&] {
+            s.close();
+        });
+
+    c1->connect();
+    ios.run();
+    BOOST_TEST(chk.all());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
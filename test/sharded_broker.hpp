@@ -0,0 +1,373 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MQTT_TEST_SHARDED_BROKER_HPP)
+#define MQTT_TEST_SHARDED_BROKER_HPP
+
+#include "test_broker.hpp"
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <map>
+#include <algorithm>
+
+#include <boost/lockfree/queue.hpp>
+
+/**
+ * Multi threaded broker.
+ *
+ * Connections are distributed over N shards. Each shard has its own io_service,
+ * thread and test_broker, so the broker state of a shard is only accessed by
+ * the thread of the shard and no global lock is required.
+ *
+ * When a client publishes a message, the shard delivers it to its own subscribers
+ * and pushes it to the lock-free inbound queue of each other shard. The other shard
+ * drains its queue on its own thread and delivers the messages to its subscribers.
+ * Retained messages are replicated to all shards in the same way.
+ *
+ * A shared subscription ($share/{ShareName}/{filter}) can have members on several
+ * shards. The publishing shard chooses one of the shards that have members of the
+ * group, in round robin, and only that shard delivers the message to the group.
+ * The shards that have members of each group are recorded under a mutex.
+ *
+ * Each client id is owned by the shard that the client was connected to last.
+ * When a client connects to another shard, CONNACK is deferred and the owner shard
+ * disconnects the existing connection of the client id, and hands over the saved
+ * session (clean_session = false) to the new shard. The owners are recorded under a mutex.
+ * Limitation: messages that are delivered to the previous owner after the session is
+ * taken out and before the client connects to the new shard are not queued.
+ *
+ * Usage:
+ *   sharded_broker sb(num_of_threads);
+ *   mqtt::server<> s(endpoint, ios_accept);
+ *   s.set_io_service_selector([&]() -> as::io_service& { return sb.next_io_service(); });
+ *   s.set_accept_handler([&](auto& ep) { sb.handle_accept(ep); });
+ *   s.listen();
+ *   sb.run();
+ *   ios_accept.run();
+ */
+class sharded_broker {
+public:
+    explicit sharded_broker(std::size_t num_of_shards) {
+        BOOST_ASSERT(num_of_shards != 0);
+        shards_.reserve(num_of_shards);
+        for (std::size_t i = 0; i != num_of_shards; ++i) {
+            shards_.push_back(std::make_unique<shard>(i));
+        }
+        for (auto& s : shards_) {
+            auto self = s.get();
+            s->broker.set_publish_forward_handler(
+                [this, self]
+                (std::shared_ptr<std::string> const& topic,
+                 std::shared_ptr<std::string> const& contents,
+                 std::uint8_t qos,
+                 bool is_retain,
+                 std::vector<mqtt::v5::property_variant> const& props) {
+                    return forward(*self, topic, contents, qos, is_retain, props);
+                }
+            );
+            s->broker.set_shared_group_handler(
+                [this, self]
+                (std::string const& share_name, std::string const& filter, bool exists) {
+                    update_shared_group(self->index, share_name, filter, exists);
+                }
+            );
+            s->broker.set_connect_handover_handler(
+                [this, self]
+                (std::string const& client_id,
+                 std::function<void(mqtt::optional<test_broker::taken_session>)> resume) {
+                    handover(*self, client_id, std::move(resume));
+                }
+            );
+            s->broker.set_client_released_handler(
+                [this, self]
+                (std::string const& client_id) {
+                    std::lock_guard<std::mutex> lck(clients_mtx_);
+                    auto it = client_shards_.find(client_id);
+                    // The client id may have been taken by another shard already.
+                    if (it != client_shards_.end() && it->second == self->index) client_shards_.erase(it);
+                }
+            );
+        }
+    }
+
+    ~sharded_broker() {
+        stop();
+        join();
+    }
+
+    sharded_broker(sharded_broker const&) = delete;
+    sharded_broker(sharded_broker&&) = delete;
+    sharded_broker& operator=(sharded_broker const&) = delete;
+    sharded_broker& operator=(sharded_broker&&) = delete;
+
+    /**
+     * @brief Start the threads of the shards.
+     */
+    void run() {
+        for (auto& s : shards_) {
+            auto p = s.get();
+            s->thread = std::thread([p] { p->ios.run(); });
+        }
+    }
+
+    /**
+     * @brief Stop the io_services of the shards.
+     */
+    void stop() {
+        for (auto& s : shards_) {
+            s->work.reset();
+            s->ios.stop();
+        }
+    }
+
+    /**
+     * @brief Wait for the threads of the shards.
+     */
+    void join() {
+        for (auto& s : shards_) {
+            if (s->thread.joinable()) s->thread.join();
+        }
+    }
+
+    /**
+     * @brief Select the shard of the next accepted connection.
+     *        Pass it to mqtt::server::set_io_service_selector().
+     *        It must be called on the accepting thread.
+     * @return io_service of the selected shard
+     */
+    as::io_service& next_io_service() {
+        next_ = (next_ + 1) % shards_.size();
+        return shards_[next_]->ios;
+    }
+
+    /**
+     * @brief Pass the accepted endpoint to the shard that runs its io_service.
+     *        Call this function from the accept handler of mqtt::server.
+     * @param ep accepted endpoint
+     */
+    template <typename Endpoint>
+    void handle_accept(Endpoint& ep) {
+#if BOOST_VERSION < 107000
+        auto& ios = ep.socket()->get_io_service();
+#else  // BOOST_VERSION < 107000
+        auto& ios = ep.socket()->lowest_layer().get_executor().context();
+#endif // BOOST_VERSION < 107000
+        auto it = std::find_if(
+            shards_.begin(),
+            shards_.end(),
+            [&](std::unique_ptr<shard> const& s) { return &s->ios == &ios; }
+        );
+        BOOST_ASSERT(it != shards_.end());
+        auto& s = **it;
+        s.ios.post(
+            [&s, sp = ep.shared_from_this()] {
+                s.broker.handle_accept(*sp);
+            }
+        );
+    }
+
+    std::size_t num_of_shards() const {
+        return shards_.size();
+    }
+
+    test_broker& broker(std::size_t index) {
+        return shards_[index]->broker;
+    }
+
+    as::io_service& io_service(std::size_t index) {
+        return shards_[index]->ios;
+    }
+
+private:
+    // The shared subscriptions that a shard delivers a message to. The pair is (share_name, filter).
+    using shared_targets_t = std::set<std::pair<std::string, std::string>>;
+
+    struct forwarded_message {
+        std::shared_ptr<std::string> topic;
+        std::shared_ptr<std::string> contents;
+        std::uint8_t qos;
+        bool is_retain;
+        std::vector<mqtt::v5::property_variant> props;
+        // Indexed by the shard
+        std::vector<shared_targets_t> shared_targets;
+    };
+
+    // The shards that have members of a shared subscription
+    struct shared_group_shards {
+        shared_group_shards(std::string filter, std::size_t num_of_shards)
+            :filter(std::move(filter)), exists(num_of_shards, false) {}
+        std::string filter;
+        std::vector<bool> exists;
+        // The shard that is checked first by the next message
+        std::size_t next = 0;
+    };
+
+    struct shard {
+        explicit shard(std::size_t index)
+            :index(index),
+             work(std::make_unique<as::io_service::work>(ios)),
+             broker(ios),
+             inbound(128)
+        {}
+        ~shard() {
+            std::shared_ptr<forwarded_message>* p;
+            while (inbound.pop(p)) delete p;
+        }
+        std::size_t index;
+        as::io_service ios;
+        std::unique_ptr<as::io_service::work> work;
+        test_broker broker;
+        // Messages from other shards. Multiple producers, single consumer.
+        boost::lockfree::queue<std::shared_ptr<forwarded_message>*> inbound;
+        std::atomic<bool> drain_scheduled{false};
+        std::thread thread;
+    };
+
+    // Called on the thread of the shard
+    void update_shared_group(std::size_t index, std::string const& share_name, std::string const& filter, bool exists) {
+        std::lock_guard<std::mutex> lck(shared_mtx_);
+        auto groups = shared_groups_.find_filter(filter);
+        std::shared_ptr<shared_group_shards> g;
+        if (groups) {
+            auto it = groups->find(share_name);
+            if (it != groups->end()) g = it->second;
+        }
+        if (!g) {
+            if (!exists) return;
+            g = std::make_shared<shared_group_shards>(filter, shards_.size());
+            shared_groups_.insert_or_assign(filter, share_name, g);
+        }
+        g->exists[index] = exists;
+        if (std::none_of(g->exists.begin(), g->exists.end(), [](bool e) { return e; })) {
+            shared_groups_.erase(filter, share_name);
+        }
+    }
+
+    // Choose the shard that delivers the message to each shared subscription that matches the topic.
+    // Called on the thread of the publishing shard.
+    std::vector<shared_targets_t> choose_shared_targets(std::string const& topic) {
+        std::vector<shared_targets_t> targets(shards_.size());
+        std::lock_guard<std::mutex> lck(shared_mtx_);
+        shared_groups_.match(
+            topic,
+            [&](std::string const& share_name, std::shared_ptr<shared_group_shards> const& g) {
+                for (std::size_t n = 0; n != shards_.size(); ++n) {
+                    auto index = (g->next + n) % shards_.size();
+                    if (!g->exists[index]) continue;
+                    targets[index].emplace(share_name, g->filter);
+                    g->next = index + 1;
+                    break;
+                }
+            }
+        );
+        return targets;
+    }
+
+    static test_broker::shared_dispatch_filter make_shared_filter(shared_targets_t const& targets) {
+        return
+            [&targets](std::string const& share_name, std::string const& filter) {
+                return targets.count(std::make_pair(share_name, filter)) != 0;
+            };
+    }
+
+    // Called on the thread of from
+    test_broker::shared_dispatch_filter forward(
+        shard& from,
+        std::shared_ptr<std::string> const& topic,
+        std::shared_ptr<std::string> const& contents,
+        std::uint8_t qos,
+        bool is_retain,
+        std::vector<mqtt::v5::property_variant> const& props) {
+        if (shards_.size() == 1) return test_broker::shared_dispatch_filter();
+        // The message is shared by all destination shards.
+        // The properties are copied from the receive buffer, because it is reused
+        // after the publish handler returns, while the other shards deliver them
+        // on their own threads.
+        auto msg = std::make_shared<forwarded_message>(
+            forwarded_message {
+                topic, contents, qos, is_retain, test_broker::owning_props(props), choose_shared_targets(*topic)
+            }
+        );
+        for (auto& s : shards_) {
+            if (s.get() == &from) continue;
+            s->inbound.push(new std::shared_ptr<forwarded_message>(msg));
+            // Only one drain job is posted until the shard starts draining.
+            if (!s->drain_scheduled.exchange(true)) {
+                auto p = s.get();
+                s->ios.post([p] { drain(*p); });
+            }
+        }
+        // The publishing shard delivers the message to the shared subscriptions chosen for it.
+        return
+            [msg, index = from.index](std::string const& share_name, std::string const& filter) {
+                return msg->shared_targets[index].count(std::make_pair(share_name, filter)) != 0;
+            };
+    }
+
+    // Called on the thread of to
+    void handover(
+        shard& to,
+        std::string const& client_id,
+        std::function<void(mqtt::optional<test_broker::taken_session>)> resume) {
+        std::size_t prev;
+        {
+            std::lock_guard<std::mutex> lck(clients_mtx_);
+            auto ret = client_shards_.emplace(client_id, to.index);
+            if (ret.second) {
+                prev = to.index;
+            }
+            else {
+                prev = ret.first->second;
+                ret.first->second = to.index;
+            }
+        }
+        if (prev == to.index) {
+            resume(mqtt::nullopt);
+            return;
+        }
+        // The previous owner disconnects the existing connection and gives the session back to the new owner.
+        auto& from = *shards_[prev];
+        from.ios.post(
+            [&from, &to, client_id, resume = std::move(resume)]() mutable {
+                auto taken = from.broker.take_client(client_id);
+                to.ios.post(
+                    [taken = std::move(taken), resume = std::move(resume)]() mutable {
+                        resume(std::move(taken));
+                    }
+                );
+            }
+        );
+    }
+
+    // Called on the thread of s
+    static void drain(shard& s) {
+        // Clear the flag first. Messages pushed after this point schedule a new drain job.
+        s.drain_scheduled = false;
+        std::shared_ptr<forwarded_message>* p;
+        while (s.inbound.pop(p)) {
+            std::unique_ptr<std::shared_ptr<forwarded_message>> guard(p);
+            auto const& m = **p;
+            s.broker.deliver_publish(
+                m.topic, m.contents, m.qos, m.is_retain, m.props, make_shared_filter(m.shared_targets[s.index])
+            );
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<shard>> shards_;
+    std::size_t next_ = 0;
+    std::mutex shared_mtx_;
+    mqtt::subscription_map<std::string, std::shared_ptr<shared_group_shards>> shared_groups_; ///< The key is the share name.
+    std::mutex clients_mtx_;
+    std::map<std::string, std::size_t> client_shards_; ///< The shard that owns the client id
+};
+
+#endif // MQTT_TEST_SHARDED_BROKER_HPP
@@ -0,0 +1,130 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+
+#include <mqtt/message.hpp>
+#include <mqtt/v5_message.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_shared_publish)
+
+namespace {
+
+template <typename Message>
+std::string concat(Message const& msg) {
+    std::string ret;
+    auto cbs = msg.const_buffer_sequence();
+    BOOST_TEST(cbs.size() == msg.num_of_const_buffer_sequence());
+    for (auto const& cb : cbs) {
+        ret.append(mqtt::get_pointer(cb), mqtt::get_size(cb));
+    }
+    return ret;
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( v3_1_1 ) {
+    std::string topic = "topic1";
+    std::string contents(1000, 'x');
+    auto body = mqtt::make_shared_publish(
+        boost::asio::buffer(topic),
+        boost::asio::buffer(contents),
+        mqtt::any()
+    );
+
+    for (auto qos : { mqtt::qos::at_most_once, mqtt::qos::at_least_once, mqtt::qos::exactly_once }) {
+        std::uint16_t packet_id = qos == mqtt::qos::at_most_once ? 0 : 0x1234;
+        mqtt::v3_1_1::publish_message expected(
+            boost::asio::buffer(topic), qos, true, false, packet_id, boost::asio::buffer(contents)
+        );
+        mqtt::v3_1_1::publish_message shared(*body, qos, true, false, packet_id);
+        BOOST_TEST(shared.continuous_buffer() == expected.continuous_buffer());
+        BOOST_TEST(concat(shared) == expected.continuous_buffer());
+        BOOST_TEST(shared.size() == expected.size());
+        if (qos != mqtt::qos::at_most_once) {
+            BOOST_TEST(shared.packet_id() == packet_id);
+        }
+        shared.set_dup(true);
+        BOOST_TEST(shared.is_dup());
+    }
+}
+
+BOOST_AUTO_TEST_CASE( v5 ) {
+    std::string topic = "topic1";
+    std::string contents(200, 'x');
+    std::vector<mqtt::v5::property_variant> props {
+        mqtt::v5::property::payload_format_indicator(mqtt::v5::property::payload_format_indicator::string),
+        mqtt::v5::property::message_expiry_interval(0x12345678UL),
+        mqtt::v5::property::content_type("content type"),
+        mqtt::v5::property::user_property("key1", "val1"),
+    };
+    auto body = mqtt::make_shared_publish(
+        boost::asio::buffer(topic),
+        boost::asio::buffer(contents),
+        mqtt::any(),
+        props
+    );
+
+    for (auto qos : { mqtt::qos::at_most_once, mqtt::qos::at_least_once }) {
+        std::uint16_t packet_id = qos == mqtt::qos::at_most_once ? 0 : 0x1234;
+        mqtt::v5::publish_message expected(
+            boost::asio::buffer(topic), qos, false, false, packet_id, props, boost::asio::buffer(contents)
+        );
+        mqtt::v5::publish_message shared(*body, qos, false, false, packet_id);
+        BOOST_TEST(shared.continuous_buffer() == expected.continuous_buffer());
+        BOOST_TEST(concat(shared) == expected.continuous_buffer());
+
+        // The encoded message can be parsed again
+        auto buf = shared.continuous_buffer();
+        mqtt::v5::publish_message parsed(buf.begin(), buf.end());
+        BOOST_TEST(parsed.qos() == qos);
+        BOOST_TEST(mqtt::get_size(parsed.payload()) == contents.size());
+    }
+
+    // Without properties
+    auto body_no_props = mqtt::make_shared_publish(
+        boost::asio::buffer(topic),
+        boost::asio::buffer(contents),
+        mqtt::any()
+    );
+    mqtt::v5::publish_message expected(
+        boost::asio::buffer(topic), mqtt::qos::at_most_once, false, false, 0, {}, boost::asio::buffer(contents)
+    );
+    mqtt::v5::publish_message shared(*body_no_props, mqtt::qos::at_most_once, false, false, 0);
+    BOOST_TEST(shared.continuous_buffer() == expected.continuous_buffer());
+    BOOST_TEST(concat(shared) == expected.continuous_buffer());
+}
+
+BOOST_AUTO_TEST_CASE( life_keeper ) {
+    auto topic = std::make_shared<std::string>("topic1");
+    auto contents = std::make_shared<std::string>("contents");
+    std::weak_ptr<std::string> wp = contents;
+    auto body = mqtt::make_shared_publish(
+        boost::asio::buffer(*topic),
+        boost::asio::buffer(*contents),
+        std::make_pair(topic, contents)
+    );
+    topic.reset();
+    contents.reset();
+    BOOST_TEST(!wp.expired());
+    body.reset();
+    BOOST_TEST(wp.expired());
+}
+
+BOOST_AUTO_TEST_CASE( invalid_topic ) {
+    std::string topic("a\0b", 3);
+    std::string contents = "contents";
+    BOOST_CHECK_THROW(
+        mqtt::make_shared_publish(
+            boost::asio::buffer(topic),
+            boost::asio::buffer(contents),
+            mqtt::any()
+        ),
+        mqtt::utf8string_contents_error
+    );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,559 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+#include "test_settings.hpp"
+#include "test_broker.hpp"
+#include "test_server_no_tls.hpp"
+
+#include <mqtt/client.hpp>
+#include <mqtt/shared_subscription.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_shared_subscription)
+
+namespace {
+
+using group_t = mqtt::shared_subscription_group<std::string, std::uint8_t>;
+
+std::string select(group_t& g, mqtt::string_view topic = "topic", bool counted = true) {
+    auto m = g.select(topic, counted);
+    if (!m) return std::string();
+    return m->key;
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( parse ) {
+    auto r = mqtt::parse_shared_subscription("$share/group/a/+/c");
+    BOOST_TEST(r.has_value());
+    if (r) {
+        BOOST_TEST(r->first == "group");
+        BOOST_TEST(r->second == "a/+/c");
+    }
+    BOOST_TEST(mqtt::parse_shared_subscription("$share/g/#").has_value());
+    BOOST_TEST(!mqtt::parse_shared_subscription("a/b").has_value());
+    BOOST_TEST(!mqtt::parse_shared_subscription("$share/group").has_value());
+    BOOST_TEST(!mqtt::parse_shared_subscription("$share//a").has_value());
+    BOOST_TEST(!mqtt::parse_shared_subscription("$share/g+/a").has_value());
+    BOOST_TEST(!mqtt::parse_shared_subscription("$share/g/").has_value());
+    BOOST_TEST(!mqtt::parse_shared_subscription("$share/g/a#").has_value());
+}
+
+BOOST_AUTO_TEST_CASE( round_robin ) {
+    group_t g(mqtt::shared_subscription_strategy::round_robin);
+    BOOST_TEST(select(g).empty());
+    BOOST_TEST(g.insert_or_assign("a", 1, 10));
+    BOOST_TEST(g.insert_or_assign("b", 1, 10));
+    BOOST_TEST(g.insert_or_assign("c", 1, 10));
+    BOOST_TEST(!g.insert_or_assign("c", 2, 10));
+    BOOST_TEST(g.size() == 3U);
+    BOOST_TEST(select(g) == "a");
+    BOOST_TEST(select(g) == "b");
+    BOOST_TEST(select(g) == "c");
+    BOOST_TEST(select(g) == "a");
+    // The turn of "b" is kept when "a" leaves.
+    BOOST_TEST(g.erase("a"));
+    BOOST_TEST(!g.erase("a"));
+    BOOST_TEST(select(g) == "b");
+    BOOST_TEST(select(g) == "c");
+    BOOST_TEST(g.get("b")->inflight == 2U);
+    BOOST_TEST(g.get("c")->value == 2U);
+}
+
+BOOST_AUTO_TEST_CASE( window ) {
+    group_t g(mqtt::shared_subscription_strategy::round_robin);
+    g.insert_or_assign("a", 1, 1);
+    g.insert_or_assign("b", 1, 2);
+    BOOST_TEST(select(g) == "a");
+    BOOST_TEST(select(g) == "b");
+    BOOST_TEST(select(g) == "b");
+    // All the members are full.
+    BOOST_TEST(select(g).empty());
+    // The messages that are not counted are not limited.
+    BOOST_TEST(select(g, "topic", false) == "a");
+    BOOST_TEST(g.release("a"));
+    BOOST_TEST(!g.release("a"));
+    BOOST_TEST(select(g) == "a");
+    BOOST_TEST(select(g).empty());
+}
+
+BOOST_AUTO_TEST_CASE( least_inflight ) {
+    group_t g(mqtt::shared_subscription_strategy::least_inflight);
+    g.insert_or_assign("a", 1, 10);
+    g.insert_or_assign("b", 1, 10);
+    g.insert_or_assign("c", 1, 10);
+    BOOST_TEST(select(g) == "a");
+    BOOST_TEST(select(g) == "b");
+    BOOST_TEST(select(g) == "c");
+    g.release("b");
+    BOOST_TEST(select(g) == "b");
+    g.release("c");
+    g.release("a");
+    // Ties are taken in turns.
+    BOOST_TEST(select(g) == "c");
+    BOOST_TEST(select(g) == "a");
+}
+
+BOOST_AUTO_TEST_CASE( hash_topic ) {
+    group_t g(mqtt::shared_subscription_strategy::hash_topic);
+    g.insert_or_assign("a", 1, 100);
+    g.insert_or_assign("b", 1, 100);
+    g.insert_or_assign("c", 1, 100);
+    std::set<std::string> chosen;
+    for (int i = 0; i != 20; ++i) {
+        auto topic = "topic" + std::to_string(i);
+        auto m = select(g, topic);
+        // The same topic goes to the same member.
+        BOOST_TEST(select(g, topic) == m);
+        chosen.insert(m);
+    }
+    BOOST_TEST(chosen.size() > 1U);
+
+    // If the member is full, the next one is taken.
+    group_t g1(mqtt::shared_subscription_strategy::hash_topic);
+    g1.insert_or_assign("a", 1, 1);
+    g1.insert_or_assign("b", 1, 1);
+    auto first = select(g1, "x");
+    auto second = select(g1, "x");
+    BOOST_TEST(!second.empty());
+    BOOST_TEST(first != second);
+    BOOST_TEST(select(g1, "x").empty());
+}
+
+BOOST_AUTO_TEST_CASE( broker_round_robin ) {
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    test_server_no_tls s(ios, b);
+
+    auto c1 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    auto c2 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    auto c3 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c1)>::packet_id_t;
+    c1->set_client_id("cid1");
+    c2->set_client_id("cid2");
+    c3->set_client_id("cid3");
+    for (auto const& c : { c1, c2, c3 }) c->set_clean_session(true);
+
+    std::vector<std::string> received1;
+    std::vector<std::string> received2;
+    std::size_t closed = 0;
+    auto on_close =
+        [&] {
+            if (++closed == 3) s.close();
+        };
+    auto on_received =
+        [&] {
+            if (received1.size() + received2.size() != 4) return;
+            // Disconnect after PUBACK is sent. The unacknowledged messages are
+            // delivered to the other member when the connection is closed.
+            ios.post(
+                [&] {
+                    c1->disconnect();
+                    c2->disconnect();
+                    c3->disconnect();
+                });
+        };
+
+    c1->set_v5_connack_handler(
+        [&](bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c1->subscribe("$share/group/topic1", mqtt::qos::at_least_once);
+            return true;
+        });
+    c1->set_v5_suback_handler(
+        [&](packet_id_t /*packet_id*/, std::vector<std::uint8_t> reasons, std::vector<mqtt::v5::property_variant> /*props*/) {
+            BOOST_TEST(reasons.size() == 1U);
+            BOOST_TEST(reasons.front() == mqtt::qos::at_least_once);
+            c2->connect();
+            return true;
+        });
+    c1->set_v5_publish_handler(
+        [&](std::uint8_t /*header*/,
+            mqtt::optional<packet_id_t> /*packet_id*/,
+            std::string topic,
+            std::string contents,
+            std::vector<mqtt::v5::property_variant> /*props*/) {
+            BOOST_TEST(topic == "topic1");
+            received1.push_back(contents);
+            on_received();
+            return true;
+        });
+    c2->set_v5_connack_handler(
+        [&](bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c2->subscribe("$share/group/topic1", mqtt::qos::at_least_once);
+            return true;
+        });
+    c2->set_v5_suback_handler(
+        [&](packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c3->connect();
+            return true;
+        });
+    c2->set_v5_publish_handler(
+        [&](std::uint8_t /*header*/,
+            mqtt::optional<packet_id_t> /*packet_id*/,
+            std::string /*topic*/,
+            std::string contents,
+            std::vector<mqtt::v5::property_variant> /*props*/) {
+            received2.push_back(contents);
+            on_received();
+            return true;
+        });
+    c3->set_v5_connack_handler(
+        [&](bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            for (auto const& c : { "1", "2", "3", "4" }) {
+                c3->publish(std::string("topic1"), std::string(c), mqtt::qos::at_least_once);
+            }
+            return true;
+        });
+    for (auto const& c : { c1, c2, c3 }) {
+        c->set_close_handler(on_close);
+        c->set_error_handler(
+            [&](boost::system::error_code const&) {
+                BOOST_CHECK(false);
+                on_close();
+            });
+    }
+
+    c1->connect();
+    ios.run();
+    BOOST_TEST(received1 == (std::vector<std::string>{ "1", "3" }));
+    BOOST_TEST(received2 == (std::vector<std::string>{ "2", "4" }));
+}
+
+BOOST_AUTO_TEST_CASE( broker_redistribute ) {
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    b.set_shared_subscription_window(1);
+    test_server_no_tls s(ios, b);
+
+    auto c1 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    auto c2 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    auto c3 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c1)>::packet_id_t;
+    c1->set_client_id("cid1");
+    c2->set_client_id("cid2");
+    c3->set_client_id("cid3");
+    for (auto const& c : { c1, c2, c3 }) c->set_clean_session(true);
+    // c1 doesn't acknowledge the message, and its connection is closed.
+    c1->set_auto_pub_response(false);
+
+    std::vector<std::string> received1;
+    std::set<std::string> received2;
+    std::size_t closed = 0;
+    auto on_close =
+        [&] {
+            if (++closed == 2) s.close();
+        };
+
+    c1->set_v5_connack_handler(
+        [&](bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c1->subscribe("$share/group/topic1", mqtt::qos::at_least_once);
+            return true;
+        });
+    c1->set_v5_suback_handler(
+        [&](packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c2->connect();
+            return true;
+        });
+    c1->set_v5_publish_handler(
+        [&](std::uint8_t /*header*/,
+            mqtt::optional<packet_id_t> /*packet_id*/,
+            std::string /*topic*/,
+            std::string contents,
+            std::vector<mqtt::v5::property_variant> /*props*/) {
+            received1.push_back(contents);
+            c1->force_disconnect();
+            return true;
+        });
+    c2->set_v5_connack_handler(
+        [&](bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c2->subscribe("$share/group/topic1", mqtt::qos::at_least_once);
+            return true;
+        });
+    c2->set_v5_suback_handler(
+        [&](packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c3->connect();
+            return true;
+        });
+    c2->set_v5_publish_handler(
+        [&](std::uint8_t /*header*/,
+            mqtt::optional<packet_id_t> /*packet_id*/,
+            std::string /*topic*/,
+            std::string contents,
+            std::vector<mqtt::v5::property_variant> /*props*/) {
+            BOOST_TEST(received2.insert(contents).second);
+            if (received2.size() == 3) {
+                ios.post(
+                    [&] {
+                        c2->disconnect();
+                        c3->disconnect();
+                    });
+            }
+            return true;
+        });
+    c3->set_v5_connack_handler(
+        [&](bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            for (auto const& c : { "1", "2", "3" }) {
+                c3->publish(std::string("topic1"), std::string(c), mqtt::qos::at_least_once);
+            }
+            return true;
+        });
+    for (auto const& c : { c2, c3 }) {
+        c->set_close_handler(on_close);
+        c->set_error_handler(
+            [&](boost::system::error_code const&) {
+                BOOST_CHECK(false);
+                on_close();
+            });
+    }
+
+    c1->connect();
+    ios.run();
+    BOOST_TEST(received1 == (std::vector<std::string>{ "1" }));
+    BOOST_TEST(received2 == (std::set<std::string>{ "1", "2", "3" }));
+}
+
+BOOST_AUTO_TEST_CASE( broker_will ) {
+    // The will of c1 matches the shared subscription of c1 and c2.
+    // c1 leaves the group before the will is published, so c2 receives it.
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    test_server_no_tls s(ios, b);
+
+    auto c1 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    auto c2 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c1)>::packet_id_t;
+    c1->set_client_id("cid1");
+    c2->set_client_id("cid2");
+    for (auto const& c : { c1, c2 }) c->set_clean_session(true);
+    c1->set_will(mqtt::will("topic1", "will_contents"));
+
+    std::vector<std::string> received1;
+    std::vector<std::string> received2;
+    bool closed = false;
+
+    c1->set_v5_connack_handler(
+        [&](bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c1->subscribe("$share/group/topic1", mqtt::qos::at_most_once);
+            return true;
+        });
+    c1->set_v5_suback_handler(
+        [&](packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c2->connect();
+            return true;
+        });
+    c1->set_v5_publish_handler(
+        [&](std::uint8_t /*header*/,
+            mqtt::optional<packet_id_t> /*packet_id*/,
+            std::string /*topic*/,
+            std::string contents,
+            std::vector<mqtt::v5::property_variant> /*props*/) {
+            received1.push_back(contents);
+            return true;
+        });
+    c2->set_v5_connack_handler(
+        [&](bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c2->subscribe("$share/group/topic1", mqtt::qos::at_most_once);
+            return true;
+        });
+    c2->set_v5_suback_handler(
+        [&](packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            // c1 is the next member of the round robin.
+            c1->force_disconnect();
+            return true;
+        });
+    c2->set_v5_publish_handler(
+        [&](std::uint8_t /*header*/,
+            mqtt::optional<packet_id_t> /*packet_id*/,
+            std::string /*topic*/,
+            std::string contents,
+            std::vector<mqtt::v5::property_variant> /*props*/) {
+            received2.push_back(contents);
+            c2->disconnect();
+            return true;
+        });
+    c2->set_close_handler(
+        [&] {
+            closed = true;
+            s.close();
+        });
+    c2->set_error_handler(
+        [&](boost::system::error_code const&) {
+            BOOST_CHECK(false);
+            s.close();
+        });
+
+    c1->connect();
+    ios.run();
+    BOOST_TEST(closed);
+    BOOST_TEST(received1.empty());
+    BOOST_TEST(received2 == (std::vector<std::string>{ "will_contents" }));
+}
+
+BOOST_AUTO_TEST_CASE( broker_pending_props ) {
+    // The second message waits in pending until c1 acknowledges the first one.
+    // Its properties are kept after the receive buffer of c2 is reused.
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    b.set_shared_subscription_window(1);
+    test_server_no_tls s(ios, b);
+
+    auto c1 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    auto c2 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c1)>::packet_id_t;
+    c1->set_client_id("cid1");
+    c2->set_client_id("cid2");
+    for (auto const& c : { c1, c2 }) c->set_clean_session(true);
+
+    std::vector<std::string> received;
+    std::vector<std::string> user_props;
+    std::size_t closed = 0;
+    auto on_close =
+        [&] {
+            if (++closed == 2) s.close();
+        };
+
+    c1->set_v5_connack_handler(
+        [&](bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c1->subscribe("$share/group/topic1", mqtt::qos::at_least_once);
+            return true;
+        });
+    c1->set_v5_suback_handler(
+        [&](packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c2->connect();
+            return true;
+        });
+    c1->set_v5_publish_handler(
+        [&](std::uint8_t /*header*/,
+            mqtt::optional<packet_id_t> /*packet_id*/,
+            std::string /*topic*/,
+            std::string contents,
+            std::vector<mqtt::v5::property_variant> props) {
+            received.push_back(contents);
+            for (auto const& p : props) {
+                mqtt::visit(
+                    mqtt::make_lambda_visitor<void>(
+                        [&](mqtt::v5::property::user_property::recv const& t) {
+                            user_props.push_back(std::string(t.key()) + "=" + std::string(t.val()));
+                        },
+                        [&](auto const&) {
+                        }
+                    ),
+                    p
+                );
+            }
+            if (received.size() == 2) {
+                ios.post(
+                    [&] {
+                        c1->disconnect();
+                        c2->disconnect();
+                    });
+            }
+            return true;
+        });
+    c2->set_v5_connack_handler(
+        [&](bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c2->publish(
+                std::string("topic1"), std::string("1"), mqtt::qos::at_least_once, false,
+                std::vector<mqtt::v5::property_variant> { mqtt::v5::property::user_property("key", "val1") });
+            c2->publish(
+                std::string("topic1"), std::string("2"), mqtt::qos::at_least_once, false,
+                std::vector<mqtt::v5::property_variant> { mqtt::v5::property::user_property("key", "val2") });
+            // Overwrites the receive buffer of the broker.
+            c2->publish(
+                std::string("topic2"), std::string("3"), mqtt::qos::at_least_once, false,
+                std::vector<mqtt::v5::property_variant> { mqtt::v5::property::user_property("xxx", "yyyy") });
+            return true;
+        });
+    for (auto const& c : { c1, c2 }) {
+        c->set_close_handler(on_close);
+        c->set_error_handler(
+            [&](boost::system::error_code const&) {
+                BOOST_CHECK(false);
+                on_close();
+            });
+    }
+
+    c1->connect();
+    ios.run();
+    BOOST_TEST(received == (std::vector<std::string>{ "1", "2" }));
+    BOOST_TEST(user_props == (std::vector<std::string>{ "key=val1", "key=val2" }));
+}
+
+BOOST_AUTO_TEST_CASE( broker_maximum_packet_size ) {
+    // c1 accepts packets up to 64 bytes. The large message is discarded,
+    // and the window of c1 is released for the next message.
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    b.set_shared_subscription_window(1);
+    test_server_no_tls s(ios, b);
+
+    auto c1 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    auto c2 = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c1)>::packet_id_t;
+    c1->set_client_id("cid1");
+    c2->set_client_id("cid2");
+    for (auto const& c : { c1, c2 }) c->set_clean_session(true);
+
+    std::vector<std::string> received;
+    std::size_t closed = 0;
+    auto on_close =
+        [&] {
+            if (++closed == 2) s.close();
+        };
+
+    c1->set_v5_connack_handler(
+        [&](bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c1->subscribe("$share/group/topic1", mqtt::qos::at_least_once);
+            return true;
+        });
+    c1->set_v5_suback_handler(
+        [&](packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c2->connect();
+            return true;
+        });
+    c1->set_v5_publish_handler(
+        [&](std::uint8_t /*header*/,
+            mqtt::optional<packet_id_t> /*packet_id*/,
+            std::string /*topic*/,
+            std::string contents,
+            std::vector<mqtt::v5::property_variant> /*props*/) {
+            received.push_back(contents);
+            if (received.size() == 2) {
+                ios.post(
+                    [&] {
+                        c1->disconnect();
+                        c2->disconnect();
+                    });
+            }
+            return true;
+        });
+    c2->set_v5_connack_handler(
+        [&](bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            c2->publish(std::string("topic1"), std::string(64, 'a'), mqtt::qos::at_least_once);
+            c2->publish(std::string("topic1"), std::string("1"), mqtt::qos::at_least_once);
+            c2->publish(std::string("topic1"), std::string("2"), mqtt::qos::at_least_once);
+            return true;
+        });
+    for (auto const& c : { c1, c2 }) {
+        c->set_close_handler(on_close);
+        c->set_error_handler(
+            [&](boost::system::error_code const&) {
+                BOOST_CHECK(false);
+                on_close();
+            });
+    }
+
+    c1->connect(
+        std::vector<mqtt::v5::property_variant> {
+            mqtt::v5::property::maximum_packet_size(64)
+        }
+    );
+    ios.run();
+    BOOST_TEST(closed == 2U);
+    BOOST_TEST(received == (std::vector<std::string>{ "1", "2" }));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
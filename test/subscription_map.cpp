@@ -0,0 +1,267 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+#include "combi_test.hpp"
+#include "checker.hpp"
+
+#include <mqtt/subscription_map.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_subscription_map)
+
+namespace {
+
+using map_t = mqtt::subscription_map<std::string, std::uint8_t>;
+
+std::vector<std::string> match(map_t const& m, mqtt::string_view topic) {
+    std::vector<std::string> ret;
+    m.match(
+        topic,
+        [&](std::string const& key, std::uint8_t) {
+            ret.push_back(key);
+        }
+    );
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( validate ) {
+    BOOST_TEST(mqtt::validate_topic_filter("a/b/c"));
+    BOOST_TEST(mqtt::validate_topic_filter("+"));
+    BOOST_TEST(mqtt::validate_topic_filter("#"));
+    BOOST_TEST(mqtt::validate_topic_filter("+/+"));
+    BOOST_TEST(mqtt::validate_topic_filter("a/+/c/#"));
+    BOOST_TEST(mqtt::validate_topic_filter("/"));
+    BOOST_TEST(!mqtt::validate_topic_filter(""));
+    BOOST_TEST(!mqtt::validate_topic_filter("a+"));
+    BOOST_TEST(!mqtt::validate_topic_filter("a/b+/c"));
+    BOOST_TEST(!mqtt::validate_topic_filter("a/#/c"));
+    BOOST_TEST(!mqtt::validate_topic_filter("a#"));
+
+    BOOST_TEST(mqtt::validate_topic_name("a/b/c"));
+    BOOST_TEST(!mqtt::validate_topic_name("a/+"));
+    BOOST_TEST(!mqtt::validate_topic_name("a/#"));
+    BOOST_TEST(!mqtt::validate_topic_name(""));
+}
+
+BOOST_AUTO_TEST_CASE( wildcard ) {
+    map_t m;
+    m.insert_or_assign("a/b/c", "exact", 0);
+    m.insert_or_assign("a/+/c", "plus", 0);
+    m.insert_or_assign("a/#", "hash", 0);
+    m.insert_or_assign("#", "all", 0);
+    m.insert_or_assign("+/+", "two_levels", 0);
+    m.insert_or_assign("a/b/c/#", "under_abc", 0);
+    BOOST_TEST(m.size() == 6U);
+
+    BOOST_TEST(match(m, "a/b/c") == (std::vector<std::string>{ "all", "exact", "hash", "plus", "under_abc" }));
+    BOOST_TEST(match(m, "a/x/c") == (std::vector<std::string>{ "all", "hash", "plus" }));
+    BOOST_TEST(match(m, "a/b") == (std::vector<std::string>{ "all", "hash", "two_levels" }));
+    // "a/#" matches the parent level "a"
+    BOOST_TEST(match(m, "a") == (std::vector<std::string>{ "all", "hash" }));
+    BOOST_TEST(match(m, "b/c/d") == (std::vector<std::string>{ "all" }));
+    // empty levels
+    BOOST_TEST(match(m, "a//c") == (std::vector<std::string>{ "all", "hash", "plus" }));
+    BOOST_TEST(match(m, "/") == (std::vector<std::string>{ "all", "two_levels" }));
+}
+
+BOOST_AUTO_TEST_CASE( dollar ) {
+    map_t m;
+    m.insert_or_assign("#", "all", 0);
+    m.insert_or_assign("+/monitor/Clients", "plus", 0);
+    m.insert_or_assign("$SYS/#", "sys", 0);
+    m.insert_or_assign("$SYS/monitor/+", "sys_monitor", 0);
+
+    // Wildcards at the first level don't match topics that start with '$'.
+    BOOST_TEST(match(m, "$SYS/monitor/Clients") == (std::vector<std::string>{ "sys", "sys_monitor" }));
+    BOOST_TEST(match(m, "SYS/monitor/Clients") == (std::vector<std::string>{ "all", "plus" }));
+}
+
+BOOST_AUTO_TEST_CASE( overlap ) {
+    map_t m;
+    BOOST_TEST(m.insert_or_assign("a/+", "c1", 0));
+    BOOST_TEST(m.insert_or_assign("a/#", "c1", 2));
+    BOOST_TEST(m.insert_or_assign("a/b", "c1", 1));
+    BOOST_TEST(m.insert_or_assign("a/b", "c2", 0));
+    // overwrite
+    BOOST_TEST(!m.insert_or_assign("a/b", "c2", 1));
+    BOOST_TEST(m.size() == 4U);
+
+    BOOST_TEST(match(m, "a/b") == (std::vector<std::string>{ "c1", "c1", "c1", "c2" }));
+    auto merged = m.match_merged(
+        "a/b",
+        [](std::uint8_t& merged, std::uint8_t qos) {
+            merged = std::max(merged, qos);
+        }
+    );
+    BOOST_TEST(merged.size() == 2U);
+    BOOST_TEST(merged["c1"] == 2);
+    BOOST_TEST(merged["c2"] == 1);
+}
+
+BOOST_AUTO_TEST_CASE( erase ) {
+    map_t m;
+    m.insert_or_assign("a/+/c", "c1", 0);
+    m.insert_or_assign("a/+/c", "c2", 0);
+    m.insert_or_assign("a/#", "c1", 0);
+    BOOST_TEST(m.find_filter("a/+/c")->size() == 2U);
+    BOOST_TEST(!m.find_filter("a/+"));
+
+    BOOST_TEST(!m.erase("a/+", "c1"));
+    BOOST_TEST(!m.erase("a/+/c", "c3"));
+    BOOST_TEST(m.erase("a/+/c", "c1"));
+    BOOST_TEST(match(m, "a/b/c") == (std::vector<std::string>{ "c1", "c2" }));
+    BOOST_TEST(m.erase("a/#", "c1"));
+    BOOST_TEST(match(m, "a/b/c") == (std::vector<std::string>{ "c2" }));
+    BOOST_TEST(m.erase("a/+/c", "c2"));
+    BOOST_TEST(match(m, "a/b/c").empty());
+    BOOST_TEST(m.empty());
+
+    // nodes are pruned and can be created again
+    m.insert_or_assign("a/+/c", "c1", 0);
+    BOOST_TEST(match(m, "a/b/c") == (std::vector<std::string>{ "c1" }));
+}
+
+BOOST_AUTO_TEST_CASE( broker_overlap ) {
+    auto test = [](boost::asio::io_service& ios, auto& c, auto& s, auto& /*b*/) {
+        using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+        c->set_clean_session(true);
+
+        checker chk = {
+            // connect
+            cont("h_connack"),
+            // subscribe topic1/+ QoS0, topic1/# QoS1 and topic1/a QoS0
+            cont("h_suback"),
+            // publish topic1/a QoS1 is delivered once with QoS1
+            cont("h_publish"),
+            cont("h_puback"),
+            // publish $topic1 is not delivered to +/#
+            cont("h_publish_dollar"),
+            // disconnect
+            cont("h_close"),
+        };
+
+        auto on_suback =
+            [&] {
+                MQTT_CHK("h_suback");
+                c->publish_at_least_once("topic1/a", "topic1_contents");
+            };
+        auto on_publish =
+            [&]
+            (std::uint8_t header, std::string const& topic) {
+                if (topic == "topic1/a") {
+                    MQTT_CHK("h_publish");
+                    BOOST_TEST(mqtt::publish::get_qos(header) == mqtt::qos::at_least_once);
+                }
+                else {
+                    MQTT_CHK("h_publish_dollar");
+                    BOOST_TEST(topic == "$topic1/b");
+                    c->disconnect();
+                }
+            };
+        auto on_puback =
+            [&] {
+                MQTT_CHK("h_puback");
+                c->publish_at_most_once("$topic1/a", "topic1_contents");
+                c->publish_at_most_once("$topic1/b", "topic1_contents");
+            };
+
+        std::vector<std::tuple<mqtt::string_view, std::uint8_t>> entries {
+            { "topic1/+", mqtt::qos::at_most_once },
+            { "topic1/#", mqtt::qos::at_least_once },
+            { "topic1/a", mqtt::qos::at_most_once },
+            { "+/#", mqtt::qos::at_most_once },
+            { "$topic1/b", mqtt::qos::at_most_once },
+        };
+
+        switch (c->get_protocol_version()) {
+        case mqtt::protocol_version::v3_1_1:
+            c->set_connack_handler(
+                [&chk, &c, &entries]
+                (bool /*sp*/, std::uint8_t /*connack_return_code*/) {
+                    MQTT_CHK("h_connack");
+                    c->subscribe(entries);
+                    return true;
+                });
+            c->set_suback_handler(
+                [&on_suback]
+                (packet_id_t /*packet_id*/, std::vector<mqtt::optional<std::uint8_t>> /*results*/) {
+                    on_suback();
+                    return true;
+                });
+            c->set_puback_handler(
+                [&on_puback]
+                (packet_id_t /*packet_id*/) {
+                    on_puback();
+                    return true;
+                });
+            c->set_publish_handler(
+                [&on_publish]
+                (std::uint8_t header,
+                 mqtt::optional<packet_id_t> /*packet_id*/,
+                 std::string topic,
+                 std::string /*contents*/) {
+                    on_publish(header, topic);
+                    return true;
+                });
+            break;
+        case mqtt::protocol_version::v5:
+            c->set_v5_connack_handler(
+                [&chk, &c, &entries]
+                (bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                    MQTT_CHK("h_connack");
+                    c->subscribe(entries);
+                    return true;
+                });
+            c->set_v5_suback_handler(
+                [&on_suback]
+                (packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                    on_suback();
+                    return true;
+                });
+            c->set_v5_puback_handler(
+                [&on_puback]
+                (packet_id_t /*packet_id*/, std::uint8_t /*reason*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                    on_puback();
+                    return true;
+                });
+            c->set_v5_publish_handler(
+                [&on_publish]
+                (std::uint8_t header,
+                 mqtt::optional<packet_id_t> /*packet_id*/,
+                 std::string topic,
+                 std::string /*contents*/,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    on_publish(header, topic);
+                    return true;
+                });
+            break;
+        default:
+            BOOST_CHECK(false);
+            break;
+        }
+
+        c->set_close_handler(
+            [&chk, &s]
+            () {
+                MQTT_CHK("h_close");
+                s.close();
+            });
+        c->set_error_handler(
+            []
+            (boost::system::error_code const&) {
+                BOOST_CHECK(false);
+            });
+        c->connect();
+        ios.run();
+        BOOST_TEST(chk.all());
+    };
+    do_combi_test_sync(test);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,9 @@
 
 #include <iostream>
 #include <set>
+#include <map>
+#include <deque>
+#include <limits>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/multi_index_container.hpp>
@@ -16,10 +19,16 @@
 #include <boost/multi_index/sequenced_index.hpp>
 #include <boost/multi_index/member.hpp>
 #include <boost/multi_index/identity.hpp>
+#include <boost/multi_index/composite_key.hpp>
 
 #include <mqtt_server_cpp.hpp>
 #include <mqtt/optional.hpp>
 #include <mqtt/visitor_util.hpp>
+#include <mqtt/subscription_map.hpp>
+#include <mqtt/retained_index.hpp>
+#include <mqtt/offline_queue.hpp>
+#include <mqtt/timing_wheel.hpp>
+#include <mqtt/shared_subscription.hpp>
 
 #include "test_settings.hpp"
 
@@ -67,8 +76,232 @@ public:
     void set_disconnect_delay(boost::posix_time::time_duration const& delay) {
         delay_disconnect_ = delay;
     }
+
+    /**
+     * @brief set_retained_batch_size sets the number of retained messages
+     *        that are published at a time when a topic filter is subscribed.
+     *
+     * @param size - the number of messages. It must be greater than 0.
+     */
+    void set_retained_batch_size(std::size_t size) {
+        BOOST_ASSERT(size > 0);
+        retained_batch_size_ = size;
+    }
+
+    /**
+     * @brief set_offline_queue_config sets the limits of the queues that
+     *        keep the messages for disconnected sessions.
+     *
+     * It is applied to the sessions that are saved after the call.
+     *
+     * @param config - the limits and the overflow policy
+     */
+    void set_offline_queue_config(mqtt::offline_queue_config config) {
+        offline_queue_config_ = std::move(config);
+    }
+
+    /**
+     * @brief set_offline_replay_batch_size sets the number of queued messages
+     *        that are passed to the connection and not written yet, when a session is resumed.
+     *
+     * @param size - the number of messages. It must be greater than 0.
+     */
+    void set_offline_replay_batch_size(std::size_t size) {
+        BOOST_ASSERT(size > 0);
+        offline_replay_batch_size_ = size;
+    }
+
+    /**
+     * @brief set_shared_subscription_strategy sets how a message that matches
+     *        a shared subscription ($share/{ShareName}/{filter}) chooses the member.
+     *
+     * It is applied to the shared subscriptions that are created after the call.
+     *
+     * @param strategy - the strategy
+     */
+    void set_shared_subscription_strategy(mqtt::shared_subscription_strategy strategy) {
+        shared_strategy_ = strategy;
+    }
+
+    /**
+     * @brief set_shared_subscription_window sets the maximum number of unacknowledged
+     *        QoS1 and QoS2 messages of a member of a shared subscription.
+     *
+     * The window of a member is the smaller of this and the Receive Maximum of the client.
+     * It is applied to the members that subscribe after the call.
+     *
+     * @param window - the number of messages. It must be greater than 0.
+     */
+    void set_shared_subscription_window(std::size_t window) {
+        BOOST_ASSERT(window > 0);
+        shared_window_ = window;
+    }
+
+    /**
+     * @brief num_of_expiry_entries returns the number of the scheduled removals
+     *        of the messages that have Message Expiry Interval.
+     *
+     * @return the number of the entries
+     */
+    std::size_t num_of_expiry_entries() const {
+        return expiry_wheel_.size();
+    }
     // [end] for test setting
 
+    /**
+     * @brief shared_dispatch_filter chooses the shared subscriptions ($share/{ShareName}/{filter})
+     *        that this broker delivers a message to. It is called as f(share_name, filter).
+     *        An empty filter chooses all of them.
+     */
+    using shared_dispatch_filter = std::function<bool(std::string const& share_name, std::string const& filter)>;
+
+    /**
+     * @brief publish_forward_handler is called when a client of this broker publishes a message,
+     *        including will messages.
+     *        It returns the shared subscriptions of this broker that the message is delivered to,
+     *        because a shared subscription that has members on several brokers delivers
+     *        the message on only one of them.
+     */
+    using publish_forward_handler = std::function<
+        shared_dispatch_filter(
+            std::shared_ptr<std::string> const& topic,
+            std::shared_ptr<std::string> const& contents,
+            std::uint8_t qos,
+            bool is_retain,
+            std::vector<mqtt::v5::property_variant> const& props
+        )
+    >;
+
+    /**
+     * @brief set_publish_forward_handler sets the handler that forwards published messages
+     *        to other brokers, e.g. other shards of sharded_broker.
+     *        The other brokers should deliver the message by deliver_publish().
+     *
+     * @param h - handler
+     */
+    void set_publish_forward_handler(publish_forward_handler h = publish_forward_handler()) {
+        h_publish_forward_ = std::move(h);
+    }
+
+    /**
+     * @brief shared_group_handler is called when the first member subscribes a shared subscription
+     *        of this broker (exists is true), and when the last member leaves it (exists is false).
+     */
+    using shared_group_handler = std::function<void(std::string const& share_name, std::string const& filter, bool exists)>;
+
+    /**
+     * @brief set_shared_group_handler sets the handler that tracks the shared subscriptions
+     *        of this broker, e.g. to choose the shard of sharded_broker that delivers a message.
+     *
+     * @param h - handler
+     */
+    void set_shared_group_handler(shared_group_handler h = shared_group_handler()) {
+        h_shared_group_ = std::move(h);
+    }
+
+    // The saved session of a client that is not connected
+    struct session {
+        session(std::string client_id, mqtt::offline_queue_config const& config)
+            :client_id(std::move(client_id)), data(config) {}
+        std::string client_id;
+        mqtt::offline_queue data;
+        // The time when the expired messages are removed. See schedule_expiry().
+        mqtt::optional<std::chrono::steady_clock::time_point> expiry_check;
+    };
+
+    /**
+     * @brief taken_session is the session of a client that is taken out of a broker by take_client(),
+     *        and is passed to the connect handover handler of another broker.
+     */
+    struct taken_session {
+        std::vector<std::pair<std::shared_ptr<std::string>, std::uint8_t>> subscriptions;
+        /// The queued messages. It is not referred to by the broker that it is taken from.
+        std::shared_ptr<session> s;
+    };
+
+    /**
+     * @brief connect_handover_handler is called when a client that has a client id connects,
+     *        before the session is looked up. The handler calls resume on the thread of this broker,
+     *        with the session that is taken from another broker, or nullopt.
+     *        CONNACK is sent by resume.
+     */
+    using connect_handover_handler = std::function<
+        void(
+            std::string const& client_id,
+            std::function<void(mqtt::optional<taken_session>)> resume
+        )
+    >;
+
+    /**
+     * @brief set_connect_handover_handler sets the handler that moves the session of a client
+     *        from another broker, e.g. another shard of sharded_broker.
+     *
+     * @param h - handler
+     */
+    void set_connect_handover_handler(connect_handover_handler h = connect_handover_handler()) {
+        h_connect_handover_ = std::move(h);
+    }
+
+    /**
+     * @brief client_released_handler is called when a client that has a client id leaves
+     *        this broker without a saved session.
+     */
+    using client_released_handler = std::function<void(std::string const& client_id)>;
+
+    /**
+     * @brief set_client_released_handler sets the handler that is called when a client
+     *        leaves this broker without a saved session.
+     *
+     * @param h - handler
+     */
+    void set_client_released_handler(client_released_handler h = client_released_handler()) {
+        h_client_released_ = std::move(h);
+    }
+
+    /**
+     * @brief take_client Disconnect the connection of the client id, and take the saved session
+     *        out of this broker.
+     *
+     * The will of the connection is published. The session is passed to another broker
+     * by the connect handover handler.
+     *
+     * @param client_id - The client id
+     * @return The saved session, or nullopt if the client has no saved session.
+     */
+    mqtt::optional<taken_session> take_client(std::string const& client_id) {
+        auto& idx = cons_.get<tag_client_id>();
+        auto it = idx.find(client_id);
+        if (it != idx.end()) {
+            // The saved session is made by close_proc() if the session is not clean.
+            auto before_overwrite = it->before_overwrite;
+            before_overwrite();
+        }
+        auto sit = sessions_.find(client_id);
+        if (sit == sessions_.end()) return mqtt::nullopt;
+        sessions_.erase(sit);
+
+        taken_session taken;
+        std::shared_ptr<session> saved;
+        auto r = subsessions_.equal_range(client_id);
+        while (r.first != r.second) {
+            saved = r.first->s;
+            taken.subscriptions.emplace_back(r.first->topic, r.first->qos);
+            subsessions_map_.erase(*r.first->topic, r.first->s);
+            r.first = subsessions_.erase(r.first);
+        }
+        if (saved) {
+            // The messages are moved to a new session, because the saved one can be
+            // referred to by expiry_wheel_ of this broker.
+            taken.s = std::make_shared<session>(client_id, offline_queue_config_);
+            while (!saved->data.empty()) {
+                for (auto& m : saved->data.pop(offline_replay_batch_size_)) {
+                    taken.s->data.push(std::move(m));
+                }
+            }
+        }
+        return taken;
+    }
+
     /**
      * @brief handle_accept
      *
@@ -169,19 +402,22 @@ public:
         );
         ep.set_puback_handler(
             [&]
-            (typename Endpoint::packet_id_t /*packet_id*/){
+            (typename Endpoint::packet_id_t packet_id){
+                shared_acked(ep.shared_from_this(), packet_id);
                 return true;
             });
         ep.set_v5_puback_handler(
             [&]
-            (typename Endpoint::packet_id_t /*packet_id*/,
+            (typename Endpoint::packet_id_t packet_id,
              std::uint8_t /*reason_code*/,
              std::vector<mqtt::v5::property_variant> /*props*/){
+                shared_acked(ep.shared_from_this(), packet_id);
                 return true;
             });
         ep.set_pubrec_handler(
             [&]
             (typename Endpoint::packet_id_t packet_id){
+                shared_acked(ep.shared_from_this(), packet_id);
                 ep.pubrel(packet_id);
                 return true;
             });
@@ -190,6 +426,7 @@ public:
             (typename Endpoint::packet_id_t packet_id,
              std::uint8_t /*reason_code*/,
              std::vector<mqtt::v5::property_variant> /*props*/){
+                shared_acked(ep.shared_from_this(), packet_id);
                 ep.pubrel(packet_id, mqtt::v5::reason_code::success, pubrel_props_);
                 return true;
             });
@@ -389,6 +626,203 @@ public:
         h_auth_props_ = std::move(h);
     }
 
+    /**
+     * @brief owning_props Copy the properties that refer to the receive buffer
+     *
+     * The string properties that are passed to the publish handler, e.g. content_type_ref,
+     * refer to the receive buffer that is reused after the handler returns.
+     * They are converted to the owning types, e.g. content_type, to keep them after that.
+     *
+     * @param props - The properties that are passed to the handler.
+     * @return The properties that don't refer to the receive buffer.
+     */
+    static std::vector<mqtt::v5::property_variant> owning_props(std::vector<mqtt::v5::property_variant> props) {
+        namespace mp = mqtt::v5::property;
+        for (auto& p : props) {
+            p = mqtt::visit(
+                mqtt::make_lambda_visitor<mqtt::v5::property_variant>(
+                    [](mp::content_type_ref const& p) -> mqtt::v5::property_variant {
+                        return mp::content_type(p.val());
+                    },
+                    [](mp::response_topic_ref const& p) -> mqtt::v5::property_variant {
+                        return mp::response_topic(p.val());
+                    },
+                    [](mp::correlation_data_ref const& p) -> mqtt::v5::property_variant {
+                        return mp::correlation_data(p.val());
+                    },
+                    [](mp::assigned_client_identifier_ref const& p) -> mqtt::v5::property_variant {
+                        return mp::assigned_client_identifier(p.val());
+                    },
+                    [](mp::authentication_method_ref const& p) -> mqtt::v5::property_variant {
+                        return mp::authentication_method(p.val());
+                    },
+                    [](mp::authentication_data_ref const& p) -> mqtt::v5::property_variant {
+                        return mp::authentication_data(p.val());
+                    },
+                    [](mp::response_information_ref const& p) -> mqtt::v5::property_variant {
+                        return mp::response_information(p.val());
+                    },
+                    [](mp::server_reference_ref const& p) -> mqtt::v5::property_variant {
+                        return mp::server_reference(p.val());
+                    },
+                    [](mp::reason_string_ref const& p) -> mqtt::v5::property_variant {
+                        return mp::reason_string(p.val());
+                    },
+                    [](mp::user_property_ref const& p) -> mqtt::v5::property_variant {
+                        return mp::user_property(p.key(), p.val());
+                    },
+                    [](auto const& p) -> mqtt::v5::property_variant {
+                        return p;
+                    }
+                ),
+                p
+            );
+        }
+        return props;
+    }
+
+    /**
+     * @brief deliver_publish Publish a message to subscribed clients of this broker.
+     *
+     * The message is not passed to the publish forward handler. This is used to
+     * deliver a message that is forwarded from another broker.
+     *
+     * @param topic - The topic to publish the message on.
+     * @param contents - The contents of the message.
+     * @param qos - The QOS setting to use for the published message.
+     * @param is_retain - Whether the message should be retained so it can
+     *                    be sent to newly added subscriptions in the future.
+     * @param shared_filter - The shared subscriptions that the message is delivered to.
+     *                        If it is empty, the message is delivered to all of them.
+     */
+    void deliver_publish(
+        std::shared_ptr<std::string> const& topic,
+        std::shared_ptr<std::string> const& contents,
+        std::uint8_t qos,
+        bool is_retain,
+        std::vector<mqtt::v5::property_variant> props,
+        shared_dispatch_filter const& shared_filter = shared_dispatch_filter()) {
+        expire_messages();
+        auto expiry = message_expiry(props);
+        // If a client has overlapping subscriptions, the message is delivered once
+        // with the maximum QoS of them.
+        // MQTT 3.1.1 - 3.3.5 Actions - paragraph 5.
+        auto max_qos =
+            [](std::uint8_t& merged, std::uint8_t qos) {
+                merged = std::max(merged, qos);
+            };
+        {
+            // For each subscription that matches this topic
+            auto subs = subs_map_.match_merged(*topic, max_qos);
+            if (!subs.empty()) {
+                // The topic, properties and contents are encoded once and shared by
+                // all subscribers. Each subscriber only builds its own header.
+                auto body = mqtt::make_shared_publish(
+                    as::buffer(*topic),
+                    as::buffer(*contents),
+                    std::make_pair(topic, contents),
+                    props
+                );
+                for (auto const& sub : subs) {
+                    // While the queued messages are replayed, the new messages are
+                    // queued after them to keep the order.
+                    if (!replaying_.empty()) {
+                        auto it = replaying_.find(sub.first);
+                        if (it != replaying_.end()) {
+                            it->second.s->data.push({ topic, contents, std::min(sub.second, qos), expiry });
+                            schedule_expiry(it->second.s);
+                            continue;
+                        }
+                    }
+                    mqtt::visit(
+                        mqtt::make_lambda_visitor<void>(
+                            [&](auto& con) {
+                                // publish the message to subscribers.
+                                // TODO: Probably this should be switched to async_publish?
+                                //       Given the async_client / sync_client seperation
+                                //       and the way they have different function names,
+                                //       it wouldn't be possible for test_broker.hpp to be
+                                //       used with some hypothetical "async_server" in the future.
+                                con->publish(body, std::min(sub.second, qos));
+                            }
+                        ),
+                        sub.first
+                    );
+                }
+            }
+        }
+        {
+            // Each shared subscription delivers the message to one of its members.
+            // MQTT v5 - 4.8.2 Shared Subscriptions
+            std::vector<std::shared_ptr<shared_group>> groups;
+            shared_map_.match(
+                *topic,
+                [&](std::string const& share_name, std::shared_ptr<shared_group> const& g) {
+                    if (!shared_filter || shared_filter(share_name, g->filter)) groups.push_back(g);
+                }
+            );
+            if (!groups.empty()) {
+                // The message can be kept in pending or in-flight after the receive buffer is reused.
+                auto shared_props = owning_props(props);
+                for (auto const& g : groups) {
+                    dispatch_shared(g, shared_message { topic, contents, qos, shared_props, expiry });
+                }
+            }
+        }
+        {
+            // For each saved subscription, add this message to
+            // the list to be sent out when a connection resumes
+            // a lost session.
+            auto subs = subsessions_map_.match_merged(*topic, max_qos);
+            for (auto const& sub : subs) {
+                sub.first->data.push({ topic, contents, std::min(sub.second, qos), expiry });
+                schedule_expiry(sub.first);
+            }
+        }
+        /*
+         * If the message is marked as being retained, then we
+         * keep it in case a new subscription is added that matches
+         * this topic.
+         *
+         * @note: The MQTT standard 3.3.1.3 RETAIN makes it clear that
+         *        retained messages are global based on the topic, and
+         *        are not scoped by the client id. So any client may
+         *        publish a retained message on any topic, and the most
+         *        recently published retained message on a particular
+         *        topic is the message that is stored on the server.
+         *
+         * @note: The standard doesn't make it clear that publishing
+         *        a message with zero length, but the retain flag not
+         *        set, does not result in any existing retained message
+         *        being removed. However, internet searching indicates
+         *        that most brokers have opted to keep retained messages
+         *        when receiving contents of zero bytes, unless the so
+         *        received message has the retain flag set, in which case
+         *        the retained message is removed.
+         */
+        if (is_retain) {
+            if (contents->empty()) {
+                cancel_retain_expiry(*topic);
+                retains_.erase(*topic);
+            }
+            else {
+                cancel_retain_expiry(*topic);
+                mqtt::optional<expiry_wheel_t::id_t> expiry_id;
+                if (expiry) {
+                    // Remove the retained message when it expires. The removal is cancelled
+                    // when the message is overwritten or removed.
+                    expiry_id = expiry_wheel_.add(
+                        *expiry,
+                        [this, topic](clock::time_point) {
+                            retains_.erase(*topic);
+                        }
+                    );
+                }
+                retains_.insert_or_assign(*topic, retain(topic, contents, owning_props(std::move(props)), qos, expiry, expiry_id));
+            }
+        }
+    }
+
 private:
     template <typename Endpoint>
     bool connect_handler(
@@ -410,12 +844,39 @@ private:
             ep.connack(false, mqtt::connect_return_code::identifier_rejected);
             return false;
         }
+        if (h_connect_handover_ && !client_id.empty()) {
+            auto receive_max = receive_maximum(props);
+            h_connect_handover_(
+                client_id,
+                [this, sp = ep.shared_from_this(), client_id, clean_session, will = std::move(will), receive_max]
+                (mqtt::optional<taken_session> taken) mutable {
+                    if (taken) put_session(client_id, std::move(*taken));
+                    // If the connection is closed during the handover, the session is kept.
+                    if (!sp->connected()) return;
+                    connect_accept(*sp, client_id, clean_session, std::move(will), receive_max);
+                }
+            );
+            return true;
+        }
+        connect_accept(ep, client_id, clean_session, std::move(will), receive_maximum(props));
+        return true;
+    }
+
+    template <typename Endpoint>
+    void connect_accept(
+        Endpoint&& ep,
+        std::string const& client_id,
+        bool clean_session,
+        mqtt::optional<mqtt::will> will,
+        std::size_t receive_max
+    ) {
         auto spep = ep.shared_from_this();
         auto emplace =
             [&] {
                 return cons_.emplace(
                     client_id,
                     spep,
+                    receive_max,
                     [this, spep] () {
                         // send will no keep
                         spep->force_disconnect();
@@ -435,7 +896,17 @@ private:
             BOOST_ASSERT(std::get<1>(it_ret));
         }
         connect_proc(std::forward<Endpoint>(ep), clean_session, spep, client_id, std::move(will));
-        return true;
+    }
+
+    // Save the session that is taken from another broker. It is resumed by connect_proc().
+    void put_session(std::string const& client_id, taken_session taken) {
+        sessions_.emplace(client_id);
+        auto s = taken.s ? taken.s : std::make_shared<session>(client_id, offline_queue_config_);
+        for (auto& sub : taken.subscriptions) {
+            subsessions_map_.insert_or_assign(*sub.first, s, sub.second);
+            subsessions_.emplace(std::move(sub.first), s, sub.second);
+        }
+        schedule_expiry(s);
     }
 
     template <typename Endpoint>
@@ -525,13 +996,42 @@ private:
         // not the one requested.
         std::vector<std::uint8_t> res;
         res.reserve(entries.size());
+        con_sp_t spep = ep.shared_from_this();
         for (auto const& e : entries) {
             std::string const& topic = std::get<0>(e);
             std::uint8_t qos = std::get<1>(e);
+            if (!validate_subscription(topic)) {
+                res.emplace_back(
+                    ep.get_protocol_version() == mqtt::protocol_version::v5
+                    ? mqtt::v5::reason_code::topic_filter_invalid
+                    : 0x80 // Failure
+                );
+                continue;
+            }
             res.emplace_back(qos);
-            // TODO: This doesn't handle situations where we receive a new subscription for the same topic.
+            if (auto shared = mqtt::parse_shared_subscription(topic)) {
+                shared_subscribe(spep, shared->first, shared->second, qos);
+                auto& idx = subs_.get<tag_con_topic>();
+                auto it = idx.find(boost::make_tuple(spep, topic));
+                if (it == idx.end()) {
+                    subs_.emplace(std::make_shared<std::string>(topic), spep, qos);
+                }
+                else {
+                    idx.modify(it, [&](sub_con& val) { val.qos = qos; });
+                }
+                continue;
+            }
+            // If the same topic filter is subscribed again, the existing subscription is replaced.
             // MQTT 3.1.1 - 3.8.4 Response - paragraph 3.
-            subs_.emplace(std::make_shared<std::string>(topic), ep.shared_from_this(), qos);
+            if (subs_map_.insert_or_assign(topic, spep, qos)) {
+                subs_.emplace(std::make_shared<std::string>(topic), spep, qos);
+            }
+            else {
+                auto& idx = subs_.get<tag_con_topic>();
+                auto it = idx.find(boost::make_tuple(spep, topic));
+                BOOST_ASSERT(it != idx.end());
+                idx.modify(it, [&](sub_con& val) { val.qos = qos; });
+            }
         }
         switch (ep.get_protocol_version()) {
         case mqtt::protocol_version::v3_1_1:
@@ -547,24 +1047,24 @@ private:
             BOOST_ASSERT(false);
             break;
         }
+        expire_messages();
         for (auto const& e : entries) {
             std::string const& topic = std::get<0>(e);
             std::uint8_t qos = std::get<1>(e);
-            // Publish any retained messages that match the newly subscribed topic.
-            auto it = retains_.find(topic);
-            if (it != retains_.end()) {
-                ep.publish(
-                    as::buffer(*it->topic),
-                    as::buffer(*it->contents),
-                    std::make_pair(it->topic, it->contents),
-                    std::min(it->qos, qos),
-                    true,
-                    it->props);
+            if (!validate_subscription(topic)) continue;
+            // Retained messages are not sent to shared subscriptions.
+            // MQTT v5 - 3.8.4 SUBSCRIBE Actions
+            if (mqtt::parse_shared_subscription(topic)) continue;
+            // Publish any retained messages that match the newly subscribed topic filter.
+            auto matched = std::make_shared<std::vector<retain>>(retains_.match(topic));
+            if (!matched->empty()) {
+                publish_retains(spep, std::make_shared<std::string>(topic), qos, std::move(matched), 0);
             }
         }
         return true;
     }
 
+
     template <typename Endpoint>
     bool unsubscribe_handler(
         Endpoint&& ep,
@@ -572,8 +1072,17 @@ private:
         std::vector<std::string> topics,
         std::vector<mqtt::v5::property_variant> props) {
 
+        con_sp_t spep = ep.shared_from_this();
+        auto& idx = subs_.get<tag_con_topic>();
         for (auto const& topic : topics) {
-            subs_.erase(topic);
+            if (auto shared = mqtt::parse_shared_subscription(topic)) {
+                shared_unsubscribe(spep, shared->first, shared->second);
+            }
+            else {
+                subs_map_.erase(topic, spep);
+            }
+            auto it = idx.find(boost::make_tuple(spep, topic));
+            if (it != idx.end()) idx.erase(it);
         }
 
         switch (ep.get_protocol_version()) {
@@ -615,6 +1124,7 @@ private:
         con_sp_t const& spep,
         std::string const& client_id,
         mqtt::optional<mqtt::will> will) {
+        expire_messages();
         auto it = sessions_.find(client_id);
         mqtt::visit(
             mqtt::make_lambda_visitor<void>(
@@ -646,39 +1156,33 @@ private:
         }
 
         if (clean_session) {
-            subsessions_.erase(client_id);
+            auto r = subsessions_.equal_range(client_id);
+            while (r.first != r.second) {
+                subsessions_map_.erase(*r.first->topic, r.first->s);
+                r.first = subsessions_.erase(r.first);
+            }
         }
         else {
             // If it's not a clean session, then all of the
             // saved subscriptions are moved to the new session
             // object so they can be used immediately.
             auto r = subsessions_.equal_range(client_id);
-            std::vector<session_data> data;
+            std::shared_ptr<session> s;
             if (r.first != r.second) {
-                data = std::move(r.first->s->data);
+                s = r.first->s;
             }
             while (r.first != r.second) {
+                subsessions_map_.erase(*r.first->topic, r.first->s);
+                subs_map_.insert_or_assign(*r.first->topic, spep, r.first->qos);
                 subs_.emplace(r.first->topic, spep, r.first->qos);
                 r.first = subsessions_.erase(r.first);
             }
             // Any, of course, any saved messages need to go out as well.
-            for (auto const& d : data) {
-                mqtt::visit(
-                    mqtt::make_lambda_visitor<void>(
-                        [&](auto& con) {
-                            // But *only* for this connection
-                            // Not every connection in the broker.
-                            con->publish(
-                                as::buffer(*d.topic),
-                                as::buffer(*d.contents),
-                                std::make_pair(d.topic, d.contents),
-                                d.qos,
-                                true
-                            );
-                        }
-                    ),
-                    spep
-                );
+            // But *only* for this connection
+            // Not every connection in the broker.
+            if (s && !s->data.empty()) {
+                replaying_.emplace(spep, replay_state { s });
+                replay_offline(spep);
             }
         }
         // save the last-will-and-testiment of this connection, if there is one.
@@ -690,6 +1194,9 @@ private:
     /**
      * @brief do_publish Publish a message to any subscribed clients.
      *
+     * If the publish forward handler is set, the message is passed to it
+     * before it is delivered to the clients of this broker.
+     *
      * @param topic - The topic to publish the message on.
      * @param contents - The contents of the message.
      * @param qos - The QOS setting to use for the published message.
@@ -702,89 +1209,9 @@ private:
         std::uint8_t qos,
         bool is_retain,
         std::vector<mqtt::v5::property_variant> props) {
-        {
-            // For each subscription registered for this topic
-            auto const& idx = subs_.get<tag_topic>();
-            auto r = idx.equal_range(*topic);
-            for (; r.first != r.second; ++r.first) {
-                mqtt::visit(
-                    mqtt::make_lambda_visitor<void>(
-                        [&](auto& con) {
-                            // publish the message to subscribers.
-                            // TODO: Probably this should be switched to async_publish?
-                            //       Given the async_client / sync_client seperation
-                            //       and the way they have different function names,
-                            //       it wouldn't be possible for test_broker.hpp to be
-                            //       used with some hypothetical "async_server" in the future.
-                            con->publish(
-                                as::buffer(*topic),
-                                as::buffer(*contents),
-                                std::make_pair(topic, contents),
-                                std::min(r.first->qos, qos),
-                                false,
-                                props
-                            );
-                        }
-                    ),
-                    r.first->con
-                );
-            }
-        }
-        {
-            // For each saved subscription, add this message to
-            // the list to be sent out when a connection resumes
-            // a lost session.
-            auto const& idx = subsessions_.get<tag_topic>();
-            auto r = idx.equal_range(*topic);
-            for (; r.first != r.second; ++r.first) {
-                r.first->s->data.emplace_back(
-                    topic,
-                    contents,
-                    std::min(r.first->qos, qos)
-                );
-            }
-        }
-        /*
-         * If the message is marked as being retained, then we
-         * keep it in case a new subscription is added that matches
-         * this topic.
-         *
-         * @note: The MQTT standard 3.3.1.3 RETAIN makes it clear that
-         *        retained messages are global based on the topic, and
-         *        are not scoped by the client id. So any client may
-         *        publish a retained message on any topic, and the most
-         *        recently published retained message on a particular
-         *        topic is the message that is stored on the server.
-         *
-         * @note: The standard doesn't make it clear that publishing
-         *        a message with zero length, but the retain flag not
-         *        set, does not result in any existing retained message
-         *        being removed. However, internet searching indicates
-         *        that most brokers have opted to keep retained messages
-         *        when receiving contents of zero bytes, unless the so
-         *        received message has the retain flag set, in which case
-         *        the retained message is removed.
-         */
-        if (is_retain) {
-            if (contents->empty()) {
-                retains_.erase(*topic);
-            }
-            else {
-                auto it = retains_.find(*topic);
-                if(it == retains_.end()) {
-                    retains_.emplace_hint(it, topic, contents, std::move(props), qos);
-                }
-                else {
-                    retains_.modify(it,
-                                    [&](retain& val)
-                                    {
-                                        val.qos = qos;
-                                        val.props = std::move(props);
-                                        val.contents = contents;
-                                    });
-                }
-            }
-        }
+        shared_dispatch_filter shared_filter;
+        if (h_publish_forward_) shared_filter = h_publish_forward_(topic, contents, qos, is_retain, props);
+        deliver_publish(topic, contents, qos, is_retain, std::move(props), shared_filter);
     }
 
     /**
@@ -804,6 +1231,24 @@ private:
         auto cs = ep.clean_session();
         auto client_id = it->cid;
 
+        {
+            auto& idx = subs_.get<tag_con>();
+            auto r = idx.equal_range(spep);
+            // Shared subscriptions are not kept in the session, so the other members
+            // receive the messages while the client is offline.
+            // They are left before the will is published, so that the will is not
+            // delivered to this connection.
+            for (auto it = r.first; it != r.second;) {
+                if (auto shared = mqtt::parse_shared_subscription(*it->topic)) {
+                    shared_unsubscribe(spep, shared->first, shared->second);
+                    it = idx.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+        }
+
         {   // will processing
             auto it = will_.find(spep);
             if (it != will_.end()) {
@@ -822,38 +1267,59 @@ private:
         // Remove the client from the clientid <-> connection map.
         idx.erase(it);
 
+        // The messages that are not replayed yet are kept in the session.
+        std::shared_ptr<session> replaying;
+        {
+            auto it = replaying_.find(spep);
+            if (it != replaying_.end()) {
+                replaying = std::move(it->second.s);
+                replaying_.erase(it);
+            }
+        }
+
         {
             auto& idx = subs_.get<tag_con>();
             auto r = idx.equal_range(spep);
             if (cs) {
                 // Remove all subscriptions for this clientid
+                for (auto it = r.first; it != r.second; ++it) {
+                    subs_map_.erase(*it->topic, spep);
+                }
                 idx.erase(r.first, r.second);
+                if (h_client_released_ && !client_id.empty()) h_client_released_(client_id);
             }
             else {
                 // Save all the subscriptions for this clientid for later.
                 sessions_.emplace(client_id);
-                auto s = std::make_shared<session>(client_id);
+                auto s = replaying ? replaying : std::make_shared<session>(client_id, offline_queue_config_);
                 while (r.first != r.second) {
+                    subs_map_.erase(*r.first->topic, spep);
+                    subsessions_map_.insert_or_assign(*r.first->topic, s, r.first->qos);
                     subsessions_.emplace(r.first->topic, s, r.first->qos);
                     r.first = idx.erase(r.first);
                 }
             }
         }
+        redistribute_shared(spep);
     }
 
 private:
+    using clock = std::chrono::steady_clock;
 
     struct tag_topic {};
     struct tag_con {};
+    struct tag_con_topic {};
     struct tag_client_id {};
 
     // Mapping between clientid and underlying connection.
     // Used as a basic sanity check on whether a particular clientid is currently connected.
     struct cid_con {
-        cid_con(std::string cid, con_sp_t con, std::function<void()> before_overwrite)
-            :cid(std::move(cid)), con(std::move(con)), before_overwrite(std::move(before_overwrite)) {}
+        cid_con(std::string cid, con_sp_t con, std::size_t receive_maximum, std::function<void()> before_overwrite)
+            :cid(std::move(cid)), con(std::move(con)), receive_maximum(receive_maximum), before_overwrite(std::move(before_overwrite)) {}
         std::string cid;
         con_sp_t con;
+        /// Receive Maximum of the client. See MQTT v5 3.1.2.11.3.
+        std::size_t receive_maximum;
         std::function<void()> before_overwrite;
     };
 
@@ -888,9 +1354,13 @@ private:
     using mi_sub_con = mi::multi_index_container<
         sub_con,
         mi::indexed_by<
-            mi::ordered_non_unique<
-                mi::tag<tag_topic>,
-                BOOST_MULTI_INDEX_CONST_MEM_FUN(sub_con, std::string const&, sub_con::get_topic)
+            mi::ordered_unique<
+                mi::tag<tag_con_topic>,
+                mi::composite_key<
+                    sub_con,
+                    BOOST_MULTI_INDEX_MEMBER(sub_con, con_sp_t, con),
+                    BOOST_MULTI_INDEX_CONST_MEM_FUN(sub_con, std::string const&, sub_con::get_topic)
+                >
             >,
             mi::ordered_non_unique<
                 mi::tag<tag_con>,
@@ -899,6 +1369,8 @@ private:
         >
     >;
 
+    using expiry_wheel_t = mqtt::timing_wheel<std::function<void(clock::time_point)>>;
+
     // A collection of topics that have been retained for
     // clients that add a new subscription to the topic.
     struct retain {
@@ -906,43 +1378,478 @@ private:
             std::shared_ptr<std::string> topic,
             std::shared_ptr<std::string> contents,
             std::vector<mqtt::v5::property_variant> props,
-            std::uint8_t qos)
-            :topic(std::move(topic)), contents(std::move(contents)), props(std::move(props)), qos(qos) {}
-        std::string const& get_topic() const {
-            return *topic;
-        }
+            std::uint8_t qos,
+            mqtt::optional<clock::time_point> expiry,
+            mqtt::optional<expiry_wheel_t::id_t> expiry_id)
+            :topic(std::move(topic)), contents(std::move(contents)), props(std::move(props)), qos(qos), expiry(expiry), expiry_id(expiry_id) {}
         std::shared_ptr<std::string> topic;
         std::shared_ptr<std::string> contents;
         std::vector<mqtt::v5::property_variant> props;
         std::uint8_t qos;
+        mqtt::optional<clock::time_point> expiry;
+        mqtt::optional<expiry_wheel_t::id_t> expiry_id; ///< The entry of expiry_wheel_ that removes this message.
     };
-    using mi_retain = mi::multi_index_container<
-        retain,
-        mi::indexed_by<
-            mi::ordered_unique<
-                mi::tag<tag_topic>,
-                BOOST_MULTI_INDEX_CONST_MEM_FUN(retain, std::string const&, retain::get_topic)
-            >
-        >
-    >;
 
-    // It's not clear what this does. Is it related to retained messages perhaps?
-    struct session_data {
-        session_data(
-            std::shared_ptr<std::string> topic,
-            std::shared_ptr<std::string> contents,
-            std::uint8_t qos)
-            : topic(std::move(topic)), contents(std::move(contents)), qos(qos) {}
+    /**
+     * @brief cancel_retain_expiry Cancel the removal of the retained message of the topic
+     *
+     * It is called before the retained message is overwritten or removed,
+     * so that expiry_wheel_ doesn't keep the entries of the old messages.
+     *
+     * @param topic - The topic of the retained message
+     */
+    void cancel_retain_expiry(std::string const& topic) {
+        auto r = retains_.find(topic);
+        if (r && r->expiry_id) expiry_wheel_.cancel(*r->expiry_id);
+    }
+
+    /**
+     * @brief publish_retains Publish the retained messages from the position
+     *
+     * A wide topic filter can match many retained messages, so they are
+     * published retained_batch_size_ at a time. The rest are posted to
+     * the io_service, so that other connections can be processed between
+     * the batches. The publishing is stopped if the subscription is removed.
+     *
+     * @param spep - The connection that subscribed the filter
+     * @param filter - The topic filter
+     * @param qos - The subscribed QoS
+     * @param matched - The retained messages that match the filter
+     * @param pos - The position of the first message to publish
+     */
+    void publish_retains(
+        con_sp_t const& spep,
+        std::shared_ptr<std::string> filter,
+        std::uint8_t qos,
+        std::shared_ptr<std::vector<retain>> matched,
+        std::size_t pos) {
+        auto end = std::min(matched->size(), pos + retained_batch_size_);
+        auto now = clock::now();
+        mqtt::visit(
+            mqtt::make_lambda_visitor<void>(
+                [&](auto const& ep) {
+                    for (; pos != end; ++pos) {
+                        auto const& r = (*matched)[pos];
+                        if (r.expiry && *r.expiry <= now) continue;
+                        ep->publish(
+                            as::buffer(*r.topic),
+                            as::buffer(*r.contents),
+                            std::make_pair(r.topic, r.contents),
+                            std::min(r.qos, qos),
+                            true,
+                            r.expiry ? with_remaining_expiry(r.props, *r.expiry, now) : r.props);
+                    }
+                }
+            ),
+            spep
+        );
+        if (end == matched->size()) return;
+        ios_.post(
+            [this, spep, filter, qos, matched, end] {
+                auto subs = subs_map_.find_filter(*filter);
+                if (!subs || subs->find(spep) == subs->end()) return;
+                publish_retains(spep, filter, qos, matched, end);
+            }
+        );
+    }
+
+    // The messages for a disconnected session.
+    /**
+     * @brief expire_messages Remove the messages whose Message Expiry Interval has passed
+     *
+     * expiry_wheel_ has no timer. It is advanced when the broker handles
+     * CONNECT, SUBSCRIBE and PUBLISH, so that an idle broker doesn't wake up.
+     * The messages that expire between the advances are skipped when they are
+     * published.
+     */
+    void expire_messages() {
+        if (expiry_wheel_.empty()) return;
+        auto now = clock::now();
+        expiry_wheel_.advance(
+            now,
+            [&](std::function<void(clock::time_point)> const& f) {
+                f(now);
+            }
+        );
+    }
+
+    /**
+     * @brief schedule_expiry Schedule the removal of the expired messages of the session
+     *
+     * A session has one entry in expiry_wheel_ at the earliest expiry of its
+     * queue, instead of one entry for each message. When it expires, the
+     * expired messages are removed and the next expiry is scheduled.
+     *
+     * @param s - The session that has queued a message
+     */
+    void schedule_expiry(std::shared_ptr<session> const& s) {
+        auto next = s->data.next_expiry();
+        if (!next || (s->expiry_check && *s->expiry_check <= *next)) return;
+        s->expiry_check = next;
+        expiry_wheel_.add(
+            *next,
+            [this, ws = std::weak_ptr<session>(s), at = *next](clock::time_point now) {
+                auto s = ws.lock();
+                // The session is resumed, or an earlier check is scheduled.
+                if (!s || s->expiry_check != at) return;
+                s->expiry_check = mqtt::nullopt;
+                s->data.expire(now);
+                schedule_expiry(s);
+            }
+        );
+    }
+
+    // The time when the message expires. See MQTT v5 3.3.2.3.3 Message Expiry Interval.
+    static mqtt::optional<clock::time_point> message_expiry(std::vector<mqtt::v5::property_variant> const& props) {
+        for (auto const& p : props) {
+            if (auto interval = get_message_expiry_interval(p)) {
+                return clock::now() + std::chrono::seconds(*interval);
+            }
+        }
+        return mqtt::nullopt;
+    }
+
+    // The Message Expiry Interval that is sent is the received value minus the time
+    // that the message has been waiting in the broker. It is rounded up not to expire early.
+    static std::uint32_t remaining_expiry_interval(clock::time_point expiry, clock::time_point now) {
+        auto remaining = std::chrono::duration_cast<std::chrono::seconds>(
+            expiry - now + std::chrono::seconds(1) - clock::duration(1));
+        return static_cast<std::uint32_t>(remaining.count());
+    }
+
+    static std::vector<mqtt::v5::property_variant> with_remaining_expiry(
+        std::vector<mqtt::v5::property_variant> props,
+        clock::time_point expiry,
+        clock::time_point now) {
+        for (auto& p : props) {
+            if (get_message_expiry_interval(p)) {
+                p = mqtt::v5::property::message_expiry_interval(remaining_expiry_interval(expiry, now));
+            }
+        }
+        return props;
+    }
+
+    static mqtt::optional<std::uint32_t> get_message_expiry_interval(mqtt::v5::property_variant const& p) {
+        return mqtt::visit(
+            mqtt::make_lambda_visitor<mqtt::optional<std::uint32_t>>(
+                [](mqtt::v5::property::message_expiry_interval const& p) -> mqtt::optional<std::uint32_t> {
+                    return p.val();
+                },
+                [](auto const&) -> mqtt::optional<std::uint32_t> {
+                    return mqtt::nullopt;
+                }
+            ),
+            p
+        );
+    }
+
+    /**
+     * @brief replay_offline Publish the queued messages of the resumed session
+     *
+     * At most offline_replay_batch_size_ messages are passed to the connection
+     * and not written yet, including the messages that wait for the Receive Maximum
+     * quota. The next messages are popped from the queue when the writes complete,
+     * so the rest stay in the queue while the client is slow. The messages that are
+     * published to the connection during the replay are queued after them. When the
+     * connection is closed during the replay, the rest are kept in the session.
+     *
+     * @param spep - The connection that resumed the session
+     */
+    void replay_offline(con_sp_t const& spep) {
+        auto it = replaying_.find(spep);
+        if (it == replaying_.end()) return;
+        auto& r = it->second;
+        // The completion handler can be called during the publish, e.g. by an oversized message.
+        if (r.publishing) return;
+        if (r.in_flight >= offline_replay_batch_size_) return;
+        auto s = r.s;
+        auto batch = s->data.pop(offline_replay_batch_size_ - r.in_flight);
+        r.in_flight += batch.size();
+        r.publishing = true;
+        auto now = clock::now();
+        mqtt::visit(
+            mqtt::make_lambda_visitor<void>(
+                [&](auto& con) {
+                    for (auto const& d : batch) {
+                        std::vector<mqtt::v5::property_variant> props;
+                        if (d.expiry) {
+                            props.emplace_back(
+                                mqtt::v5::property::message_expiry_interval(remaining_expiry_interval(*d.expiry, now))
+                            );
+                        }
+                        con->async_publish(
+                            as::buffer(*d.topic),
+                            as::buffer(*d.contents),
+                            std::make_pair(d.topic, d.contents),
+                            d.qos,
+                            true,
+                            std::move(props),
+                            [this, spep](boost::system::error_code const& /*ec*/) {
+                                replayed(spep);
+                            }
+                        );
+                    }
+                }
+            ),
+            spep
+        );
+        it = replaying_.find(spep);
+        if (it == replaying_.end()) return;
+        it->second.publishing = false;
+        if (s->data.empty()) {
+            // The new messages are published directly after the last queued ones.
+            replaying_.erase(it);
+        }
+        else if (it->second.in_flight < offline_replay_batch_size_) {
+            // Some writes have completed during the publish.
+            ios_.post(
+                [this, spep] {
+                    replay_offline(spep);
+                }
+            );
+        }
+    }
+
+    // Called when the write of a replayed message completes
+    void replayed(con_sp_t const& spep) {
+        auto it = replaying_.find(spep);
+        if (it == replaying_.end()) return;
+        BOOST_ASSERT(it->second.in_flight > 0);
+        --it->second.in_flight;
+        replay_offline(spep);
+    }
+
+    // A message that is delivered to a shared subscription
+    struct shared_message {
         std::shared_ptr<std::string> topic;
         std::shared_ptr<std::string> contents;
         std::uint8_t qos;
+        std::vector<mqtt::v5::property_variant> props;
+        mqtt::optional<clock::time_point> expiry;
     };
-    struct session {
-        explicit session(std::string client_id)
-            :client_id(std::move(client_id)) {}
-        std::string client_id;
-        std::vector<session_data> data;
+
+    // A shared subscription of a share name and a topic filter
+    struct shared_group {
+        shared_group(std::string filter, mqtt::shared_subscription_strategy strategy)
+            :filter(std::move(filter)), members(strategy) {}
+        // The topic filter without "$share/{ShareName}/"
+        std::string filter;
+        mqtt::shared_subscription_group<con_sp_t, std::uint8_t> members;
+        // QoS1 and QoS2 messages that wait for a member that has room in its window
+        std::deque<shared_message> pending;
     };
+
+    // A message that is published to a member of a shared subscription and not acknowledged
+    struct shared_inflight {
+        std::weak_ptr<shared_group> group;
+        shared_message message;
+    };
+
+    // "$share/..." that is not a valid shared subscription is rejected,
+    // instead of being subscribed as a normal topic filter.
+    static bool validate_subscription(std::string const& topic) {
+        if (mqtt::parse_shared_subscription(topic)) return true;
+        return topic.compare(0, 7, "$share/") != 0 && mqtt::validate_topic_filter(topic);
+    }
+
+    static std::size_t receive_maximum(std::vector<mqtt::v5::property_variant> const& props) {
+        for (auto const& p : props) {
+            auto rm = mqtt::visit(
+                mqtt::make_lambda_visitor<mqtt::optional<std::size_t>>(
+                    [](mqtt::v5::property::receive_maximum const& p) -> mqtt::optional<std::size_t> {
+                        return p.val();
+                    },
+                    [](auto const&) -> mqtt::optional<std::size_t> {
+                        return mqtt::nullopt;
+                    }
+                ),
+                p
+            );
+            if (rm) return *rm;
+        }
+        return 0xffff;
+    }
+
+    std::shared_ptr<shared_group> find_shared(mqtt::string_view share_name, mqtt::string_view filter) const {
+        auto groups = shared_map_.find_filter(filter);
+        if (!groups) return nullptr;
+        auto it = groups->find(std::string(share_name));
+        if (it == groups->end()) return nullptr;
+        return it->second;
+    }
+
+    /**
+     * @brief shared_subscribe Add the connection to the members of the shared subscription
+     *
+     * The window of the member is the smaller of shared_window_ and the Receive Maximum
+     * of the client. The pending messages of the group are delivered if the new member has room.
+     *
+     * @param spep - The connection that subscribed
+     * @param share_name - The share name
+     * @param filter - The topic filter without "$share/{ShareName}/"
+     * @param qos - The subscribed QoS
+     */
+    void shared_subscribe(con_sp_t const& spep, mqtt::string_view share_name, mqtt::string_view filter, std::uint8_t qos) {
+        auto g = find_shared(share_name, filter);
+        if (!g) {
+            g = std::make_shared<shared_group>(std::string(filter), shared_strategy_);
+            shared_map_.insert_or_assign(filter, std::string(share_name), g);
+            if (h_shared_group_) h_shared_group_(std::string(share_name), g->filter, true);
+        }
+        std::size_t window = shared_window_;
+        auto& idx = cons_.get<tag_con>();
+        auto it = idx.find(spep);
+        if (it != idx.end()) window = std::min(window, it->receive_maximum);
+        g->members.insert_or_assign(spep, qos, std::max(window, std::size_t(1)));
+        deliver_shared_pending(g);
+    }
+
+    /**
+     * @brief shared_unsubscribe Remove the connection from the members of the shared subscription
+     *
+     * When the last member leaves, the shared subscription and its pending messages are removed.
+     * The unacknowledged messages of the member stay in shared_inflight_ until they are
+     * acknowledged, or the connection is closed.
+     */
+    void shared_unsubscribe(con_sp_t const& spep, mqtt::string_view share_name, mqtt::string_view filter) {
+        auto g = find_shared(share_name, filter);
+        if (!g) return;
+        g->members.erase(spep);
+        if (g->members.empty()) {
+            shared_map_.erase(filter, std::string(share_name));
+            if (h_shared_group_) h_shared_group_(std::string(share_name), g->filter, false);
+        }
+    }
+
+    /**
+     * @brief dispatch_shared Deliver the message to a member of the shared subscription
+     *
+     * QoS1 and QoS2 messages are queued if no member has room in its window, or if other
+     * messages are already queued, so that the order is kept.
+     * The message is delivered to one member only, so it is not encoded as shared_publish.
+     */
+    void dispatch_shared(std::shared_ptr<shared_group> const& g, shared_message message) {
+        bool counted = message.qos != mqtt::qos::at_most_once;
+        if (counted && !g->pending.empty()) {
+            g->pending.push_back(std::move(message));
+            return;
+        }
+        auto m = g->members.select(*message.topic, counted);
+        if (!m) {
+            if (counted) g->pending.push_back(std::move(message));
+            return;
+        }
+        send_shared(g, m->key, m->value, std::move(message));
+    }
+
+    // Deliver the pending messages while the members have room.
+    void deliver_shared_pending(std::shared_ptr<shared_group> const& g) {
+        auto now = clock::now();
+        while (!g->pending.empty()) {
+            auto& front = g->pending.front();
+            if (front.expiry && *front.expiry <= now) {
+                g->pending.pop_front();
+                continue;
+            }
+            auto m = g->members.select(*front.topic, true);
+            if (!m) return;
+            auto message = std::move(front);
+            g->pending.pop_front();
+            send_shared(g, m->key, m->value, std::move(message));
+        }
+    }
+
+    /**
+     * @brief send_shared Publish the message to the member that is selected with in-flight counted
+     *
+     * QoS1 and QoS2 deliveries are kept in shared_inflight_ until PUBACK or PUBREC is received.
+     * If the delivery is QoS0 because the member subscribed with QoS0, the message has expired,
+     * or the message exceeds the Maximum Packet Size of the member, the in-flight count of the
+     * member is released immediately.
+     */
+    void send_shared(std::shared_ptr<shared_group> const& g, con_sp_t spep, std::uint8_t sub_qos, shared_message message) {
+        bool counted = message.qos != mqtt::qos::at_most_once;
+        auto now = clock::now();
+        if (message.expiry && *message.expiry <= now) {
+            if (counted) g->members.release(spep);
+            return;
+        }
+        auto qos = std::min(sub_qos, message.qos);
+        if (counted && qos == mqtt::qos::at_most_once) g->members.release(spep);
+        mqtt::visit(
+            mqtt::make_lambda_visitor<void>(
+                [&](auto& con) {
+                    auto packet_id = con->publish(
+                        as::buffer(*message.topic),
+                        as::buffer(*message.contents),
+                        std::make_pair(message.topic, message.contents),
+                        qos,
+                        false,
+                        message.expiry ? with_remaining_expiry(message.props, *message.expiry, now) : message.props
+                    );
+                    if (qos == mqtt::qos::at_most_once) return;
+                    if (packet_id == 0) {
+                        // The message exceeds the Maximum Packet Size of the member and is discarded.
+                        // No PUBACK comes for it, so the window of the member is released here.
+                        g->members.release(spep);
+                        deliver_shared_pending(g);
+                        return;
+                    }
+                    shared_inflight_.emplace(
+                        std::make_pair(spep, std::size_t(packet_id)),
+                        shared_inflight { g, std::move(message) }
+                    );
+                }
+            ),
+            spep
+        );
+    }
+
+    /**
+     * @brief shared_acked Release the in-flight message of a shared subscription
+     *
+     * Called on PUBACK and PUBREC. After PUBREC, the message is not delivered to another
+     * member even if the connection is closed, because the client has received it.
+     */
+    void shared_acked(con_sp_t const& spep, std::size_t packet_id) {
+        auto it = shared_inflight_.find(std::make_pair(spep, packet_id));
+        if (it == shared_inflight_.end()) return;
+        auto g = it->second.group.lock();
+        shared_inflight_.erase(it);
+        if (!g) return;
+        g->members.release(spep);
+        deliver_shared_pending(g);
+    }
+
+    /**
+     * @brief redistribute_shared Deliver the unacknowledged messages of the closed connection
+     *        to the other members of the shared subscriptions
+     *
+     * The connection has been removed from the members. The messages are put in front of the
+     * pending messages, because they were published earlier. If no member is left, the
+     * shared subscription has been removed and the messages are discarded.
+     * MQTT v5 - 4.8.2 Shared Subscriptions
+     */
+    void redistribute_shared(con_sp_t const& spep) {
+        auto b = shared_inflight_.lower_bound(std::make_pair(spep, std::size_t(0)));
+        auto e = b;
+        std::vector<std::shared_ptr<shared_group>> groups;
+        std::map<std::shared_ptr<shared_group>, std::vector<shared_message>> messages;
+        for (; e != shared_inflight_.end() && e->first.first == spep; ++e) {
+            auto g = e->second.group.lock();
+            if (!g || g->members.empty()) continue;
+            auto& v = messages[g];
+            if (v.empty()) groups.push_back(g);
+            v.push_back(std::move(e->second.message));
+        }
+        shared_inflight_.erase(b, e);
+        for (auto const& g : groups) {
+            auto& v = messages[g];
+            g->pending.insert(g->pending.begin(), std::make_move_iterator(v.begin()), std::make_move_iterator(v.end()));
+            deliver_shared_pending(g);
+        }
+    }
+
     struct sub_session {
         sub_session(
             std::shared_ptr<std::string> topic,
@@ -998,9 +1905,29 @@ private:
     mqtt::optional<boost::posix_time::time_duration> delay_disconnect_; ///< Used to delay disconnect handling for testing
     mi_cid_con cons_; ///< Map of client id and connections
     mi_sub_con subs_; ///< Map of subscriptions to client ids
+    mqtt::subscription_map<con_sp_t, std::uint8_t> subs_map_; ///< Topic filter tree of subscriptions to match published topics
     std::set<std::string> sessions_; ///< A list of clientIDs ? TODO: It's not clear how this is different than cons_, 2 lines above.
     mi_sub_session subsessions_; ///< TODO: It's not clear what this is for.
-    mi_retain retains_; ///< A list of messages retained so they can be sent to newly subscribed clients.
+    mqtt::subscription_map<std::shared_ptr<session>, std::uint8_t> subsessions_map_; ///< Topic filter tree of saved subscriptions
+    mqtt::offline_queue_config offline_queue_config_; ///< Limits of the message queues of the saved sessions
+    // A resumed session whose queued messages are being published
+    struct replay_state {
+        replay_state(std::shared_ptr<session> s)
+            :s(std::move(s)) {}
+        std::shared_ptr<session> s;
+        std::size_t in_flight = 0; ///< The number of the messages that are not written yet
+        bool publishing = false;
+    };
+
+    std::map<con_sp_t, replay_state> replaying_; ///< Resumed sessions whose queued messages are being published
+    std::size_t offline_replay_batch_size_ = 64; ///< The number of queued messages that are published at a time on resumption
+    mqtt::subscription_map<std::string, std::shared_ptr<shared_group>> shared_map_; ///< Topic filter tree of shared subscriptions. The key is the share name.
+    std::map<std::pair<con_sp_t, std::size_t>, shared_inflight> shared_inflight_; ///< Unacknowledged messages of shared subscriptions by connection and packet id
+    mqtt::shared_subscription_strategy shared_strategy_ = mqtt::shared_subscription_strategy::round_robin; ///< How a shared subscription chooses the member
+    std::size_t shared_window_ = std::numeric_limits<std::size_t>::max(); ///< The maximum number of unacknowledged messages of a member of a shared subscription
+    mqtt::retained_index<retain> retains_; ///< Topic tree of messages retained so they can be sent to newly subscribed clients.
+    expiry_wheel_t expiry_wheel_ { std::chrono::seconds(1) }; ///< Removes the expired messages. See expire_messages().
+    std::size_t retained_batch_size_ = 64; ///< The number of retained messages that are published at a time on subscription.
     mi_con_will will_; ///< Map of last-wills and their associated connection objects.
     std::vector<mqtt::v5::property_variant> connack_props_;
     std::vector<mqtt::v5::property_variant> suback_props_;
@@ -1019,6 +1946,10 @@ private:
     std::function<void(std::vector<mqtt::v5::property_variant> const&)> h_subscribe_props_;
     std::function<void(std::vector<mqtt::v5::property_variant> const&)> h_unsubscribe_props_;
     std::function<void(std::vector<mqtt::v5::property_variant> const&)> h_auth_props_;
+    publish_forward_handler h_publish_forward_;
+    shared_group_handler h_shared_group_;
+    connect_handover_handler h_connect_handover_;
+    client_released_handler h_client_released_;
 };
 
 #endif // MQTT_TEST_BROKER_HPP
@@ -41,6 +41,10 @@ public:
         server_.close();
     }
 
+    mqtt::server<>& server() {
+        return server_;
+    }
+
 private:
     mqtt::server<> server_;
     test_broker& b_;
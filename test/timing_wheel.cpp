@@ -0,0 +1,152 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+
+#include <map>
+#include <random>
+
+#include <mqtt/timing_wheel.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_timing_wheel)
+
+namespace {
+
+using wheel_t = mqtt::timing_wheel<int>;
+using clock = wheel_t::clock;
+
+auto const origin = clock::time_point(std::chrono::hours(1));
+
+clock::time_point at(std::uint64_t ms) {
+    return origin + std::chrono::milliseconds(ms);
+}
+
+std::vector<int> advance(wheel_t& w, std::uint64_t ms) {
+    std::vector<int> ret;
+    w.advance(at(ms), [&](int v) { ret.push_back(v); });
+    return ret;
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_CASE( expire ) {
+    wheel_t w(std::chrono::milliseconds(10), origin);
+    w.add(at(25), 1);
+    w.add(at(30), 2);
+    w.add(at(1000), 3);
+    w.add(at(5), 4);
+    BOOST_TEST(w.size() == 4U);
+
+    // The deadline is rounded up to the tick.
+    BOOST_TEST(advance(w, 9).empty());
+    BOOST_TEST(advance(w, 10) == (std::vector<int>{ 4 }));
+    BOOST_TEST(advance(w, 29).empty());
+    BOOST_TEST(advance(w, 30) == (std::vector<int>{ 1, 2 }));
+    // The time doesn't go back.
+    BOOST_TEST(advance(w, 0).empty());
+    BOOST_TEST(advance(w, 999).empty());
+    BOOST_TEST(advance(w, 5000) == (std::vector<int>{ 3 }));
+    BOOST_TEST(w.empty());
+
+    // The deadline that has passed expires on the next tick.
+    w.add(at(0), 5);
+    BOOST_TEST(advance(w, 5000).empty());
+    BOOST_TEST(advance(w, 5010) == (std::vector<int>{ 5 }));
+}
+
+BOOST_AUTO_TEST_CASE( cancel ) {
+    wheel_t w(std::chrono::milliseconds(1), origin);
+    auto id1 = w.add(at(100), 1);
+    auto id2 = w.add(at(100000), 2);
+    w.add(at(100), 3);
+    BOOST_TEST(w.cancel(id1));
+    BOOST_TEST(!w.cancel(id1));
+    BOOST_TEST(w.cancel(id2));
+    BOOST_TEST(w.size() == 1U);
+    BOOST_TEST(advance(w, 200000) == (std::vector<int>{ 3 }));
+
+    // The entries can be added and cancelled in the function.
+    auto id4 = w.add(at(200010), 4);
+    auto id5 = w.add(at(200010), 5);
+    std::vector<int> expired;
+    w.advance(
+        at(200010),
+        [&](int v) {
+            expired.push_back(v);
+            if (v == 4) {
+                BOOST_TEST(w.cancel(id5));
+                w.add(at(200011), 6);
+            }
+        }
+    );
+    static_cast<void>(id4);
+    BOOST_TEST(expired == (std::vector<int>{ 4 }));
+    BOOST_TEST(advance(w, 200011) == (std::vector<int>{ 6 }));
+}
+
+BOOST_AUTO_TEST_CASE( far ) {
+    // 64^4 ticks is the range of the wheel.
+    wheel_t w(std::chrono::milliseconds(1), origin);
+    std::uint64_t range = 64 * 64 * 64 * 64;
+    w.add(at(range * 3 + 7), 1);
+    w.add(at(range - 1), 2);
+    BOOST_TEST(advance(w, range - 2).empty());
+    BOOST_TEST(advance(w, range - 1) == (std::vector<int>{ 2 }));
+    BOOST_TEST(advance(w, range * 3 + 6).empty());
+    BOOST_TEST(advance(w, range * 3 + 7) == (std::vector<int>{ 1 }));
+}
+
+// Compare with the deadlines that are sorted by std::multimap.
+BOOST_AUTO_TEST_CASE( random ) {
+    std::mt19937 gen(20191018);
+    wheel_t w(std::chrono::milliseconds(1), origin);
+    std::multimap<std::uint64_t, int> expected;
+    std::map<int, wheel_t::id_t> ids;
+    std::uint64_t now = 0;
+    int value = 0;
+    for (std::size_t i = 0; i != 2000; ++i) {
+        switch (std::uniform_int_distribution<int>(0, 3)(gen)) {
+        case 0:
+        case 1: {
+            // from the near future to the outside of the lowest levels
+            auto delta = std::uniform_int_distribution<std::uint64_t>(0, 300000)(gen) >>
+                std::uniform_int_distribution<int>(0, 16)(gen);
+            expected.emplace(now + delta, value);
+            ids.emplace(value, w.add(at(now + delta), value));
+            ++value;
+        } break;
+        case 2:
+            if (!ids.empty()) {
+                auto it = std::next(ids.begin(), std::uniform_int_distribution<std::ptrdiff_t>(0, static_cast<std::ptrdiff_t>(ids.size()) - 1)(gen));
+                BOOST_TEST(w.cancel(it->second));
+                for (auto e = expected.begin(); e != expected.end(); ++e) {
+                    if (e->second == it->first) {
+                        expected.erase(e);
+                        break;
+                    }
+                }
+                ids.erase(it);
+            }
+            break;
+        case 3: {
+            now += std::uniform_int_distribution<std::uint64_t>(0, 5000)(gen);
+            std::vector<int> expired;
+            w.advance(at(now), [&](int v) { expired.push_back(v); ids.erase(v); });
+            std::vector<int> due;
+            while (!expected.empty() && expected.begin()->first <= now) {
+                due.push_back(expected.begin()->second);
+                expected.erase(expected.begin());
+            }
+            std::sort(expired.begin(), expired.end());
+            std::sort(due.begin(), due.end());
+            BOOST_TEST(expired == due);
+        } break;
+        }
+        BOOST_TEST(w.size() == expected.size());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,433 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+#include "test_settings.hpp"
+#include "test_broker.hpp"
+#include "test_server_no_tls.hpp"
+
+#include <thread>
+
+#include <mqtt/client.hpp>
+#include <mqtt/topic_alias.hpp>
+#include <mqtt/shared_publish.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_topic_alias)
+
+BOOST_AUTO_TEST_CASE( send_lru ) {
+    mqtt::topic_alias_send ta(2);
+    BOOST_TEST((ta.find_or_assign("topic1") == std::make_pair(std::uint16_t(1), true)));
+    BOOST_TEST((ta.find_or_assign("topic2") == std::make_pair(std::uint16_t(2), true)));
+    BOOST_TEST((ta.find_or_assign("topic1") == std::make_pair(std::uint16_t(1), false)));
+    // topic2 is the least recently used one.
+    BOOST_TEST((ta.find_or_assign("topic3") == std::make_pair(std::uint16_t(2), true)));
+    BOOST_TEST((ta.find_or_assign("topic2") == std::make_pair(std::uint16_t(1), true)));
+    BOOST_TEST((ta.find_or_assign("topic3") == std::make_pair(std::uint16_t(2), false)));
+    BOOST_TEST(ta.size() == 2U);
+
+    ta.reset(0);
+    BOOST_TEST((ta.find_or_assign("topic1") == std::make_pair(std::uint16_t(0), false)));
+    BOOST_TEST(ta.size() == 0U);
+}
+
+BOOST_AUTO_TEST_CASE( recv_table ) {
+    mqtt::topic_alias_recv ta(2);
+    BOOST_TEST(*ta.insert_or_update(1, "topic1") == "topic1");
+    BOOST_TEST(*ta.find(1) == "topic1");
+    BOOST_TEST(*ta.insert_or_update(1, "topic2") == "topic2");
+    BOOST_TEST(*ta.find(1) == "topic2");
+    BOOST_TEST(!ta.find(2));
+    BOOST_TEST(!ta.insert_or_update(0, "topic1"));
+    BOOST_TEST(!ta.insert_or_update(3, "topic1"));
+}
+
+BOOST_AUTO_TEST_CASE( message ) {
+    std::string topic = "topic1";
+    std::string contents = "contents";
+    std::vector<mqtt::v5::property_variant> props {
+        mqtt::v5::property::payload_format_indicator(mqtt::v5::property::payload_format_indicator::string)
+    };
+    auto check =
+        [&](bool omit_topic_name) {
+            mqtt::v5::publish_message m(
+                boost::asio::buffer(topic), mqtt::qos::at_least_once, false, false, 1, props, boost::asio::buffer(contents)
+            );
+            m.add_topic_alias(0x1234, omit_topic_name);
+
+            std::string expected =
+                mqtt::v5::publish_message(
+                    boost::asio::buffer(topic.data(), omit_topic_name ? 0 : topic.size()),
+                    mqtt::qos::at_least_once,
+                    false,
+                    false,
+                    1,
+                    std::vector<mqtt::v5::property_variant> {
+                        mqtt::v5::property::topic_alias(0x1234),
+                        mqtt::v5::property::payload_format_indicator(mqtt::v5::property::payload_format_indicator::string)
+                    },
+                    boost::asio::buffer(contents)
+                ).continuous_buffer();
+            BOOST_TEST(m.continuous_buffer() == expected);
+
+            std::string seq;
+            for (auto const& b : m.const_buffer_sequence()) {
+                seq.append(static_cast<char const*>(b.data()), b.size());
+            }
+            BOOST_TEST(seq == expected);
+        };
+    check(false);
+    check(true);
+}
+
+BOOST_AUTO_TEST_CASE( has_topic_alias ) {
+    std::string topic = "topic1";
+    std::string contents = "contents";
+    std::vector<mqtt::v5::property_variant> alias_props {
+        mqtt::v5::property::topic_alias(1)
+    };
+
+    mqtt::v5::publish_message m1(
+        boost::asio::buffer(topic), mqtt::qos::at_most_once, false, false, 0, {}, boost::asio::buffer(contents)
+    );
+    BOOST_TEST(!m1.has_topic_alias());
+    m1.add_topic_alias(1, false);
+    BOOST_TEST(m1.has_topic_alias());
+
+    mqtt::v5::publish_message m2(
+        boost::asio::buffer(topic), mqtt::qos::at_most_once, false, false, 0, alias_props, boost::asio::buffer(contents)
+    );
+    BOOST_TEST(m2.has_topic_alias());
+
+    // The properties encoded by shared_publish are also searched.
+    auto body = mqtt::make_shared_publish(boost::asio::buffer(topic), boost::asio::buffer(contents), mqtt::any(), alias_props);
+    mqtt::v5::publish_message m3(*body, mqtt::qos::at_most_once, false, false, 0);
+    BOOST_TEST(m3.has_topic_alias());
+    auto body_no_alias = mqtt::make_shared_publish(boost::asio::buffer(topic), boost::asio::buffer(contents), mqtt::any());
+    mqtt::v5::publish_message m4(*body_no_alias, mqtt::qos::at_most_once, false, false, 0);
+    BOOST_TEST(!m4.has_topic_alias());
+}
+
+BOOST_AUTO_TEST_CASE( pubsub ) {
+    // Both the client and the broker accept 2 topic aliases. 3 topics are published in turn,
+    // so the aliases are reassigned on both directions.
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    b.set_connack_props(
+        std::vector<mqtt::v5::property_variant> {
+            mqtt::v5::property::topic_alias_maximum(2)
+        }
+    );
+    std::size_t broker_received = 0;
+    b.set_publish_props_handler(
+        [&](std::vector<mqtt::v5::property_variant> const& props) {
+            // The resolved topic alias is removed.
+            BOOST_TEST(props.empty());
+            ++broker_received;
+        });
+    test_server_no_tls s(ios, b);
+    auto c = mqtt::make_client(ios, broker_url, broker_notls_port, mqtt::protocol_version::v5);
+    using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+    c->set_clean_session(true);
+
+    std::vector<std::string> topics { "topic1", "topic2", "topic3", "topic1", "topic2", "topic3", "topic3" };
+    std::size_t suback = 0;
+    std::vector<std::string> received;
+    bool closed = false;
+
+    c->set_v5_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t connack_return_code, std::vector<mqtt::v5::property_variant> /*props*/) {
+            BOOST_TEST(connack_return_code == mqtt::v5::reason_code::success);
+            c->subscribe("topic1", mqtt::qos::at_least_once);
+            c->subscribe("topic2", mqtt::qos::at_least_once);
+            c->subscribe("topic3", mqtt::qos::at_least_once);
+            return true;
+        });
+    c->set_v5_suback_handler(
+        [&]
+        (packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+            if (++suback == 3) {
+                for (auto const& t : topics) {
+                    c->publish_at_least_once(t, "contents");
+                }
+            }
+            return true;
+        });
+    c->set_v5_publish_handler(
+        [&]
+        (std::uint8_t /*header*/,
+         mqtt::optional<packet_id_t> /*packet_id*/,
+         std::string topic,
+         std::string contents,
+         std::vector<mqtt::v5::property_variant> props) {
+            BOOST_TEST(contents == "contents");
+            BOOST_TEST(props.empty());
+            received.push_back(std::move(topic));
+            if (received.size() == topics.size()) c->disconnect();
+            return true;
+        });
+    c->set_close_handler(
+        [&] {
+            closed = true;
+            s.close();
+        });
+    c->set_error_handler(
+        [&]
+        (boost::system::error_code const&) {
+            BOOST_CHECK(false);
+            s.close();
+        });
+    c->connect(
+        std::vector<mqtt::v5::property_variant> {
+            mqtt::v5::property::topic_alias_maximum(2)
+        }
+    );
+    ios.run();
+    BOOST_TEST(closed);
+    BOOST_TEST(broker_received == topics.size());
+    BOOST_TEST(received == topics);
+}
+
+BOOST_AUTO_TEST_CASE( recv_invalid ) {
+    // The server accepts 1 topic alias. The raw client sends PUBLISH with the unregistered alias.
+    boost::asio::io_service ios;
+    mqtt::server<> s(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), broker_notls_port),
+        ios
+    );
+    using endpoint_t = mqtt::server<>::endpoint_t;
+    using packet_id_t = endpoint_t::packet_id_t;
+    std::vector<mqtt::v5::property_variant> connack_props {
+        mqtt::v5::property::topic_alias_maximum(1)
+    };
+    std::shared_ptr<endpoint_t> sep;
+    std::vector<std::string> received;
+    s.set_accept_handler(
+        [&](endpoint_t& ep) {
+            sep = ep.shared_from_this();
+            ep.start_session();
+            ep.set_v5_connect_handler(
+                [&]
+                (std::string const& /*client_id*/,
+                 mqtt::optional<std::string> const& /*username*/,
+                 mqtt::optional<std::string> const& /*password*/,
+                 mqtt::optional<mqtt::will>,
+                 bool /*clean_session*/,
+                 std::uint16_t /*keep_alive*/,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    sep->connack(false, mqtt::v5::reason_code::success, connack_props);
+                    return true;
+                });
+            ep.set_v5_publish_handler(
+                [&]
+                (std::uint8_t /*header*/,
+                 mqtt::optional<packet_id_t> /*packet_id*/,
+                 std::string topic,
+                 std::string /*contents*/,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    received.push_back(std::move(topic));
+                    return true;
+                });
+        });
+    s.listen();
+    std::thread th([&] { ios.run(); });
+
+    boost::asio::ip::tcp::socket socket(ios);
+    socket.connect(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), broker_notls_port)
+    );
+    std::string out =
+        mqtt::v5::connect_message(
+            0, "cid1", true, mqtt::nullopt, mqtt::nullopt, mqtt::nullopt, {}
+        ).continuous_buffer();
+    std::string topic = "topic1";
+    std::string contents = "contents";
+    // Register the alias 1 and use it.
+    out += mqtt::v5::publish_message(
+        boost::asio::buffer(topic), mqtt::qos::at_most_once, false, false, 0,
+        { mqtt::v5::property::topic_alias(1) }, boost::asio::buffer(contents)
+    ).continuous_buffer();
+    out += mqtt::v5::publish_message(
+        boost::asio::buffer(topic.data(), 0), mqtt::qos::at_most_once, false, false, 0,
+        { mqtt::v5::property::topic_alias(1) }, boost::asio::buffer(contents)
+    ).continuous_buffer();
+    // The alias 2 is out of range.
+    out += mqtt::v5::publish_message(
+        boost::asio::buffer(topic.data(), 0), mqtt::qos::at_most_once, false, false, 0,
+        { mqtt::v5::property::topic_alias(2) }, boost::asio::buffer(contents)
+    ).continuous_buffer();
+    boost::asio::write(socket, boost::asio::buffer(out));
+
+    std::string expected =
+        mqtt::v5::connack_message(false, mqtt::v5::reason_code::success, connack_props).continuous_buffer() +
+        mqtt::v5::disconnect_message(mqtt::v5::reason_code::topic_alias_invalid, {}).continuous_buffer();
+    std::string in(expected.size(), '\0');
+    boost::asio::read(socket, boost::asio::buffer(&in[0], in.size()));
+    BOOST_TEST(in == expected);
+
+    socket.close();
+    ios.post(
+        [&] {
+            sep.reset();
+            s.close();
+        });
+    th.join();
+    BOOST_TEST((received == std::vector<std::string> { "topic1", "topic1" }));
+}
+
+BOOST_AUTO_TEST_CASE( recv_empty_topic_without_maximum ) {
+    // The server doesn't send Topic Alias Maximum. The raw client sends PUBLISH with an empty topic name.
+    boost::asio::io_service ios;
+    mqtt::server<> s(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), broker_notls_port),
+        ios
+    );
+    using endpoint_t = mqtt::server<>::endpoint_t;
+    using packet_id_t = endpoint_t::packet_id_t;
+    std::shared_ptr<endpoint_t> sep;
+    std::vector<std::string> received;
+    s.set_accept_handler(
+        [&](endpoint_t& ep) {
+            sep = ep.shared_from_this();
+            ep.start_session();
+            ep.set_v5_connect_handler(
+                [&]
+                (std::string const& /*client_id*/,
+                 mqtt::optional<std::string> const& /*username*/,
+                 mqtt::optional<std::string> const& /*password*/,
+                 mqtt::optional<mqtt::will>,
+                 bool /*clean_session*/,
+                 std::uint16_t /*keep_alive*/,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    sep->connack(false, mqtt::v5::reason_code::success);
+                    return true;
+                });
+            ep.set_v5_publish_handler(
+                [&]
+                (std::uint8_t /*header*/,
+                 mqtt::optional<packet_id_t> /*packet_id*/,
+                 std::string topic,
+                 std::string /*contents*/,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    received.push_back(std::move(topic));
+                    return true;
+                });
+        });
+    s.listen();
+    std::thread th([&] { ios.run(); });
+
+    boost::asio::ip::tcp::socket socket(ios);
+    socket.connect(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), broker_notls_port)
+    );
+    std::string out =
+        mqtt::v5::connect_message(
+            0, "cid1", true, mqtt::nullopt, mqtt::nullopt, mqtt::nullopt, {}
+        ).continuous_buffer();
+    std::string topic = "topic1";
+    std::string contents = "contents";
+    out += mqtt::v5::publish_message(
+        boost::asio::buffer(topic), mqtt::qos::at_most_once, false, false, 0,
+        {}, boost::asio::buffer(contents)
+    ).continuous_buffer();
+    out += mqtt::v5::publish_message(
+        boost::asio::buffer(topic.data(), 0), mqtt::qos::at_least_once, false, false, 1,
+        {}, boost::asio::buffer(contents)
+    ).continuous_buffer();
+    boost::asio::write(socket, boost::asio::buffer(out));
+
+    std::string expected =
+        mqtt::v5::connack_message(false, mqtt::v5::reason_code::success, {}).continuous_buffer() +
+        mqtt::v5::disconnect_message(mqtt::v5::reason_code::protocol_error, {}).continuous_buffer();
+    std::string in(expected.size(), '\0');
+    boost::asio::read(socket, boost::asio::buffer(&in[0], in.size()));
+    BOOST_TEST(in == expected);
+
+    socket.close();
+    ios.post(
+        [&] {
+            sep.reset();
+            s.close();
+        });
+    th.join();
+    BOOST_TEST((received == std::vector<std::string> { "topic1" }));
+}
+
+BOOST_AUTO_TEST_CASE( recv_invalid_without_handler ) {
+    // The server accepts 1 topic alias and has no publish handler.
+    // The invalid alias is rejected in the same way.
+    boost::asio::io_service ios;
+    mqtt::server<> s(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), broker_notls_port),
+        ios
+    );
+    using endpoint_t = mqtt::server<>::endpoint_t;
+    std::vector<mqtt::v5::property_variant> connack_props {
+        mqtt::v5::property::topic_alias_maximum(1)
+    };
+    std::shared_ptr<endpoint_t> sep;
+    s.set_accept_handler(
+        [&](endpoint_t& ep) {
+            sep = ep.shared_from_this();
+            ep.start_session();
+            ep.set_v5_connect_handler(
+                [&]
+                (std::string const& /*client_id*/,
+                 mqtt::optional<std::string> const& /*username*/,
+                 mqtt::optional<std::string> const& /*password*/,
+                 mqtt::optional<mqtt::will>,
+                 bool /*clean_session*/,
+                 std::uint16_t /*keep_alive*/,
+                 std::vector<mqtt::v5::property_variant> /*props*/) {
+                    sep->connack(false, mqtt::v5::reason_code::success, connack_props);
+                    return true;
+                });
+        });
+    s.listen();
+    std::thread th([&] { ios.run(); });
+
+    boost::asio::ip::tcp::socket socket(ios);
+    socket.connect(
+        boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), broker_notls_port)
+    );
+    std::string out =
+        mqtt::v5::connect_message(
+            0, "cid1", true, mqtt::nullopt, mqtt::nullopt, mqtt::nullopt, {}
+        ).continuous_buffer();
+    std::string topic = "topic1";
+    std::string contents = "contents";
+    // The alias 1 is registered, but the alias 2 is out of range.
+    out += mqtt::v5::publish_message(
+        boost::asio::buffer(topic), mqtt::qos::at_most_once, false, false, 0,
+        { mqtt::v5::property::topic_alias(1) }, boost::asio::buffer(contents)
+    ).continuous_buffer();
+    out += mqtt::v5::publish_message(
+        boost::asio::buffer(topic.data(), 0), mqtt::qos::at_most_once, false, false, 0,
+        { mqtt::v5::property::topic_alias(1) }, boost::asio::buffer(contents)
+    ).continuous_buffer();
+    out += mqtt::v5::publish_message(
+        boost::asio::buffer(topic.data(), 0), mqtt::qos::at_most_once, false, false, 0,
+        { mqtt::v5::property::topic_alias(2) }, boost::asio::buffer(contents)
+    ).continuous_buffer();
+    boost::asio::write(socket, boost::asio::buffer(out));
+
+    std::string expected =
+        mqtt::v5::connack_message(false, mqtt::v5::reason_code::success, connack_props).continuous_buffer() +
+        mqtt::v5::disconnect_message(mqtt::v5::reason_code::topic_alias_invalid, {}).continuous_buffer();
+    std::string in(expected.size(), '\0');
+    boost::asio::read(socket, boost::asio::buffer(&in[0], in.size()));
+    BOOST_TEST(in == expected);
+
+    socket.close();
+    ios.post(
+        [&] {
+            sep.reset();
+            s.close();
+        });
+    th.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,115 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+#include "test_settings.hpp"
+#include "test_broker.hpp"
+#include "test_server_no_tls.hpp"
+
+#include <mqtt/client.hpp>
+#include <mqtt/traffic_stats.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_traffic_stats)
+
+BOOST_AUTO_TEST_CASE( recorder ) {
+    auto shared = std::make_shared<mqtt::traffic_counters>();
+    {
+        mqtt::traffic_recorder r;
+        r.received(mqtt::control_packet_type::publish, 10);
+        r.queue_push(20);
+        r.queue_push(30);
+        r.store_size(2);
+        // The gauges are moved to the shared counters, but the totals are not.
+        r.set_shared(shared);
+        r.sent(mqtt::control_packet_type::puback, 4);
+        r.queue_pop(20);
+        r.store_size(1);
+
+        auto s = shared->take_snapshot();
+        BOOST_TEST(s.bytes_in == 0U);
+        BOOST_TEST(s.bytes_out == 4U);
+        BOOST_TEST(s.packets_out[mqtt::control_packet_type::puback] == 1U);
+        BOOST_TEST(s.queue_depth == 1U);
+        BOOST_TEST(s.queue_bytes == 30U);
+        BOOST_TEST(s.store_size == 1U);
+
+        auto o = r.take_snapshot();
+        BOOST_TEST(o.bytes_in == 10U);
+        BOOST_TEST(o.packets_in[mqtt::control_packet_type::publish] == 1U);
+        BOOST_TEST(o.bytes_out == 4U);
+        BOOST_TEST(o.queue_depth == 1U);
+        BOOST_TEST(o.store_size == 1U);
+    }
+    // The gauges are removed on destruction.
+    auto s = shared->take_snapshot();
+    BOOST_TEST(s.bytes_out == 4U);
+    BOOST_TEST(s.queue_depth == 0U);
+    BOOST_TEST(s.queue_bytes == 0U);
+    BOOST_TEST(s.store_size == 0U);
+}
+
+BOOST_AUTO_TEST_CASE( endpoint ) {
+    boost::asio::io_service ios;
+    test_broker b(ios);
+    test_server_no_tls s(ios, b);
+    auto c = mqtt::make_client(ios, broker_url, broker_notls_port);
+    c->set_clean_session(true);
+    namespace cpt = mqtt::control_packet_type;
+
+    c->set_connack_handler(
+        [&]
+        (bool /*sp*/, std::uint8_t connack_return_code) {
+            BOOST_TEST(connack_return_code == mqtt::connect_return_code::accepted);
+            c->publish_at_least_once("topic1", "topic1_contents");
+            BOOST_TEST(c->stats().store_size == 1U);
+            c->async_publish_at_most_once("topic1", "topic1_contents");
+            return true;
+        });
+    c->set_puback_handler(
+        [&](std::uint16_t) {
+            BOOST_TEST(c->stats().store_size == 0U);
+            c->disconnect();
+            return true;
+        });
+    c->set_close_handler(
+        [&] {
+            s.close();
+        });
+    c->set_error_handler(
+        [&]
+        (boost::system::error_code const&) {
+            BOOST_CHECK(false);
+            s.close();
+        });
+    c->connect();
+    ios.run();
+
+    auto cs = c->stats();
+    BOOST_TEST(cs.packets_out[cpt::connect] == 1U);
+    BOOST_TEST(cs.packets_out[cpt::publish] == 2U);
+    BOOST_TEST(cs.packets_out[cpt::disconnect] == 1U);
+    BOOST_TEST(cs.packets_in[cpt::connack] == 1U);
+    BOOST_TEST(cs.packets_in[cpt::puback] == 1U);
+    // Each synchronous write and async publish is one batch.
+    BOOST_TEST(cs.write_batches == 4U);
+    BOOST_TEST(cs.read_calls >= 2U);
+    BOOST_TEST(cs.queue_depth == 0U);
+    BOOST_TEST(cs.queue_bytes == 0U);
+    BOOST_TEST(cs.store_size == 0U);
+
+    // The server sees the same traffic in the opposite direction.
+    auto ss = s.server().stats();
+    BOOST_TEST(ss.packets_in[cpt::connect] == 1U);
+    BOOST_TEST(ss.packets_in[cpt::publish] == 2U);
+    BOOST_TEST(ss.packets_in[cpt::disconnect] == 1U);
+    BOOST_TEST(ss.packets_out[cpt::connack] == 1U);
+    BOOST_TEST(ss.packets_out[cpt::puback] == 1U);
+    BOOST_TEST(ss.bytes_in == cs.bytes_out);
+    BOOST_TEST(ss.bytes_out == cs.bytes_in);
+    BOOST_TEST(ss.queue_depth == 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,8 @@
 #include "test_main.hpp"
 #include "combi_test.hpp"
 
+#include <random>
+
 namespace mqtt {
 namespace utf8string {
 std::ostream& operator<<(std::ostream& o, validation e) {
@@ -722,4 +724,213 @@ BOOST_AUTO_TEST_CASE( unsubscribe_invalid_topic ) {
 #endif // MQTT_USE_STR_CHECK
 }
 
+#if defined(MQTT_USE_STR_CHECK)
+
+namespace {
+
+// The byte by byte implementation before the SIMD paths were added.
+mqtt::utf8string::validation
+reference_validate(mqtt::string_view str) {
+    using mqtt::utf8string::validation;
+    // This code is based on https://www.cl.cam.ac.uk/~mgk25/ucs/utf8_check.c
+    auto result = validation::well_formed;
+    auto it = str.begin();
+    auto end = str.end();
+
+    while (it != end) {
+        if (static_cast<unsigned char>(*(it + 0)) < 0b1000'0000) {
+            // 0xxxxxxxxx
+            if (static_cast<unsigned char>(*(it + 0)) == 0x00) {
+                result = validation::ill_formed;
+                break;
+            }
+            if ((static_cast<unsigned char>(*(it + 0)) >= 0x01 &&
+                 static_cast<unsigned char>(*(it + 0)) <= 0x1f) ||
+                static_cast<unsigned char>(*(it + 0)) == 0x7f) {
+                result = validation::well_formed_with_non_charactor;
+            }
+            ++it;
+        }
+        else if ((static_cast<unsigned char>(*(it + 0)) & 0b1110'0000) == 0b1100'0000) {
+            // 110XXXXx 10xxxxxx
+            if (it + 1 >= end) {
+                result = validation::ill_formed;
+                break;
+            }
+            if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'0000) != 0b1000'0000 ||
+                (static_cast<unsigned char>(*(it + 0)) & 0b1111'1110) == 0b1100'0000) { // overlong
+                result = validation::ill_formed;
+                break;
+            }
+            if (static_cast<unsigned char>(*(it + 0)) == 0b1100'0010 &&
+                static_cast<unsigned char>(*(it + 1)) >= 0b1000'0000 &&
+                static_cast<unsigned char>(*(it + 1)) <= 0b1001'1111) {
+                result = validation::well_formed_with_non_charactor;
+            }
+            it += 2;
+        }
+        else if ((static_cast<unsigned char>(*(it + 0)) & 0b1111'0000) == 0b1110'0000) {
+            // 1110XXXX 10Xxxxxx 10xxxxxx
+            if (it + 2 >= end) {
+                result = validation::ill_formed;
+                break;
+            }
+            if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'0000) != 0b1000'0000 ||
+                (static_cast<unsigned char>(*(it + 2)) & 0b1100'0000) != 0b1000'0000 ||
+                (static_cast<unsigned char>(*(it + 0)) == 0b1110'0000 &&
+                 (static_cast<unsigned char>(*(it + 1)) & 0b1110'0000) == 0b1000'0000) || // overlong?
+                (static_cast<unsigned char>(*(it + 0)) == 0b1110'1101 &&
+                 (static_cast<unsigned char>(*(it + 1)) & 0b1110'0000) == 0b1010'0000)) { // surrogate?
+                result = validation::ill_formed;
+                break;
+            }
+            if (static_cast<unsigned char>(*(it + 0)) == 0b1110'1111 &&
+                static_cast<unsigned char>(*(it + 1)) == 0b1011'1111 &&
+                (static_cast<unsigned char>(*(it + 2)) & 0b1111'1110) == 0b1011'1110) {
+                // U+FFFE or U+FFFF?
+                result = validation::well_formed_with_non_charactor;
+            }
+            it += 3;
+        }
+        else if ((static_cast<unsigned char>(*(it + 0)) & 0b1111'1000) == 0b1111'0000) {
+            // 11110XXX 10XXxxxx 10xxxxxx 10xxxxxx
+            if (it + 3 >= end) {
+                result = validation::ill_formed;
+                break;
+            }
+            if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'0000) != 0b1000'0000 ||
+                (static_cast<unsigned char>(*(it + 2)) & 0b1100'0000) != 0b1000'0000 ||
+                (static_cast<unsigned char>(*(it + 3)) & 0b1100'0000) != 0b1000'0000 ||
+                (static_cast<unsigned char>(*(it + 0)) == 0b1111'0000 &&
+                 (static_cast<unsigned char>(*(it + 1)) & 0b1111'0000) == 0b1000'0000) ||    // overlong?
+                (static_cast<unsigned char>(*(it + 0)) == 0b1111'0100 &&
+                 static_cast<unsigned char>(*(it + 1)) > 0b1000'1111) ||
+                static_cast<unsigned char>(*(it + 0)) > 0b1111'0100) { // > U+10FFFF?
+                result = validation::ill_formed;
+                break;
+            }
+            if ((static_cast<unsigned char>(*(it + 1)) & 0b1100'1111) == 0b1000'1111 &&
+                static_cast<unsigned char>(*(it + 2)) == 0b1011'1111 &&
+                (static_cast<unsigned char>(*(it + 3)) & 0b1111'1110) == 0b1011'1110) {
+                // U+nFFFE or U+nFFFF?
+                result = validation::well_formed_with_non_charactor;
+            }
+            it += 4;
+        }
+        else {
+            result = validation::ill_formed;
+            break;
+        }
+    }
+    return result;
+}
+
+std::string random_utf8(std::mt19937& gen) {
+    auto rnd = [&](std::uint32_t lo, std::uint32_t hi) {
+        return std::uniform_int_distribution<std::uint32_t>(lo, hi)(gen);
+    };
+    auto push_code_point = [](std::string& s, std::uint32_t cp) {
+        if (cp < 0x80) {
+            s.push_back(static_cast<char>(cp));
+        }
+        else if (cp < 0x800) {
+            s.push_back(static_cast<char>(0xc0 | (cp >> 6)));
+            s.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+        }
+        else if (cp < 0x10000) {
+            s.push_back(static_cast<char>(0xe0 | (cp >> 12)));
+            s.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+            s.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+        }
+        else {
+            s.push_back(static_cast<char>(0xf0 | (cp >> 18)));
+            s.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3f)));
+            s.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+            s.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+        }
+    };
+    std::string s;
+    auto size = rnd(0, 200);
+    while (s.size() < size) {
+        switch (rnd(0, 15)) {
+        case 0:
+            // control character
+            s.push_back(static_cast<char>(rnd(0, 1) ? rnd(0x01, 0x1f) : 0x7f));
+            break;
+        case 1:
+            // rarely null
+            if (rnd(0, 7) == 0) s.push_back('\0');
+            break;
+        case 2:
+            // C1 control, 2 bytes, 3 bytes or 4 bytes character
+            push_code_point(s, rnd(0x80, 0x9f));
+            break;
+        case 3:
+            push_code_point(s, rnd(0x80, 0x7ff));
+            break;
+        case 4: {
+            auto cp = rnd(0x800, 0xffff);
+            // surrogates are ill formed if they are not excluded
+            if (cp >= 0xd800 && cp <= 0xdfff && rnd(0, 3) != 0) cp = 0xfffe + rnd(0, 1);
+            push_code_point(s, cp);
+        } break;
+        case 5:
+            push_code_point(s, rnd(0x10000, 0x10ffff));
+            break;
+        case 6:
+            // non character U+nFFFE or U+nFFFF
+            push_code_point(s, (rnd(0, 0x10) << 16) | 0xfffe | rnd(0, 1));
+            break;
+        case 7:
+            // any byte
+            s.push_back(static_cast<char>(rnd(0, 0xff)));
+            break;
+        default: {
+            // printable ASCII
+            auto n = rnd(1, 40);
+            for (std::uint32_t i = 0; i != n; ++i) s.push_back(static_cast<char>(rnd(0x20, 0x7e)));
+        } break;
+        }
+    }
+    // Sometimes truncate, that can cut a multi byte character.
+    if (rnd(0, 3) == 0 && !s.empty()) s.resize(rnd(0, static_cast<std::uint32_t>(s.size())));
+    return s;
+}
+
+} // anonymous namespace
+
+#endif // defined(MQTT_USE_STR_CHECK)
+
+BOOST_AUTO_TEST_CASE( fuzz ) {
+#if defined(MQTT_USE_STR_CHECK)
+    using namespace mqtt::utf8string;
+    using impl = validation (*)(char const*, char const*);
+    std::vector<std::pair<char const*, impl>> impls {
+        { "scalar", &detail::validate_scalar },
+#if defined(MQTT_UTF8_SSE2)
+        { "sse2", &detail::validate_sse2 },
+#endif // defined(MQTT_UTF8_SSE2)
+    };
+#if defined(MQTT_UTF8_AVX2)
+    if (detail::avx2_supported()) impls.emplace_back("avx2", &detail::validate_avx2);
+#endif // defined(MQTT_UTF8_AVX2)
+
+    std::mt19937 gen(20191018);
+    std::size_t results[3] = {};
+    for (std::size_t i = 0; i != 200000; ++i) {
+        auto s = random_utf8(gen);
+        auto expected = reference_validate(s);
+        ++results[static_cast<int>(expected)];
+        BOOST_TEST(validate_contents(s) == expected, s.size() << " bytes: " << i);
+        for (auto const& e : impls) {
+            BOOST_TEST(e.second(s.data(), s.data() + s.size()) == expected, e.first << " " << i);
+        }
+    }
+    // All results are covered.
+    BOOST_TEST(results[0] != 0U);
+    BOOST_TEST(results[1] != 0U);
+    BOOST_TEST(results[2] != 0U);
+#endif // MQTT_USE_STR_CHECK
+}
+
 BOOST_AUTO_TEST_SUITE_END()
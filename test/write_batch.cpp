@@ -0,0 +1,197 @@
+// Copyright Takatoshi Kondo 2019
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "test_main.hpp"
+#include "combi_test.hpp"
+#include "checker.hpp"
+
+#include <mqtt/optional.hpp>
+#include <mqtt/write_batch_policy.hpp>
+
+BOOST_AUTO_TEST_SUITE(test_write_batch)
+
+BOOST_AUTO_TEST_CASE( policy ) {
+    auto p1 = mqtt::write_batch_policy::drain_all();
+    BOOST_TEST(p1.max_messages() == 0U);
+    BOOST_TEST(p1.max_bytes() == 0U);
+    BOOST_TEST(!p1.full(1000, 1000000));
+
+    auto p2 = mqtt::write_batch_policy::one_by_one();
+    BOOST_TEST(p2.full(1, 0));
+
+    auto p3 = mqtt::write_batch_policy::up_to_bytes(100);
+    BOOST_TEST(!p3.full(10, 99));
+    BOOST_TEST(p3.full(10, 100));
+
+    auto p4 = mqtt::write_batch_policy::linger_for(std::chrono::microseconds(500), 100);
+    BOOST_TEST(p4.linger().count() == 500);
+    BOOST_TEST(p4.max_bytes() == 100U);
+}
+
+// Publish count messages at once and return the number of messages of each batch.
+template <typename Client, typename Server>
+inline std::vector<std::size_t> pubsub_batch(
+    boost::asio::io_service& ios,
+    Client& c,
+    Server& s,
+    mqtt::write_batch_policy policy,
+    std::size_t count) {
+    using packet_id_t = typename std::remove_reference_t<decltype(*c)>::packet_id_t;
+    c->set_clean_session(true);
+
+    std::vector<std::size_t> batches;
+    std::size_t received = 0;
+
+    checker chk = {
+        // connect
+        cont("h_connack"),
+        // subscribe topic1 QoS0
+        cont("h_suback"),
+        // publish topic1 QoS0 * count
+        cont("h_publish_all"),
+        // disconnect
+        cont("h_close"),
+    };
+
+    auto publish_all =
+        [&] {
+            c->set_write_batch_policy(policy);
+            c->set_write_batch_handler(
+                [&]
+                (std::size_t num_of_messages, std::size_t bytes) {
+                    BOOST_TEST(bytes != 0U);
+                    batches.push_back(num_of_messages);
+                });
+            for (std::size_t i = 0; i != count; ++i) {
+                c->async_publish_at_most_once("topic1", "topic1_contents");
+            }
+        };
+    auto on_publish =
+        [&] {
+            if (++received == count) {
+                MQTT_CHK("h_publish_all");
+                c->set_write_batch_handler();
+                c->set_write_batch_policy(mqtt::write_batch_policy());
+                c->async_disconnect();
+            }
+        };
+
+    switch (c->get_protocol_version()) {
+    case mqtt::protocol_version::v3_1_1:
+        c->set_connack_handler(
+            [&chk, &c]
+            (bool /*sp*/, std::uint8_t /*connack_return_code*/) {
+                MQTT_CHK("h_connack");
+                c->async_subscribe("topic1", mqtt::qos::at_most_once);
+                return true;
+            });
+        c->set_suback_handler(
+            [&chk, &publish_all]
+            (packet_id_t /*packet_id*/, std::vector<mqtt::optional<std::uint8_t>> /*results*/) {
+                MQTT_CHK("h_suback");
+                publish_all();
+                return true;
+            });
+        c->set_publish_handler(
+            [&on_publish]
+            (std::uint8_t /*header*/,
+             mqtt::optional<packet_id_t> /*packet_id*/,
+             std::string /*topic*/,
+             std::string /*contents*/) {
+                on_publish();
+                return true;
+            });
+        break;
+    case mqtt::protocol_version::v5:
+        c->set_v5_connack_handler(
+            [&chk, &c]
+            (bool /*sp*/, std::uint8_t /*connack_return_code*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                MQTT_CHK("h_connack");
+                c->async_subscribe("topic1", mqtt::qos::at_most_once);
+                return true;
+            });
+        c->set_v5_suback_handler(
+            [&chk, &publish_all]
+            (packet_id_t /*packet_id*/, std::vector<std::uint8_t> /*reasons*/, std::vector<mqtt::v5::property_variant> /*props*/) {
+                MQTT_CHK("h_suback");
+                publish_all();
+                return true;
+            });
+        c->set_v5_publish_handler(
+            [&on_publish]
+            (std::uint8_t /*header*/,
+             mqtt::optional<packet_id_t> /*packet_id*/,
+             std::string /*topic*/,
+             std::string /*contents*/,
+             std::vector<mqtt::v5::property_variant> /*props*/) {
+                on_publish();
+                return true;
+            });
+        break;
+    default:
+        BOOST_CHECK(false);
+        break;
+    }
+
+    c->set_close_handler(
+        [&chk, &s]
+        () {
+            MQTT_CHK("h_close");
+            s.close();
+        });
+    c->set_error_handler(
+        []
+        (boost::system::error_code const&) {
+            BOOST_CHECK(false);
+        });
+    c->connect();
+    ios.run();
+    BOOST_TEST(chk.all());
+    return batches;
+}
+
+BOOST_AUTO_TEST_CASE( drain_all ) {
+    auto test = [](boost::asio::io_service& ios, auto& c, auto& s, auto& /*b*/) {
+        auto batches = pubsub_batch(ios, c, s, mqtt::write_batch_policy::drain_all(), 10);
+        // The first message is sent immediately and the rest are queued during sending.
+        BOOST_TEST(batches.size() == 2U);
+        BOOST_TEST(batches.front() == 1U);
+        BOOST_TEST(batches.back() == 9U);
+    };
+    do_combi_test(test);
+}
+
+BOOST_AUTO_TEST_CASE( one_by_one ) {
+    auto test = [](boost::asio::io_service& ios, auto& c, auto& s, auto& /*b*/) {
+        auto batches = pubsub_batch(ios, c, s, mqtt::write_batch_policy::one_by_one(), 10);
+        BOOST_TEST(batches == std::vector<std::size_t>(10, 1));
+    };
+    do_combi_test(test);
+}
+
+BOOST_AUTO_TEST_CASE( linger ) {
+    auto test = [](boost::asio::io_service& ios, auto& c, auto& s, auto& /*b*/) {
+        auto batches = pubsub_batch(
+            ios, c, s,
+            mqtt::write_batch_policy::linger_for(std::chrono::milliseconds(100)),
+            10);
+        BOOST_TEST(batches == std::vector<std::size_t>(1, 10));
+    };
+    do_combi_test(test);
+}
+
+BOOST_AUTO_TEST_CASE( linger_until_full ) {
+    auto test = [](boost::asio::io_service& ios, auto& c, auto& s, auto& /*b*/) {
+        // The linger time is long enough. The batch is sent when it becomes full.
+        auto policy = mqtt::write_batch_policy::linger_for(std::chrono::seconds(10));
+        policy.set_max_messages(5);
+        auto batches = pubsub_batch(ios, c, s, policy, 10);
+        BOOST_TEST(batches == std::vector<std::size_t>(2, 5));
+    };
+    do_combi_test(test);
+}
+
+BOOST_AUTO_TEST_SUITE_END()